@@ -0,0 +1,518 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "Calculator/include/AsyncEvaluator.h"
+#include "Calculator/include/ExpressionTree.h"
+#include "Calculator/include/IncrementalScript.h"
+#include "Calculator/include/StaticExpression.h"
+#include "Calculator/include/TieredExpression.h"
+#include "Calculator/include/Workspace.h"
+using namespace calculator;
+using namespace std;
+
+// 防止被优化掉
+static volatile double sink;
+
+template <class F>
+static double timeit(F&& f, size_t count) {
+    auto begin = chrono::steady_clock::now();
+    f();
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - begin).count() / count;
+}
+
+// 以double的ULP为单位的误差
+static double ulpError(double x, long double ref) {
+    double r = (double)ref;
+    if (isnan(r) && isnan(x)) return 0;
+    if (isinf(r) || isinf(x)) return x == r ? 0 : INFINITY;
+    double ulp = nextafter(fabs(r), INFINITY) - fabs(r);
+    return (double)(fabsl((long double)x - ref) / ulp);
+}
+
+static const char* modeName(MathMode mode) {
+    return mode == MathMode::Fast ? "fast" : "approx";
+}
+
+struct UnaryCase {
+    const char* name;
+    double (*precise)(double);
+    long double (*reference)(long double);
+    double lo, hi;
+};
+
+template <MathMode M>
+struct Kernels {
+    static auto scalarFunction(const string& name) {
+        if (name == "sin") return (double (*)(double))fastSin<M>;
+        if (name == "cos") return (double (*)(double))fastCos<M>;
+        if (name == "tan") return (double (*)(double))fastTan<M>;
+        if (name == "exp") return (double (*)(double))fastExp<M>;
+        return (double (*)(double))fastLog<M>;
+    }
+    static auto batchFunction(const string& name) {
+        using B = void (*)(const double*, double*, size_t);
+        if (name == "sin") return (B)fastSin<M>;
+        if (name == "cos") return (B)fastCos<M>;
+        if (name == "tan") return (B)fastTan<M>;
+        if (name == "exp") return (B)fastExp<M>;
+        return (B)fastLog<M>;
+    }
+};
+
+template <MathMode M>
+static void benchUnary(const UnaryCase& c, size_t n) {
+    mt19937_64 rng(20211);
+    uniform_real_distribution<double> dist(c.lo, c.hi);
+    vector<double> in(n), out(n);
+    for (auto& x : in) x = dist(rng);
+
+    auto fast = Kernels<M>::scalarFunction(c.name);
+    auto batch = Kernels<M>::batchFunction(c.name);
+    double max_ulp = 0, max_rel = 0;
+    for (double x : in) {
+        long double ref = c.reference(x);
+        double y = fast(x);
+        max_ulp = max(max_ulp, ulpError(y, ref));
+        if (ref != 0)
+            max_rel = max(max_rel, (double)fabsl((y - ref) / ref));
+    }
+
+    double t_precise = timeit(
+        [&] {
+            double s = 0;
+            for (double x : in) s += c.precise(x);
+            sink = s;
+        },
+        n);
+    double t_fast = timeit(
+        [&] {
+            double s = 0;
+            for (double x : in) s += fast(x);
+            sink = s;
+        },
+        n);
+    double t_batch = timeit(
+        [&] {
+            batch(in.data(), out.data(), n);
+            sink = out[n / 2];
+        },
+        n);
+    printf("%-6s %-6s [%9.3g,%9.3g] %10.2f %12.3g %10.2f %10.2f %10.2f\n",
+           c.name, modeName(M), c.lo, c.hi, max_ulp, max_rel, t_precise,
+           t_fast, t_batch);
+}
+
+template <MathMode M>
+static void benchPow(size_t n) {
+    mt19937_64 rng(20212);
+    uniform_real_distribution<double> dx(1e-3, 1e3), dy(-20, 20);
+    vector<double> x(n), y(n), out(n);
+    for (size_t i = 0; i < n; i++) x[i] = dx(rng), y[i] = dy(rng);
+
+    double max_ulp = 0, max_rel = 0;
+    for (size_t i = 0; i < n; i++) {
+        long double ref = powl(x[i], y[i]);
+        double v = fastPow<M>(x[i], y[i]);
+        max_ulp = max(max_ulp, ulpError(v, ref));
+        max_rel = max(max_rel, (double)fabsl((v - ref) / ref));
+    }
+    double t_precise = timeit(
+        [&] {
+            double s = 0;
+            for (size_t i = 0; i < n; i++) s += pow(x[i], y[i]);
+            sink = s;
+        },
+        n);
+    double t_fast = timeit(
+        [&] {
+            double s = 0;
+            for (size_t i = 0; i < n; i++) s += fastPow<M>(x[i], y[i]);
+            sink = s;
+        },
+        n);
+    double t_batch = timeit(
+        [&] {
+            fastPow<M>(x.data(), y.data(), out.data(), n);
+            sink = out[n / 2];
+        },
+        n);
+    printf("%-6s %-6s [%9.3g,%9.3g] %10.2f %12.3g %10.2f %10.2f %10.2f\n",
+           "pow", modeName(M), 1e-3, 1e3, max_ulp, max_rel, t_precise, t_fast,
+           t_batch);
+}
+
+// 表达式级别: 同一个表达式在不同模式下的耗时
+static void benchExpression(const string& expression, size_t count) {
+    const MathMode modes[] = {MathMode::Precise, MathMode::Fast,
+                              MathMode::Approximate};
+    double result[3], t[3];
+    for (int i = 0; i < 3; i++) {
+        ExpressionTree et;
+        et.setMathMode(modes[i]);
+        t[i] = timeit(
+            [&] {
+                for (size_t k = 0; k < count; k++)
+                    result[i] = et.calcExpression(expression);
+            },
+            count);
+    }
+    printf("%-46s %10.0f %10.0f %10.0f %12.3g\n", expression.c_str(), t[0],
+           t[1], t[2], fabs(result[2] - result[0]) / fabs(result[0]));
+}
+
+// 以类型 T 批量计算 n 个点，返回每个点的耗时，结果转换为 long double
+template <class T>
+static double benchBatch(const CompiledExpression& program,
+                         const vector<double>& xs, const vector<double>& ys,
+                         vector<long double>& result) {
+    vector<T> x(xs.begin(), xs.end()), y(ys.begin(), ys.end()), out(xs.size());
+    const T* columns[2] = {x.data(), y.data()};
+    double t = timeit(
+        [&] { program.evaluateBatch(nullptr, columns, out.data(), out.size()); },
+        out.size());
+    result.assign(out.begin(), out.end());
+    return t;
+}
+
+// 编译表达式在三种精度下的批量计算吞吐量，误差相对于 long double 的结果
+// (结果的绝对值小于1时为绝对误差，避免相消得到的接近0的值放大误差)
+static void benchPrecision(const string& expression, double lo, double hi,
+                           size_t n) {
+    ExpressionTree et;
+    CompiledExpression program = et.compile(expression, {"x", "y"});
+    mt19937_64 rng(7);
+    uniform_real_distribution<double> dist(lo, hi);
+    vector<double> xs(n), ys(n);
+    for (size_t i = 0; i < n; i++) xs[i] = dist(rng), ys[i] = dist(rng);
+
+    vector<long double> single, twice, extended;
+    double t_single = benchBatch<float>(program, xs, ys, single);
+    double t_double = benchBatch<double>(program, xs, ys, twice);
+    double t_extended = benchBatch<long double>(program, xs, ys, extended);
+    long double err_single = 0, err_double = 0;
+    for (size_t i = 0; i < n; i++) {
+        long double scale = max(fabsl(extended[i]), 1.0L);
+        err_single = max(err_single, fabsl(single[i] - extended[i]) / scale);
+        err_double = max(err_double, fabsl(twice[i] - extended[i]) / scale);
+    }
+    printf("%-34s %9.2f %9.2f %9.2f %12.3Lg %12.3Lg\n", expression.c_str(),
+           t_single, t_double, t_extended, err_single, err_double);
+}
+
+// 分层执行的各层逐点计算的耗时，以及升到这一层的后台编译耗时
+static void benchTiers(const string& expression, size_t count) {
+    ExpressionTree et;
+    const Tier tiers[] = {Tier::Baseline, Tier::Optimized, Tier::Native};
+    double t[3], ms[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+        TieringOptions options;
+        options.optimize_after = i == 0 ? UINT64_MAX : 1;
+        options.native_after = i == 2 ? 2 : 0;
+        TieredExpression program(et, expression, {"x", "y"}, options);
+        double args[2] = {0.5, 1.5};
+        // 每次计算后等待后台编译，直到升到第 i 层
+        for (int k = 0; k < 2 && program.tier() != tiers[i]; k++) {
+            sink = program.evaluate(args);
+            program.wait();
+        }
+        TierStats stats = program.stats();
+        if (stats.tier != tiers[i]) {
+            printf("%-40s %s: %s\n", expression.c_str(), tierName(tiers[i]),
+                   stats.blocked.c_str());
+            return;
+        }
+        if (!stats.transitions.empty())
+            ms[i] = stats.transitions.back().compile_ms;
+        t[i] = timeit(
+            [&] {
+                for (size_t k = 0; k < count; k++) {
+                    args[0] = k * 1e-6;
+                    sink = program.evaluate(args);
+                }
+            },
+            count);
+    }
+    printf("%-40s %10.1f %10.1f %10.1f %10.2f %10.1f\n", expression.c_str(),
+           t[0], t[1], t[2], ms[1], ms[2]);
+}
+
+// 一组有公共子表达式的公式: 分别批量计算与合并到 Workspace 后一起计算
+static void benchWorkspace(size_t formulas, size_t n) {
+    ExpressionTree et;
+    const vector<string> inputs = {"x", "y", "a", "b"};
+    Workspace workspace(et, inputs);
+    vector<CompiledExpression> programs;
+    for (size_t j = 0; j < formulas; j++) {
+        string c = to_string(j % 17 + 1);
+        string text = j % 2 ? "log(x/y)*" + c + "+pow(a+b,2)"
+                            : "pow(a+b,2)/" + c + "-log(x/y)*sqrt(x*x+y*y)";
+        workspace.add(text, text);
+        programs.push_back(et.compile(text, inputs));
+    }
+    mt19937_64 rng(11);
+    uniform_real_distribution<double> dist(0.5, 2);
+    vector<vector<double>> in(4, vector<double>(n));
+    for (auto& column : in)
+        for (double& v : column) v = dist(rng);
+    const double* columns[4] = {in[0].data(), in[1].data(), in[2].data(),
+                                in[3].data()};
+    vector<vector<double>> out(formulas, vector<double>(n));
+    vector<double*> results;
+    for (auto& column : out) results.push_back(column.data());
+    double t_separate = timeit(
+        [&] {
+            for (size_t j = 0; j < formulas; j++)
+                programs[j].evaluateBatch(nullptr, columns, results[j], n);
+        },
+        n);
+    double t_workspace = timeit(
+        [&] { workspace.evaluateBatch(nullptr, columns, results.data(), n); },
+        n);
+    WorkspaceStats stats = workspace.stats();
+    printf("%-10zu %12zu %10zu %10zu %12.1f %12.1f\n", formulas,
+           stats.instructions, stats.nodes, stats.shared_nodes, t_separate,
+           t_workspace);
+}
+
+// 长脚本的每次按键: 整体重新计算与增量计算的耗时(微秒)。
+// 编辑中间一条语句的常数，之后每8条语句中有一条用到它
+static void benchIncremental(size_t statements, size_t keystrokes) {
+    ExpressionTree session;
+    string text;
+    for (size_t k = 0; k < statements; k++) {
+        string v = "v" + to_string(k);
+        if (k % 8 == 0 && k > statements / 2)
+            text += v + "=c*" + to_string(k) + "+sqrt(" + to_string(k) + ");";
+        else
+            text += v + "=sin(" + to_string(k) + ")*" + to_string(k % 7 + 1) +
+                    ";";
+        if (k == statements / 2) text += "c=1;";
+    }
+    text += "v0+v" + to_string(statements - 1);
+    IncrementalScript script(session, text);
+    sink = script.evaluate();
+    const size_t offset = text.find("c=1;") + 2;
+    double t_full = timeit(
+        [&] {
+            for (size_t k = 0; k < keystrokes; k++) {
+                text[offset] = char('1' + k % 9);
+                ExpressionTree et(session.snapshot());
+                sink = et.calcExpression(text);
+            }
+        },
+        keystrokes);
+    double t_incremental = timeit(
+        [&] {
+            for (size_t k = 0; k < keystrokes; k++) {
+                script.edit(offset, 1, string(1, char('1' + k % 9)));
+                sink = script.evaluate();
+            }
+        },
+        keystrokes);
+    const IncrementalStats &stats = script.stats();
+    printf("%-10zu %12.1f %12.1f %10zu %10zu\n", statements, t_full / 1000,
+           t_incremental / 1000, stats.relexed, stats.evaluated);
+}
+
+// 进程内模拟的键值存储: get 立即返回，经过固定的延迟后在存储的线程中回调，
+// 键 k 的值为 k*2+1
+class FakeStore {
+   public:
+    explicit FakeStore(chrono::microseconds latency)
+        : latency_(latency), thread_([this] { run(); }) {}
+    ~FakeStore() {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+    void get(double key, AsyncDoneType done) {
+        {
+            lock_guard<mutex> lock(mutex_);
+            queue_.push_back(
+                {chrono::steady_clock::now() + latency_, key, move(done)});
+        }
+        cv_.notify_all();
+    }
+
+   private:
+    struct Pending {
+        chrono::steady_clock::time_point deadline;
+        double key;
+        AsyncDoneType done;
+    };
+    // 延迟固定，按提交的顺序完成
+    void run() {
+        unique_lock<mutex> lock(mutex_);
+        for (;;) {
+            cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (stop_) return;
+            auto deadline = queue_.front().deadline;
+            if (cv_.wait_until(lock, deadline, [&] { return stop_; })) return;
+            Pending item = move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            item.done(item.key * 2 + 1, nullptr);
+            lock.lock();
+        }
+    }
+
+    chrono::microseconds latency_;
+    mutex mutex_;
+    condition_variable cv_;
+    deque<Pending> queue_;
+    bool stop_ = false;
+    thread thread_;
+};
+
+// 调用键值存储的表达式: workers 个线程同步计算(每次调用阻塞线程)与
+// AsyncEvaluator(互不依赖的调用一起发起，多个表达式共用线程)的总耗时
+static void benchAsync(size_t expressions, size_t latency_us, size_t workers) {
+    FakeStore store{chrono::microseconds(latency_us)};
+    ExpressionTree session;
+    session.addAsyncFunction("kv", [&store](double key, AsyncDoneType done) {
+        store.get(key, move(done));
+    });
+    vector<string> texts;
+    for (size_t k = 0; k < expressions; k++) {
+        string a = to_string(k % 10), b = to_string(k % 7);
+        texts.push_back("kv(" + a + ")+kv(" + b + ")*kv(" + a + "+1)-kv(kv(" +
+                        b + ")%5)");
+    }
+    vector<double> blocking(expressions), async(expressions);
+    auto begin = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (size_t w = 0; w < workers; w++)
+        threads.emplace_back([&, w] {
+            ExpressionTree et(session.registry());
+            for (size_t k = w; k < expressions; k += workers)
+                blocking[k] = et.calcExpression(texts[k]);
+        });
+    for (auto& t : threads) t.join();
+    auto middle = chrono::steady_clock::now();
+    AsyncStats stats;
+    {
+        AsyncEvaluator evaluator(session, workers);
+        vector<future<double>> results;
+        for (auto& text : texts) results.push_back(evaluator.evaluate(text));
+        for (size_t k = 0; k < expressions; k++) async[k] = results[k].get();
+        stats = evaluator.stats();
+    }
+    auto end = chrono::steady_clock::now();
+    size_t differ = 0;
+    for (size_t k = 0; k < expressions; k++)
+        if (blocking[k] != async[k]) differ++;
+    printf("%-12zu %10zu %8zu %12.1f %10.1f %8zu %8zu %8zu\n", expressions,
+           latency_us, workers,
+           chrono::duration<double, milli>(middle - begin).count(),
+           chrono::duration<double, milli>(end - middle).count(), stats.calls,
+           stats.batches, differ);
+}
+
+// 编译期表达式与运行时编译的表达式: 每次调用的耗时，结果应该完全相同
+template <class Static>
+static void benchStatic(Static f, size_t count) {
+    ExpressionTree et;
+    const string text(f.text);
+    CompiledExpression program = et.compile(text, f.parameters());
+    double args[2] = {0.5, 1.5};
+    size_t differ = 0;
+    for (size_t k = 0; k < 1000; k++) {
+        args[0] = k * 0.01 - 5;
+        double a = program.evaluate(args), b = f.evaluate(args);
+        if (a != b && !(isnan(a) && isnan(b))) differ++;
+    }
+    double t_compiled = timeit(
+        [&] {
+            for (size_t k = 0; k < count; k++) {
+                args[0] = k * 1e-6;
+                sink = program.evaluate(args);
+            }
+        },
+        count);
+    double t_static = timeit(
+        [&] {
+            for (size_t k = 0; k < count; k++) {
+                args[0] = k * 1e-6;
+                sink = f.evaluate(args);
+            }
+        },
+        count);
+    printf("%-40s %10.1f %10.1f %10zu\n", text.c_str(), t_compiled, t_static,
+           differ);
+}
+
+int main() {
+    const size_t n = 1 << 20;
+    using R = long double (*)(long double);
+
+    printf("%-6s %-6s %21s %10s %12s %10s %10s %10s\n", "func", "mode",
+           "domain", "max_ulp", "max_rel", "libm_ns", "fast_ns", "batch_ns");
+    UnaryCase cases[] = {
+        {"sin", sin, (R)sinl, -10, 10},       {"sin", sin, (R)sinl, -2e5, 2e5},
+        {"cos", cos, (R)cosl, -10, 10},       {"cos", cos, (R)cosl, -2e5, 2e5},
+        {"tan", tan, (R)tanl, -10, 10},       {"exp", exp, (R)expl, -700, 700},
+        {"exp", exp, (R)expl, -1, 1},         {"log", log, (R)logl, 1e-300, 1e300},
+        {"log", log, (R)logl, 0.5, 2},
+    };
+    for (auto& c : cases) {
+        benchUnary<MathMode::Fast>(c, n);
+        benchUnary<MathMode::Approximate>(c, n);
+    }
+    benchPow<MathMode::Fast>(n);
+    benchPow<MathMode::Approximate>(n);
+
+    printf("\n%-46s %10s %10s %10s %12s\n", "expression", "precise_ns",
+           "fast_ns", "approx_ns", "approx_diff");
+    benchExpression("sin(1.5)*cos(0.3)+exp(2)-log(10)", 20000);
+    benchExpression("pow(sin(pi/7),2)+pow(cos(pi/7),2)-tan(0.25)", 20000);
+    benchExpression("exp(log(1234.5)*0.5)+3**0.5", 20000);
+
+    printf("\n%-34s %9s %9s %9s %12s %12s\n", "expression (batch, ns/point)",
+           "float", "double", "ldouble", "float_rel", "double_rel");
+    benchPrecision("x*y+x-y*0.5", -10, 10, n);
+    benchPrecision("sin(x)*cos(y)+exp(x*0.1)", -10, 10, n);
+    benchPrecision("sqrt(x*x+y*y)+log(x*x+1)", -100, 100, n);
+    benchPrecision("if(x>y, pow(x,2), max(x,y))", -10, 10, n);
+
+    printf("\n%-40s %10s %10s %10s %10s %10s\n", "expression (tiers, ns/call)",
+           "baseline", "optimized", "native", "opt_ms", "native_ms");
+    benchTiers("x*y+x-y*0.5", n);
+    benchTiers("x*(2**10/3+1)-y*(sqrt(2)+1)", n);
+    benchTiers("sin(x)*cos(y)+exp(x*0.1)", n);
+    benchTiers("if(x>y, pow(x,2), max(x,y))", n);
+
+    printf("\n%-10s %12s %10s %10s %12s %12s\n", "formulas", "instructions",
+           "nodes", "shared", "separate_ns", "workspace_ns");
+    benchWorkspace(10, n / 16);
+    benchWorkspace(100, n / 16);
+
+    printf("\n%-10s %12s %12s %10s %10s\n", "statements", "full_us",
+           "incremental_us", "relexed", "evaluated");
+    benchIncremental(100, 200);
+    benchIncremental(1000, 50);
+    benchIncremental(5000, 10);
+
+    printf("\n%-12s %10s %8s %12s %10s %8s %8s %8s\n", "expressions",
+           "latency_us", "workers", "blocking_ms", "async_ms", "calls",
+           "batches", "differ");
+    benchAsync(200, 1000, 2);
+    benchAsync(1000, 1000, 2);
+
+    printf("\n%-40s %10s %10s %10s\n", "expression (static, ns/call)",
+           "compiled", "static", "differ");
+    benchStatic(CALCULATOR_STATIC("x*y+x-y*0.5"), n);
+    benchStatic(CALCULATOR_STATIC("x*(2**10/3+1)-y*(sqrt(2)+1)"), n);
+    benchStatic(CALCULATOR_STATIC("sin(x)*cos(y)+exp(x*0.1)"), n);
+    benchStatic(CALCULATOR_STATIC("if(x>y, pow(x,2), max(x,y))"), n);
+    return 0;
+}
@@ -0,0 +1,161 @@
+#ifndef MYEASYCALCULATOR_ASYNCEVALUATOR_H
+#define MYEASYCALCULATOR_ASYNCEVALUATOR_H
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Environment.h"
+#include "Governor.h"
+#include "Registry.h"
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#include <coroutine>
+#define CALCULATOR_HAS_COROUTINES 1
+#endif
+
+namespace calculator {
+
+class ExpressionTree;
+struct node;
+
+// 异步计算的统计
+struct AsyncStats {
+    // 提交和完成的表达式数
+    size_t submitted = 0;
+    size_t completed = 0;
+    // 发起的异步函数调用数，和一起发起、一起等待的批数
+    size_t calls = 0;
+    size_t batches = 0;
+};
+
+/*
+ * 异步计算表达式: 表达式中的异步函数(ExpressionTree::addAsyncFunction，比如从
+ * 键值存储中读取)调用时不占用线程。一个表达式中参数已经可以计算的异步调用一起
+ * 发起，全部完成后把结果代入语法树，再发起依赖这些结果的调用，最后计算整个表达式。
+ * 条件表达式和逻辑运算先等待条件，只发起需要的分支中的调用。
+ * 多个表达式在少量工作线程上交替执行: 线程只做分析和计算，等待异步调用时去执行
+ * 其他表达式。
+ *
+ * 表达式在创建时的会话变量快照上计算(脚本中的赋值不写回会话)，使用会话的函数注册表
+ * 和资源限制。脚本中赋值语句的值和内置函数(sum/integrate 等)的函数体中的异步调用
+ * 在计算时同步等待，会占用工作线程
+ */
+class AsyncEvaluator {
+   public:
+    // 完成时在工作线程中调用，出错时 error 不为空
+    using Callback = std::function<void(double value, std::exception_ptr error)>;
+
+    // workers 为工作线程数，0 表示使用全部的硬件线程
+    explicit AsyncEvaluator(const ExpressionTree &session, size_t workers = 0);
+    // 等待已经提交的表达式全部完成
+    ~AsyncEvaluator();
+    AsyncEvaluator(const AsyncEvaluator &) = delete;
+    AsyncEvaluator &operator=(const AsyncEvaluator &) = delete;
+
+    // 提交表达式，立即返回
+    void submit(const std::string &text, Callback done);
+    // 同 submit，通过 future 取得结果
+    std::future<double> evaluate(const std::string &text);
+    AsyncStats stats() const;
+
+#ifdef CALCULATOR_HAS_COROUTINES
+    // co_await evaluator.evaluateAsync(text): 挂起协程直到表达式计算完成，
+    // 之后协程在工作线程中继续执行，出错时抛出异常
+    class Awaiter {
+       public:
+        Awaiter(AsyncEvaluator &evaluator, std::string text)
+            : evaluator_(evaluator), text_(std::move(text)) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            evaluator_.submit(text_, [this, handle](double value,
+                                                    std::exception_ptr error) {
+                value_ = value;
+                error_ = error;
+                handle.resume();
+            });
+        }
+        double await_resume() {
+            if (error_) std::rethrow_exception(error_);
+            return value_;
+        }
+
+       private:
+        AsyncEvaluator &evaluator_;
+        std::string text_;
+        double value_ = 0.0;
+        std::exception_ptr error_;
+    };
+    Awaiter evaluateAsync(std::string text) {
+        return Awaiter(*this, std::move(text));
+    }
+#endif
+
+   private:
+    struct Request;
+
+    // 在工作线程中执行
+    void post(std::function<void()> task);
+    void work();
+    // 分析表达式
+    void start(const std::shared_ptr<Request> &request);
+    // 发起参数已经可以计算的异步调用，没有时计算表达式的值
+    void advance(const std::shared_ptr<Request> &request);
+    // 一批异步调用全部完成，把结果代入语法树
+    void resolve(const std::shared_ptr<Request> &request);
+    void finish(const std::shared_ptr<Request> &request, double value,
+                std::exception_ptr error);
+    // 收集可以发起的异步调用，返回子树中是否还有没有完成的异步调用
+    bool collect(Request &request, node *x, std::vector<node *> &ready);
+    // 把节点替换为已经算出的值(同常量折叠)
+    static void fold(ExpressionTree &tree, node *x, double value);
+
+    std::shared_ptr<Registry> registry_;
+    Environment base_;
+    ResourceLimits limits_;
+
+    std::vector<std::thread> workers_;
+    std::mutex tasks_mutex_;
+    std::condition_variable tasks_cv_;
+    std::deque<std::function<void()>> tasks_;
+    bool shutdown_ = false;
+    // 没有完成的表达式数
+    size_t active_ = 0;
+    std::condition_variable idle_cv_;
+
+    std::atomic<size_t> submitted_{0}, completed_{0}, calls_{0}, batches_{0};
+};
+
+#ifdef CALCULATOR_HAS_COROUTINES
+// 最简单的协程返回类型: 协程立即开始执行，get() 等待并返回 co_return 的值
+template <class T>
+class AsyncTask {
+   public:
+    struct promise_type {
+        std::promise<T> result;
+        AsyncTask get_return_object() { return AsyncTask(result.get_future()); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_value(T value) { result.set_value(std::move(value)); }
+        void unhandled_exception() {
+            result.set_exception(std::current_exception());
+        }
+    };
+    T get() { return future_.get(); }
+
+   private:
+    explicit AsyncTask(std::future<T> future) : future_(std::move(future)) {}
+    std::future<T> future_;
+};
+#endif
+
+}  // namespace calculator
+#endif
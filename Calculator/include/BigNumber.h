@@ -0,0 +1,217 @@
+#ifndef MYEASYCALCULATOR_BIGNUMBER_H
+#define MYEASYCALCULATOR_BIGNUMBER_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace calculator {
+
+/*
+ * 任意精度整数。值在 int64 的范围内时直接保存在对象中(不分配内存)，
+ * 运算先按 int64 计算并检查溢出，溢出时才转为 32 位 limb 的数组。
+ * 乘法在两边都较长时使用 Karatsuba 算法，除法使用 Knuth 的 D 算法
+ */
+class BigInt {
+   public:
+    // limb 数不少于这个值时使用 Karatsuba 乘法
+    static constexpr size_t kKaratsubaLimbs = 40;
+
+    BigInt() = default;
+    BigInt(int64_t value) : small_(value) {}
+    // 十进制整数，可以有正负号
+    static BigInt parse(const std::string &text);
+
+    // 值在 int64 的范围内，这时 small() 为它的值
+    bool isSmall() const { return limbs_.empty(); }
+    int64_t small() const { return small_; }
+    int sign() const;
+    bool isZero() const { return isSmall() && small_ == 0; }
+    bool isOdd() const;
+    // 绝对值的二进制位数，0 为 0
+    size_t bitLength() const;
+    // 最接近的 double，超出范围时为 ±inf
+    double toDouble() const;
+    std::string toString() const;
+
+    BigInt operator-() const;
+    // 两边都是小整数并且不溢出时直接计算(内联)，否则按大数计算
+    friend BigInt operator+(const BigInt &a, const BigInt &b) {
+        int64_t x;
+        if (a.isSmall() && b.isSmall() &&
+            !__builtin_add_overflow(a.small_, b.small_, &x))
+            return BigInt(x);
+        return add(a, b, false);
+    }
+    friend BigInt operator-(const BigInt &a, const BigInt &b) {
+        int64_t x;
+        if (a.isSmall() && b.isSmall() &&
+            !__builtin_sub_overflow(a.small_, b.small_, &x))
+            return BigInt(x);
+        return add(a, b, true);
+    }
+    friend BigInt operator*(const BigInt &a, const BigInt &b) {
+        int64_t x;
+        if (a.isSmall() && b.isSmall() &&
+            !__builtin_mul_overflow(a.small_, b.small_, &x))
+            return BigInt(x);
+        return multiply(a, b);
+    }
+    // 向零取整的除法，余数与被除数同号。除数为 0 时抛出 DivZeroException
+    static void divide(const BigInt &a, const BigInt &b, BigInt *quotient,
+                       BigInt *remainder);
+    friend BigInt operator/(const BigInt &a, const BigInt &b);
+    friend BigInt operator%(const BigInt &a, const BigInt &b);
+    // 位运算按补码计算，负数的补码视为向高位无限延伸的1
+    friend BigInt operator&(const BigInt &a, const BigInt &b);
+    friend BigInt operator|(const BigInt &a, const BigInt &b);
+    friend BigInt operator^(const BigInt &a, const BigInt &b);
+    BigInt operator~() const { return -*this - BigInt(1); }
+    // 算术移位，右移向负无穷取整
+    BigInt shiftLeft(size_t bits) const;
+    BigInt shiftRight(size_t bits) const;
+
+    static int compare(const BigInt &a, const BigInt &b) {
+        if (a.isSmall() && b.isSmall())
+            return (a.small_ > b.small_) - (a.small_ < b.small_);
+        return compareBig(a, b);
+    }
+    friend bool operator==(const BigInt &a, const BigInt &b) {
+        return compare(a, b) == 0;
+    }
+    friend bool operator!=(const BigInt &a, const BigInt &b) {
+        return compare(a, b) != 0;
+    }
+    friend bool operator<(const BigInt &a, const BigInt &b) {
+        return compare(a, b) < 0;
+    }
+    friend bool operator>(const BigInt &a, const BigInt &b) {
+        return compare(a, b) > 0;
+    }
+
+    // 最大公约数(非负)
+    static BigInt gcd(BigInt a, BigInt b);
+    // 平方求幂
+    static BigInt pow(BigInt base, uint64_t exponent);
+    // lo*(lo+1)*...*hi, lo > hi 时为1。二分递归(binary splitting)，
+    // 让每次乘法的两边长度接近，大数部分由 Karatsuba 乘法完成
+    static BigInt product(uint64_t lo, uint64_t hi);
+    static BigInt factorial(uint64_t n) { return product(1, n); }
+
+   private:
+    using Limbs = std::vector<uint32_t>;
+    // 由符号和绝对值构造，能放进 int64 时转为小整数
+    static BigInt fromMagnitude(bool negative, Limbs magnitude);
+    // 绝对值的 limb(低位在前)，小整数也转换为 limb
+    Limbs magnitude() const;
+    bool negative() const { return isSmall() ? small_ < 0 : negative_; }
+    // 大数的加减法(subtract 时为 a - b)、乘法和比较
+    static BigInt add(const BigInt &a, const BigInt &b, bool subtract);
+    static BigInt multiply(const BigInt &a, const BigInt &b);
+    static int compareBig(const BigInt &a, const BigInt &b);
+    // 位运算的补码计算
+    template <class Op>
+    static BigInt bitwise(const BigInt &a, const BigInt &b, Op op);
+
+    // limbs_ 为空时值为 small_；否则值为 ±limbs_，并且超出 int64 的范围
+    int64_t small_ = 0;
+    bool negative_ = false;
+    Limbs limbs_;
+};
+
+BigInt operator/(const BigInt &a, const BigInt &b);
+BigInt operator%(const BigInt &a, const BigInt &b);
+BigInt operator&(const BigInt &a, const BigInt &b);
+BigInt operator|(const BigInt &a, const BigInt &b);
+BigInt operator^(const BigInt &a, const BigInt &b);
+
+/*
+ * 有理数: 分母为正，分子分母互质。整数(分母为1)的运算不求最大公约数，
+ * 和 BigInt 一样小的值不分配内存
+ */
+class Rational {
+   public:
+    Rational() = default;
+    Rational(int64_t value) : num_(value) {}
+    Rational(BigInt value) : num_(std::move(value)) {}
+    // 分母为 0 时抛出 DivZeroException
+    Rational(BigInt num, BigInt den);
+    // double 的精确值(二进制小数)，x 必须是有限值
+    static Rational fromDouble(double x);
+    // double 的最短十进制表示(能原样读回的最少位数)，0.1 得到 1/10
+    static Rational fromShortest(double x);
+    // 十进制小数，比如 -12.5e-3
+    static Rational parse(const std::string &text);
+
+    const BigInt &numerator() const { return num_; }
+    const BigInt &denominator() const { return den_; }
+    bool isInteger() const { return den_.isSmall() && den_.small() == 1; }
+    int sign() const { return num_.sign(); }
+    bool isZero() const { return num_.isZero(); }
+    double toDouble() const;
+    // 整数或 分子/分母
+    std::string toString() const;
+
+    Rational operator-() const;
+    friend Rational operator+(const Rational &a, const Rational &b);
+    friend Rational operator-(const Rational &a, const Rational &b);
+    friend Rational operator*(const Rational &a, const Rational &b);
+    // 除数为 0 时抛出 DivZeroException
+    friend Rational operator/(const Rational &a, const Rational &b);
+    static int compare(const Rational &a, const Rational &b);
+    friend bool operator==(const Rational &a, const Rational &b) {
+        return a.num_ == b.num_ && a.den_ == b.den_;
+    }
+    friend bool operator!=(const Rational &a, const Rational &b) {
+        return !(a == b);
+    }
+    friend bool operator<(const Rational &a, const Rational &b) {
+        return compare(a, b) < 0;
+    }
+
+    // 整数次幂，0 的负数次幂抛出 DivZeroException
+    static Rational pow(const Rational &base, int64_t exponent);
+    // 取整: 向零、向下、向上、四舍五入(0.5 远离零，同 std::round)
+    BigInt trunc() const { return num_ / den_; }
+    BigInt floor() const;
+    BigInt ceil() const;
+    BigInt round() const;
+
+   private:
+    BigInt num_, den_ = 1;
+};
+
+Rational operator+(const Rational &a, const Rational &b);
+Rational operator-(const Rational &a, const Rational &b);
+Rational operator*(const Rational &a, const Rational &b);
+Rational operator/(const Rational &a, const Rational &b);
+
+/*
+ * 精确模式中的值: 有理数，或者不能精确计算时(比如 sqrt(2)、sin(1))的 double
+ * 近似值。近似值参与的运算结果也是近似值
+ */
+class ExactNumber {
+   public:
+    ExactNumber() = default;
+    ExactNumber(Rational value) : value_(std::move(value)) {}
+    static ExactNumber approximate(double value) {
+        ExactNumber x;
+        x.exact_ = false;
+        x.approx_ = value;
+        return x;
+    }
+
+    bool exact() const { return exact_; }
+    const Rational &rational() const { return value_; }
+    double toDouble() const { return exact_ ? value_.toDouble() : approx_; }
+    // 精确值为整数或 分子/分母，近似值为 17 位有效数字
+    std::string toString() const;
+
+   private:
+    Rational value_;
+    double approx_ = 0;
+    bool exact_ = true;
+};
+
+}  // namespace calculator
+#endif
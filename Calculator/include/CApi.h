@@ -0,0 +1,61 @@
+#ifndef MYEASYCALCULATOR_CAPI_H
+#define MYEASYCALCULATOR_CAPI_H
+#include <stddef.h>
+
+/*
+ * libcalculator 的 C 接口，供 C 程序和其他语言的 FFI 调用。
+ * 不会抛出异常: 出错时返回 CALCULATOR_ERROR 或 NULL，原因由
+ * calculator_last_error() 给出(每个线程各自保存)。
+ * 一个会话对应一个 ExpressionTree，不能在多个线程中同时使用；
+ * 编译好的函数可以在多个线程中同时计算(同 CompiledExpression)
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CALCULATOR_OK 0
+#define CALCULATOR_ERROR (-1)
+
+typedef struct calculator_session calculator_session;
+typedef struct calculator_function calculator_function;
+
+calculator_session *calculator_session_create(void);
+void calculator_session_destroy(calculator_session *session);
+
+// 定义变量，之后的表达式中可以使用
+int calculator_set_variable(calculator_session *session, const char *name,
+                            double value);
+// 加载插件中的函数，见 Plugin.h
+int calculator_load_plugin(calculator_session *session, const char *path);
+
+// 计算表达式(可以是以 ; 分隔的多条赋值语句)，结果写入 result
+int calculator_evaluate(calculator_session *session, const char *expression,
+                        double *result);
+
+// 用会话当前的变量和函数编译表达式，parameters 为 count 个参数名；
+// 出错时返回 NULL。函数不依赖会话，可以在会话销毁后继续使用
+calculator_function *calculator_compile(calculator_session *session,
+                                        const char *expression,
+                                        const char *const *parameters,
+                                        size_t count);
+void calculator_function_destroy(calculator_function *function);
+size_t calculator_function_arity(const calculator_function *function);
+
+// args 按参数的顺序传入，没有参数时可以为 NULL
+int calculator_function_evaluate(const calculator_function *function,
+                                 const double *args, double *result);
+// 批量计算 n 个点，参数同 CompiledExpression::evaluateBatch；args 为 NULL 时
+// 每个参数都要有对应的列
+int calculator_function_evaluate_batch(const calculator_function *function,
+                                       const double *args,
+                                       const double *const *columns,
+                                       double *out, size_t n);
+
+// 当前线程最后一次出错的原因，没有出错时为空字符串
+const char *calculator_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
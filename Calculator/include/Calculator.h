@@ -0,0 +1,20 @@
+#ifndef MYEASYCALCULATOR_CALCULATOR_H
+#define MYEASYCALCULATOR_CALCULATOR_H
+
+/*
+ * 嵌入 libcalculator 时使用的头文件: 表达式的计算和编译、异步计算、分层执行、
+ * 蒙特卡罗采样、多公式工作区和编译期表达式。不包含 iostream 和测试代码，
+ * 命令行工具用到的 Server.h/Pipeline.h 需要时单独包含。
+ * C 程序和 FFI 使用 CApi.h
+ */
+#include "AsyncEvaluator.h"
+#include "BigNumber.h"
+#include "CompiledExpression.h"
+#include "ExpressionTree.h"
+#include "IncrementalScript.h"
+#include "MonteCarlo.h"
+#include "StaticExpression.h"
+#include "TieredExpression.h"
+#include "Workspace.h"
+
+#endif
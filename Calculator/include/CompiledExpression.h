@@ -0,0 +1,246 @@
+#ifndef MYEASYCALCULATOR_COMPILEDEXPRESSION_H
+#define MYEASYCALCULATOR_COMPILEDEXPRESSION_H
+
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Lexer.h"
+#include "Numeric.h"
+
+namespace calculator {
+
+// 编译后的指令
+enum class OpCode {
+    Constant,      // 常数
+    Argument,      // 参数
+    Add,           // +
+    Sub,           // -
+    Mul,           // *
+    Div,           // /
+    Mod,           // %
+    And,           // &
+    Or,            // |
+    Xor,           // ^
+    ShiftLeft,     // <<
+    ShiftRight,    // >>
+    Less,          // <
+    LessEqual,     // <=
+    Greater,       // >
+    GreaterEqual,  // >=
+    Equal,         // ==
+    NotEqual,      // !=
+    Not,           // !
+    Negate,        // ~
+    Minus,         // 函数前的负号 -f(x)
+    Call1,         // 一元函数
+    Call2,         // 二元函数(包括 **)
+    Builtin,       // 内置的多参数函数 integrate/solve/minimize/sum/prod
+    Conditional    // 条件表达式 if/&&/||，按栈顶的条件计算其中一个分支
+};
+
+// 内置的多参数函数
+enum class BuiltinKind {
+    Integrate,  // integrate(f, x, a, b)
+    Solve,      // solve(f, x, x0)
+    Minimize,   // minimize(f, x, a, b)
+    Sum,        // sum(i, lo, hi, f)
+    Product     // prod(i, lo, hi, f)
+};
+
+struct Instruction {
+    OpCode op;
+    // 参数下标或函数下标
+    int index;
+    // 常数的值
+    double value;
+};
+
+// 梯度的计算方式
+enum class GradientMode {
+    Automatic,  // 参数较少时使用前向模式，否则使用反向模式
+    Forward,    // 前向模式(对偶数)，代价约为 (1+参数个数) 次计算
+    Reverse     // 反向模式(记录每条指令的值)，代价约为 3 次计算，与参数个数无关
+};
+
+// 编译表达式计算时使用的浮点类型
+enum class Precision {
+    Single,   // float，批量计算的吞吐量最高，约7位有效数字
+    Double,   // double(默认)
+    Extended  // long double，x86上为80位扩展精度
+};
+
+/*
+ * 编译后的表达式: 由 ExpressionTree::compile 生成的后缀指令序列,
+ * 参数在计算时按下标传入，不需要重新解析表达式文本。
+ * 编译时会复制用到的函数，之后对 ExpressionTree 的修改不会影响已经编译的表达式。
+ * 计算本身不修改对象，只要用到的自定义函数是线程安全的，就可以在多个线程中同时计算
+ */
+class CompiledExpression {
+    friend class ExpressionTree;
+    friend class TieredExpression;
+    friend class Workspace;
+
+   public:
+    // 参数个数小于等于这个值时自动选择前向模式
+    static constexpr size_t kForwardModeMaxParams = 4;
+    // 批量计算时每次处理的点数
+    static constexpr size_t kBatchLanes = 256;
+
+    const std::vector<std::string>& parameters() const { return parameters_; }
+    size_t arity() const { return parameters_.size(); }
+    // 用到的函数都是没有缓存的纯函数或随机数函数，可以在多个线程中同时计算
+    bool concurrent() const { return concurrent_; }
+    // 用到 rand/uniform/normal，结果取决于当前线程的随机数流。
+    // 这时 sum/prod 只在当前线程计算，保证随机数的使用顺序
+    bool random() const { return random_; }
+    // 是否用到第k个参数(包括内置函数的函数体和条件表达式的分支)
+    bool usesParameter(size_t k) const;
+
+    /*
+     * 计算使用的精度，对内置函数的函数体和条件表达式的分支同样有效。
+     * 内置数学函数有各个精度的版本，自定义函数和插件转换为 double 调用；
+     * 积分/求根等数值算法、梯度和 ExpressionTree 的直接计算总是使用 double
+     */
+    void setPrecision(Precision precision);
+    Precision precision() const { return precision_; }
+
+    // 计算表达式的值, args 的长度为参数个数。double 版本按 precision() 计算，
+    // float/long double 版本直接以对应的类型计算，不做转换
+    double evaluate(const double* args) const;
+    float evaluate(const float* args) const;
+    long double evaluate(const long double* args) const;
+    double operator()(const std::vector<double>& args) const;
+    // 批量计算 n 个点: 第k个参数取 columns[k][i]，columns 或 columns[k]
+    // 为空时取 args[k]。按指令逐列计算，内置数学函数使用批量实现
+    void evaluateBatch(const double* args, const double* const* columns,
+                       double* out, size_t n) const;
+    void evaluateBatch(const float* args, const float* const* columns,
+                       float* out, size_t n) const;
+    void evaluateBatch(const long double* args,
+                       const long double* const* columns, long double* out,
+                       size_t n) const;
+
+    // 计算梯度，grad 的长度为参数个数，返回表达式的值
+    double gradient(const double* args, double* grad,
+                    GradientMode mode = GradientMode::Automatic) const;
+    std::vector<double> gradient(
+        const std::vector<double>& args,
+        GradientMode mode = GradientMode::Automatic) const;
+
+   private:
+    // 内置函数的调用: 函数体被编译为参数多一个(绑定变量)的子表达式,
+    // 其余参数(积分限、初值等)是栈上的操作数
+    struct Builtin {
+        BuiltinKind kind;
+        std::string name;
+        // 栈上操作数的个数
+        int operands;
+        std::shared_ptr<const CompiledExpression> body;
+    };
+
+    // 条件表达式的两个分支，分支与所在的表达式有相同的参数
+    struct Conditional {
+        std::shared_ptr<const CompiledExpression> then_branch, else_branch;
+        // 分支中有内置函数或者非纯函数时，批量计算也只计算选中的分支，
+        // 否则两个分支都批量计算，再按条件选择(没有跳转)
+        bool per_lane;
+    };
+
+    // 用到的函数的 float/long double 版本，没有时为空
+    template <class T>
+    struct PrecisionCalls {
+        std::vector<T (*)(T)> unary;
+        std::vector<void (*)(const T*, T*, size_t)> batch;
+        std::vector<T (*)(T, T)> binary;
+    };
+
+    // 添加一个用到的函数，返回其下标。table 中有 float/long double 版本时一起复制
+    int addUnary(const std::string& name, const UnaryFunctionType& func,
+                 const UnaryFunctionType& derivative,
+                 BatchFunctionType batch = nullptr,
+                 const FunctionTable* table = nullptr);
+    int addBinary(const std::string& name, const BinaryFunctionType& func,
+                  const BinaryFunctionType& dx, const BinaryFunctionType& dy,
+                  const FunctionTable* table = nullptr);
+    int addBuiltin(const std::string& name,
+                   std::shared_ptr<const CompiledExpression> body);
+    int addConditional(std::shared_ptr<const CompiledExpression> then_branch,
+                       std::shared_ptr<const CompiledExpression> else_branch);
+    // 编译完成后计算栈的深度和每条指令的操作数位置
+    void finalize();
+
+    // 执行一条指令, a/b 为操作数
+    template <class T>
+    T apply(const Instruction& ins, T a, T b) const;
+    // 以类型 T 调用用到的函数，没有 T 的版本时转换为 double 调用
+    template <class T>
+    T callUnary(int index, T x) const;
+    template <class T>
+    T callBinary(int index, T x, T y) const;
+    template <class T>
+    const PrecisionCalls<T>& precisionCalls() const {
+        if constexpr (std::is_same_v<T, float>)
+            return float_calls_;
+        else
+            return long_double_calls_;
+    }
+    // 指令对操作数的局部偏导数, r 为指令的结果
+    void partials(const Instruction& ins, double a, double b, double r,
+                  double& da, double& db) const;
+
+    // 计算内置函数, args 为外层表达式的参数
+    double callBuiltin(const Builtin& builtin, const double* args,
+                       const double* operands) const;
+    template <class T>
+    T callBuiltin(const Builtin& builtin, const T* args,
+                  const T* operands) const;
+    // 内置函数对栈上操作数和外层参数的偏导数
+    void builtinPartials(const Builtin& builtin, const double* args,
+                         const double* operands, double result,
+                         double* d_operands, double* d_args) const;
+    // 以类型 T 计算
+    template <class T>
+    T evaluateAs(const T* args) const;
+    // 批量计算的一段，最多 kBatchLanes 个点
+    template <class T>
+    void evaluateLanes(const T* args, const T* const* columns, size_t offset,
+                       T* out, size_t n) const;
+    template <class T>
+    void evaluateBatchAs(const T* args, const T* const* columns, T* out,
+                         size_t n) const;
+    // double 的参数转换为 T 计算，结果再转换回 double
+    template <class T>
+    double evaluateConverted(const double* args) const;
+    template <class T>
+    void evaluateBatchConverted(const double* args,
+                                const double* const* columns, double* out,
+                                size_t n) const;
+
+    double gradientForward(const double* args, double* grad) const;
+    double gradientReverse(const double* args, double* grad) const;
+
+    std::vector<std::string> parameters_;
+    std::vector<Instruction> code_;
+    // 每条指令的操作数所在的指令下标(没有则为-1)
+    std::vector<std::pair<int, int>> operands_;
+    size_t max_depth_ = 0;
+    bool concurrent_ = true;
+    bool random_ = false;
+    // 有内置函数、非纯函数或随机数函数，不能多计算(见 Conditional::per_lane)
+    bool expensive_ = false;
+    Precision precision_ = Precision::Double;
+
+    std::vector<std::string> unary_names_, binary_names_;
+    std::vector<UnaryFunctionType> unary_, unary_derivatives_;
+    std::vector<BatchFunctionType> unary_batch_;
+    std::vector<BinaryFunctionType> binary_, binary_dx_, binary_dy_;
+    PrecisionCalls<float> float_calls_;
+    PrecisionCalls<long double> long_double_calls_;
+    std::vector<Builtin> builtins_;
+    std::vector<Conditional> conditionals_;
+};
+
+}  // namespace calculator
+#endif
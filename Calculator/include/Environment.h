@@ -0,0 +1,95 @@
+#ifndef MYEASYCALCULATOR_ENVIRONMENT_H
+#define MYEASYCALCULATOR_ENVIRONMENT_H
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace calculator {
+
+// 变量名 -> 值
+using Bindings = std::unordered_map<std::string, double>;
+// 数组的值，只读，变量和表达式之间共享
+using ArrayRef = std::shared_ptr<const std::vector<double>>;
+
+/*
+ * 会话的变量环境，分为两层:
+ *   基础层: 内置常量和全局常量，只读，所有会话共享同一份
+ *   会话层: 会话中定义过的变量。fork 之后与副本共享，第一次写入时才复制
+ * 会话层可以设置内存上限，超过时淘汰最久没有使用的变量(被淘汰的变量变为未定义)。
+ * 环境中只保存有值的变量，未定义的标识符不会被记录。
+ * 会话层的变量可以是数组，数组的元素也计入内存
+ */
+class Environment {
+   public:
+    // 内置常量 pi/e/sqrt2 组成的基础层
+    static std::shared_ptr<const Bindings> builtinConstants();
+    // 内置常量加上全局常量组成的基础层，同名时全局常量优先
+    static std::shared_ptr<const Bindings> makeBase(const Bindings &globals);
+
+    explicit Environment(
+        std::shared_ptr<const Bindings> base = builtinConstants())
+        : base_(std::move(base)) {}
+
+    // 查找变量，依次查找会话层、globals(注册表中的全局常量)和基础层，
+    // 没有定义或者是数组时返回 nullopt
+    std::optional<double> find(const std::string &name,
+                               const Bindings *globals = nullptr);
+    // 查找数组变量，没有定义或者不是数组时返回空
+    ArrayRef findArray(const std::string &name);
+    bool contains(const std::string &name) const;
+    // 在会话层定义变量(可以覆盖基础层的同名变量)
+    void assign(const std::string &name, double value);
+    void assign(const std::string &name, ArrayRef array);
+    // 删除会话层的变量，返回是否存在
+    bool erase(const std::string &name);
+    // 删除会话层的全部变量
+    void clear() { local_.reset(); }
+
+    // 复制只增加引用计数，之后两个环境的修改互不影响
+    Environment fork() const { return *this; }
+
+    // 会话层的变量个数和估计占用的内存(字节)
+    size_t size() const { return local_ ? local_->entries.size() : 0; }
+    size_t memoryUsage() const { return local_ ? local_->memory : 0; }
+    // 会话层的内存上限，0 表示不限制
+    void setMemoryLimit(size_t bytes);
+    size_t memoryLimit() const { return limit_; }
+    // 被淘汰的变量个数
+    size_t evictions() const { return evictions_; }
+
+    const Bindings &base() const { return *base_; }
+
+   private:
+    struct Entry {
+        double value;
+        // 数组变量的值，标量为空
+        ArrayRef array;
+        // 最近一次使用的时刻
+        uint64_t used;
+    };
+    struct Layer {
+        std::unordered_map<std::string, Entry> entries;
+        size_t memory = 0;
+        uint64_t clock = 0;
+    };
+
+    // 写入前确保会话层只属于当前环境
+    void detach();
+    // 定义变量，value 或 array 之一有效
+    void put(const std::string &name, double value, ArrayRef array);
+    // 淘汰最久没有使用的变量直到低于上限的3/4，keep 不会被淘汰
+    void evict(const std::string *keep);
+    static size_t entryCost(const std::string &name, const Entry &entry);
+
+    std::shared_ptr<const Bindings> base_;
+    // 没有定义过变量时为空
+    std::shared_ptr<Layer> local_;
+    size_t limit_ = 0;
+    size_t evictions_ = 0;
+};
+
+}  // namespace calculator
+#endif
@@ -114,6 +114,60 @@ class BinaryFunctionException : public ValueException {
                     "] must have two operator numbers: ";
     }
 };
+// 内置函数的数值计算失败(积分区间无效、找不到根等)
+class NumericException : public ValueException {
+   public:
+    NumericException(const std::string& function, const std::string& reason) {
+        error_msg = "Error: builtin function [" + function + "] " + reason;
+    }
+};
+// 数组的长度不一致，或者数组用在了需要数值的地方
+class ArrayException : public ValueException {
+   public:
+    ArrayException(const std::string& reason) {
+        error_msg = "Error: array " + reason;
+    }
+};
+// 内置函数的参数错误
+class BuiltinArgumentException : public SyntaxError {
+   public:
+    BuiltinArgumentException(const std::string& function,
+                             const std::string& reason) {
+        error_msg = "Error: builtin function [" + function + "] " + reason;
+    }
+};
+// 插件加载失败
+class PluginException : public SyntaxError {
+   public:
+    PluginException(const std::string& path, const std::string& reason) {
+        error_msg = "Error: plugin [" + path + "] " + reason;
+    }
+};
+// CSV 文件无法读取或格式错误
+class CsvException : public SyntaxError {
+   public:
+    CsvException(const std::string& path, const std::string& reason) {
+        error_msg = "Error: csv [" + path + "] " + reason;
+    }
+};
+// 计算的资源，见 Governor.h 中的 ResourceLimits
+enum class Resource { Tokens, Nodes, Depth, Steps, Iterations, Time };
+// 超过了一次计算的资源限制
+class ResourceLimitException : public SyntaxError {
+   public:
+    ResourceLimitException(Resource resource, size_t limit)
+        : resource_(resource) {
+        static const char *names[] = {"tokens", "nodes",      "depth",
+                                      "steps",  "iterations", "time(ms)"};
+        error_msg = "Error: resource limit [" +
+                    std::string(names[(int)resource]) +
+                    "] exceeded: " + std::to_string(limit);
+    }
+    Resource resource() const { return resource_; }
+
+   private:
+    Resource resource_;
+};
 // 变量声明和定义需要;分隔
 class DeclareVariableException : public SyntaxError {
    public:
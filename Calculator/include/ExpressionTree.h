@@ -2,10 +2,17 @@
 #define MYEASYCALCULATOR_EXPRESSIONTREE_H
 
 #include <algorithm>
+#include <cstdint>
+#include <exception>
 #include <numeric>
+#include <unordered_map>
 #include <vector>
 
+#include "BigNumber.h"
+#include "CompiledExpression.h"
+#include "Governor.h"
 #include "Lexer.h"
+#include "Plugin.h"
 
 namespace calculator {
 
@@ -18,6 +25,18 @@ struct node {
     bool negative;
     // 节点的值，根据孩子节点来计算
     double value;
+    // 当type为Identifier时，表示编译表达式的参数下标
+    // 当type为Builtin时，表示绑定变量的参数下标
+    int index = -1;
+    // 当type为Builtin时，绑定变量名和参数(第一个是函数体，其余按原来的顺序)
+    // 当type为Conditional时，args为条件和两个分支
+    // 当type为Array时，args为数组字面量的元素; 当type为Reduction时为归约的参数
+    std::string variable;
+    std::vector<node *> args;
+    // 当type为Array时，数组的值(字面量在计算时才生成)
+    ArrayRef array;
+    // 节点的值已经在构建时计算出来(常量折叠)，孩子节点已经释放
+    bool folded = false;
 
     node *left;
     node *right;
@@ -27,41 +46,224 @@ struct node {
     node(Tag t) : node(t, 0.0) {}
 };
 
+// 性能分析时一个节点的计算次数和耗时(包括子树)
+struct NodeProfile {
+    uint64_t calls = 0;
+    uint64_t ticks = 0;
+};
+
 class ExpressionTree {
+    // 编译 Baseline 层时关闭常量折叠
+    friend class TieredExpression;
+    // 增量计算按语句分析和执行(同并行分析)
+    friend class IncrementalScript;
+    // 异步计算分步分析和计算语法树
+    friend class AsyncEvaluator;
+
    public:
     ExpressionTree() : root_(nullptr) { lexer_.tokenList().clear(); }
-    explicit ExpressionTree(const std::string &text) : lexer_(text) {
-        ExpressionTree();
+    explicit ExpressionTree(const std::string &text)
+        : lexer_(text), root_(nullptr) {}
+    // 使用已有的变量环境(比如另一个会话的快照)创建会话
+    explicit ExpressionTree(const Environment &environment) : ExpressionTree() {
+        lexer_.environment = environment;
     }
+    // 使用共享的函数注册表，注册的函数和全局常量对所有共享的会话可见
+    explicit ExpressionTree(std::shared_ptr<Registry> registry)
+        : lexer_(std::move(registry)), root_(nullptr) {}
 
     ~ExpressionTree() { clear(root_); };
 
     double calcExpression(const std::string &text);
+    // 计算值为数组的表达式，比如 a=[1,2,3]; a*a+1。值为数值时返回一个元素
+    std::vector<double> calcArray(const std::string &text);
+    /*
+     * 精确模式: 整数和有理数按任意精度计算(见 BigNumber.h)，比如 factorial(30)、
+     * 2**200、1/3+1/6、位运算和移位。字面量和变量按 double 的最短十进制表示
+     * 读入(0.1 为 1/10)，赋值的变量仍然保存为 double。结果不能精确表示的
+     * 函数(比如 sqrt(2)、sin(1)、积分)按 double 计算，结果标记为近似值
+     */
+    ExactNumber calcExact(const std::string &text);
+    // 分析表达式(其中的赋值语句会执行)，返回常量折叠后的语法树: 节点类型、
+    // 调用的函数及其属性、折叠的常量，以及节点数和深度
+    std::string explain(const std::string &text);
+    // 不做常量折叠，把表达式计算 iterations 次，返回每个节点的计算次数、
+    // 包括子树的耗时和自身的耗时(x86 上为时钟周期，其他平台为纳秒)
+    std::string profile(const std::string &text, size_t iterations = 10000);
 
     // 添加变量
     void addVariable(const std::string &name, double value) {
         lexer_.putConstant(name, value);
     }
-    // 添加一元函数
-    void addUnaryFunction(const std::string &function_name,
-                          const UnaryFunctionType &func) {
-        lexer_.unary_functions[function_name] = std::move(func);
+    // 添加数组变量
+    void addVariable(const std::string &name, std::vector<double> values) {
+        lexer_.environment.assign(
+            name, std::make_shared<const std::vector<double>>(std::move(values)));
     }
+    // 会话的变量环境: 共享只读的内置常量，会话中定义的变量写时复制，
+    // 可以通过 environment().setMemoryLimit 限制会话的内存
+    Environment &environment() { return lexer_.environment; }
+    // 当前变量的快照，只增加引用计数。可以用 restore 恢复，或者用来创建新的会话
+    Environment snapshot() const { return lexer_.environment.fork(); }
+    void restore(const Environment &environment) {
+        lexer_.environment = environment;
+    }
+    // 添加一元函数, attr 可以声明为纯函数并启用记忆化缓存
+    void addUnaryFunction(const std::string &function_name,
+                          const UnaryFunctionType &func,
+                          FunctionAttribute attr = FunctionAttribute());
     // 添加二元函数
     void addBinaryFunction(const std::string &function_name,
-                           const BinaryFunctionType &func) {
-        lexer_.binary_functions[function_name] = std::move(func);
+                           const BinaryFunctionType &func,
+                           FunctionAttribute attr = FunctionAttribute());
+    // 添加异步的一元函数(比如从键值存储中读取): AsyncEvaluator 中一个表达式里
+    // 互不依赖的调用一起发起，等待时不占用线程；其他计算方式中同步等待结果。
+    // 异步函数不是纯函数，不做常量折叠
+    void addAsyncFunction(const std::string &function_name,
+                          const AsyncFunctionType &func);
+    // 加载插件中的函数(见 Plugin.h)，再次加载同一个路径会替换为新的版本，
+    // 已经编译的表达式继续使用原来的版本
+    void loadPlugin(const std::string &path);
+    // 注册已经加载的插件中的函数，多个会话可以共用一个插件
+    void addPlugin(const std::shared_ptr<PluginLibrary> &library);
+    // 为自定义函数提供导数(用于梯度计算), 没有提供时使用数值差分
+    void setDerivative(const std::string &function_name,
+                       const UnaryFunctionType &derivative) {
+        lexer_.registry->update([&](FunctionTable &table) {
+            table.unary_derivatives[function_name] = derivative;
+        });
+    }
+    void setDerivative(const std::string &function_name,
+                       const BinaryFunctionType &dx,
+                       const BinaryFunctionType &dy) {
+        lexer_.registry->update([&](FunctionTable &table) {
+            table.binary_derivatives[function_name] = {dx, dy};
+        });
+    }
+    // 编译表达式，params 为参数名，计算时按顺序传入参数的值，
+    // precision 为计算使用的精度(见 CompiledExpression::setPrecision)
+    CompiledExpression compile(const std::string &text,
+                               const std::vector<std::string> &params = {},
+                               Precision precision = Precision::Double);
+    // 函数记忆化缓存的统计信息(调用次数/命中率)
+    FunctionStats functionStats(const std::string &function_name) {
+        FunctionPin pin(lexer_);
+        return lexer_.functionStats(function_name);
     }
 
+    // 选择内置数学函数的实现(精确/快速近似), 默认为精确。
+    // 数学模式属于函数注册表，共享注册表时对所有会话生效
+    void setMathMode(MathMode mode) {
+        lexer_.registry->update(
+            [mode](FunctionTable &table) { table.setMathMode(mode); });
+    }
+    MathMode mathMode() const {
+        return Registry::ReadGuard(*lexer_.registry)->math_mode;
+    }
+    // 函数注册表，可以用来创建共享同一组函数的会话
+    const std::shared_ptr<Registry> &registry() const {
+        return lexer_.registry;
+    }
+    // 分析长脚本(以 ; 分隔的多条语句)的线程数，0 表示使用全部的硬件线程，
+    // 1 表示只在当前线程分析
+    void setParseWorkers(size_t workers) { parse_workers_ = workers; }
+    // 每次计算的资源限制(token 数、节点数、深度、步数、内置函数的项数和时间)，
+    // 超过时抛出 ResourceLimitException，会话中已经执行的赋值保留
+    void setLimits(const ResourceLimits &limits) { limits_ = limits; }
+    const ResourceLimits &limits() const { return limits_; }
+
+    // 精确模式中结果的位数上限，超过时抛出 NumericException
+    static constexpr size_t kMaxExactBits = size_t(1) << 26;
+    // 超过这个长度的脚本按语句切分后并行分析
+    static constexpr size_t kParallelScriptBytes = 64 * 1024;
+
    private:
+    // 并行分析出的一条语句
+    struct Statement {
+        // 赋值的变量名，表达式语句为空
+        std::string variable;
+        // 值的语法树，值只有一个 token 时为空，使用 token
+        node *value = nullptr;
+        std::shared_ptr<Token> token;
+        // 分析这条语句时的错误，在按顺序执行到这条语句时抛出
+        std::exception_ptr error;
+    };
+
     void parseExpression(const std::string &text);
     node *buildTree();
-    // 递归计算表达式树的值
+    // 分析并执行脚本中的赋值语句，返回最后的表达式的语法树
+    node *parseScript(const std::string &text);
+    // 在顶层的 ; 处把脚本切分为最多 chunks 块，返回每块的开始位置和结尾，
+    // 括号不匹配或者括号中有 ; 时返回空(不能切分)
+    static std::vector<size_t> splitScript(const std::string &text,
+                                           size_t chunks);
+    // 在工作线程中分析一块脚本，变量留到执行时查找。
+    // 有不能并行分析的语句(比如表达式中的赋值)时返回 false
+    bool parseStatements(const std::string &text,
+                         std::vector<Statement> &statements);
+    // parseStatements 的语法分析部分: 由词法分析得到的 token 构建语句
+    bool buildStatements(std::vector<Statement> &statements);
+    // 按顺序执行并行分析出的语句，返回最后的表达式
+    node *runStatements(std::vector<Statement> &statements);
+    // 查找语法树中留到执行时查找的变量
+    void resolveVariables(node *x);
+    // 语法树的节点数和深度计入资源限制，在递归处理语法树之前检查
+    void checkTree(node *x);
+    // 递归计算表达式树的值，性能分析时记录每个节点的耗时
     double calcValue(node *x);
+    double calcNode(node *x);
+    // 语法树的文本形式，profile 不为空时每个节点前加上计时，
+    // 百分比相对于 total
+    void describe(node *x, int depth, std::string &out,
+                  const std::unordered_map<const node *, NodeProfile> *profile,
+                  uint64_t total = 0);
+    // 子树的值是否是数组
+    bool isArrayValued(node *x);
+    // 计算值为数组的子树，值为数值时返回一个元素
+    ArrayRef calcArrayValue(node *x);
+    // 计算数组表达式中的数值子树，收集数组作为逐元素计算的参数
+    void prepareArray(node *x, std::vector<node *> &leaves);
+    // 数组的归约
+    double calcReduction(node *x);
+    // 精确模式计算子树，slots 为内置函数绑定变量的值
+    ExactNumber calcExactValue(node *x, std::vector<ExactNumber> &slots);
+    ExactNumber calcExactBuiltin(node *x, std::vector<ExactNumber> &slots);
 
     // token序列,中缀表达式构建语法分析树
     node *buildTreeInfix(int &token_index);
+    // 内置的多参数函数 integrate(f,x,a,b)
+    node *buildBuiltin(int &token_index);
+    // 条件表达式 if(c,a,b)
+    node *buildConditional(int &token_index);
+    // 数组字面量 [a,b,c]
+    node *buildArray(int &token_index);
+    // 数组的归约 sum(a) dot(a,b)
+    node *buildReduction(int &token_index);
+    std::vector<int> splitArguments(int token_index);
+    node *buildArgument(const std::string &name, const std::vector<int> &starts,
+                        int k);
     void clear(node *&x);
+    // 将表达式树转化为编译表达式的指令
+    void emitProgram(node *x, CompiledExpression &program);
+    // 常量折叠，返回子树是否为常量
+    bool foldConstants(node *x);
+    // 折叠条件表达式的分支，出错时不折叠
+    bool foldBranch(node *x);
+    // 子树是否只用到下标不小于slot的参数和纯函数
+    bool isClosed(node *x, int slot);
+    // 函数是否可以在多个线程中同时调用(没有缓存的纯函数和随机数函数)
+    bool isConcurrent(const std::string &function) const {
+        auto &attributes = lexer_.functions().function_attributes;
+        auto it = attributes.find(function);
+        return it != attributes.end() &&
+               ((it->second.pure && it->second.cache_size == 0) ||
+                it->second.random);
+    }
+    bool isRandom(const std::string &function) const {
+        auto &attributes = lexer_.functions().function_attributes;
+        auto it = attributes.find(function);
+        return it != attributes.end() && it->second.random;
+    }
     // 一元函数的计算
     double calcFunctionValue(node *x, std::string function);
     // 二元函数的计算
@@ -77,6 +279,18 @@ class ExpressionTree {
     Lexer lexer_;
     Reader reader_;
     node *root_;
+    // 下一个内置函数绑定变量的参数下标
+    int slot_count_ = 0;
+    size_t parse_workers_ = 0;
+    ResourceLimits limits_;
+    // explain 和 calcExpression 做常量折叠，profile 不做
+    bool fold_ = true;
+    // 性能分析时每个节点的计时，不分析时为空
+    std::unordered_map<const node *, NodeProfile> *profile_ = nullptr;
+    // 并行分析的工作线程中为 true: 未定义的变量不报错，留到执行时查找
+    bool deferred_ = false;
+    // 不为空时按构建的顺序记录留到执行时查找的变量名(增量计算报告第一个未定义的变量)
+    std::vector<std::string> *deferred_names_ = nullptr;
 };
 }  // namespace calculator
 #endif
\ No newline at end of file
@@ -0,0 +1,298 @@
+#ifndef MYEASYCALCULATOR_FASTMATH_H
+#define MYEASYCALCULATOR_FASTMATH_H
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/*
+ * 快速近似数学函数(sin/cos/tan/exp/log/pow)
+ *
+ * 采用 范围规约 + 多项式逼近 的方法，核心部分不含分支也不调用libm，
+ * 批量版本可以被编译器自动向量化。超出规约范围的输入(很大的角度、
+ * 溢出/下溢、非正数、inf/nan)会回退到libm，所以结果总是有定义的。
+ *
+ * 两种精度(与long double的libm结果比较, 见 Benchmark.cpp):
+ *                        MathMode::Fast    MathMode::Approximate
+ *   sin/cos  |x|<=2^18   <= 3 ULP          相对误差 <= 4e-8
+ *   tan      |x|<=2^18   <= 4 ULP          相对误差 <= 4e-8
+ *   exp      |x|<=708    <= 2 ULP          相对误差 <= 1e-8
+ *   log      正规浮点数    <= 3 ULP          相对误差 <= 3e-9
+ *   pow      x>0         相对误差 <= (2+|y*ln(x)|)*2^-52
+ *                                          相对误差 <= 1e-8+|y|*1e-9
+ * 可以通过 ExpressionTree::setMathMode 选择使用哪一种。
+ *
+ * glibc 的 log/pow 是查表实现(有 FMA 时使用 FMA)，fastLog/fastPow 在
+ * calculator_bench 中比它们慢(log 约 2 倍，pow 约 1.5~2 倍)，所以
+ * setMathMode 只替换 sin/cos/tan/exp，log 和 pow 在各模式下都使用 libm
+ */
+namespace calculator {
+
+// 数学函数的计算方式: 精确(libm)、快速(几个ULP)、近似(约1e-8相对误差)
+enum class MathMode { Precise, Fast, Approximate };
+
+namespace fastmath {
+
+// 双精度和位模式互相转换
+inline double fromBits(uint64_t u) {
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+inline uint64_t toBits(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+// 加上 1.5*2^52 之后, 低位就是四舍五入得到的整数(|x| < 2^51)
+constexpr double kRoundMagic = 6755399441055744.0;
+
+constexpr double kLn2Hi = 6.93147180369123816490e-01;
+constexpr double kLn2Lo = 1.90821492927058770002e-10;
+constexpr double kInvLn2 = 1.44269504088896338700e+00;
+constexpr double kSqrt2 = 1.41421356237309504880e+00;
+
+// pi/2 拆分为三段33位的常数, |k| < 2^20 时 k*kPio2_1 和 k*kPio2_2 都是精确的
+constexpr double kPio2_1 = 1.57079632673412561417e+00;
+constexpr double kPio2_2 = 6.07710050630396597660e-11;
+constexpr double kPio2_3 = 2.02226624871116645580e-21;
+constexpr double kInvPio2 = 6.36619772367581382433e-01;
+
+// 规约范围
+constexpr double kTrigMax = 262144.0;
+constexpr double kExpMax = 708.0;
+
+// |r| <= pi/4 时的 sin(r)/cos(r)
+template <MathMode M>
+inline double sinPoly(double r) {
+    double z = r * r, p;
+    if constexpr (M == MathMode::Approximate) {
+        p = 1.0 / 362880.0;
+    } else {
+        p = -1.0 / 355687428096000.0;
+        p = p * z + 1.0 / 1307674368000.0;
+        p = p * z - 1.0 / 6227020800.0;
+        p = p * z + 1.0 / 39916800.0;
+        p = p * z - 1.0 / 362880.0;
+        p = -p;
+    }
+    p = p * z - 1.0 / 5040.0;
+    p = p * z + 1.0 / 120.0;
+    p = p * z - 1.0 / 6.0;
+    return r + r * z * p;
+}
+template <MathMode M>
+inline double cosPoly(double r) {
+    double z = r * r, p;
+    if constexpr (M == MathMode::Approximate) {
+        p = 1.0 / 40320.0;
+    } else {
+        p = 1.0 / 20922789888000.0;
+        p = p * z - 1.0 / 87178291200.0;
+        p = p * z + 1.0 / 479001600.0;
+        p = p * z - 1.0 / 3628800.0;
+        p = p * z + 1.0 / 40320.0;
+    }
+    p = p * z - 1.0 / 720.0;
+    p = p * z + 1.0 / 24.0;
+    return 1.0 - 0.5 * z + z * z * p;
+}
+
+// 将x规约为 r = x - k*pi/2, 返回r, 象限保存在quadrant中
+inline double reducePio2(double x, uint64_t& quadrant) {
+    double kd = x * kInvPio2 + kRoundMagic;
+    quadrant = toBits(kd);
+    kd -= kRoundMagic;
+    double r = x - kd * kPio2_1;
+    r -= kd * kPio2_2;
+    r -= kd * kPio2_3;
+    return r;
+}
+
+// 不检查范围的核心函数，批量计算时使用
+template <MathMode M>
+inline double sinCore(double x) {
+    uint64_t q;
+    double r = reducePio2(x, q);
+    double s = sinPoly<M>(r), c = cosPoly<M>(r);
+    // 奇数象限取cos, 第2/3象限取反
+    uint64_t sel = 0 - (q & 1);
+    uint64_t bits = (toBits(s) & ~sel) | (toBits(c) & sel);
+    return fromBits(bits ^ ((q & 2) << 62));
+}
+template <MathMode M>
+inline double cosCore(double x) {
+    uint64_t q;
+    double r = reducePio2(x, q);
+    double s = sinPoly<M>(r), c = cosPoly<M>(r);
+    uint64_t sel = 0 - (q & 1);
+    uint64_t bits = (toBits(c) & ~sel) | (toBits(s) & sel);
+    // cos在第1/2象限为负
+    return fromBits(bits ^ (((q + 1) & 2) << 62));
+}
+template <MathMode M>
+inline double tanCore(double x) {
+    uint64_t q;
+    double r = reducePio2(x, q);
+    double s = sinPoly<M>(r), c = cosPoly<M>(r);
+    // 奇数象限 tan = -cos/sin
+    uint64_t sel = 0 - (q & 1);
+    double num = fromBits((toBits(s) & ~sel) | (toBits(c) & sel));
+    double den = fromBits((toBits(c) & ~sel) | (toBits(s) & sel));
+    return fromBits(toBits(num / den) ^ ((q & 1) << 63));
+}
+template <MathMode M>
+inline double expCore(double x) {
+    double kd = x * kInvLn2 + kRoundMagic;
+    uint64_t k = toBits(kd);
+    kd -= kRoundMagic;
+    double r = x - kd * kLn2Hi;
+    r -= kd * kLn2Lo;
+    // |r| <= ln2/2 时的泰勒展开, 分别到13阶和7阶
+    double p;
+    if constexpr (M == MathMode::Approximate) {
+        p = 1.0 / 5040.0;
+    } else {
+        p = 1.0 / 6227020800.0;
+        p = p * r + 1.0 / 479001600.0;
+        p = p * r + 1.0 / 39916800.0;
+        p = p * r + 1.0 / 3628800.0;
+        p = p * r + 1.0 / 362880.0;
+        p = p * r + 1.0 / 40320.0;
+        p = p * r + 1.0 / 5040.0;
+    }
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = 1.0 + r + r * r * p;
+    // 乘以 2^k
+    return p * fromBits((k + 1023) << 52);
+}
+template <MathMode M>
+inline double logCore(double x) {
+    uint64_t bits = toBits(x);
+    // 指数部分, 同样借助 2^52 转换为浮点数
+    double e = fromBits((bits >> 52) | 0x4330000000000000ULL) -
+               (4503599627370496.0 + 1023.0);
+    // 尾数 m 属于 [1,2), 如果大于sqrt2则折半使得 m 属于 [sqrt2/2,sqrt2)
+    double m =
+        fromBits((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    double adjust = m > kSqrt2 ? 1.0 : 0.0;
+    m *= 1.0 - 0.5 * adjust;
+    e += adjust;
+    // log(m) = 2*atanh(f), f = (m-1)/(m+1)
+    double f = (m - 1.0) / (m + 1.0);
+    double s = f * f, p;
+    if constexpr (M == MathMode::Approximate) {
+        p = 1.0 / 9.0;
+    } else {
+        p = 1.0 / 21.0;
+        p = p * s + 1.0 / 19.0;
+        p = p * s + 1.0 / 17.0;
+        p = p * s + 1.0 / 15.0;
+        p = p * s + 1.0 / 13.0;
+        p = p * s + 1.0 / 11.0;
+        p = p * s + 1.0 / 9.0;
+    }
+    p = p * s + 1.0 / 7.0;
+    p = p * s + 1.0 / 5.0;
+    p = p * s + 1.0 / 3.0;
+    double lm = 2.0 * f + 2.0 * f * s * p;
+    return e * kLn2Hi + (lm + e * kLn2Lo);
+}
+
+inline bool inTrigRange(double x) { return std::fabs(x) <= kTrigMax; }
+inline bool inExpRange(double x) { return std::fabs(x) <= kExpMax; }
+inline bool inLogRange(double x) {
+    return x >= 2.2250738585072014e-308 && x <= 1.7976931348623157e308;
+}
+
+}  // namespace fastmath
+
+template <MathMode M = MathMode::Fast>
+inline double fastSin(double x) {
+    if (!fastmath::inTrigRange(x)) return std::sin(x);
+    return fastmath::sinCore<M>(x);
+}
+template <MathMode M = MathMode::Fast>
+inline double fastCos(double x) {
+    if (!fastmath::inTrigRange(x)) return std::cos(x);
+    return fastmath::cosCore<M>(x);
+}
+template <MathMode M = MathMode::Fast>
+inline double fastTan(double x) {
+    if (!fastmath::inTrigRange(x)) return std::tan(x);
+    return fastmath::tanCore<M>(x);
+}
+template <MathMode M = MathMode::Fast>
+inline double fastExp(double x) {
+    if (!fastmath::inExpRange(x)) return std::exp(x);
+    return fastmath::expCore<M>(x);
+}
+template <MathMode M = MathMode::Fast>
+inline double fastLog(double x) {
+    if (!fastmath::inLogRange(x)) return std::log(x);
+    return fastmath::logCore<M>(x);
+}
+template <MathMode M = MathMode::Fast>
+inline double fastPow(double x, double y) {
+    // 负数底数、0、inf、nan 的各种特殊情况交给libm
+    if (!fastmath::inLogRange(x)) return std::pow(x, y);
+    return fastExp<M>(y * fastmath::logCore<M>(x));
+}
+
+/*
+ * 批量版本: 先对所有元素执行无分支的核心计算(可自动向量化),
+ * 然后再单独修正少数超出范围的元素。
+ * 注意GCC只有在 -fno-trapping-math 时才会向量化其中的比较运算
+ */
+#define CALCULATOR_FASTMATH_BATCH(NAME, CORE, IN_RANGE, FALLBACK, CLAMP)   \
+    template <MathMode M = MathMode::Fast>                                \
+    inline void NAME(const double* __restrict in, double* __restrict out, \
+                     size_t n) {                                          \
+        for (size_t i = 0; i < n; i++) {                                  \
+            double x = in[i];                                             \
+            out[i] = fastmath::CORE<M>(IN_RANGE(x) ? x : CLAMP);          \
+        }                                                                 \
+        for (size_t i = 0; i < n; i++)                                    \
+            if (!IN_RANGE(in[i])) out[i] = FALLBACK(in[i]);               \
+    }
+
+CALCULATOR_FASTMATH_BATCH(fastSin, sinCore, fastmath::inTrigRange, std::sin, 0.0)
+CALCULATOR_FASTMATH_BATCH(fastCos, cosCore, fastmath::inTrigRange, std::cos, 0.0)
+CALCULATOR_FASTMATH_BATCH(fastTan, tanCore, fastmath::inTrigRange, std::tan, 0.0)
+CALCULATOR_FASTMATH_BATCH(fastExp, expCore, fastmath::inExpRange, std::exp, 0.0)
+CALCULATOR_FASTMATH_BATCH(fastLog, logCore, fastmath::inLogRange, std::log, 1.0)
+
+#undef CALCULATOR_FASTMATH_BATCH
+
+template <MathMode M = MathMode::Fast>
+inline void fastPow(const double* __restrict x, const double* __restrict y,
+                    double* __restrict out, size_t n) {
+    // 按块计算，保留每个元素的 y*log(x) 供修正时使用，log 只计算一次
+    constexpr size_t kBlock = 256;
+    double t[kBlock];
+    for (size_t begin = 0; begin < n; begin += kBlock) {
+        size_t m = n - begin < kBlock ? n - begin : kBlock;
+        const double* xb = x + begin;
+        const double* yb = y + begin;
+        double* ob = out + begin;
+        for (size_t i = 0; i < m; i++) {
+            double b = fastmath::inLogRange(xb[i]) ? xb[i] : 1.0;
+            t[i] = yb[i] * fastmath::logCore<M>(b);
+            ob[i] = fastmath::expCore<M>(fastmath::inExpRange(t[i]) ? t[i]
+                                                                    : 0.0);
+        }
+        for (size_t i = 0; i < m; i++) {
+            if (!fastmath::inLogRange(xb[i]))
+                ob[i] = std::pow(xb[i], yb[i]);
+            else if (!fastmath::inExpRange(t[i]))
+                ob[i] = std::exp(t[i]);
+        }
+    }
+}
+
+}  // namespace calculator
+#endif
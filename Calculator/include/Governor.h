@@ -0,0 +1,118 @@
+#ifndef MYEASYCALCULATOR_GOVERNOR_H
+#define MYEASYCALCULATOR_GOVERNOR_H
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
+#include "Exception.h"
+
+namespace calculator {
+
+// 一次计算(calcExpression/calcArray/compile)可以使用的资源，0 表示不限制
+struct ResourceLimits {
+    // 词法分析产生的 token 数
+    size_t max_tokens = 0;
+    // 语法树的节点数(脚本中所有语句的总和)
+    size_t max_nodes = 0;
+    // 括号、函数调用和数组的嵌套深度，以及语法树的深度
+    size_t max_depth = 0;
+    // 计算的步数: 语法树的每个节点计算一次是一步，数组的每个元素是一步
+    size_t max_steps = 0;
+    // 内置函数 sum/prod 的总项数
+    size_t max_iterations = 0;
+    // 计算时间的上限(毫秒)
+    size_t time_limit_ms = 0;
+
+    bool enabled() const {
+        return max_tokens || max_nodes || max_depth || max_steps ||
+               max_iterations || time_limit_ms;
+    }
+};
+
+/*
+ * 一次计算的资源计数，超过 ResourceLimits 时抛出 ResourceLimitException:
+ *   词法分析每产生一个 token 检查 token 数和嵌套深度
+ *   语法树在递归计算之前检查节点数和深度(过深的树在递归中会栈溢出)
+ *   表达式树每计算一个节点计一步，每 256 步检查一次时间
+ *   内置函数 sum/prod 在开始前计入项数，批量计算每一块时检查时间
+ * 计算期间用 Scope 设为当前线程的 current()，编译表达式中的内置函数通过它检查。
+ * step/addTree 只在计算的线程中调用，其余的可以在多个线程中同时调用
+ */
+class Governor {
+   public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Governor(const ResourceLimits &limits)
+        : limits_(limits),
+          deadline_(Clock::now() +
+                    std::chrono::milliseconds(limits.time_limit_ms)) {}
+    Governor(const Governor &) = delete;
+    Governor &operator=(const Governor &) = delete;
+
+    const ResourceLimits &limits() const { return limits_; }
+
+    // 词法分析: 已经产生的 token 数和当前的嵌套深度
+    void checkTokens(size_t tokens, size_t depth) const {
+        if (limits_.max_tokens && tokens > limits_.max_tokens)
+            throw ResourceLimitException(Resource::Tokens, limits_.max_tokens);
+        if (limits_.max_depth && depth > limits_.max_depth)
+            throw ResourceLimitException(Resource::Depth, limits_.max_depth);
+        if ((tokens & 1023) == 0) checkDeadline();
+    }
+    // 语法树的节点数和深度
+    void addTree(size_t nodes, size_t depth) {
+        nodes_ += nodes;
+        if (limits_.max_nodes && nodes_ > limits_.max_nodes)
+            throw ResourceLimitException(Resource::Nodes, limits_.max_nodes);
+        if (limits_.max_depth && depth > limits_.max_depth)
+            throw ResourceLimitException(Resource::Depth, limits_.max_depth);
+    }
+    void step(size_t steps = 1) {
+        steps_ += steps;
+        if (limits_.max_steps && steps_ > limits_.max_steps)
+            throw ResourceLimitException(Resource::Steps, limits_.max_steps);
+        if ((++ticks_ & 255) == 0) checkDeadline();
+    }
+    void addIterations(size_t iterations) {
+        size_t total = iterations_ += iterations;
+        if (limits_.max_iterations && total > limits_.max_iterations)
+            throw ResourceLimitException(Resource::Iterations,
+                                         limits_.max_iterations);
+        checkDeadline();
+    }
+    void checkDeadline() const {
+        if (limits_.time_limit_ms && Clock::now() > deadline_)
+            throw ResourceLimitException(Resource::Time, limits_.time_limit_ms);
+    }
+
+    // 当前线程正在进行的计算的资源计数，没有限制时为空
+    static Governor *current() { return currentSlot(); }
+
+    // 在生存期内把 governor 设为当前线程的 current()，嵌套时结束后恢复外层的
+    class Scope {
+       public:
+        explicit Scope(Governor *governor) : outer_(currentSlot()) {
+            currentSlot() = governor;
+        }
+        ~Scope() { currentSlot() = outer_; }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+       private:
+        Governor *outer_;
+    };
+
+   private:
+    static Governor *&currentSlot() {
+        static thread_local Governor *current = nullptr;
+        return current;
+    }
+
+    ResourceLimits limits_;
+    Clock::time_point deadline_;
+    size_t nodes_ = 0, steps_ = 0, ticks_ = 0;
+    std::atomic<size_t> iterations_{0};
+};
+
+}  // namespace calculator
+#endif
@@ -0,0 +1,75 @@
+#ifndef MYEASYCALCULATOR_HISTOGRAM_H
+#define MYEASYCALCULATOR_HISTOGRAM_H
+#include <atomic>
+#include <cstdint>
+
+namespace calculator {
+
+/*
+ * 延迟直方图(纳秒): 小于16的值每个值一个桶，更大的值按2的幂分段，
+ * 每段再线性分为16个桶，所以分位数的相对误差不超过 1/16。
+ * 记录是无锁的，可以在多个线程中同时调用 record
+ */
+class LatencyHistogram {
+   public:
+    static constexpr int kSubBuckets = 16;
+    static constexpr int kBuckets = kSubBuckets + 60 * kSubBuckets;
+
+    LatencyHistogram() { reset(); }
+
+    void record(uint64_t ns) {
+        counts_[index(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (ns > max && !max_.compare_exchange_weak(
+                               max, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    // 第 p(0~1) 分位数，返回所在桶的上界(不超过最大值)
+    uint64_t percentile(double p) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t target = (uint64_t)(p * total + 0.5);
+        if (target < 1) target = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= target) {
+                uint64_t upper = upperBound(i);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+    void reset() {
+        for (auto &count : counts_) count.store(0, std::memory_order_relaxed);
+        count_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+   private:
+    static int index(uint64_t ns) {
+        if (ns < (uint64_t)kSubBuckets) return (int)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        int shift = msb - 4;
+        return kSubBuckets + shift * kSubBuckets +
+               (int)((ns >> shift) - kSubBuckets);
+    }
+    static uint64_t upperBound(int i) {
+        if (i < kSubBuckets) return (uint64_t)i;
+        int shift = (i - kSubBuckets) / kSubBuckets;
+        uint64_t sub = (uint64_t)((i - kSubBuckets) % kSubBuckets);
+        return ((kSubBuckets + sub + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> counts_[kBuckets];
+    std::atomic<uint64_t> count_, max_;
+};
+
+}  // namespace calculator
+#endif
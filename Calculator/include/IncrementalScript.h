@@ -0,0 +1,138 @@
+#ifndef MYEASYCALCULATOR_INCREMENTALSCRIPT_H
+#define MYEASYCALCULATOR_INCREMENTALSCRIPT_H
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Environment.h"
+#include "Token.h"
+
+namespace calculator {
+
+class ExpressionTree;
+struct node;
+
+// 最近一次 evaluate 的统计
+struct IncrementalStats {
+    // 语句数(按顶层的 ; 切分)
+    size_t statements = 0;
+    // 重新做词法分析的语句数和重新构建语法树的语句数
+    size_t relexed = 0;
+    size_t rebuilt = 0;
+    // 重新计算的语句数，和沿用上一次的值的语句数
+    size_t evaluated = 0;
+    size_t reused = 0;
+    // 不能按语句计算，整体计算了脚本
+    bool full = false;
+};
+
+/*
+ * 增量计算的脚本: 编辑器在每次按键后重新计算以 ; 分隔的长脚本。
+ * 脚本在顶层的 ; 处切分为语句，edit 只重新切分编辑位置所在的语句；计算时
+ * 只对文本变化的语句重新做词法分析和构建语法树(与并行分析相同，脚本中赋值的
+ * 变量留到执行时查找，见 ExpressionTree::parseScript)，其他语句沿用上一次的
+ * 语法树。和整体计算一样，第一条表达式语句之后的语句只做词法分析。
+ * 只重新计算文本变化的语句，以及用到的变量的值变化的语句；值没有变化时不会
+ * 引起用到它的语句重新计算。调用非纯函数(比如 rand())的语句每次都重新计算。
+ *
+ * 脚本在创建时的会话变量快照上执行，脚本中赋值的变量不写回会话。结果和错误与
+ * 在快照上对整个脚本 calcExpression 相同; 不能按语句计算的写法(重复赋值、
+ * 表达式中的赋值、括号不匹配或者括号中有 ;)和计算出错的脚本整体计算。
+ * 函数注册表发布新版本后(比如定义了新的函数)全部语句重新分析
+ */
+class IncrementalScript {
+   public:
+    // 使用会话的变量快照、函数注册表和资源限制
+    explicit IncrementalScript(const ExpressionTree &session,
+                               const std::string &text = "");
+    ~IncrementalScript();
+    IncrementalScript(const IncrementalScript &) = delete;
+    IncrementalScript &operator=(const IncrementalScript &) = delete;
+
+    // 编辑: 从 offset 开始删除 removed 个字符，再插入 inserted
+    void edit(size_t offset, size_t removed, const std::string &inserted);
+    void setText(const std::string &text) { edit(0, text_.size(), text); }
+    const std::string &text() const { return text_; }
+
+    // 计算脚本的值，同 calcExpression
+    double evaluate();
+    const IncrementalStats &stats() const { return stats_; }
+
+   private:
+    struct Segment {
+        // 语句的文本，除了最后一条都以 ; 结尾
+        std::string text;
+        // 括号不匹配或者括号中有 ;，不能切分为语句
+        bool raw = false;
+        // 词法分析的结果和错误(在计算任何语句之前抛出)，构建语法树后释放 token
+        bool lexed = false;
+        std::exception_ptr lex_error;
+        std::vector<std::shared_ptr<Token>> tokens;
+        size_t token_count = 0;
+        // 没有 token(比如只有空白)
+        bool empty = false;
+        bool built = false;
+        // 不能按语句分析(同 parseStatements 返回 false)
+        bool supported = true;
+        // 语法分析的错误，执行到这条语句时抛出
+        std::exception_ptr error;
+        // 赋值的变量名，表达式语句为空
+        std::string variable;
+        // 已经登记为 variable 的赋值语句
+        bool writer = false;
+        // 值的语法树，其中留到执行时查找的变量节点为 references，
+        // 计算前替换为变量的值。值只有一个变量名时 single 为 true(错误不同)
+        node *value = nullptr;
+        std::vector<node *> references;
+        bool single = false;
+        // 用到的脚本中的变量名(不重复，按 token 的顺序)
+        std::vector<std::string> names;
+        // 调用了非纯函数，每次都重新计算
+        bool impure = false;
+
+        // 在脚本中的位置，计算前更新
+        size_t index = 0;
+        // 需要重新计算
+        bool pending = true;
+        // 上一次计算的值
+        bool computed = false;
+        double result = 0;
+        ArrayRef array;
+    };
+
+    void lex(Segment &segment);
+    // 构建语法树，登记语句赋值和用到的变量
+    void build(Segment &segment);
+    // 释放语法树，解除登记，回到没有分析的状态
+    void release(Segment &segment);
+    // 第一个在这条语句之前没有赋值的变量名，都有赋值时为 nullptr
+    const std::string *undefinedName(const Segment &segment) const;
+    // 计算一条语句，返回值是否变化
+    bool compute(Segment &segment);
+    // 变量的定义变化，用到它的语句都要重新计算
+    void invalidate(const std::string &variable);
+    // 在快照上对整个脚本 calcExpression
+    double evaluateFull();
+
+    std::unique_ptr<ExpressionTree> tree_;
+    Environment base_;
+    std::string text_;
+    std::vector<std::unique_ptr<Segment>> segments_;
+    // 变量名 -> 赋值的语句 / 用到它的语句
+    std::unordered_map<std::string, std::vector<Segment *>> writers_,
+        readers_;
+    // 有多条语句赋值的变量
+    std::unordered_set<std::string> duplicated_;
+    // 不能切分的语句数、有词法错误的语句数和全部语句的 token 数
+    size_t raw_ = 0, lex_errors_ = 0, tokens_ = 0;
+    uint64_t registry_version_ = 0;
+    IncrementalStats stats_;
+};
+
+}  // namespace calculator
+#endif
@@ -2,84 +2,114 @@
 #define MYEASYCALCULATOR_LEXER_H
 #include <cmath>
 #include <memory>
+#include <optional>
 #include <stack>
 
+#include "Environment.h"
 #include "Exception.h"
+#include "Registry.h"
 #include "Token.h"
 
 namespace calculator {
 
-using UnaryFunctionType = std::function<double(double)>;
-using BinaryFunctionType = std::function<double(double, double)>;
-
 // 词法分析器,将输入的表达式转化成token序列
 class Lexer {
    public:
-    // 常量表
-    std::unordered_map<std::string, double> constant;
-    // 变量表
-    std::unordered_map<std::string, std::shared_ptr<Token>> variable;
-    // 一元函数
-    std::unordered_map<std::string, UnaryFunctionType> unary_functions = {
-        {"sqrt", __xsqrt},
-        {"ceil", __xceil},
-        {"cos", __xcos},
-        {"sin", __xsin},
-        {"tan", __xtan},
-        {"log", __xlog},
-        {"floor", __xfloor},
-        {"acos", __xacos},
-        {"asin", __xasin},
-        {"atan", __xatan},
-        {"exp", __xexp},
-        {"log2", __xlog2},
-        {"log10", __xlog10},
-        {"erf", __xerf},
-        {"round", __xround},
-        {"factorial", [](double x) {
-             int v = 1;
-             for (int i = 1; i <= x; i++) v *= i;
-             return v;
-         }}};
-    // 二元函数
-    std::unordered_map<std::string, BinaryFunctionType> binary_functions = {
-        {"pow", __xpow},
-        {"max", [](double x, double y) { return x > y ? x : y; }},
-        {"min", [](double x, double y) { return x < y ? x : y; }}};
+    // 常量和变量: 共享的内置常量 + 会话中定义的变量
+    Environment environment;
+    // 函数和全局常量的注册表，多个会话可以共享一个
+    std::shared_ptr<Registry> registry;
+    // 编译表达式的参数, 参数名->下标
+    std::unordered_map<std::string, int> parameters;
 
    public:
+    // 新建自己的函数注册表
     Lexer();
-    explicit Lexer(const std::string& text) : reader_(text) { Lexer(); }
+    // 使用已有的函数注册表，不再构造默认的函数表
+    explicit Lexer(std::shared_ptr<Registry> shared);
+    explicit Lexer(const std::string& text) : Lexer() {
+        reader_.set_buffer(text);
+    }
 
     void scan();
 
+    // 当前固定使用的函数表版本，只能在 FunctionPin 的生存期内调用
+    const FunctionTable& functions() const { return *functions_; }
+    // 使用另一个分析器固定的函数表版本(并行分析的工作线程)，
+    // 只能在 pinned 的 FunctionPin 生存期内使用
+    void shareFunctions(const Lexer& pinned) { functions_ = pinned.functions_; }
+    // 查找变量/常量: 会话中定义的变量 > 注册表中的全局常量 > 内置常量
+    std::optional<double> lookupConstant(const std::string& name) {
+        return environment.find(name, &functions_->constants);
+    }
+
     // 是否是一元函数
-    bool isUnaryFunction(const std::string& func) {
-        return (unary_functions.find(func) != unary_functions.end());
+    bool isUnaryFunction(const std::string& func) const {
+        return functions_->unary_functions.count(func) != 0;
     }
     // 是否是二元函数
-    bool isBinaryFunction(const std::string& func) {
-        return (binary_functions.find(func) != binary_functions.end());
+    bool isBinaryFunction(const std::string& func) const {
+        return functions_->binary_functions.count(func) != 0;
+    }
+    // 是否是内置的多参数函数
+    bool isBuiltinForm(const std::string& func) const {
+        return functions_->builtin_forms.count(func) != 0;
+    }
+    // 下一个函数调用是否是数组的归约: 参数个数与归约相同，并且没有同名的
+    // 一元/二元函数(自定义的同名函数优先)
+    bool isReduction(const std::string& func) const;
+    // 是否是编译表达式的参数或者内置函数的绑定变量
+    bool isParameter(const std::string& id) const {
+        if (parameters.find(id) != parameters.end()) return true;
+        for (auto& bound : bound_names_)
+            if (bound.second == id) return true;
+        return false;
+    }
+    // 开始分析新的表达式前清除上一次分析残留的状态(比如出错时未匹配的括号)
+    void reset() {
+        while (!bracket_match_.empty()) bracket_match_.pop();
+        bound_names_.clear();
+        array_depth_ = 0;
+        is_function_ = false;
+        lookforward_ = 0;
+    }
+    // 是否是纯函数(可以常量折叠)
+    bool isPureFunction(const std::string& func) const {
+        auto it = functions_->function_attributes.find(func);
+        return it != functions_->function_attributes.end() && it->second.pure;
     }
-    // 保存变量名
-    void putWord(const std::string& id) {
-        if (variable.find(id) == variable.end())
-            variable[id] = std::shared_ptr<Token>(new Word(id));
+    // 记忆化缓存的统计信息, 没有缓存的函数返回空的统计
+    FunctionStats functionStats(const std::string& func) const {
+        auto& unary = functions_->unary_caches;
+        auto& binary = functions_->binary_caches;
+        if (auto it = unary.find(func); it != unary.end())
+            return it->second->stats();
+        if (auto it = binary.find(func); it != binary.end())
+            return it->second->stats();
+        return FunctionStats();
     }
-    // 原始的常量名+用户定义的变量名
+    // 用户定义的变量
     void putConstant(const std::string& key, double value) {
-        constant[key] = value;
-        putWord(key);
+        environment.assign(key, value);
     }
 
     Reader& reader() { return reader_; }
     std::vector<std::shared_ptr<Token>>& tokenList() { return tokenlist_; }
     std::stack<bool>& bm() { return bracket_match_; }
+    // 当前未闭合的括号和数组的层数
+    size_t depth() const { return bracket_match_.size() + array_depth_; }
 
    private:
+    friend class FunctionPin;
+    // 向前查找内置函数的第index个参数(绑定变量名)
+    std::string lookupArgument(int index) const;
+    // 向前数出函数调用的参数个数
+    int countArguments() const;
+
     int line_;
     char lookforward_;
     bool is_function_;
+    const FunctionTable* functions_ = nullptr;
 
     Reader reader_;
     // token列表
@@ -87,6 +117,30 @@ class Lexer {
     // 用于识别函数的声明定义左右括号的位置
     // 同时还可以检测表达式中括号是否匹配(栈不为空)
     std::stack<bool> bracket_match_;
+    // 内置函数的绑定变量: (函数括号的深度, 变量名)，在函数的右括号处解除绑定
+    std::vector<std::pair<size_t, std::string>> bound_names_;
+    // 未闭合的数组字面量 [ 的个数
+    size_t array_depth_ = 0;
+};
+
+// 在生存期内固定使用注册表的当前版本: 一个表达式的分析和计算都使用同一个版本，
+// 期间发布的新版本从下一个表达式开始生效。嵌套时沿用最外层的版本
+class FunctionPin {
+   public:
+    explicit FunctionPin(Lexer& lexer)
+        : lexer_(lexer), guard_(*lexer.registry), outer_(!lexer.functions_) {
+        if (outer_) lexer.functions_ = guard_.get();
+    }
+    ~FunctionPin() {
+        if (outer_) lexer_.functions_ = nullptr;
+    }
+    FunctionPin(const FunctionPin&) = delete;
+    FunctionPin& operator=(const FunctionPin&) = delete;
+
+   private:
+    Lexer& lexer_;
+    Registry::ReadGuard guard_;
+    bool outer_;
 };
 }  // namespace calculator
 #endif
\ No newline at end of file
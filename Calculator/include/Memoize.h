@@ -0,0 +1,102 @@
+#ifndef MYEASYCALCULATOR_MEMOIZE_H
+#define MYEASYCALCULATOR_MEMOIZE_H
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace calculator {
+
+// 函数的属性
+struct FunctionAttribute {
+    // 纯函数: 相同的参数总是得到相同的结果，并且没有副作用，可以常量折叠
+    bool pure = false;
+    // 记忆化缓存的条目数, 0表示不缓存。只对纯函数有效
+    size_t cache_size = 0;
+    // 随机数函数(rand/uniform/normal): 不是纯函数，但只使用当前线程的随机数流，
+    // 可以在多个线程中同时调用
+    bool random = false;
+};
+
+// 记忆化缓存的统计信息
+struct FunctionStats {
+    // 调用次数
+    size_t calls = 0;
+    // 命中缓存的次数
+    size_t hits = 0;
+    // 缓存中已使用的条目数和总条目数
+    size_t entries = 0;
+    size_t capacity = 0;
+
+    double hitRate() const { return calls ? (double)hits / calls : 0.0; }
+};
+
+// 以参数的二进制位作为键的定长缓存(直接映射，冲突时覆盖旧的条目)。
+// 共享函数注册表的多个会话可能同时调用，查找和写入时加锁(计算时不加锁)
+template <size_t Arity>
+class MemoCache {
+   public:
+    explicit MemoCache(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        slots_.resize(n);
+        mask_ = n - 1;
+        stats_.capacity = n;
+    }
+
+    template <class F>
+    double get(const double (&args)[Arity], F&& compute) {
+        uint64_t key[Arity];
+        memcpy(key, args, sizeof(key));
+        Slot& slot = slots_[hash(key) & mask_];
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.calls++;
+            if (slot.used && memcmp(slot.key, key, sizeof(key)) == 0) {
+                stats_.hits++;
+                return slot.value;
+            }
+        }
+        double value = compute();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!slot.used) stats_.entries++;
+        memcpy(slot.key, key, sizeof(key));
+        slot.value = value;
+        slot.used = true;
+        return value;
+    }
+
+    FunctionStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+   private:
+    struct Slot {
+        uint64_t key[Arity];
+        double value;
+        bool used = false;
+    };
+
+    // splitmix64 的混合函数
+    static uint64_t hash(const uint64_t (&key)[Arity]) {
+        uint64_t h = 0x9e3779b97f4a7c15ULL;
+        for (size_t i = 0; i < Arity; i++) {
+            h ^= key[i] + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+            h ^= h >> 30;
+            h *= 0xbf58476d1ce4e5b9ULL;
+            h ^= h >> 27;
+            h *= 0x94d049bb133111ebULL;
+            h ^= h >> 31;
+        }
+        return h;
+    }
+
+    std::vector<Slot> slots_;
+    size_t mask_;
+    FunctionStats stats_;
+    mutable std::mutex mutex_;
+};
+
+}  // namespace calculator
+#endif
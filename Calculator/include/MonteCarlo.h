@@ -0,0 +1,32 @@
+#ifndef MYEASYCALCULATOR_MONTECARLO_H
+#define MYEASYCALCULATOR_MONTECARLO_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "CompiledExpression.h"
+#include "Numeric.h"
+
+namespace calculator {
+
+struct MonteCarloOptions {
+    uint64_t seed = 0;
+    // 置信区间的置信水平
+    double confidence = 0.95;
+};
+
+/*
+ * 蒙特卡罗估计: 计算 program 的 samples 个样本，返回均值、方差和置信区间。
+ * 第i个样本在种子为 seed、流号为 i 的随机数流上计算(见 RandomStream)，
+ * 样本的值只取决于种子和i，统计量按固定的块合并(见 numeric::sample)，
+ * 所以结果与线程数无关。args 为所有样本相同的参数。
+ * program.concurrent() 时在多个线程中计算，线程数见 numeric::setMaxThreads
+ */
+SampleStats monteCarlo(const CompiledExpression &program, const double *args,
+                       size_t samples, const MonteCarloOptions &options = {});
+SampleStats monteCarlo(const CompiledExpression &program,
+                       const std::vector<double> &args, size_t samples,
+                       const MonteCarloOptions &options = {});
+
+}  // namespace calculator
+#endif
@@ -0,0 +1,95 @@
+#ifndef MYEASYCALCULATOR_NUMERIC_H
+#define MYEASYCALCULATOR_NUMERIC_H
+#include <cstddef>
+#include <functional>
+
+namespace calculator {
+
+// 批量计算函数值: y[i] = f(x[i]), 0 <= i < n
+using BatchEvaluator = std::function<void(const double *, double *, size_t)>;
+using ScalarEvaluator = std::function<double(double)>;
+// 批量计算样本: y[i] 为第 first+i 个样本的值, 0 <= i < n
+using SampleEvaluator = std::function<void(size_t first, double *, size_t n)>;
+
+// 样本的统计量
+struct SampleStats {
+    size_t count = 0;
+    double mean = 0;
+    // 样本方差(除以 n-1)
+    double variance = 0;
+    // 均值的标准误差 sqrt(variance/n)
+    double std_error = 0;
+    // 均值的置信区间(正态近似)
+    double confidence = 0, lower = 0, upper = 0;
+};
+
+namespace numeric {
+
+// 积分的容差: |误差估计| <= max(kAbsTolerance, kRelTolerance * |积分值|)
+constexpr double kAbsTolerance = 1e-12;
+constexpr double kRelTolerance = 1e-10;
+// 积分最多细分的区间数，达到后返回当前的估计值
+constexpr size_t kMaxIntervals = 500;
+
+/*
+ * 自适应 Gauss-Kronrod(G7/K15) 积分: 每次细分误差最大的区间，
+ * 两个子区间的 30 个采样点通过 f 一次批量计算。
+ * a > b 时返回 -∫[b,a]，积分限必须是有限值
+ */
+double integrate(const BatchEvaluator &f, double a, double b);
+
+/*
+ * 在 x0 附近求 f(x)=0 的根: 先用牛顿法(df 为 f 的导数)，
+ * 不收敛时从 x0 向两侧扩大区间寻找变号点，再用 Brent 方法。找不到时抛出异常
+ */
+double solve(const ScalarEvaluator &f, const ScalarEvaluator &df, double x0);
+
+/*
+ * Brent 方法(黄金分割 + 抛物线插值)求 [a,b] 内 f 的极小值点，
+ * 区间端点的函数值更小时返回端点
+ */
+double minimize(const ScalarEvaluator &f, double a, double b);
+
+// 求和/求积时固定的块大小: 块的划分只取决于项数，与线程数无关
+constexpr size_t kBlockTerms = 4096;
+// 项数达到这个值时才使用多线程
+constexpr size_t kParallelMinTerms = 1 << 16;
+
+// lo, lo+1, ... 不超过 hi 的项数，hi < lo 时为0。
+// 上下限不是有限值或项数超过 2^53 时抛出异常，function 为报错的函数名
+size_t termCount(const char *function, double lo, double hi);
+
+// 设置求和/求积使用的最大线程数，0表示使用全部的硬件线程
+void setMaxThreads(size_t threads);
+size_t maxThreads();
+
+/*
+ * Σ f(i), i = lo, lo+1, ..., hi(不超过hi), hi < lo 时为0。
+ * 每块内按位置分别做 Kahan 补偿求和，块的结果再按顺序补偿累加，
+ * 所以结果与线程数无关。parallel 为 false 时只在当前线程计算(f 不是线程安全的)
+ */
+double sum(const BatchEvaluator &f, double lo, double hi, bool parallel);
+// ∏ f(i), 用 double-double 累乘, hi < lo 时为1
+double product(const BatchEvaluator &f, double lo, double hi, bool parallel);
+
+// 采样时固定的块大小，每个样本的计算量较大，块比求和的小
+constexpr size_t kBlockSamples = 1024;
+
+/*
+ * count 个样本的均值、方差和置信水平为 confidence 的置信区间。
+ * 块内两遍计算均值和离差平方和，块的结果再按顺序合并(Chan 等的公式)，
+ * 所以结果与线程数无关。parallel 为 false 时只在当前线程计算
+ */
+SampleStats sample(const SampleEvaluator &f, size_t count, double confidence,
+                   bool parallel);
+// 标准正态分布的分位数, 0 < p < 1
+double normalQuantile(double p);
+
+// 数组元素的和，与 sum 一样按位置分别做补偿求和
+double sumArray(const double *x, size_t n);
+// 内积 Σ x[i]*y[i]，乘积的舍入误差也参与补偿求和
+double dot(const double *x, const double *y, size_t n);
+
+}  // namespace numeric
+}  // namespace calculator
+#endif
@@ -0,0 +1,85 @@
+#ifndef MYEASYCALCULATOR_PIPELINE_H
+#define MYEASYCALCULATOR_PIPELINE_H
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ExpressionTree.h"
+#include "Workspace.h"
+
+namespace calculator {
+
+struct PipelineOptions {
+    // 输入的 CSV 文件，第一行是列名
+    std::string input;
+    // 输出文件，为空时输出到标准输出
+    std::string output;
+    // 追加的列: 列名和公式，公式中用列名表示这一行的值
+    std::vector<std::pair<std::string, std::string>> formulas;
+    // 解析和计算的线程数，0 表示使用全部的硬件线程
+    size_t workers = 0;
+    // 每块的大致字节数(在行尾切分)，块是并行处理的单位
+    size_t chunk_bytes = 1 << 20;
+};
+
+struct PipelineStats {
+    size_t rows = 0;
+    size_t bytes = 0;
+    double seconds = 0;
+};
+
+/*
+ * CSV 流水线(calculator --csv): 对每一行计算一组公式，结果作为新的列追加在行尾。
+ *   输入文件用 mmap 映射，按块分给工作线程
+ *   工作线程: 只解析公式用到的列(字段解析不分配内存，空字段和非数值为 nan)，
+ *            所有公式合并为一个 Workspace(公共子表达式只算一次)对整块的列
+ *            批量计算，再把原来的行和结果写入这一块的输出缓冲区
+ *   调用 run 的线程按块的顺序写出
+ * 不同的块的解析、计算和写出同时进行，同时在处理的块数有上限(内存有界)。
+ * 公式中有非纯函数时只用一个工作线程
+ */
+class CsvPipeline {
+   public:
+    // 映射输入文件，读取列名并编译公式，公式用到的函数来自 tree
+    CsvPipeline(ExpressionTree &tree, const PipelineOptions &options);
+    ~CsvPipeline();
+    CsvPipeline(const CsvPipeline &) = delete;
+    CsvPipeline &operator=(const CsvPipeline &) = delete;
+
+    // 输入文件的列名
+    const std::vector<std::string> &columns() const { return columns_; }
+    // 处理整个文件，出错时抛出异常(已经写出的部分保留)
+    PipelineStats run();
+
+   private:
+    // 工作线程的缓冲区，处理每一块时复用
+    struct Worker {
+        std::vector<std::pair<const char *, const char *>> lines;
+        // 每行比列名少的字段数
+        std::vector<size_t> missing;
+        std::vector<std::vector<double>> columns;
+        std::vector<std::vector<double>> results;
+        std::string output;
+    };
+
+    // 处理 [begin, end) 中的行，输出写入 worker.output，返回行数
+    size_t process(const char *begin, const char *end, Worker &worker) const;
+    void writeAll(int fd, const std::string &data) const;
+
+    PipelineOptions options_;
+    std::vector<std::string> columns_;
+    // 公式用到的列，没有用到的列不解析
+    std::vector<bool> used_;
+    std::unique_ptr<Workspace> formulas_;
+    size_t workers_;
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    // 列名一行(不含换行)和数据开始的位置
+    std::string header_;
+    size_t body_ = 0;
+};
+
+}  // namespace calculator
+#endif
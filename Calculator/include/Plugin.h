@@ -0,0 +1,93 @@
+#ifndef MYEASYCALCULATOR_PLUGIN_H
+#define MYEASYCALCULATOR_PLUGIN_H
+#include <stddef.h>
+
+/*
+ * 插件(动态库)的接口，插件用 C 接口导出一组一元函数，可以用 C 或 C++ 编写:
+ *
+ *   #include "Calculator/include/Plugin.h"
+ *   static void square(const double *in, double *out, size_t n) {
+ *       for (size_t i = 0; i < n; i++) out[i] = in[i] * in[i];
+ *   }
+ *   static const CalculatorPluginFunction functions[] = {
+ *       {"square", square, NULL, NULL, 1},
+ *   };
+ *   CALCULATOR_DECLARE_PLUGIN(functions)
+ *
+ * 编译: gcc -O2 -shared -fPIC square.c -o square.so
+ */
+#ifdef __cplusplus
+#define CALCULATOR_PLUGIN_EXTERN extern "C"
+extern "C" {
+#else
+#define CALCULATOR_PLUGIN_EXTERN
+#endif
+
+#define CALCULATOR_PLUGIN_ABI 1
+
+typedef struct CalculatorPluginFunction {
+    // 函数名
+    const char *name;
+    // 批量版本 out[i] = f(in[i])，必须提供，编译表达式批量计算时整块调用
+    void (*batch)(const double *in, double *out, size_t n);
+    // 标量版本，可以为空(用批量版本计算一个值)
+    double (*scalar)(double x);
+    // 导数，可以为空(计算梯度时用数值差分)
+    double (*derivative)(double x);
+    // 非0表示纯函数: 可以常量折叠，sum/prod 可以在多个线程中同时调用
+    int pure;
+} CalculatorPluginFunction;
+
+typedef int (*CalculatorPluginAbi)(void);
+typedef const CalculatorPluginFunction *(*CalculatorPluginEntry)(size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define CALCULATOR_DECLARE_PLUGIN(table)                                    \
+    CALCULATOR_PLUGIN_EXTERN int calculator_plugin_abi(void) {              \
+        return CALCULATOR_PLUGIN_ABI;                                       \
+    }                                                                       \
+    CALCULATOR_PLUGIN_EXTERN const CalculatorPluginFunction                 \
+        *calculator_plugin_functions(size_t *count) {                       \
+        *count = sizeof(table) / sizeof(table[0]);                          \
+        return table;                                                       \
+    }
+
+#ifdef __cplusplus
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace calculator {
+
+// 已加载的插件，最后一个引用(注册的函数、编译表达式)释放时才卸载
+class PluginLibrary {
+   public:
+    /*
+     * 加载插件: 先把动态库复制到临时文件再 dlopen，所以同一个路径修改后
+     * 可以再次加载(热更新)，覆盖原文件也不会影响已经加载的版本
+     */
+    static std::shared_ptr<PluginLibrary> load(const std::string &path);
+    ~PluginLibrary();
+    PluginLibrary(const PluginLibrary &) = delete;
+    PluginLibrary &operator=(const PluginLibrary &) = delete;
+
+    const std::string &path() const { return path_; }
+    const std::vector<CalculatorPluginFunction> &functions() const {
+        return functions_;
+    }
+
+   private:
+    PluginLibrary(const std::string &path, void *handle)
+        : path_(path), handle_(handle) {}
+
+    std::string path_;
+    void *handle_;
+    std::vector<CalculatorPluginFunction> functions_;
+};
+
+}  // namespace calculator
+#endif
+#endif
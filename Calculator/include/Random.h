@@ -0,0 +1,62 @@
+#ifndef MYEASYCALCULATOR_RANDOM_H
+#define MYEASYCALCULATOR_RANDOM_H
+#include <array>
+#include <cstdint>
+
+namespace calculator {
+
+// Philox4x32-10 计数器随机数生成器(Salmon 等, "Parallel Random Numbers: As
+// Easy as 1, 2, 3")，128 位计数器经过 10 轮变换得到 4 个 32 位随机数
+struct Philox4x32 {
+    using Counter = std::array<uint32_t, 4>;
+    using Key = std::array<uint32_t, 2>;
+    static Counter generate(Counter counter, Key key);
+};
+
+/*
+ * 随机数流: 密钥为种子，计数器为 (流号, 块序号)，每块得到两个 double。
+ * 第n个随机数只取决于种子、流号和n，重新设置流的代价只是几次赋值。
+ * rand/uniform/normal 使用当前线程的流，线程之间互不影响；
+ * 采样时每个样本使用以样本序号为流号的流(见 MonteCarlo.h)
+ */
+class RandomStream {
+   public:
+    explicit RandomStream(uint64_t seed = 0, uint64_t stream = 0) {
+        reset(seed, stream);
+    }
+
+    void reset(uint64_t seed, uint64_t stream) {
+        seed_ = seed;
+        stream_ = stream;
+        block_ = 0;
+        available_ = 0;
+    }
+    uint64_t seed() const { return seed_; }
+    uint64_t stream() const { return stream_; }
+
+    // [0,1) 上的均匀分布，53 位精度
+    double uniform() {
+        if (available_ == 0) refill();
+        return buffer_[2 - available_--];
+    }
+    // 标准正态分布(Box-Muller)，每次用两个均匀分布的随机数
+    double normal();
+
+    // 当前线程的流: 以全局种子(见 seedRandom)和线程的序号初始化，
+    // 线程的流号与样本的流号不重叠
+    static RandomStream &current();
+
+   private:
+    void refill();
+
+    uint64_t seed_ = 0, stream_ = 0, block_ = 0;
+    double buffer_[2] = {0, 0};
+    int available_ = 0;
+};
+
+// 设置全局种子，所有线程的流在下一次使用时重新初始化。
+// 没有设置时使用启动时的随机种子
+void seedRandom(uint64_t seed);
+
+}  // namespace calculator
+#endif
@@ -73,6 +73,11 @@ class Reader {
         for (int i = 0; i < count; i++) s.append(1, get());
         return s;
     }
+    // 获取任意位置的字符(不移动)
+    char at(int i) const {
+        if (i < 0 || i >= len_) return EOF;
+        return sbuffer_[i];
+    }
     int len() const { return len_; }
     int pos() const { return ptr_; }
     bool eof() const { return ptr_ > len_ - 1; }
@@ -0,0 +1,221 @@
+#ifndef MYEASYCALCULATOR_REGISTRY_H
+#define MYEASYCALCULATOR_REGISTRY_H
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Environment.h"
+#include "FastMath.h"
+#include "Memoize.h"
+#include "utils.h"
+
+namespace calculator {
+
+using UnaryFunctionType = std::function<double(double)>;
+using BinaryFunctionType = std::function<double(double, double)>;
+// 批量计算的一元函数: out[i] = f(in[i])
+using BatchFunctionType = void (*)(const double*, double*, size_t);
+// 异步的一元函数: 发起调用后立即返回，完成时调用 done(值, 错误)。
+// done 可以在其他线程中调用，只能调用一次
+using AsyncDoneType = std::function<void(double, std::exception_ptr)>;
+using AsyncFunctionType = std::function<void(double, AsyncDoneType)>;
+
+// 单精度/扩展精度下的内置函数，编译表达式按 Precision 选用(见 CompiledExpression)
+template <class T>
+struct PrecisionFunctions {
+    std::unordered_map<std::string, T (*)(T)> unary;
+    std::unordered_map<std::string, T (*)(T, T)> binary;
+    // 批量实现 out[i] = f(in[i])
+    std::unordered_map<std::string, void (*)(const T*, T*, size_t)> batch;
+};
+
+// 内置的多参数函数的形式
+struct BuiltinForm {
+    // 参数个数
+    int arity;
+    // 绑定变量是第几个参数，-1表示没有绑定变量
+    int variable;
+    // 函数体(含有绑定变量的表达式)是第几个参数
+    int body;
+};
+
+// 函数表的一个版本: 函数、导数、批量实现、属性和全局常量。发布后只读
+struct FunctionTable {
+    // 一元函数
+    std::unordered_map<std::string, UnaryFunctionType> unary_functions = {
+        {"sqrt", __xsqrt},
+        {"ceil", __xceil},
+        {"cos", __xcos},
+        {"sin", __xsin},
+        {"tan", __xtan},
+        {"log", __xlog},
+        {"floor", __xfloor},
+        {"acos", __xacos},
+        {"asin", __xasin},
+        {"atan", __xatan},
+        {"exp", __xexp},
+        {"log2", __xlog2},
+        {"log10", __xlog10},
+        {"erf", __xerf},
+        {"round", __xround},
+        {"factorial", [](double x) {
+             // 170! 之后溢出为 inf，循环最多 171 次
+             double v = 1;
+             for (int i = 1; i <= x && !std::isinf(v); i++) v *= i;
+             return v;
+         }}};
+    // 二元函数
+    std::unordered_map<std::string, BinaryFunctionType> binary_functions = {
+        {"pow", __xpow},
+        {"max", [](double x, double y) { return x > y ? x : y; }},
+        {"min", [](double x, double y) { return x < y ? x : y; }}};
+    // 一元函数的导数(用于计算梯度)
+    std::unordered_map<std::string, UnaryFunctionType> unary_derivatives = {
+        {"sqrt", [](double x) { return 0.5 / __xsqrt(x); }},
+        {"ceil", [](double) { return 0.0; }},
+        {"cos", [](double x) { return -__xsin(x); }},
+        {"sin", [](double x) { return __xcos(x); }},
+        {"tan",
+         [](double x) {
+             double t = __xtan(x);
+             return 1 + t * t;
+         }},
+        {"log", [](double x) { return 1 / x; }},
+        {"floor", [](double) { return 0.0; }},
+        {"acos", [](double x) { return -1 / __xsqrt(1 - x * x); }},
+        {"asin", [](double x) { return 1 / __xsqrt(1 - x * x); }},
+        {"atan", [](double x) { return 1 / (1 + x * x); }},
+        {"exp", [](double x) { return __xexp(x); }},
+        {"log2", [](double x) { return 1.4426950408889634 / x; }},
+        {"log10", [](double x) { return 0.4342944819032518 / x; }},
+        {"erf", [](double x) { return 1.1283791670955126 * __xexp(-x * x); }},
+        {"round", [](double) { return 0.0; }},
+        {"factorial", [](double) { return 0.0; }}};
+    // 二元函数的偏导数, 分别对x和对y
+    std::unordered_map<std::string,
+                       std::pair<BinaryFunctionType, BinaryFunctionType>>
+        binary_derivatives = {
+            {"pow",
+             {[](double x, double y) { return y * __xpow(x, y - 1); },
+              [](double x, double y) {
+                  return x > 0 ? __xpow(x, y) * __xlog(x) : 0.0;
+              }}},
+            {"max", {[](double x, double y) { return x >= y ? 1.0 : 0.0; },
+                     [](double x, double y) { return x >= y ? 0.0 : 1.0; }}},
+            {"min", {[](double x, double y) { return x <= y ? 1.0 : 0.0; },
+                     [](double x, double y) { return x <= y ? 0.0 : 1.0; }}}};
+    // 可以不带参数调用的一元函数，f() 相当于 f(0)
+    std::unordered_set<std::string> nullary_functions;
+    // 异步函数(见 AsyncEvaluator)，同名的一元函数同步等待它的结果
+    std::unordered_map<std::string, AsyncFunctionType> async_functions;
+    // 一元函数的批量实现(用于编译表达式的批量计算)，没有的函数逐个调用
+    std::unordered_map<std::string, BatchFunctionType> unary_batch_functions;
+    // 内置的多参数函数
+    std::unordered_map<std::string, BuiltinForm> builtin_forms = {
+        {"integrate", {4, 1, 0}},  // integrate(f, x, a, b) 数值积分
+        {"solve", {3, 1, 0}},      // solve(f, x, x0) 在x0附近求f=0的根
+        {"minimize", {4, 1, 0}},   // minimize(f, x, a, b) 求[a,b]内f的极小值点
+        {"sum", {4, 0, 3}},        // sum(i, lo, hi, f) 求和 i=lo,lo+1,...,hi
+        {"prod", {4, 0, 3}},       // prod(i, lo, hi, f) 求积
+        {"if", {3, -1, -1}}};      // if(c, a, b) 条件表达式
+    // 数组的归约函数和参数个数，参数个数不同时是同名的普通函数(比如 max(x,y))
+    std::unordered_map<std::string, int> reductions = {
+        {"sum", 1}, {"mean", 1}, {"min", 1}, {"max", 1}, {"dot", 2}};
+    // 函数属性, 除随机数函数外内置函数都是纯函数
+    std::unordered_map<std::string, FunctionAttribute> function_attributes;
+    // 纯函数的记忆化缓存
+    std::unordered_map<std::string, std::shared_ptr<MemoCache<1>>> unary_caches;
+    std::unordered_map<std::string, std::shared_ptr<MemoCache<2>>>
+        binary_caches;
+    // 内置函数的 float/long double 版本。自定义函数和插件只有 double 版本，
+    // 注册同名函数时删除这里的版本，计算时转换为 double 调用
+    PrecisionFunctions<float> float_functions;
+    PrecisionFunctions<long double> long_double_functions;
+
+    // 全局常量: 所有共享这个注册表的会话可见，会话中定义的同名变量优先
+    Bindings constants;
+    MathMode math_mode = MathMode::Precise;
+
+    // 内置函数都是纯函数(随机数函数除外)，数学函数为精确模式
+    FunctionTable();
+    // 切换内置的 sin/cos/tan/exp/log/pow 的实现
+    void setMathMode(MathMode mode);
+
+    template <class T>
+    const PrecisionFunctions<T>& precisionFunctions() const {
+        if constexpr (std::is_same_v<T, float>)
+            return float_functions;
+        else
+            return long_double_functions;
+    }
+    // 删除函数的 float/long double 版本
+    void erasePrecisionFunctions(const std::string& name);
+
+   private:
+    template <class T>
+    static void fillPrecisionFunctions(PrecisionFunctions<T>& functions);
+    template <MathMode M>
+    void useFastMath();
+};
+
+/*
+ * 函数和常量的注册表，读多写少，可以在其他线程计算时修改:
+ *   读者: ReadGuard 读取当前版本的指针，只有普通的原子读写和一个内存屏障，
+ *         不加锁也没有原子的读-改-写操作，在 ReadGuard 的生存期内这个版本不会被释放
+ *   写者: update 复制当前版本并修改，然后原子地发布新版本；旧版本记录发布时的纪元(epoch)，
+ *         等所有在这之前开始读的读者都结束后才释放(基于纪元的回收，类似 RCU)
+ * 每个线程第一次读时登记一次(加锁)，之后复用
+ */
+class Registry {
+   public:
+    Registry() : current_(new FunctionTable) {}
+    ~Registry();
+    Registry(const Registry &) = delete;
+    Registry &operator=(const Registry &) = delete;
+
+    class ReadGuard {
+       public:
+        explicit ReadGuard(const Registry &registry);
+        ~ReadGuard();
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+
+        const FunctionTable *get() const { return table_; }
+        const FunctionTable &operator*() const { return *table_; }
+        const FunctionTable *operator->() const { return table_; }
+
+       private:
+        const FunctionTable *table_;
+    };
+
+    // 修改函数表并发布新版本，写者之间互斥
+    void update(const std::function<void(FunctionTable &)> &modify);
+    // 设置全局常量
+    void setConstant(const std::string &name, double value) {
+        update([&](FunctionTable &table) { table.constants[name] = value; });
+    }
+    // 已经发布的版本数
+    uint64_t version() const { return version_.load(std::memory_order_relaxed); }
+    // 已经发布但还有读者在使用、没有释放的旧版本数
+    size_t retired() const;
+
+   private:
+    // 释放没有读者的旧版本，需要持有 writer_mutex_
+    void reclaim();
+
+    std::atomic<const FunctionTable *> current_;
+    std::atomic<uint64_t> version_{0};
+    mutable std::mutex writer_mutex_;
+    // 旧版本和它被替换时的纪元
+    std::vector<std::pair<const FunctionTable *, uint64_t>> retired_;
+};
+
+}  // namespace calculator
+#endif
@@ -0,0 +1,115 @@
+#ifndef MYEASYCALCULATOR_SERVER_H
+#define MYEASYCALCULATOR_SERVER_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Governor.h"
+#include "Histogram.h"
+#include "Registry.h"
+
+namespace calculator {
+
+struct ServerOptions {
+    // Unix 域套接字的路径，为空时监听 TCP
+    std::string unix_path;
+    // TCP 端口(只监听 127.0.0.1)，0 表示由系统分配
+    int tcp_port = 0;
+    // 计算线程数，0 表示使用全部的硬件线程
+    size_t workers = 0;
+    // 每个会话的变量占用的内存上限(字节)，超过时淘汰最久没有使用的变量，0 表示不限制
+    size_t session_memory = 0;
+    // 每个请求的资源限制，超过时这个请求返回错误，不影响其他请求
+    ResourceLimits limits;
+    // 所有会话共用的插件
+    std::vector<std::string> plugins;
+};
+
+/*
+ * 表达式服务(calculator --serve): 一个 epoll 事件循环负责所有连接的读写，
+ * 线程池负责计算。协议按行，每行是一个表达式或命令，每个请求按顺序返回一行:
+ *   表达式   => 3.0000000000 或 Error: ...
+ *   :stats   请求数、错误数、连接数和延迟的 p50/p90/p99/max(微秒)
+ *   :reset   清空当前连接的变量
+ *   :quit    返回剩余的结果后关闭连接
+ * 每个连接有独立的会话(ExpressionTree)，变量互不影响。同一个连接的请求
+ * 同一时间只由一个线程按顺序计算，客户端可以不等待结果连续发送多行(流水线)，
+ * 一次读到的多行会作为一批交给线程池。客户端不读取结果时，等待发送的结果和
+ * 积压的请求超过上限后服务端暂停读取这个连接(背压)，每个连接占用的内存有上限。
+ * 文件描述符用完时新的连接被接受后立即关闭
+ */
+class Server {
+   public:
+    explicit Server(const ServerOptions &options);
+    ~Server();
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
+    // 所有会话共享的函数注册表，可以在运行时添加或替换函数和全局常量
+    const std::shared_ptr<Registry> &registry() const { return registry_; }
+    // 监听的地址: unix:路径 或 tcp:127.0.0.1:端口
+    const std::string &address() const { return address_; }
+    // 运行事件循环，直到 stop() 被调用
+    void run();
+    // 停止事件循环，可以在信号处理函数中调用
+    void stop();
+    // :stats 命令返回的统计信息
+    std::string stats() const;
+
+   private:
+    struct Connection;
+
+    void accept();
+    void receive(const std::shared_ptr<Connection> &conn);
+    // 发送等待中的结果，全部发送完并且连接需要关闭时关闭连接
+    void flush(const std::shared_ptr<Connection> &conn);
+    void close(std::shared_ptr<Connection> conn);
+    void schedule(const std::shared_ptr<Connection> &conn);
+    // 线程池: 取出有请求的连接并计算
+    void work();
+    void process(Connection &conn);
+    std::string execute(Connection &conn, const std::string &line);
+    // 计算完成后通知事件循环发送结果
+    void complete(uint64_t id);
+
+   private:
+    std::string address_;
+    std::string unix_path_;
+    size_t session_memory_;
+    ResourceLimits limits_;
+    // 所有会话共享的函数注册表，插件只加载一次
+    std::shared_ptr<Registry> registry_;
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    int event_fd_ = -1;
+    // 预留的文件描述符，描述符用完时用来接受并关闭等待的连接
+    int spare_fd_ = -1;
+    std::atomic<bool> stopping_{false};
+
+    // 以下只在事件循环线程中访问
+    uint64_t next_id_ = 2;
+    std::unordered_map<uint64_t, std::shared_ptr<Connection>> connections_;
+
+    std::vector<std::thread> workers_;
+    std::mutex tasks_mutex_;
+    std::condition_variable tasks_cv_;
+    std::deque<std::shared_ptr<Connection>> tasks_;
+    bool shutdown_ = false;
+
+    std::mutex completed_mutex_;
+    std::vector<uint64_t> completed_;
+
+    LatencyHistogram latency_;
+    std::atomic<uint64_t> requests_{0}, errors_{0}, accepted_{0};
+    std::atomic<size_t> active_{0};
+};
+
+}  // namespace calculator
+#endif
@@ -0,0 +1,809 @@
+#ifndef MYEASYCALCULATOR_STATICEXPRESSION_H
+#define MYEASYCALCULATOR_STATICEXPRESSION_H
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Exception.h"
+#include "utils.h"
+
+namespace calculator {
+
+/*
+ * 编译期表达式: 在编译 C++ 代码时完成词法和语法分析，生成的是直接计算表达式的
+ * 内联代码，运行时没有解析、没有指令循环，参数是常量时由编译器直接算出结果。
+ *   auto f = CALCULATOR_STATIC("a*sin(b)+1");   // C++17
+ *   auto g = calculator::compile<"a*sin(b)+1">();  // C++20
+ *   double y = f(1.0, 2.0);
+ * 语法与 Lexer/ExpressionTree 相同(运算符优先级、左结合、负号、0x/0o/0b、
+ * 整数才能移位和取反、除以整数0是错误)，函数只有内置的一元/二元数学函数和 if，
+ * 常量只有 pi、e、sqrt2，其余的名字按第一次出现的顺序作为参数。
+ * 表达式有错误时编译失败，错误信息在编译器给出的 fail(...) 调用中。
+ * 与运行时编译的不同:
+ *   - 只有精确的数学模式，看不到会话中定义的变量和注册的函数
+ *   - 不支持数组、integrate/solve/minimize/sum/prod 等有绑定变量的内置函数
+ *   - -(...) 在运行时会丢掉负号，这里是编译错误(写成 -1*(...))
+ *   - 小数只能是能精确转换的字面量(有效数字不超过 2^53 且指数不太大)
+ */
+
+// 编译期表达式的节点
+enum class StaticOp {
+    Constant,
+    Parameter,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    And,
+    Or,
+    Xor,
+    ShiftLeft,
+    ShiftRight,
+    Less,
+    LessEqual,
+    Greater,
+    GreaterEqual,
+    Equal,
+    NotEqual,
+    Not,
+    Minus,
+    Call1,
+    Call2,
+    Conditional,
+    // 以下只在分析时使用
+    LogicalAnd,
+    LogicalOr
+};
+
+struct StaticNode {
+    StaticOp op = StaticOp::Constant;
+    double value = 0;
+    // 参数/函数的下标
+    int index = 0;
+    // 操作数，条件表达式为 条件/then/else
+    int a = -1, b = -1, c = -1;
+    // 整数字面量(可以移位和取反)、小数字面量或常量
+    bool integer = false, real = false;
+    // 子树中没有参数，只需要计算一次
+    bool constant = true;
+};
+
+// 分析的结果，N 为表达式文本的长度
+template <size_t N>
+struct StaticProgram {
+    // 每个字符最多产生3个节点(比如 -x 为 -1 * x)
+    static constexpr size_t capacity = 3 * N + 8;
+    StaticNode nodes[capacity] = {};
+    int count = 0, root = -1;
+    // 参数名在文本中的位置和长度
+    size_t names[N + 1][2] = {};
+    int parameters = 0;
+};
+
+template <size_t N>
+class StaticParser {
+   public:
+    static constexpr const char *unary_functions[] = {
+        "sqrt", "ceil", "cos",  "sin",  "tan",   "log", "floor", "acos",
+        "asin", "atan", "exp",  "log2", "log10", "erf", "round", "factorial"};
+    static constexpr const char *binary_functions[] = {"pow", "max", "min"};
+
+    static constexpr StaticProgram<N> parse(std::string_view text) {
+        StaticParser parser(text);
+        parser.tokenize();
+        parser.program_.root = parser.expression(0);
+        if (parser.peek().kind != Kind::End) fail("unexpected token");
+        return parser.program_;
+    }
+
+    // 表达式有错误。在常量求值中执行到 throw 时编译失败
+    static constexpr void fail(const char *message) {
+        throw SyntaxError(message);
+    }
+
+   private:
+    enum class Kind {
+        End,
+        Integer,
+        Float,
+        Name,
+        Function,  // 一元函数
+        Binary,    // 二元函数
+        If,
+        Left,
+        Right,
+        Comma,
+        Operator,  // 二元运算符
+        Not,
+        Negate
+    };
+    struct Token {
+        Kind kind = Kind::End;
+        StaticOp op = StaticOp::Constant;
+        double value = 0;
+        // 名字的位置，函数的下标
+        size_t begin = 0, length = 0;
+        int index = 0;
+        // 函数的负号
+        bool minus = false;
+    };
+    // -x 为 -1 * x 三个记号
+    static constexpr size_t kMaxTokens = 3 * N + 2;
+
+    constexpr explicit StaticParser(std::string_view text) : text_(text) {}
+
+    static constexpr bool isLetter(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+    static constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+    static constexpr bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+               c == '\f';
+    }
+    static constexpr bool equal(std::string_view a, const char *b) {
+        size_t i = 0;
+        for (; b[i] != 0; i++)
+            if (i >= a.size() || a[i] != b[i]) return false;
+        return i == a.size();
+    }
+    static constexpr int priority(StaticOp op) {
+        switch (op) {
+            case StaticOp::Call2:  // **
+                return 200;
+            case StaticOp::Mul:
+            case StaticOp::Div:
+            case StaticOp::Mod:
+            case StaticOp::Xor:
+            case StaticOp::And:
+            case StaticOp::Or:
+                return 100;
+            case StaticOp::Add:
+            case StaticOp::Sub:
+                return 90;
+            case StaticOp::ShiftLeft:
+            case StaticOp::ShiftRight:
+                return 80;
+            case StaticOp::Less:
+            case StaticOp::LessEqual:
+            case StaticOp::Greater:
+            case StaticOp::GreaterEqual:
+                return 70;
+            case StaticOp::Equal:
+            case StaticOp::NotEqual:
+                return 60;
+            case StaticOp::LogicalAnd:
+                return 50;
+            case StaticOp::LogicalOr:
+                return 40;
+            default:
+                return -1;
+        }
+    }
+
+    constexpr char at(size_t i) const { return i < text_.size() ? text_[i] : 0; }
+    constexpr void skipSpace() {
+        while (pos_ < text_.size() && isSpace(text_[pos_])) pos_++;
+    }
+
+    // 十进制字面量转换为浮点数，只接受能精确转换的(与 strtod 的结果相同)
+    static constexpr double decimal(uint64_t mantissa, int exponent) {
+        constexpr double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                     1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                     1e18, 1e19, 1e20, 1e21, 1e22};
+        constexpr uint64_t limit = uint64_t(1) << 53;
+        if (mantissa == 0) return 0;
+        while (mantissa % 10 == 0) mantissa /= 10, exponent++;
+        while (exponent > 22 && mantissa <= limit / 10)
+            mantissa *= 10, exponent--;
+        if (mantissa > limit || exponent > 22 || exponent < -22)
+            fail("decimal literal can not be converted exactly at compile time");
+        return exponent >= 0 ? (double)mantissa * powers[exponent]
+                             : (double)mantissa / powers[-exponent];
+    }
+
+    // 数字字面量，规则同 Lexer::scan
+    constexpr Token number(bool minus) {
+        Token token;
+        char c = at(pos_);
+        if (c == '0' && isDigit(at(pos_ + 1)))
+            fail("integer can not start with 0");
+        if (c == '0' && (at(pos_ + 1) == 'x' || at(pos_ + 1) == 'o' ||
+                         at(pos_ + 1) == 'b')) {
+            // 运行时会丢掉进制数前面的负号
+            if (minus) fail("can not negate a hex/oct/bin literal, use -1*");
+            int base = at(pos_ + 1) == 'x' ? 16 : at(pos_ + 1) == 'o' ? 8 : 2;
+            pos_ += 2;
+            uint64_t value = 0;
+            size_t begin = pos_;
+            for (;; pos_++) {
+                char d = at(pos_);
+                int digit = isDigit(d)               ? d - '0'
+                            : d >= 'a' && d <= 'f' ? d - 'a' + 10
+                            : d >= 'A' && d <= 'F' ? d - 'A' + 10
+                                                   : 99;
+                if (digit >= base) break;
+                if (value >> 58) fail("hex/oct/bin literal is too large");
+                value = value * base + digit;
+            }
+            if (pos_ == begin) fail("hex/oct/bin literal has no digits");
+            if (isLetter(at(pos_)) || isDigit(at(pos_)))
+                fail("invalid digit in hex/oct/bin literal");
+            token.kind = Kind::Integer;
+            token.value = (double)(Integer)value;
+            return token;
+        }
+        if (c == '0' && at(pos_ + 1) != '.') {
+            // 单独的 0，负号同样被丢掉
+            pos_++;
+            token.kind = Kind::Integer;
+            return token;
+        }
+        uint64_t mantissa = 0;
+        int exponent = 0, digits = 0, written = 0;
+        bool real = false;
+        for (; isDigit(at(pos_)) || at(pos_) == '.'; pos_++) {
+            if (at(pos_) == '.') {
+                if (real) break;
+                real = true;
+                continue;
+            }
+            digits++;
+            if (mantissa == 0 && at(pos_) == '0') {
+                if (real) exponent--;
+                continue;
+            }
+            if (written < 19) {
+                mantissa = mantissa * 10 + (at(pos_) - '0');
+                written++;
+                if (real) exponent--;
+            } else if (at(pos_) != '0') {
+                fail("decimal literal has too many digits");
+            } else if (!real) {
+                exponent++;
+            }
+        }
+        if (digits == 0) fail("expect a digit");
+        if (at(pos_) == 'e' || at(pos_) == 'E') {
+            pos_++;
+            bool negative = false;
+            if (at(pos_) == '+' || at(pos_) == '-') {
+                // e 后面有符号时是浮点数
+                real = true;
+                negative = at(pos_++) == '-';
+            }
+            if (!isDigit(at(pos_))) fail("after digit e/E error");
+            int e = 0;
+            for (; isDigit(at(pos_)); pos_++)
+                if ((e = e * 10 + (at(pos_) - '0')) > 10000)
+                    fail("exponent is too large");
+            exponent += negative ? -e : e;
+            if (at(pos_) == 'e' || at(pos_) == 'E')
+                fail("expoent e/E is to many!");
+        }
+        double value = decimal(mantissa, exponent);
+        if (minus) value = -value;
+        if (!real) {
+            // 整数字面量保存为 Integer
+            if (value >= 9223372036854775808.0 || value < -9223372036854775808.0)
+                fail("integer literal is too large");
+            value = (double)(Integer)value;
+        }
+        token.kind = real ? Kind::Float : Kind::Integer;
+        token.value = value;
+        return token;
+    }
+
+    constexpr void push(Token token) {
+        if (count_ >= kMaxTokens) fail("expression is too long");
+        tokens_[count_++] = token;
+    }
+
+    // 词法分析，规则同 Lexer::scan
+    constexpr void tokenize() {
+        // 前一个记号的最后一个字符，用来判断 +/- 是符号还是加减法
+        char previous = 0;
+        for (;;) {
+            skipSpace();
+            if (pos_ >= text_.size()) break;
+            char c = text_[pos_];
+            bool minus = false;
+            if (c == '+' || c == '-') {
+                size_t next = pos_ + 1;
+                while (isSpace(at(next))) next++;
+                if (at(next) == c) fail("can not present continue symbol ++/--");
+                if (previous != ')' && previous != ']' && previous != 'e' &&
+                    previous != 'E' && previous != '.' && !isDigit(previous) &&
+                    !isLetter(previous)) {
+                    minus = c == '-';
+                    pos_ = next;
+                    c = at(pos_);
+                    if (c == '(' && minus)
+                        fail("-(...) is not supported, write -1*(...)");
+                    if (!isDigit(c) && c != '.' && !isLetter(c) && c != '(')
+                        fail("unexpected sign");
+                }
+            }
+            Token token;
+            if (isDigit(c) || c == '.') {
+                push(number(minus));
+                previous = text_[pos_ - 1];
+                continue;
+            }
+            if (isLetter(c)) {
+                size_t begin = pos_;
+                while (isLetter(at(pos_))) pos_++;
+                while (isDigit(at(pos_))) pos_++;
+                std::string_view name = text_.substr(begin, pos_ - begin);
+                previous = text_[pos_ - 1];
+                if (at(pos_) == '(') {
+                    token.minus = minus;
+                    token.kind = Kind::End;
+                    for (int i = 0; i < 16; i++)
+                        if (equal(name, unary_functions[i]))
+                            token.kind = Kind::Function, token.index = i;
+                    for (int i = 0; i < 3; i++)
+                        if (equal(name, binary_functions[i]))
+                            token.kind = Kind::Binary, token.index = i;
+                    if (equal(name, "if")) token.kind = Kind::If;
+                    if (token.kind == Kind::End) {
+                        if (equal(name, "integrate") || equal(name, "solve") ||
+                            equal(name, "minimize") || equal(name, "sum") ||
+                            equal(name, "prod"))
+                            fail("builtin functions with bound variables are "
+                                 "not supported at compile time");
+                        fail("function not defined");
+                    }
+                    push(token);
+                    continue;
+                }
+                // -x 看作 -1 * x
+                if (minus) {
+                    Token one;
+                    one.kind = Kind::Integer;
+                    one.value = -1;
+                    push(one);
+                    Token mul;
+                    mul.kind = Kind::Operator;
+                    mul.op = StaticOp::Mul;
+                    push(mul);
+                }
+                double constant = 0;
+                bool found = true;
+                if (equal(name, "pi"))
+                    constant = 3.141592653589793;
+                else if (equal(name, "e"))
+                    constant = 2.718281828459045;
+                else if (equal(name, "sqrt2"))
+                    constant = 1.4142135623730951;
+                else
+                    found = false;
+                if (found) {
+                    token.kind = Kind::Float;
+                    token.value = constant;
+                } else {
+                    token.kind = Kind::Name;
+                    token.begin = begin;
+                    token.length = pos_ - begin;
+                    token.index = parameter(name);
+                }
+                push(token);
+                continue;
+            }
+            pos_++;
+            previous = c;
+            token.kind = Kind::Operator;
+            char n = at(pos_);
+            bool twice = n == c;
+            switch (c) {
+                case '(':
+                    token.kind = Kind::Left;
+                    break;
+                case ')':
+                    token.kind = Kind::Right;
+                    break;
+                case ',':
+                    token.kind = Kind::Comma;
+                    break;
+                case '+':
+                    token.op = StaticOp::Add;
+                    break;
+                case '-':
+                    token.op = StaticOp::Sub;
+                    break;
+                case '*':
+                    token.op = twice ? StaticOp::Call2 : StaticOp::Mul;
+                    break;
+                case '/':
+                    token.op = StaticOp::Div;
+                    break;
+                case '%':
+                    token.op = StaticOp::Mod;
+                    break;
+                case '^':
+                    token.op = StaticOp::Xor;
+                    break;
+                case '&':
+                    token.op = twice ? StaticOp::LogicalAnd : StaticOp::And;
+                    break;
+                case '|':
+                    token.op = twice ? StaticOp::LogicalOr : StaticOp::Or;
+                    break;
+                case '~':
+                    token.kind = Kind::Negate;
+                    break;
+                case '!':
+                    if (n == '=') {
+                        token.op = StaticOp::NotEqual;
+                        twice = true;
+                    } else {
+                        token.kind = Kind::Not;
+                    }
+                    break;
+                case '=':
+                    if (!twice) fail("assignment is not supported");
+                    token.op = StaticOp::Equal;
+                    break;
+                case '<':
+                case '>':
+                    if (twice) {
+                        token.op = c == '<' ? StaticOp::ShiftLeft
+                                            : StaticOp::ShiftRight;
+                    } else if (n == '=') {
+                        token.op = c == '<' ? StaticOp::LessEqual
+                                            : StaticOp::GreaterEqual;
+                        twice = true;
+                    } else {
+                        token.op = c == '<' ? StaticOp::Less : StaticOp::Greater;
+                    }
+                    break;
+                default:
+                    fail("unexpected character");
+            }
+            if (token.kind == Kind::Operator && twice) pos_++;
+            push(token);
+        }
+        Token end;
+        push(end);
+    }
+
+    // 参数的下标，新的参数名加到最后
+    constexpr int parameter(std::string_view name) {
+        for (int i = 0; i < program_.parameters; i++)
+            if (text_.substr(program_.names[i][0], program_.names[i][1]) == name)
+                return i;
+        program_.names[program_.parameters][0] = name.data() - text_.data();
+        program_.names[program_.parameters][1] = name.size();
+        return program_.parameters++;
+    }
+
+    constexpr const Token &peek() const { return tokens_[next_]; }
+    constexpr const Token &take() { return tokens_[next_++]; }
+    constexpr void expect(Kind kind, const char *message) {
+        if (take().kind != kind) fail(message);
+    }
+
+    constexpr int add(StaticNode x) {
+        if (program_.count >= (int)StaticProgram<N>::capacity)
+            fail("expression is too long");
+        x.constant = x.op != StaticOp::Parameter;
+        for (int k : {x.a, x.b, x.c})
+            if (k >= 0 && !program_.nodes[k].constant) x.constant = false;
+        program_.nodes[program_.count] = x;
+        return program_.count++;
+    }
+    constexpr int add(StaticOp op, int a = -1,
+                      int b = -1, int c = -1) {
+        StaticNode x;
+        x.op = op, x.a = a, x.b = b, x.c = c;
+        return add(x);
+    }
+    constexpr int constant(double value) {
+        StaticNode x;
+        x.value = value;
+        return add(x);
+    }
+
+    // 优先级不低于 lowest 的二元运算，所有运算符都是左结合
+    constexpr int expression(int lowest) {
+        int left = unary();
+        for (;;) {
+            const Token &token = peek();
+            if (token.kind != Kind::Operator || priority(token.op) < lowest)
+                return left;
+            StaticOp op = take().op;
+            int right = expression(priority(op) + 1);
+            const StaticNode &l = program_.nodes[left], &r = program_.nodes[right];
+            switch (op) {
+                case StaticOp::Div:
+                    if (r.integer && r.value == 0) fail("div zero/0 error");
+                    break;
+                case StaticOp::ShiftLeft:
+                case StaticOp::ShiftRight:
+                    // 参数和小数不能移位
+                    if (l.real || r.real || l.op == StaticOp::Parameter ||
+                        r.op == StaticOp::Parameter)
+                        fail("can not shift left/right double/float type");
+                    if (r.integer && r.value < 0)
+                        fail("shift left/right negative count");
+                    break;
+                case StaticOp::LogicalAnd:
+                case StaticOp::LogicalOr: {
+                    // a && b 为 a ? b != 0 : 0，a || b 为 a ? 1 : b != 0
+                    int truth = add(StaticOp::NotEqual, right,
+                                    constant(0));
+                    left = op == StaticOp::LogicalAnd
+                               ? add(StaticOp::Conditional, left,
+                                     truth, constant(0))
+                               : add(StaticOp::Conditional, left,
+                                     constant(1), truth);
+                    continue;
+                }
+                default:
+                    break;
+            }
+            StaticNode x;
+            x.op = op, x.a = left, x.b = right;
+            left = add(x);
+        }
+    }
+
+    // 前缀运算 ! 和 ~ 只作用于后面的一个操作数
+    constexpr int unary() {
+        const Token &token = peek();
+        if (token.kind == Kind::Not) {
+            take();
+            return add(StaticOp::Not, unary());
+        }
+        if (token.kind == Kind::Negate) {
+            take();
+            const Token &operand = take();
+            if (operand.kind != Kind::Integer)
+                fail("can not negate double/float type");
+            return constant((double)~(Integer)operand.value);
+        }
+        return primary();
+    }
+
+    constexpr int primary() {
+        Token token = take();
+        StaticNode x;
+        switch (token.kind) {
+            case Kind::Integer:
+            case Kind::Float:
+                x.value = token.value;
+                x.integer = token.kind == Kind::Integer;
+                x.real = !x.integer;
+                return add(x);
+            case Kind::Name:
+                x.op = StaticOp::Parameter;
+                x.index = token.index;
+                return add(x);
+            case Kind::Left: {
+                int inner = expression(0);
+                expect(Kind::Right, "expression unexpected (!");
+                return inner;
+            }
+            case Kind::Function:
+            case Kind::Binary:
+            case Kind::If: {
+                int arguments = token.kind == Kind::Function ? 1
+                                : token.kind == Kind::Binary ? 2
+                                                             : 3;
+                int args[3] = {-1, -1, -1};
+                expect(Kind::Left, "function need (");
+                for (int i = 0; i < arguments; i++) {
+                    if (i > 0) expect(Kind::Comma, "function need more arguments");
+                    args[i] = expression(0);
+                }
+                expect(Kind::Right, "function need )");
+                x.op = token.kind == Kind::Function ? StaticOp::Call1
+                       : token.kind == Kind::Binary ? StaticOp::Call2
+                                                    : StaticOp::Conditional;
+                x.index = token.index;
+                x.a = args[0], x.b = args[1], x.c = args[2];
+                int call = add(x);
+                // -sin(x) 的负号属于函数，先于 ** 计算
+                return token.minus ? add(StaticOp::Minus, call) : call;
+            }
+            default:
+                fail("expect a number, name, function or (");
+                return -1;
+        }
+    }
+
+    std::string_view text_;
+    size_t pos_ = 0;
+    Token tokens_[kMaxTokens] = {};
+    size_t count_ = 0, next_ = 0;
+    StaticProgram<N> program_;
+};
+
+/*
+ * 编译期表达式，Source::text() 返回表达式文本(constexpr)。
+ * 对象是空的，可以按值传递；计算可以在多个线程中同时进行
+ */
+template <class Source>
+class StaticExpression {
+   public:
+    static constexpr std::string_view text = Source::text();
+    static constexpr StaticProgram<text.size()> program =
+        StaticParser<text.size()>::parse(text);
+
+    static constexpr size_t arity() { return program.parameters; }
+    static constexpr std::string_view parameter(size_t k) {
+        return text.substr(program.names[k][0], program.names[k][1]);
+    }
+    // 参数名，可以传给 ExpressionTree::compile
+    static std::vector<std::string> parameters() {
+        std::vector<std::string> names;
+        for (size_t k = 0; k < arity(); k++)
+            names.emplace_back(parameter(k));
+        return names;
+    }
+
+    // 参数按第一次出现的顺序传入
+    template <class... Args>
+    double operator()(Args... args) const {
+        static_assert(sizeof...(Args) == arity(),
+                      "wrong number of arguments for static expression");
+        const double values[sizeof...(Args) + 1] = {(double)args...};
+        return evaluate(values);
+    }
+    // 同 CompiledExpression::evaluate
+    static double evaluate(const double *args) {
+        return node<program.root>(args);
+    }
+
+   private:
+    template <int I>
+    static double node(const double *args) {
+        constexpr StaticNode x = program.nodes[I];
+        if constexpr (x.constant && x.op != StaticOp::Constant) {
+            // 常量子表达式(比如 sqrt(2))在第一次计算到时求值，编译器不一定能折叠
+            static const double value = compute<I>(args);
+            return value;
+        } else {
+            return compute<I>(args);
+        }
+    }
+
+    template <int I>
+    static double compute(const double *args) {
+        constexpr StaticNode x = program.nodes[I];
+        if constexpr (x.op == StaticOp::Constant) {
+            return x.value;
+        } else if constexpr (x.op == StaticOp::Parameter) {
+            return args[x.index];
+        } else if constexpr (x.op == StaticOp::Conditional) {
+            // 只计算选中的分支
+            return node<x.a>(args) != 0 ? node<x.b>(args) : node<x.c>(args);
+        } else if constexpr (x.op == StaticOp::Minus) {
+            return -node<x.a>(args);
+        } else if constexpr (x.op == StaticOp::Not) {
+            return (Integer) !((Integer)node<x.a>(args));
+        } else if constexpr (x.op == StaticOp::Call1) {
+            return unary<x.index>(node<x.a>(args));
+        } else {
+            double a = node<x.a>(args), b = node<x.b>(args);
+            return apply<x.op, x.index>(a, b);
+        }
+    }
+
+    // 二元运算，与 CompiledExpression::apply 相同
+    template <StaticOp Op, int F>
+    static double apply(double a, double b) {
+        switch (Op) {
+            case StaticOp::Call2:
+                return binary<F>(a, b);
+            case StaticOp::Add:
+                return a + b;
+            case StaticOp::Sub:
+                return a - b;
+            case StaticOp::Mul:
+                return a * b;
+            case StaticOp::Div:
+                return a / b;
+            case StaticOp::Mod:
+                return std::fmod(a, b);
+            case StaticOp::And:
+                return (Integer)a & (Integer)b;
+            case StaticOp::Or:
+                return (Integer)a | (Integer)b;
+            case StaticOp::Xor:
+                return (Integer)a ^ (Integer)b;
+            case StaticOp::ShiftLeft:
+                if (b < 0) throw ShiftNegativeException();
+                return (Integer)a << (Integer)b;
+            case StaticOp::ShiftRight:
+                if (b < 0) throw ShiftNegativeException();
+                return (Integer)a >> (Integer)b;
+            case StaticOp::Less:
+                return a < b;
+            case StaticOp::LessEqual:
+                return a <= b;
+            case StaticOp::Greater:
+                return a > b;
+            case StaticOp::GreaterEqual:
+                return a >= b;
+            case StaticOp::Equal:
+                return a == b;
+            default:
+                return a != b;
+        }
+    }
+
+    // 与 FunctionTable 中的内置函数相同
+    template <int F>
+    static double unary(double x) {
+        switch (F) {
+            case 0: return __xsqrt(x);
+            case 1: return __xceil(x);
+            case 2: return __xcos(x);
+            case 3: return __xsin(x);
+            case 4: return __xtan(x);
+            case 5: return __xlog(x);
+            case 6: return __xfloor(x);
+            case 7: return __xacos(x);
+            case 8: return __xasin(x);
+            case 9: return __xatan(x);
+            case 10: return __xexp(x);
+            case 11: return __xlog2(x);
+            case 12: return __xlog10(x);
+            case 13: return __xerf(x);
+            case 14: return __xround(x);
+            default: {
+                double v = 1;
+                for (int i = 1; i <= x && !std::isinf(v); i++) v *= i;
+                return v;
+            }
+        }
+    }
+    template <int F>
+    static double binary(double x, double y) {
+        if constexpr (F == 0) return __xpow(x, y);
+        if constexpr (F == 1) return x > y ? x : y;
+        return x < y ? x : y;
+    }
+};
+
+// 宏的参数是字符串字面量，C++17 中不能直接作为模板参数
+#define CALCULATOR_STATIC(expression)                              \
+    ([] {                                                          \
+        struct Source {                                            \
+            static constexpr std::string_view text() {             \
+                return expression;                                 \
+            }                                                      \
+        };                                                         \
+        return ::calculator::StaticExpression<Source>();           \
+    }())
+
+#if __cplusplus >= 202002L
+// C++20 中字符串字面量可以作为模板参数: compile<"a*sin(b)+1">()
+template <size_t N>
+struct FixedString {
+    char data[N] = {};
+    constexpr FixedString(const char (&s)[N]) {
+        for (size_t i = 0; i < N; i++) data[i] = s[i];
+    }
+};
+
+template <FixedString S>
+struct LiteralSource {
+    static constexpr std::string_view text() {
+        return std::string_view(S.data, sizeof(S.data) - 1);
+    }
+};
+
+template <FixedString S>
+constexpr StaticExpression<LiteralSource<S>> compile() {
+    return {};
+}
+#endif
+
+}  // namespace calculator
+#endif
@@ -1,30 +1,67 @@
 #ifndef MYEASYCALCULATOR_TEST_H
 #define MYEASYCALCULATOR_TEST_H
 
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
+#include "AsyncEvaluator.h"
+#include "CApi.h"
 #include "ExpressionTree.h"
+#include "IncrementalScript.h"
+#include "MonteCarlo.h"
+#include "Pipeline.h"
+#include "Random.h"
+#include "Server.h"
+#include "StaticExpression.h"
+#include "TieredExpression.h"
+#include "Workspace.h"
 using namespace calculator;
 using namespace std;
 
-int gcd(int a, int b) {
+inline int gcd(int a, int b) {
     int maxa = a > b ? a : b;
     int minb = a < b ? a : b;
     if (minb == 0) return maxa;
     return gcd(minb, maxa % minb);
 }
 
-string expression;
-void Test() {
+// 测试表达式用到的变量 var 和函数 func、h
+inline void setupTestSession(ExpressionTree &et) {
+    et.addVariable("var", 999999);
+    et.addUnaryFunction(
+        "func", function<double(double)>([](double x) { return 2 * x; }));
+    et.addBinaryFunction(
+        "h", [](double x, double y) { return x * 10000 + y * 2000; });
+}
+
+struct TestCase {
+    string expression;
+    // 不为空时编译表达式并计算梯度
+    vector<string> params = {};
+    vector<double> args = {};
+};
+
+inline string expression;
+inline void Test() {
     try {
         ExpressionTree et;
-        et.addVariable("var", 999999);
-        et.addUnaryFunction(
-            "func", function<double(double)>([](double x) { return 2 * x; }));
-        et.addBinaryFunction(
-            "h", [](double x, double y) { return x * 10000 + y * 2000; });
-
+        setupTestSession(et);
         cout << "=> " << setprecision(10) << fixed
              << et.calcExpression(expression) << "\n";
 
@@ -33,138 +70,991 @@ void Test() {
     }
 }
 
-#define __TEST__ Test();
+// 编译表达式并计算梯度
+inline void CompileTest(const vector<string> &params,
+                        const vector<double> &args) {
+    try {
+        ExpressionTree et;
+        auto f = et.compile(expression, params);
+        cout << "=> " << setprecision(10) << fixed << f(args) << " grad:";
+        for (double g : f.gradient(args)) cout << " " << g;
+        cout << "\n";
+    } catch (SyntaxError &e) {
+        cerr << e.what() << endl;
+    }
+}
+
+// expression_test 中的表达式，按顺序计算；注释为期望的结果
+inline const vector<TestCase> &testCases() {
+    static const vector<TestCase> cases = {
+        {"100-sin(1234+10/18*cos(129))/1023*19999"},  // 81.84392659975263
+        {"10-9+12*3/pow(2,10)-10*192"},  // -1918.96484375
+        {"100-cos(17)+pow(3,8)"},  // 6661.275163338051
+        {"a=100;b=1.234;c=0.234;-123*9/23.4+pow(c+a/b,3)-pow(cos(pi/"
+         "3),sin(18332))*100/12*73.4324-192+192/992/cos(12)*pow(111,1e-3)*a/pi/"
+         "(8*12/10/e)"},  // 535572.732147942
+        {"exp(10)"},  // 22026.465794806718
+        {"func(100)-sin(cos(pow(12,5)))"},  // 199.47680614214548
+        {"a=100;b=1010100;a+1000+cos(a+pow(tan(a+b),2))/log(999/a)+cos(a)"},  // 1100.4561295864257
+        {"e3=12345;log2(e3)"},  // 13.591639216030144
+        {"h(-13e-4,-5)/log(100000)"},  // -869.7181294594521
+        {"123.33*2"},  // 246.66
+        {"19199&(172121|1910)^123"},  // 516
+        {"2*2<<11>>1"},  // 4096
+        {"a12=100;1+3*a12/10"},  // 31.0
+        {"9**-3/12"},  // 0.00011431184270690443
+        {"-311>>2"},  // -78
+        {"pow(10<<2,20)"},  // 1.099511627776e+32
+        {"10+0x11 + 100"},  // 127
+        {"0b10101010"},  // 170
+        {"0xffffeeAA / 0b0101010 + 0o7777 - 100"},  // 102265015.42857143
+        {"0o10111 + 111.1234"},  // 4280.1234
+        {"0. + 0.12121 + 0b10101010"},  // 170.12121
+        {"1.001+0.-100"},  // -98.999
+        {"a=pi;b=a;a+10.1+var/1000;"},  // 1013.2405926535898
+        {"5/func(111)+12"},  // 12.022522522522523
+        {"a=10;b=100*200;b/100.2"},  // 199.6007984031936
+        {"a=10;x=-1000;b=100*pow(100,2)+100;b/2*x/a"},  // -50005000.0
+        {"b=pi*e/(sin(tan(10)))/(1+-100*1.2/cos(0.12e4));a=b+122;a*10"},  // 1218.81632320905
+        {"cos(12.34/(111.22*exp(3)))"},  // 0.9999847430913299
+        {"sin((2+1))"},  // 0.1411200080598672
+        {"a=1000 "
+         ";b=0.341;a/0.1-100/1999*(a*b-111/23*123/0.12*a+b-a+b/(a+b*-123.33e3))"},  // 257493.63629029953
+        {";;;;y=10000*200;;;a=100;;;b=100;;;a+100+b*y;"},  // 200000200
+        {"cos(2+(100)+100)"},  // 0.591345375451585
+        {"cos(2+(100+2)+10)"},  // 0.6195206125592099
+        {"a=10;0.0001e5*(pow(101*a/"
+         "10,cos(0.31*pi*199)))-1*cos((2)+2)-max(cos(100),sin(200))/"
+         "pow(2,cos(20))"},  // 133.84679913329174
+        {"cos(((((((((((((((19))+10)))))/1000))))*1911*cos(100)))))"},  // -0.7869416029408316
+        {"cos(2+(((((((((((((((((((((((((((((((((((((((((((sin(1111))))))))+100)"
+         "))))*2000)))))))))*2)))))))))))))))))))))))"},  // 0.16178461176298067
+        {"a=10<<2;a+1"},  // 41
+        {"a=1000;x=a;b=x;b"},  // 1000
+        {"-1000-log2(pi*e/-max(10,min(-100,-cos(-pi*22*exp(3)))))"},  // -nan
+        {"a=100;b=-a-100;c=a-2*b/a;c"},  // 104
+        {"1000-pow(100,2)"},
+        {"-1000+-log2(-pi*e/-max(10,min(-100,-cos(pi*22*exp(3)))))"},  // -999.7722630754739
+        {"-pi"},  // -3.14......
+        {"-1+-log(101010)"},  // -12.52297480082323
+        {" 1. - - - - -100"},  // bad example
+        {"1. - - - - - -100"},  // bad example
+        {"1. - - - - --100"},  // bad example
+        {"1- - - - - -100"},  // bad example
+        {"1*-pow(2,3)"},  // -8
+        {"1--100"},  // bad example
+        {"1-+100"},  // -99
+        {"1+-100"},  // -99
+        {"1++100"},  // bad example
+        {"1 + -100 + 100 - +1000 - +1000 + -10100"},  // -12099
+        {"-12e-3+12.33e+2-10.e1"},  // -12e-3+12.33e+2-10.e1
+        {"100e3-100*pow(4,7)"},  // -1538400.0
+        {"x*sin(y)+pow(x,2)", {"x", "y"}, {2, 0}},  // 4.0 grad: 4.0 2.0
+        {"-exp(x)/y+a%y", {"x", "y", "a"}, {0, 2, 5}},  // 0.5 grad: -0.5 -1.75 1.0
+        {"integrate(sin(x),x,0,pi)"},  // 2.0
+        {"solve(x*x-2,x,1)+minimize((x-1)**2,x,-4,4)"},  // 2.4142135624
+        {"integrate(integrate(x*y,y,0,x),x,0,1)"},  // 0.125
+        {"integrate(a*x*x,x,0,b)", {"a", "b"}, {3, 2}},  // 8.0 grad: 2.6666666667 12.0
+        {"solve(x*x-a,x,1)-minimize((x-a)**2,x,-10,10)", {"a"}, {4}},  // -2.0 grad: -0.75
+        {"sum(i,1,100,i)+prod(i,1,10,i)"},  // 3633850.0
+        {"sum(k,1,1000000,1/(k*k))"},  // 1.6449330668
+        {"sum(i,1,50,a*i**2)+prod(i,1,5,a+i)", {"a"}, {2}},  // 88370.0 grad: 45679.0
+        {"sum(i,1,10,sum(j,5,20,i*j))"},  // 11000.0
+        {"sum(i,1,10,if(i>5,sum(j,1,20,i),0))"},  // 800.0
+        {"prod(i,1,3,sum(j,1,i+1,j))"},  // 180.0
+        {"sum(i,2**53,2**53+4,a)", {"a"}, {1}},  // 5.0 grad: 5.0
+        {"(1<<2)+(3>=2)+(1!=1)+(0||2)"},  // 6.0
+        {"if(1<2&&2<3,10,1/0)"},  // 10.0
+        {"sum(i,1,10,if(i%2==0,i,0))"},  // 30.0
+        {"if(x>0&&y>0,x*y,-x)", {"x", "y"}, {2, 3}},  // 6.0 grad: 3.0 2.0
+        {"v=[1,2,3,4]; sum(v*v)+max(v)-mean(v)"},  // 31.5
+        {"dot([1,2,3],[4,5,6])+sum(if([1,2,3]>1,1,0))"},  // 34.0
+    };
+    return cases;
+}
+
+// 不是单个表达式的功能测试: 返回是否通过，输出 "名称: ok" 或 "名称: FAILED"
+struct FeatureTest {
+    string name;
+    function<bool()> run;
+};
+
+inline const vector<FeatureTest> &featureTests() {
+    static const vector<FeatureTest> tests = {
+        {"memoize",
+         [] {
+             // 纯函数的缓存: 相同的参数只调用一次，统计命中和未命中
+             ExpressionTree et;
+             int computed = 0;
+             et.addUnaryFunction("sq",
+                                 function<double(double)>([&](double x) {
+                                     computed++;
+                                     return x * x;
+                                 }),
+                                 {true, 16});
+             et.addVariable("x", 3);
+             double v = et.calcExpression("sq(x)+sq(x)+sq(x+1)");
+             FunctionStats stats = et.functionStats("sq");
+             return v == 34 && computed == 2 && stats.calls == 3 &&
+                    stats.hits == 1 && stats.entries == 2 &&
+                    stats.capacity == 16;
+         }},
+        {"sum gradient limit",
+         [] {
+             // 梯度中的求和同样按块计入资源限制
+             ExpressionTree et;
+             CompiledExpression f = et.compile("sum(i,1,1e6,a*i)", {"a"});
+             ResourceLimits limits;
+             limits.max_iterations = 1500000;
+             Governor governor(limits);
+             Governor::Scope scope(&governor);
+             try {
+                 f.gradient({1.0});
+             } catch (ResourceLimitException &) {
+                 return true;
+             }
+             return false;
+         }},
+        {"environment snapshot",
+         [] {
+             // 快照与会话共享变量，之后双方定义的变量互不可见
+             ExpressionTree et;
+             et.calcExpression("a=1;b=2;a+b");
+             Environment snapshot = et.snapshot();
+             et.calcExpression("c=3;c");
+             ExpressionTree copy(snapshot);
+             bool ok = copy.calcExpression("a+b") == 3 && !snapshot.contains("c");
+             copy.calcExpression("d=4;d");
+             return ok && et.calcExpression("a+b+c") == 6 &&
+                    copy.calcExpression("a+d") == 5 && !et.environment().contains("d") &&
+                    !snapshot.contains("d");
+         }},
+        {"environment eviction",
+         [] {
+             // 超过内存上限时淘汰最久没有使用的变量，最近读取过的变量保留
+             Environment env;
+             env.assign("keep", 1);
+             size_t limit = env.memoryUsage() * 20;
+             env.setMemoryLimit(limit);
+             for (int i = 0; i < 100; i++) {
+                 env.assign("v" + to_string(i), i);
+                 env.find("keep");
+             }
+             return env.find("keep") == 1 && !env.contains("v0") &&
+                    env.find("v99") == 99 && env.evictions() > 0 &&
+                    env.memoryUsage() <= limit && env.size() < 20;
+         }},
+        {"precision",
+         [] {
+             // float/long double 的结果与 double 一致(在各自的精度内)，
+             // 1+x-1 在较低的精度下丢失 x
+             ExpressionTree et;
+             vector<string> params = {"x", "y"};
+             string text = "sin(x)*exp(y)+sum(i,1,3,x*i)+if(x>1,x,y)";
+             double expected = et.compile(text, params)({1.5, 0.5});
+             CompiledExpression single =
+                 et.compile(text, params, Precision::Single);
+             CompiledExpression extended =
+                 et.compile(text, params, Precision::Extended);
+             float fargs[] = {1.5f, 0.5f};
+             long double largs[] = {1.5L, 0.5L};
+             float fout[4];
+             const float column[] = {1.5f, 1.5f, 1.5f, 1.5f};
+             const float *columns[] = {column, nullptr};
+             single.evaluateBatch(fargs, columns, fout, 4);
+             bool ok = fabs(single.evaluate(fargs) - expected) < 1e-5 &&
+                       fabs(fout[3] - expected) < 1e-5 &&
+                       fabsl(extended.evaluate(largs) - expected) < 1e-12 &&
+                       single({1.5, 0.5}) == single.evaluate(fargs);
+             float fx = 1e-8f;
+             ok = ok && et.compile("1+x-1", {"x"}, Precision::Single)
+                            .evaluate(&fx) == 0 &&
+                  et.compile("1+x-1", {"x"})({1e-8}) != 0;
+             if (numeric_limits<long double>::digits > 53) {
+                 long double lx = 1e-17L;
+                 ok = ok && et.compile("1+x-1", {"x"})({1e-17}) == 0 &&
+                      et.compile("1+x-1", {"x"}, Precision::Extended)
+                              .evaluate(&lx) != 0;
+             }
+             return ok;
+         }},
+        {"math mode",
+         [] {
+             // 快速/近似的 sin/cos/tan/exp 替换了 libm，在 FastMath.h 给出的
+             // 误差上界以内(与 long double 的 libm 比较)；log 和 pow 在各模式下
+             // 都与 libm 相同
+             using R = long double (*)(long double);
+             struct Case {
+                 const char *name;
+                 double (*precise)(double);
+                 R reference;
+                 double lo, hi, ulps, relative;
+             };
+             const Case cases[] = {
+                 {"sin", sin, (R)sinl, -10, 10, 3, 4e-8},
+                 {"sin", sin, (R)sinl, -2e5, 2e5, 3, 4e-8},
+                 {"cos", cos, (R)cosl, -10, 10, 3, 4e-8},
+                 {"cos", cos, (R)cosl, -2e5, 2e5, 3, 4e-8},
+                 {"tan", tan, (R)tanl, -10, 10, 4, 4e-8},
+                 {"exp", exp, (R)expl, -700, 700, 2, 1e-8},
+             };
+             const size_t n = 4096;
+             bool ok = true;
+             for (MathMode mode : {MathMode::Fast, MathMode::Approximate}) {
+                 ExpressionTree et;
+                 et.setMathMode(mode);
+                 for (const Case &c : cases) {
+                     CompiledExpression f =
+                         et.compile(string(c.name) + "(x)", {"x"});
+                     vector<double> xs(n), batch(n);
+                     for (size_t k = 0; k < n; k++)
+                         xs[k] = c.lo + (c.hi - c.lo) *
+                                            fmod(k * 0.6180339887498949, 1.0);
+                     const double *columns[] = {xs.data()};
+                     f.evaluateBatch(nullptr, columns, batch.data(), n);
+                     bool replaced = false;
+                     for (size_t k = 0; k < n; k++) {
+                         long double ref = c.reference(xs[k]);
+                         double r = (double)ref;
+                         double ulp = nextafter(fabs(r), INFINITY) - fabs(r);
+                         for (double y : {f.evaluate(&xs[k]), batch[k]}) {
+                             long double error = fabsl(y - ref);
+                             ok = ok && (mode == MathMode::Fast
+                                             ? error <= c.ulps * ulp
+                                             : error <= c.relative * fabsl(ref));
+                             replaced = replaced || y != c.precise(xs[k]);
+                         }
+                     }
+                     ok = ok && replaced;
+                 }
+                 CompiledExpression log_f = et.compile("log(x)", {"x"});
+                 CompiledExpression pow_f = et.compile("pow(x,y)", {"x", "y"});
+                 for (size_t k = 0; k < n; k++) {
+                     double x =
+                         exp(-30 + 60 * fmod(k * 0.7548776662466927, 1.0));
+                     double args[] = {
+                         x, -20 + 40 * fmod(k * 0.5698402909980532, 1.0)};
+                     ok = ok && log_f.evaluate(&x) == log(x) &&
+                          pow_f.evaluate(args) == pow(args[0], args[1]);
+                 }
+                 ok = ok && et.mathMode() == mode &&
+                      et.calcExpression("log(10)+pow(2,0.5)") ==
+                          log(10.0) + pow(2.0, 0.5);
+             }
+             return ok;
+         }},
+        {"csv round trip",
+         [] {
+             // 小块、多线程处理后，每一行保持原样并追加与单独计算相同的结果，
+             // 缺少字段的行先补上空字段
+             string dir = filesystem::temp_directory_path().string();
+             PipelineOptions options;
+             options.input = dir + "/calculator_test_input.csv";
+             options.output = dir + "/calculator_test_output.csv";
+             options.formulas = {{"s", "x+y"}, {"p", "x*y-x/4"}};
+             options.workers = 4;
+             options.chunk_bytes = 256;
+             vector<string> lines;
+             {
+                 ofstream in(options.input);
+                 in << "x, y ,\"label, quoted\"\n";
+                 for (int i = 0; i < 1000; i++) {
+                     lines.push_back(to_string(i * 0.5) + "," +
+                                     (i % 97 ? to_string(1000 - i) : "") +
+                                     (i % 89 ? ",row" + to_string(i) : ""));
+                     in << lines.back() << "\n";
+                 }
+             }
+             ExpressionTree et;
+             PipelineStats stats = CsvPipeline(et, options).run();
+             CompiledExpression s = et.compile("x+y", {"x", "y"});
+             CompiledExpression p = et.compile("x*y-x/4", {"x", "y"});
+             ifstream out(options.output);
+             string line;
+             bool ok = stats.rows == lines.size() && getline(out, line) &&
+                       line == "x, y ,\"label, quoted\",s,p";
+             for (size_t i = 0; ok && i < lines.size(); i++) {
+                 string row = lines[i] + (i % 89 ? "" : ",");
+                 ok = getline(out, line) && line.compare(0, row.size(), row) == 0;
+                 if (!ok) break;
+                 double x = i * 0.5, y = i % 97 ? 1000.0 - i : NAN;
+                 const char *fields = line.c_str() + row.size() + 1;
+                 char *end;
+                 double sv = strtod(fields, &end);
+                 double pv = strtod(end + 1, &end);
+                 ok = *end == 0 &&
+                      (isnan(y) ? isnan(sv) && isnan(pv)
+                                : sv == s({x, y}) && pv == p({x, y}));
+             }
+             ok = ok && !getline(out, line);
+             filesystem::remove(options.input);
+             filesystem::remove(options.output);
+             return ok;
+         }},
+        {"parallel parse",
+         [] {
+             // 超过 kParallelScriptBytes 的脚本并行分析，结果、错误和
+             // 停止执行的位置与只在当前线程分析相同
+             auto script = [](const string &name, int n, int broken) {
+                 string text = name + "0=1;";
+                 for (int i = 1; i < n; i++)
+                     text += name + to_string(i) + "=" + name +
+                             to_string(i - 1) + "*1.0001+sin(" +
+                             to_string(i) + ")" + (i == broken ? "+w" : "") +
+                             ";";
+                 return text + name + to_string(n - 1) + "+sum(k,1,10,k)";
+             };
+             auto run = [](ExpressionTree &et, const string &text) {
+                 try {
+                     return to_string(et.calcExpression(text));
+                 } catch (exception &e) {
+                     return string(e.what());
+                 }
+             };
+             ExpressionTree parallel, serial;
+             parallel.setParseWorkers(4);
+             serial.setParseWorkers(1);
+             string good = script("v", 4000, -1), bad = script("u", 4000, 3000);
+             if (good.size() < ExpressionTree::kParallelScriptBytes) return false;
+             string expected = run(serial, bad);
+             return run(parallel, good) == run(serial, good) &&
+                    parallel.calcExpression("v2000") ==
+                        serial.calcExpression("v2000") &&
+                    run(parallel, bad) == expected &&
+                    expected.find("w") != string::npos &&
+                    parallel.environment().contains("u2999") &&
+                    !parallel.environment().contains("u3000") &&
+                    serial.environment().contains("u2999") &&
+                    !serial.environment().contains("u3000");
+         }},
+        {"resource limits",
+         [] {
+             // 每一种限制都由对应的表达式触发，报告超过的是哪一种资源，
+             // 没有超过限制的表达式正常计算
+             struct Case {
+                 Resource resource;
+                 string expression;
+             };
+             vector<Case> cases = {
+                 {Resource::Tokens, "1+2+3+4+5+6+7+8+9+10"},
+                 {Resource::Nodes, "x+x+x+x+x+x+x+x+x+x"},
+                 {Resource::Depth, "((((((((((x))))))))))"},
+                 {Resource::Steps, "sum(i,1,3,x)*x*x*x*x*x*x*x"},
+                 {Resource::Iterations, "sum(i,1,1e6,i*x)"},
+                 {Resource::Time, "sum(i,1,1e12,sin(i*x))"}};
+             for (auto &c : cases) {
+                 ResourceLimits limits;
+                 limits.max_tokens = c.resource == Resource::Tokens ? 10 : 0;
+                 limits.max_nodes = c.resource == Resource::Nodes ? 10 : 0;
+                 limits.max_depth = c.resource == Resource::Depth ? 5 : 0;
+                 limits.max_steps = c.resource == Resource::Steps ? 10 : 0;
+                 limits.max_iterations =
+                     c.resource == Resource::Iterations ? 1000 : 0;
+                 limits.time_limit_ms = c.resource == Resource::Time ? 20 : 0;
+                 ExpressionTree et;
+                 et.addVariable("x", 2);
+                 et.setLimits(limits);
+                 if (et.calcExpression("x+1") != 3) return false;
+                 try {
+                     et.calcExpression(c.expression);
+                     return false;
+                 } catch (ResourceLimitException &e) {
+                     if (e.resource() != c.resource) return false;
+                 }
+             }
+             // 缺少操作数的运算符和缺少值的赋值报告语法错误，不会使进程崩溃
+             ExpressionTree et;
+             for (string text :
+                  {"*", "a=1;*;2", "*;a", "b=", "&&1", "1||", "1;*", "-"}) {
+                 try {
+                     et.calcExpression(text);
+                     if (text != "1;*" && text != "-") return false;
+                 } catch (SyntaxError &) {
+                 }
+             }
+             for (string text : {"x*", "&&x"}) {
+                 try {
+                     et.compile(text, {"x"});
+                     return false;
+                 } catch (SyntaxError &) {
+                 }
+             }
+             return et.calcExpression("1;*") == 1;
+         }},
+        {"explain",
+         [] {
+             // 折叠后的语法树，以及每个节点的计算次数
+             ExpressionTree et;
+             et.addUnaryFunction(
+                 "g", function<double(double)>([](double x) { return x + 1; }));
+             string tree = et.explain("2*3+g(1+1)*sin(pi/2)");
+             string expected =
+                 "nodes 6, depth 4, folded 3\n"
+                 "operator +\n"
+                 "  constant 6 <- operator *\n"
+                 "  operator *\n"
+                 "    unary g (impure)\n"
+                 "      constant 2 <- operator +\n"
+                 "    constant 1 <- unary sin (pure)\n";
+             istringstream profile(et.profile("g(2)+1", 100));
+             string line;
+             getline(profile, line);
+             bool ok = tree == expected &&
+                       line.compare(0, 15, "100 iterations,") == 0 &&
+                       getline(profile, line);
+             for (string node : {"operator +", "  unary g (impure)",
+                                 "    integer 2", "  integer 1"}) {
+                 uint64_t calls = 0;
+                 ok = ok && getline(profile, line) &&
+                      (istringstream(line) >> calls) && calls == 100 &&
+                      line.size() > node.size() &&
+                      line.compare(line.size() - node.size(), node.size(),
+                                   node) == 0 &&
+                      line[line.size() - node.size() - 1] == ' ';
+             }
+             return ok && !getline(profile, line);
+         }},
+        {"tiers",
+         [] {
+             // 每一层(包括生成的机器码)的结果与编译表达式完全相同
+             ExpressionTree et;
+             string text = "sin(x)*y+if(x>y,x**2,y/3)+2*3-sqrt(x*x+y*y)";
+             vector<string> params = {"x", "y"};
+             TieringOptions options;
+             options.optimize_after = 64;
+             options.native_after = 128;
+             TieredExpression tiered(et, text, params, options);
+             CompiledExpression reference = et.compile(text, params);
+             vector<double> xs(64), ys(64), out(64);
+             for (size_t i = 0; i < xs.size(); i++) {
+                 xs[i] = i * 0.37 - 10;
+                 ys[i] = 5 - i * 0.21;
+             }
+             const double *columns[] = {xs.data(), ys.data()};
+             vector<Tier> seen;
+             for (int round = 0; round < 4; round++) {
+                 seen.push_back(tiered.tier());
+                 for (size_t i = 0; i < xs.size(); i++)
+                     if (tiered({xs[i], ys[i]}) != reference({xs[i], ys[i]}))
+                         return false;
+                 tiered.evaluateBatch(nullptr, columns, out.data(), out.size());
+                 for (size_t i = 0; i < xs.size(); i++)
+                     if (out[i] != reference({xs[i], ys[i]})) return false;
+                 tiered.wait();
+             }
+             // 没有 C 编译器时停留在 Optimized 层
+             TierStats stats = tiered.stats();
+             Tier top = stats.blocked.empty() ? Tier::Native : Tier::Optimized;
+             return seen.front() == Tier::Baseline && stats.tier == top &&
+                    seen.back() == top &&
+                    stats.transitions.size() == (size_t)top;
+         }},
+        {"workspace",
+         [] {
+             // 合并后每个公式的值与单独编译计算的相同，公共子表达式只保留一份
+             ExpressionTree et;
+             vector<string> inputs = {"x", "y"};
+             vector<string> formulas = {"log(x/y)*2+y", "log(x/y)-x*y",
+                                        "if(x>y,log(x/y),y*x)",
+                                        "sum(i,1,3,i*x)+y*x", "x", "2*3",
+                                        "log(x/y)*2+y"};
+             Workspace workspace(et, inputs);
+             vector<CompiledExpression> separate;
+             for (size_t j = 0; j < formulas.size(); j++) {
+                 workspace.add("f" + to_string(j), formulas[j]);
+                 separate.push_back(et.compile(formulas[j], inputs));
+             }
+             size_t n = 1000;
+             vector<double> xs(n), ys(n);
+             vector<vector<double>> out(formulas.size(), vector<double>(n));
+             vector<double *> outputs;
+             for (auto &column : out) outputs.push_back(column.data());
+             for (size_t i = 0; i < n; i++) {
+                 xs[i] = 0.5 + i * 0.01;
+                 ys[i] = 7 - i * 0.003;
+             }
+             const double *columns[] = {xs.data(), ys.data()};
+             workspace.evaluateBatch(nullptr, columns, outputs.data(), n);
+             for (size_t i = 0; i < n; i++) {
+                 vector<double> values = workspace.evaluate({xs[i], ys[i]});
+                 for (size_t j = 0; j < formulas.size(); j++) {
+                     double expected = separate[j]({xs[i], ys[i]});
+                     if (values[j] != expected || out[j][i] != expected)
+                         return false;
+                 }
+             }
+             WorkspaceStats stats = workspace.stats();
+             return stats.formulas == formulas.size() && stats.shared_nodes > 0 &&
+                    stats.nodes < stats.instructions;
+         }},
+        {"static expression",
+         [] {
+             // 编译期分析的表达式与运行时编译的表达式结果相同
+             ExpressionTree et;
+             bool ok = true;
+             auto check = [&](auto f) {
+                 CompiledExpression program =
+                     et.compile(string(f.text), f.parameters());
+                 double args[2];
+                 for (int k = 0; k < 200; k++) {
+                     args[0] = k * 0.05 - 5;
+                     args[1] = 1.5 - k * 0.01;
+                     double a = program.evaluate(args), b = f.evaluate(args);
+                     ok = ok && (a == b || (isnan(a) && isnan(b)));
+                 }
+             };
+             check(CALCULATOR_STATIC("x*(2**10/3+1)-y*(sqrt(2)+1)"));
+             check(CALCULATOR_STATIC("sin(x)*cos(y)+exp(x*0.1)"));
+             check(CALCULATOR_STATIC("if(x>y, pow(x,2), max(x,y))"));
+             check(CALCULATOR_STATIC("-x**2+0x1F-0b101*y/pi+log(y)"));
+             auto constant = CALCULATOR_STATIC("2**10/3+sqrt2*(1<<4)");
+             static_assert(constant.arity() == 0, "no parameters");
+             return ok && constant() == et.calcExpression("2**10/3+sqrt2*(1<<4)");
+         }},
+        {"philox",
+         [] {
+             // Random123 的已知答案(kat_vectors 中的 philox4x32_10)
+             using Counter = Philox4x32::Counter;
+             bool ok =
+                 Philox4x32::generate({0, 0, 0, 0}, {0, 0}) ==
+                     Counter{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8} &&
+                 Philox4x32::generate(
+                     {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+                     {0xffffffff, 0xffffffff}) ==
+                     Counter{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd} &&
+                 Philox4x32::generate(
+                     {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+                     {0xa4093822, 0x299f31d0}) ==
+                     Counter{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1};
+             // 随机数流只取决于种子、流号和序号
+             RandomStream a(7, 3), b(7, 3), c(8, 3);
+             bool differ = false;
+             for (int i = 0; i < 100; i++) {
+                 double x = a.uniform();
+                 ok = ok && x == b.uniform() && x >= 0 && x < 1;
+                 differ = differ || x != c.uniform();
+             }
+             return ok && differ;
+         }},
+        {"seeded sample",
+         [] {
+             // 同一个种子的采样结果与线程数无关，均值在置信区间内
+             ExpressionTree et;
+             CompiledExpression f = et.compile("uniform(0,1)+normal(x,1)", {"x"});
+             size_t threads = numeric::maxThreads();
+             MonteCarloOptions options;
+             options.seed = 42;
+             numeric::setMaxThreads(1);
+             SampleStats serial = monteCarlo(f, {2.0}, 100000, options);
+             numeric::setMaxThreads(4);
+             SampleStats parallel = monteCarlo(f, {2.0}, 100000, options);
+             options.seed = 43;
+             SampleStats other = monteCarlo(f, {2.0}, 100000, options);
+             numeric::setMaxThreads(threads);
+             return serial.count == 100000 && serial.mean == parallel.mean &&
+                    serial.variance == parallel.variance &&
+                    serial.lower == parallel.lower && other.mean != serial.mean &&
+                    fabs(serial.mean - 2.5) < 5 * serial.std_error &&
+                    fabs(serial.variance - (1.0 / 12 + 1)) < 0.05;
+         }},
+        {"incremental script",
+         [] {
+             // 每次编辑后的结果(或错误)与在快照上整体计算相同
+             ExpressionTree session;
+             session.addVariable("k", 2);
+             IncrementalScript script(
+                 session, "a=1;b=a*2+k;c=sin(b);d=sum(i,1,5,i*c);d+b");
+             auto result = [](auto &&evaluate) {
+                 try {
+                     return to_string(evaluate());
+                 } catch (exception &e) {
+                     return string(e.what());
+                 }
+             };
+             auto same = [&] {
+                 ExpressionTree full(session.snapshot());
+                 return result([&] { return script.evaluate(); }) ==
+                        result([&] { return full.calcExpression(script.text()); });
+             };
+             bool ok = same();
+             // 只改最后一条语句: 前面的语句沿用上一次的值
+             script.edit(script.text().size() - 1, 1, "c");
+             ok = ok && same() && script.stats().evaluated == 1 &&
+                  script.stats().reused == 4;
+             // 修改第一条语句，插入和删除语句
+             script.edit(2, 1, "3");
+             ok = ok && same();
+             script.edit(4, 0, "f=a+1;");
+             ok = ok && same() && !script.stats().full &&
+                  script.text() ==
+                      "a=3;f=a+1;b=a*2+k;c=sin(b);d=sum(i,1,5,i*c);d+c";
+             script.edit(4, 6, "");
+             ok = ok && same();
+             // 出错和修复，不能按语句计算的重复赋值
+             script.edit(2, 1, "zz");
+             ok = ok && same();
+             script.edit(2, 2, "4");
+             ok = ok && same();
+             script.edit(0, 0, "a=5;");
+             ok = ok && same() && script.stats().full;
+             // 没有操作数的值不赋值，停止的语句是重复赋值，整体计算时先折叠常量
+             for (string text :
+                  {"c=*;c", "a=1;b=a;c=*;x=c-b;c+x", "b=1;b=a2;c;x=1",
+                   "**1>[1,2]", "2.5!>[1,2]pi&&"}) {
+                 script.setText(text);
+                 ok = ok && same();
+             }
+             return ok;
+         }},
+        {"async store",
+         [] {
+             // 模拟的键值存储: 在自己的线程中完成请求，键 k 的值为 10k，
+             // 不在 [0,10) 中的键返回错误
+             struct FakeStore {
+                 mutex lock;
+                 condition_variable ready;
+                 deque<pair<double, AsyncDoneType>> requests;
+                 size_t pending = 0, max_pending = 0;
+                 bool stop = false;
+                 thread worker{[this] { run(); }};
+
+                 ~FakeStore() {
+                     {
+                         lock_guard<mutex> guard(lock);
+                         stop = true;
+                     }
+                     ready.notify_all();
+                     worker.join();
+                 }
+                 void get(double key, AsyncDoneType done) {
+                     {
+                         lock_guard<mutex> guard(lock);
+                         requests.emplace_back(key, move(done));
+                         max_pending = max(max_pending, ++pending);
+                     }
+                     ready.notify_one();
+                 }
+                 void run() {
+                     unique_lock<mutex> guard(lock);
+                     for (;;) {
+                         ready.wait(guard,
+                                    [this] { return stop || !requests.empty(); });
+                         if (requests.empty()) return;
+                         auto batch = move(requests);
+                         requests.clear();
+                         guard.unlock();
+                         this_thread::sleep_for(chrono::microseconds(200));
+                         for (auto &[key, done] : batch) {
+                             if (key >= 0 && key < 10)
+                                 done(key * 10, nullptr);
+                             else
+                                 done(0, make_exception_ptr(
+                                             runtime_error("key not found")));
+                         }
+                         guard.lock();
+                         pending -= batch.size();
+                     }
+                 }
+             };
+             FakeStore store;
+             ExpressionTree et;
+             et.addAsyncFunction("get", [&](double key, AsyncDoneType done) {
+                 store.get(key, move(done));
+             });
+             // 同步计算时等待结果
+             bool ok = et.calcExpression("get(1)+get(2)*get(3)") == 610;
+             AsyncEvaluator evaluator(et, 4);
+             vector<future<double>> results;
+             for (int i = 0; i < 100; i++)
+                 results.push_back(evaluator.evaluate(
+                     "get(" + to_string(i % 10) + ")+get(get(0)+1)*get(2)+"
+                     "if(get(1)>5,get(3),get(99))"));
+             future<double> missing = evaluator.evaluate("get(1)+get(99)");
+             for (int i = 0; i < 100; i++)
+                 ok = ok && results[i].get() == (i % 10) * 10 + 10 * 20 + 30;
+             try {
+                 missing.get();
+                 ok = false;
+             } catch (runtime_error &e) {
+                 ok = ok && string(e.what()) == "key not found";
+             }
+             AsyncStats stats = evaluator.stats();
+             return ok && stats.completed == 101 && stats.batches < stats.calls &&
+                    store.max_pending > 1;
+         }},
+        {"C API",
+         [] {
+             // 出错时返回错误码，原因由 calculator_last_error 给出
+             calculator_session *session = calculator_session_create();
+             double result = 0;
+             bool ok =
+                 calculator_set_variable(session, "a", 2) == CALCULATOR_OK &&
+                 calculator_evaluate(session, "b=3;a*b+1", &result) ==
+                     CALCULATOR_OK &&
+                 result == 7;
+             ok = ok && calculator_evaluate(session, "1/0", &result) ==
+                            CALCULATOR_ERROR &&
+                  string(calculator_last_error()).find("zero") != string::npos;
+             const char *names[] = {"x", "y"};
+             calculator_function *f =
+                 calculator_compile(session, "a*x+y", names, 2);
+             calculator_session_destroy(session);
+             double args[] = {3, 4}, xs[] = {1, 2, 3}, out[3];
+             const double *columns[] = {xs, nullptr};
+             ok = ok && f && calculator_function_arity(f) == 2 &&
+                  calculator_function_evaluate(f, args, &result) ==
+                      CALCULATOR_OK &&
+                  result == 10 &&
+                  calculator_function_evaluate_batch(f, args, columns, out,
+                                                     3) == CALCULATOR_OK &&
+                  out[0] == 6 && out[2] == 10;
+             // 有参数时 args 不能为空，批量计算时缺少的列也要由 args 给出
+             ok = ok &&
+                  calculator_function_evaluate(f, nullptr, &result) ==
+                      CALCULATOR_ERROR &&
+                  string(calculator_last_error()) == "Error: args is null" &&
+                  calculator_function_evaluate_batch(f, nullptr, nullptr, out,
+                                                     3) == CALCULATOR_ERROR &&
+                  calculator_function_evaluate_batch(f, nullptr, columns, out,
+                                                     3) == CALCULATOR_ERROR;
+             calculator_function_destroy(f);
+             // 没有参数的函数 args 可以为空
+             session = calculator_session_create();
+             calculator_function *g =
+                 calculator_compile(session, "2+3", nullptr, 0);
+             ok = ok && calculator_function_evaluate(g, nullptr, &result) ==
+                            CALCULATOR_OK &&
+                  result == 5 &&
+                  !calculator_compile(session, "1+", nullptr, 0) &&
+                  *calculator_last_error() &&
+                  !calculator_compile(nullptr, "1", nullptr, 0) &&
+                  string(calculator_last_error()) == "Error: session is null";
+             calculator_function_destroy(g);
+             calculator_session_destroy(session);
+             return ok;
+         }},
+        {"shared registry",
+         [] {
+             // 共享注册表的会话看到彼此注册的函数，变量互不影响
+             ExpressionTree a;
+             ExpressionTree b(a.registry());
+             a.addUnaryFunction("triple", [](double x) { return 3 * x; });
+             a.addVariable("v", 1);
+             b.addVariable("v", 2);
+             bool ok = b.registry() == a.registry() &&
+                       b.calcExpression("triple(v)") == 6 &&
+                       a.calcExpression("triple(v)") == 3;
+             // 其他线程计算时反复发布新版本: 一次计算中的调用都使用同一个
+             // 版本(和是 100 的整数倍)，每个线程看到的版本不会倒退
+             const int versions = 2000, reader_count = 4;
+             auto version = [&](int k) {
+                 a.addUnaryFunction("ver", [k](double) { return k; });
+             };
+             version(0);
+             uint64_t published = a.registry()->version();
+             atomic<bool> done{false}, consistent{true};
+             atomic<int> started{0};
+             vector<thread> readers;
+             for (int t = 0; t < reader_count; t++)
+                 readers.emplace_back([&] {
+                     ExpressionTree reader(a.registry());
+                     double last = 0;
+                     for (bool first = true; !done || first; first = false) {
+                         double k =
+                             reader.calcExpression("sum(i,1,100,ver(i))") / 100;
+                         if (k != floor(k) || k < last || k > versions)
+                             consistent = false;
+                         last = k;
+                         if (first) started++;
+                     }
+                 });
+             while (started < reader_count) this_thread::yield();
+             for (int k = 1; k <= versions; k++) version(k);
+             done = true;
+             for (auto &reader : readers) reader.join();
+             // 读者都结束后，下一次发布时回收全部旧版本
+             version(versions);
+             return ok && consistent &&
+                    a.registry()->version() == published + versions + 1 &&
+                    a.registry()->retired() == 0 &&
+                    b.calcExpression("ver(0)") == versions;
+         }},
+        {"exact factorial",
+         [] {
+             // 二分递归的阶乘与逐个相乘的结果相同，大数的十进制输出可以读回
+             ExpressionTree et;
+             ExactNumber f = et.calcExact("factorial(100)");
+             BigInt g = 1;
+             for (int i = 1; i <= 1000; i++) g = g * BigInt(i);
+             string digits = BigInt::factorial(1000).toString();
+             int digit_sum = 0;
+             for (char c : digits) digit_sum += c - '0';
+             return f.exact() &&
+                    f.toString() ==
+                        "933262154439441526816992388562667004907159682643816214"
+                        "685929638952175999932299156089414639761565182862536979"
+                        "20827223758251185210916864000000000000000000000000" &&
+                    BigInt::factorial(1000) == g && digits.size() == 2568 &&
+                    digit_sum == 10539 && BigInt::parse(digits) == g;
+         }},
+        {"exact karatsuba",
+         [] {
+             // 两边都超过 kKaratsubaLimbs 的乘积与按 32 位分段的竖式乘法相同，
+             // 再用 D 算法除回去
+             BigInt a = BigInt::pow(3, 1000), b = BigInt::pow(7, 600);
+             BigInt product = a * b, schoolbook = 0;
+             for (size_t k = 0; k * 32 < b.bitLength(); k++) {
+                 BigInt chunk = b.shiftRight(k * 32) & BigInt(0xffffffff);
+                 schoolbook = schoolbook + (a * chunk).shiftLeft(k * 32);
+             }
+             return a.bitLength() == 1585 && b.bitLength() == 1685 &&
+                    product == schoolbook &&
+                    product % BigInt(1000000007) == BigInt(411932052) &&
+                    product.toString().size() == 985 && product / a == b &&
+                    (product + BigInt(12345)) % b == BigInt(12345) &&
+                    (-product) / b == -a;
+         }},
+        {"exact rational",
+         [] {
+             ExpressionTree et;
+             ExactNumber third = et.calcExact("2**200/3");
+             ExactNumber back = et.calcExact("2**200/3*3-2**200");
+             return third.exact() &&
+                    third.toString() ==
+                        "16069380442589902755419620923411626025222029937827928"
+                        "35301376/3" &&
+                    back.exact() && back.rational().isZero() &&
+                    et.calcExact("0.1+0.2").toString() == "3/10";
+         }},
+        {"exact bitwise",
+         [] {
+             // 负数按向高位无限延伸的补码计算，右移向负无穷取整
+             BigInt x = -BigInt::pow(2, 100);
+             return x.shiftRight(3).toString() ==
+                        "-158456325028528675187087900672" &&
+                    (x - BigInt(1)).shiftRight(3).toString() ==
+                        "-158456325028528675187087900673" &&
+                    (x & (BigInt::pow(2, 101) - BigInt(1))).toString() ==
+                        "1267650600228229401496703205376" &&
+                    ((x + BigInt(5)) | BigInt(3)).toString() ==
+                        "-1267650600228229401496703205369" &&
+                    (x ^ BigInt::pow(2, 64)).toString() ==
+                        "-1267650600209782657422993653760" &&
+                    (~x).toString() == "1267650600228229401496703205375" &&
+                    (x - BigInt(7)).shiftRight(200) == BigInt(-1);
+         }},
+        {"exact int64 boundary",
+         [] {
+             // 小整数溢出时转为大数，回到 int64 的范围内时转回小整数
+             BigInt max = INT64_MAX, min = INT64_MIN;
+             BigInt above = max + BigInt(1), below = min - BigInt(1);
+             return !above.isSmall() &&
+                    above.toString() == "9223372036854775808" &&
+                    (above - BigInt(1)).isSmall() && above - BigInt(1) == max &&
+                    !below.isSmall() &&
+                    below.toString() == "-9223372036854775809" &&
+                    (below + BigInt(1)).isSmall() &&
+                    (min * BigInt(-1)).toString() == "9223372036854775808" &&
+                    (min / BigInt(-1)) == above && (-min) == above &&
+                    (max * max).toString() ==
+                        "85070591730234615847396907784232501249" &&
+                    (max * max) / max == max;
+         }},
+#ifdef CALCULATOR_EXAMPLE_PLUGIN
+        {"plugin",
+         [] {
+             // 标量版本、只有批量版本的函数，sum 整块调用批量版本
+             auto et = make_unique<ExpressionTree>();
+             et->loadPlugin(CALCULATOR_EXAMPLE_PLUGIN);
+             bool ok = et->calcExpression("square(3)+twice(4)") == 17 &&
+                       et->calcExpression("sum(i,1,100,square(i))") == 338350;
+             // 会话释放、插件重新加载之后，编译表达式继续使用原来的批量版本
+             CompiledExpression f = et->compile("square(x)+twice(x)", {"x"});
+             et.reset();
+             ExpressionTree reloaded;
+             reloaded.loadPlugin(CALCULATOR_EXAMPLE_PLUGIN);
+             vector<double> x(1000), y(x.size());
+             for (size_t i = 0; i < x.size(); i++) x[i] = i * 0.5;
+             const double *columns[] = {x.data()};
+             f.evaluateBatch(nullptr, columns, y.data(), y.size());
+             for (size_t i = 0; i < x.size(); i++)
+                 ok = ok && y[i] == x[i] * x[i] + 2 * x[i];
+             // square 使用插件的导数，twice 使用数值差分
+             return ok && fabs(f.gradient({3.0})[0] - 8) < 1e-6;
+         }},
+        {"plugin missing symbol",
+         [] {
+             ExpressionTree et;
+             try {
+                 et.loadPlugin(CALCULATOR_BROKEN_PLUGIN);
+             } catch (PluginException &e) {
+                 return string(e.what()).find("is not a calculator plugin") !=
+                        string::npos;
+             }
+             return false;
+         }},
+#endif
+#ifdef CALCULATOR_LOADGEN
+        {"loadgen",
+         [] {
+             // 压测工具的冒烟测试: 进程内计算和发送到服务模式，随机生成的
+             // 表达式都没有错误
+             auto run = [](const string &target) {
+                 string command = string(CALCULATOR_LOADGEN) + target +
+                                  " --synthetic 50 --seed 1 --threads 2"
+                                  " --requests 200 2>&1";
+                 FILE *pipe = popen(command.c_str(), "r");
+                 if (!pipe) return false;
+                 string output;
+                 char buffer[256];
+                 while (size_t n = fread(buffer, 1, sizeof(buffer), pipe))
+                     output.append(buffer, n);
+                 return pclose(pipe) == 0 &&
+                        output.find("\"requests\": 200,") != string::npos &&
+                        output.find("\"errors\": 0,") != string::npos &&
+                        output.find("\"p99\"") != string::npos;
+             };
+             ServerOptions options;
+             options.unix_path = filesystem::temp_directory_path().string() +
+                                 "/calculator_test_loadgen.sock";
+             options.workers = 2;
+             filesystem::remove(options.unix_path);
+             Server server(options);
+             thread loop([&] { server.run(); });
+             bool ok = run("") && run(" --unix " + options.unix_path);
+             server.stop();
+             loop.join();
+             return ok;
+         }},
+#endif
+    };
+    return tests;
+}
+
+inline int feature_test() {
+    int failed = 0;
+    for (const FeatureTest &t : featureTests()) {
+        bool ok = false;
+        try {
+            ok = t.run();
+        } catch (exception &e) {
+            cerr << t.name << ": " << e.what() << endl;
+        }
+        cout << t.name << ": " << (ok ? "ok" : "FAILED") << "\n";
+        if (!ok) failed++;
+    }
+    return failed;
+}
 
-int expression_test() {
-    expression =
-        "100-sin(1234+10/18*cos(129))/1023*19999";  // 81.84392659975263
-    __TEST__
-    expression = "10-9+12*3/pow(2,10)-10*192";  // -1918.96484375
-    __TEST__
-    expression = "100-cos(17)+pow(3,8)";  // 6661.275163338051
-    __TEST__
-    expression =
-        "a=100;b=1.234;c=0.234;-123*9/23.4+pow(c+a/b,3)-pow(cos(pi/"
-        "3),sin(18332))*100/12*73.4324-192+192/992/cos(12)*pow(111,1e-3)*a/pi/"
-        "(8*12/10/e)";  // 535572.732147942
-    __TEST__
-    expression = "exp(10)";  // 22026.465794806718
-    __TEST__
-    expression = "func(100)-sin(cos(pow(12,5)))";  // 199.47680614214548
-    __TEST__
-    expression =
-        "a=100;b=1010100;a+1000+cos(a+pow(tan(a+b),2))/log(999/a)+cos(a)";  // 1100.4561295864257
-    __TEST__
-    expression = "e3=12345;log2(e3)";  // 13.591639216030144
-    __TEST__
-    expression = "h(-13e-4,-5)/log(100000)";  // -869.7181294594521
-    __TEST__
-    expression = "123.33*2";  // 246.66
-    __TEST__
-    expression = "19199&(172121|1910)^123";  // 516
-    __TEST__
-    expression = "2*2<<11>>1";  // 4096
-    __TEST__
-    expression = "a12=100;1+3*a12/10";  // 31.0
-    __TEST__
-    expression = "9**-3/12";  // 0.00011431184270690443
-    __TEST__
-    expression = "-311>>2";  // -78
-    __TEST__
-    expression = "pow(10<<2,20)";  // 1.099511627776e+32
-    __TEST__
-    expression = "10+0x11 + 100";  // 127
-    __TEST__
-    expression = "0b10101010";  // 170
-    __TEST__
-    expression = "0xffffeeAA / 0b0101010 + 0o7777 - 100";  // 102265015.42857143
-    __TEST__
-    expression = "0o10111 + 111.1234";  // 4280.1234
-    __TEST__
-    expression = "0. + 0.12121 + 0b10101010";  // 170.12121
-    __TEST__
-    expression = "1.001+0.-100";  // -98.999
-    __TEST__
-    expression = "a=pi;b=a;a+10.1+var/1000;";  // 1013.2405926535898
-    __TEST__
-    expression = "5/func(111)+12";  // 12.022522522522523
-    __TEST__
-    expression = "a=10;b=100*200;b/100.2";  // 199.6007984031936
-    __TEST__
-    expression = "a=10;x=-1000;b=100*pow(100,2)+100;b/2*x/a";  // -50005000.0
-    __TEST__
-    expression =
-        "b=pi*e/(sin(tan(10)))/(1+-100*1.2/cos(0.12e4));a=b+122;a*10";  // 1218.81632320905
-    __TEST__
-    expression = "cos(12.34/(111.22*exp(3)))";  // 0.9999847430913299
-    __TEST__
-    expression = "sin((2+1))";  // 0.1411200080598672
-    __TEST__
-    expression =
-        "a=1000 "
-        ";b=0.341;a/0.1-100/1999*(a*b-111/23*123/0.12*a+b-a+b/(a+b*-123.33e3))";  // 257493.63629029953
-    __TEST__
-    expression = ";;;;y=10000*200;;;a=100;;;b=100;;;a+100+b*y;";  // 200000200
-    __TEST__
-    expression = "cos(2+(100)+100)";  // 0.591345375451585
-    __TEST__
-    expression = "cos(2+(100+2)+10)";  // 0.6195206125592099
-    __TEST__
-    expression =
-        "a=10;0.0001e5*(pow(101*a/"
-        "10,cos(0.31*pi*199)))-1*cos((2)+2)-max(cos(100),sin(200))/"
-        "pow(2,cos(20))";  // 133.84679913329174
-    __TEST__
-    expression =
-        "cos(((((((((((((((19))+10)))))/1000))))*1911*cos(100)))))";  // -0.7869416029408316
-    __TEST__
-    expression =
-        "cos(2+(((((((((((((((((((((((((((((((((((((((((((sin(1111))))))))+100)"
-        "))))*2000)))))))))*2)))))))))))))))))))))))";  // 0.16178461176298067
-    __TEST__
-    expression = "a=10<<2;a+1";  // 41
-    __TEST__
-    expression = "a=1000;x=a;b=x;b";  // 1000
-    __TEST__
-    expression =
-        "-1000-log2(pi*e/-max(10,min(-100,-cos(-pi*22*exp(3)))))";  // -nan
-    __TEST__
-    expression = "a=100;b=-a-100;c=a-2*b/a;c";  // 104
-    __TEST__
-    expression = "1000-pow(100,2)";
-    __TEST__
-    expression =
-        "-1000+-log2(-pi*e/-max(10,min(-100,-cos(pi*22*exp(3)))))";  // -999.7722630754739
-    __TEST__
-    expression = "-pi";  // -3.14......
-    __TEST__
-    expression = "-1+-log(101010)";  // -12.52297480082323
-    __TEST__
-    expression = " 1. - - - - -100";  // bad example
-    __TEST__
-    expression = "1. - - - - - -100";  // bad example
-    __TEST__
-    expression = "1. - - - - --100";  // bad example
-    __TEST__
-    expression = "1- - - - - -100";  // bad example
-    __TEST__
-    expression = "1*-pow(2,3)";  // -8
-    __TEST__
-    expression = "1--100";  // bad example
-    __TEST__
-    expression = "1-+100";  // -99
-    __TEST__
-    expression = "1+-100";  // -99
-    __TEST__
-    expression = "1++100";  // bad example
-    __TEST__
-    expression = "1 + -100 + 100 - +1000 - +1000 + -10100";  // -12099
-    __TEST__
-    expression = "-12e-3+12.33e+2-10.e1";  // -12e-3+12.33e+2-10.e1
-    __TEST__
-    expression = "100e3-100*pow(4,7)";  // -1538400.0
-    __TEST__
-    return 0;
+inline int expression_test() {
+    for (const TestCase &c : testCases()) {
+        expression = c.expression;
+        if (c.params.empty())
+            Test();
+        else
+            CompileTest(c.params, c.args);
+    }
+    return feature_test() ? 1 : 0;
 }
 
-#endif
\ No newline at end of file
+#endif
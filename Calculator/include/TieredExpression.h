@@ -0,0 +1,145 @@
+#ifndef MYEASYCALCULATOR_TIEREDEXPRESSION_H
+#define MYEASYCALCULATOR_TIEREDEXPRESSION_H
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CompiledExpression.h"
+#include "Environment.h"
+#include "Registry.h"
+
+namespace calculator {
+
+class ExpressionTree;
+
+// 分层执行的层次，从低到高
+enum class Tier {
+    Baseline,   // 不做常量折叠的编译表达式，编译最快
+    Optimized,  // 常量折叠后的编译表达式(与 ExpressionTree::compile 相同)
+    Native      // 生成的 C 代码，用系统的 C 编译器编译为动态库后加载
+};
+
+const char *tierName(Tier tier);
+
+struct TieringOptions {
+    // 计算的点数达到这个值后在后台编译 Optimized 层
+    uint64_t optimize_after = 1000;
+    // 计算的点数达到这个值后在后台编译 Native 层，0 表示不编译为机器码
+    uint64_t native_after = 100000;
+    // 编译 C 代码的命令
+    std::string compiler = "cc";
+};
+
+// 一次层次的切换
+struct TierTransition {
+    Tier from, to;
+    // 开始编译时已经计算的点数
+    uint64_t calls;
+    // 后台编译的耗时(毫秒)
+    double compile_ms;
+};
+
+struct TierStats {
+    Tier tier;
+    // 已经计算的点数(多个线程同时计算时是近似值)
+    uint64_t calls;
+    std::vector<TierTransition> transitions;
+    // 后台正在编译下一层
+    bool compiling;
+    // 不能升到下一层的原因(比如用到了自定义函数、没有 C 编译器)
+    std::string blocked;
+};
+
+/*
+ * 分层执行的编译表达式: 大多数表达式只计算几次，少数会计算上百万次。
+ * 开始时使用编译最快的 Baseline 层并统计计算的点数，超过阈值后在后台线程中
+ * 编译下一层，完成后原子地替换，正在计算的线程不需要停下来:
+ *   Baseline -> Optimized  常量折叠
+ *   Optimized -> Native    只用到运算符、条件表达式和内置数学函数(精确模式)时
+ *                          生成 C 代码，编译为动态库后加载，结果与编译表达式相同
+ * 常量子表达式中的错误(比如 1/0)在编译 Optimized 层时才发现，之后停留在
+ * Baseline 层，原因见 stats().blocked。
+ * 后台编译使用创建时的变量快照和同一个函数注册表。计数只用普通的原子读写，
+ * 多个线程同时计算时会少计一些，只影响升级的时机。
+ * 与 CompiledExpression 一样可以在多个线程中同时计算
+ */
+class TieredExpression {
+   public:
+    // 用 et 的当前变量和函数编译 Baseline 层，表达式有错误时抛出异常
+    TieredExpression(ExpressionTree &et, const std::string &text,
+                     const std::vector<std::string> &params = {},
+                     const TieringOptions &options = TieringOptions());
+    ~TieredExpression();
+    TieredExpression(const TieredExpression &) = delete;
+    TieredExpression &operator=(const TieredExpression &) = delete;
+
+    const std::vector<std::string> &parameters() const { return parameters_; }
+    size_t arity() const { return parameters_.size(); }
+
+    // 同 CompiledExpression::evaluate/evaluateBatch，批量计算按点数计数
+    double evaluate(const double *args) const;
+    double operator()(const std::vector<double> &args) const;
+    void evaluateBatch(const double *args, const double *const *columns,
+                       double *out, size_t n) const;
+
+    Tier tier() const { return tier_.load(std::memory_order_acquire); }
+    TierStats stats() const;
+    // 等待后台正在进行的编译完成
+    void wait();
+
+   private:
+    using NativeFunction = double (*)(const double *);
+    using NativeBatch = void (*)(const double *, const double *const *,
+                                 double *, size_t);
+    // 加载的动态库
+    struct NativeCode;
+
+    // 计入 n 个点，达到阈值时开始后台编译
+    void count(uint64_t n) const {
+        uint64_t calls = calls_.load(std::memory_order_relaxed) + n;
+        calls_.store(calls, std::memory_order_relaxed);
+        if (calls >= threshold_.load(std::memory_order_relaxed)) promote();
+    }
+    void promote() const;
+    // 在后台线程中编译下一层，calls 为开始编译时的点数
+    void compileNext(uint64_t calls);
+    std::unique_ptr<NativeCode> compileNative(const CompiledExpression &program);
+    // 生成计算 program 的 C 函数，返回函数的编号；不能生成时返回 -1，
+    // reason 为原因
+    static int generate(const CompiledExpression &program, std::string &source,
+                        int &functions, std::string &reason);
+
+    std::string text_;
+    std::vector<std::string> parameters_;
+    TieringOptions options_;
+    std::shared_ptr<Registry> registry_;
+    Environment environment_;
+
+    // 编译好的各层，析构前不会释放
+    std::unique_ptr<const CompiledExpression> baseline_, optimized_;
+    std::unique_ptr<NativeCode> native_;
+    // Optimized 层编译时是精确的数学模式(快速模式的函数不能生成 C 代码)
+    bool precise_ = true;
+
+    // 当前使用的层，计算时只读这几个指针
+    std::atomic<const CompiledExpression *> program_{nullptr};
+    std::atomic<NativeFunction> native_function_{nullptr};
+    std::atomic<NativeBatch> native_batch_{nullptr};
+    std::atomic<Tier> tier_{Tier::Baseline};
+
+    mutable std::atomic<uint64_t> calls_{0};
+    // 下一次升级的点数，没有下一层或者正在编译时为最大值
+    mutable std::atomic<uint64_t> threshold_{0};
+    mutable std::mutex mutex_;
+    mutable std::thread worker_;
+    mutable bool compiling_ = false;
+    std::vector<TierTransition> transitions_;
+    std::string blocked_;
+};
+
+}  // namespace calculator
+#endif
@@ -2,7 +2,9 @@
 #define MYEASYCALCULATOR_TOKEN_H
 
 #include <functional>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "Reader.h"
 
@@ -13,6 +15,7 @@ enum class Tag {
     Number,          // 十进制数
     Float,           // 浮点数
     Identifier,      // 标识符,变量名
+    Array,           // 数组(数组变量或者数组字面量 [1,2,3])
     And,             // &
     Or,              // |
     Not,             // !
@@ -27,13 +30,26 @@ enum class Tag {
     ShiftLeft,       // <<
     ShiftRight,      // >>
     Pow,             // **
+    Less,            // <
+    LessEqual,       // <=
+    Greater,         // >
+    GreaterEqual,    // >=
+    EqualEqual,      // ==
+    NotEqual,        // !=
+    LogicalAnd,      // &&
+    LogicalOr,       // ||
+    Conditional,     // 条件表达式 if(c,a,b)，只计算选中的分支
     Function,        // 一元函数 sin(x)
     BinaryFunction,  // 二元函数 pow(x,y)
+    Builtin,         // 内置的多参数函数 integrate(f,x,a,b)
+    Reduction,       // 数组的归约 sum(a) mean(a) min(a) max(a) dot(a,b)
     END_SEP,         // 变量分隔符 ;
     BEGIN_FUNC,      // 函数定义的开始 f(
     END_FUNC,        // 函数定义的结束 )
     BEGIN_BRACKET,   // 一般的左括号
     END_BRACKET,     // 一般的右括号
+    BEGIN_ARRAY,     // 数组字面量的开始 [
+    END_ARRAY,       // 数组字面量的结束 ]
     Other            // 其他不需要解析的字符，比如二元函数的,
 };
 
@@ -48,8 +64,13 @@ class Token {
         {Tag::Div, "/"},         {Tag::Equal, "="},
         {Tag::Mod, "%"},         {Tag::ShiftLeft, "<<"},
         {Tag::ShiftRight, ">>"}, {Tag::Pow, "**"},
+        {Tag::Less, "<"},        {Tag::LessEqual, "<="},
+        {Tag::Greater, ">"},     {Tag::GreaterEqual, ">="},
+        {Tag::EqualEqual, "=="}, {Tag::NotEqual, "!="},
+        {Tag::LogicalAnd, "&&"}, {Tag::LogicalOr, "||"},
         {Tag::END_SEP, ";"},     {Tag::BEGIN_BRACKET, "("},
-        {Tag::END_BRACKET, ")"}};
+        {Tag::END_BRACKET, ")"}, {Tag::BEGIN_ARRAY, "["},
+        {Tag::END_ARRAY, "]"}};
 
     Token(Tag tag) : __tag(tag) {}
     Token(char c) : __tag(Tag::Other), __c(c) {}
@@ -91,6 +112,22 @@ class Float : public Token {
     double __value;
 };
 
+// 数组变量，在词法分析时替换为它的值(和标量变量一样)
+class ArrayConstant : public Token {
+   public:
+    ArrayConstant(std::shared_ptr<const std::vector<double>> value)
+        : Token(Tag::Array), __value(std::move(value)) {}
+    std::string toString() {
+        return "[" + std::to_string(__value->size()) + " elements]";
+    }
+    const std::shared_ptr<const std::vector<double>>& value() {
+        return __value;
+    }
+
+   private:
+    std::shared_ptr<const std::vector<double>> __value;
+};
+
 // 变量
 class Word : public Token {
    public:
@@ -117,5 +154,17 @@ class BinaryFunction : public Word {
     BinaryFunction(const std::string& name, bool minus = false)
         : Word(name, minus, Tag::BinaryFunction) {}
 };
+// 内置的多参数函数，参数中可以有绑定变量，比如 integrate(sin(x),x,0,pi)
+class BuiltinFunction : public Word {
+   public:
+    BuiltinFunction(const std::string& name, bool minus = false)
+        : Word(name, minus, Tag::Builtin) {}
+};
+// 数组的归约函数 sum(a)，与同名的多参数函数 sum(i,lo,hi,f) 按参数个数区分
+class ReductionFunction : public Word {
+   public:
+    ReductionFunction(const std::string& name, bool minus = false)
+        : Word(name, minus, Tag::Reduction) {}
+};
 }  // namespace calculator
 #endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef MYEASYCALCULATOR_WORKSPACE_H
+#define MYEASYCALCULATOR_WORKSPACE_H
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CompiledExpression.h"
+
+namespace calculator {
+
+class ExpressionTree;
+
+struct WorkspaceStats {
+    size_t formulas = 0;
+    // 各公式单独编译的指令数之和，即不合并时每个点的计算量
+    size_t instructions = 0;
+    // 合并后的节点数
+    size_t nodes = 0;
+    // 被多个公式用到的节点数
+    size_t shared_nodes = 0;
+    // 计算时同时需要保存的值的个数(批量计算时每个值是一列)
+    size_t slots = 0;
+};
+
+/*
+ * 一组使用相同输入的公式: 每个公式编译后合并到同一个有向无环图中，
+ * 运算、参数和操作数都相同的节点只保留一个(跨公式的公共子表达式消除)，
+ * 比如多个公式中的 log(x/y) 只计算一次。+ * == != & | ^ 的操作数不分顺序。
+ * 非纯函数(包括随机数函数)不合并，用到它们或有缓存的函数的内置函数和条件表达式也不合并；
+ * 条件表达式的分支和内置函数的函数体作为整体合并，内部不与其他节点共用。
+ * 计算时按节点的顺序一次算出所有公式的值，值的存储按生存期复用。
+ * add 不能与计算同时进行，计算可以在多个线程中同时进行(同 CompiledExpression)
+ */
+class Workspace {
+   public:
+    // inputs 为所有公式共用的输入名，计算时按顺序传入
+    Workspace(ExpressionTree &tree, const std::vector<std::string> &inputs);
+    Workspace(const Workspace &) = delete;
+    Workspace &operator=(const Workspace &) = delete;
+
+    // 编译公式并合并，返回输出的下标，公式有错误时抛出异常
+    size_t add(const std::string &name, const std::string &text);
+
+    const std::vector<std::string> &inputs() const { return inputs_; }
+    const std::vector<std::string> &outputs() const { return names_; }
+    // 是否有公式用到第k个输入
+    bool usesInput(size_t k) const;
+    // 所有公式都可以在多个线程中同时计算
+    bool concurrent() const { return concurrent_; }
+
+    // 计算所有公式，out 的长度为公式的个数
+    void evaluate(const double *args, double *out) const;
+    std::vector<double> evaluate(const std::vector<double> &args) const;
+    // 批量计算 n 个点，第j个公式的结果写入 out[j]。参数同
+    // CompiledExpression::evaluateBatch
+    void evaluateBatch(const double *args, const double *const *columns,
+                       double *const *out, size_t n) const;
+
+    WorkspaceStats stats() const;
+
+   private:
+    struct Node {
+        OpCode op;
+        // 参数下标，或者函数/内置函数/条件表达式在 program 中的下标
+        int index = 0;
+        double value = 0;
+        // 操作数节点
+        int a = -1, b = -1;
+        // 函数、内置函数和条件表达式所属的公式
+        const CompiledExpression *program = nullptr;
+        // 用到这个节点的公式个数，以及最后一个
+        int formulas = 0, last_formula = -1;
+    };
+
+    // 计算前分配节点的存储位置(只在 add 之后第一次计算时进行)
+    void prepare() const;
+    void evaluateLanes(const double *args, const double *const *columns,
+                       size_t offset, double *const *out, size_t n) const;
+    // 执行一个节点，a/b 为操作数的值
+    static double apply(const Node &x, double a, double b);
+    // 子表达式(条件表达式的分支、内置函数的函数体)的文本形式，相同时可以合并
+    static void signature(const CompiledExpression &program, std::string &out);
+
+    std::vector<std::string> inputs_;
+    ExpressionTree &tree_;
+    std::vector<std::string> names_;
+    std::vector<std::unique_ptr<const CompiledExpression>> programs_;
+    std::vector<Node> nodes_;
+    // 节点的键(运算、参数和操作数) -> 节点
+    std::unordered_map<std::string, int> index_;
+    // 每个公式的结果所在的节点
+    std::vector<int> outputs_;
+    size_t instructions_ = 0;
+    bool concurrent_ = true;
+
+    // 每个节点的值的存储位置
+    mutable std::vector<int> slot_;
+    // 每个节点计算后要写出的公式: (节点, 公式)，按节点排序
+    mutable std::vector<std::pair<int, int>> writes_;
+    mutable size_t slots_ = 0;
+    mutable std::atomic<bool> prepared_{false};
+    mutable std::mutex mutex_;
+};
+
+}  // namespace calculator
+#endif
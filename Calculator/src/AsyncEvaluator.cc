@@ -0,0 +1,262 @@
+#include "../include/AsyncEvaluator.h"
+
+#include "../include/ExpressionTree.h"
+using namespace calculator;
+
+// 一个表达式的计算: 在工作线程之间接力执行，同一时间只在一个线程中
+struct AsyncEvaluator::Request {
+    explicit Request(const ResourceLimits &limits) : governor(limits) {}
+
+    std::string text;
+    Callback done;
+    // 表达式的会话和语法树(属于 tree)
+    std::unique_ptr<ExpressionTree> tree;
+    node *root = nullptr;
+    Governor governor;
+    // 正在等待的一批异步调用的节点和结果
+    struct Call {
+        node *x = nullptr;
+        double value = 0.0;
+        std::exception_ptr error;
+    };
+    std::vector<Call> calls;
+    // 还没有完成的调用数，发起期间多计一个
+    std::atomic<size_t> outstanding{0};
+};
+
+void AsyncEvaluator::fold(ExpressionTree &tree, node *x, double value) {
+    x->value = value;
+    x->folded = true;
+    for (node *&arg : x->args) tree.clear(arg);
+    x->args.clear();
+    tree.clear(x->left);
+    tree.clear(x->right);
+}
+
+AsyncEvaluator::AsyncEvaluator(const ExpressionTree &session, size_t workers)
+    : registry_(session.registry()),
+      base_(session.snapshot()),
+      limits_(session.limits()) {
+    if (workers == 0) workers = std::thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+    for (size_t i = 0; i < workers; i++)
+        workers_.emplace_back([this] { work(); });
+}
+
+AsyncEvaluator::~AsyncEvaluator() {
+    {
+        // 异步调用的回调还会向线程池提交任务，等所有表达式完成后再停止
+        std::unique_lock<std::mutex> lock(tasks_mutex_);
+        idle_cv_.wait(lock, [this] { return active_ == 0; });
+        shutdown_ = true;
+    }
+    tasks_cv_.notify_all();
+    for (auto &worker : workers_) worker.join();
+}
+
+void AsyncEvaluator::submit(const std::string &text, Callback done) {
+    auto request = std::make_shared<Request>(limits_);
+    request->text = text;
+    request->done = std::move(done);
+    request->tree = std::make_unique<ExpressionTree>(registry_);
+    request->tree->restore(base_);
+    request->tree->setLimits(limits_);
+    // 表达式已经在工作线程中并发，脚本不再并行分析
+    request->tree->setParseWorkers(1);
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex_);
+        active_++;
+    }
+    submitted_++;
+    post([this, request] { start(request); });
+}
+
+std::future<double> AsyncEvaluator::evaluate(const std::string &text) {
+    auto result = std::make_shared<std::promise<double>>();
+    std::future<double> future = result->get_future();
+    submit(text, [result](double value, std::exception_ptr error) {
+        if (error)
+            result->set_exception(error);
+        else
+            result->set_value(value);
+    });
+    return future;
+}
+
+AsyncStats AsyncEvaluator::stats() const {
+    AsyncStats stats;
+    stats.submitted = submitted_;
+    stats.completed = completed_;
+    stats.calls = calls_;
+    stats.batches = batches_;
+    return stats;
+}
+
+void AsyncEvaluator::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    tasks_cv_.notify_one();
+}
+
+void AsyncEvaluator::work() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(tasks_mutex_);
+            tasks_cv_.wait(lock, [this] { return shutdown_ || !tasks_.empty(); });
+            if (shutdown_) return;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+void AsyncEvaluator::start(const std::shared_ptr<Request> &request) {
+    ExpressionTree &tree = *request->tree;
+    try {
+        FunctionPin pin(tree.lexer_);
+        Governor::Scope scope(limits_.enabled() ? &request->governor
+                                                : nullptr);
+        tree.slot_count_ = 0;
+        request->root = tree.parseScript(request->text);
+        if (tree.isArrayValued(request->root))
+            throw ArrayException(
+                "can not be the value of calcExpression, use calcArray or a "
+                "reduction such as sum()");
+    } catch (...) {
+        finish(request, 0.0, std::current_exception());
+        return;
+    }
+    advance(request);
+}
+
+void AsyncEvaluator::advance(const std::shared_ptr<Request> &request) {
+    ExpressionTree &tree = *request->tree;
+    std::vector<node *> ready;
+    std::vector<AsyncFunctionType> functions;
+    std::vector<double> args;
+    double value = 0.0;
+    try {
+        // 每一步固定使用当时的函数表版本(FunctionPin 不能跨线程持有)
+        FunctionPin pin(tree.lexer_);
+        Governor::Scope scope(limits_.enabled() ? &request->governor
+                                                : nullptr);
+        collect(*request, request->root, ready);
+        if (ready.empty()) {
+            value = tree.calcValue(request->root);
+        } else {
+            auto &async = tree.lexer_.functions().async_functions;
+            for (node *x : ready) {
+                args.push_back(tree.calcValue(x->left ? x->left : x->right));
+                functions.push_back(async.at(x->funcname));
+            }
+        }
+    } catch (...) {
+        finish(request, 0.0, std::current_exception());
+        return;
+    }
+    if (ready.empty()) {
+        finish(request, value, nullptr);
+        return;
+    }
+
+    // 一起发起这一批调用，最后完成的回调把剩下的计算交给线程池
+    request->calls.assign(ready.size(), Request::Call());
+    request->outstanding = ready.size() + 1;
+    batches_++;
+    calls_ += ready.size();
+    auto release = [this, request] {
+        if (--request->outstanding == 0)
+            post([this, request] { resolve(request); });
+    };
+    for (size_t i = 0; i < ready.size(); i++) {
+        request->calls[i].x = ready[i];
+        auto done = [request, i, release](double result,
+                                          std::exception_ptr error) {
+            request->calls[i].value = result;
+            request->calls[i].error = error;
+            release();
+        };
+        try {
+            functions[i](args[i], done);
+        } catch (...) {
+            done(0.0, std::current_exception());
+        }
+    }
+    release();
+}
+
+void AsyncEvaluator::resolve(const std::shared_ptr<Request> &request) {
+    ExpressionTree &tree = *request->tree;
+    for (auto &call : request->calls) {
+        if (call.error) {
+            finish(request, 0.0, call.error);
+            return;
+        }
+    }
+    for (auto &call : request->calls)
+        fold(tree, call.x, call.x->negative ? -call.value : call.value);
+    request->calls.clear();
+    advance(request);
+}
+
+void AsyncEvaluator::finish(const std::shared_ptr<Request> &request,
+                            double value, std::exception_ptr error) {
+    // 先释放语法树和会话再通知完成
+    request->tree.reset();
+    request->root = nullptr;
+    Callback done = std::move(request->done);
+    // 先计数，调用者拿到结果时统计已经包括这个表达式
+    completed_++;
+    if (done) done(value, error);
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex_);
+        active_--;
+    }
+    idle_cv_.notify_all();
+}
+
+bool AsyncEvaluator::collect(Request &request, node *x,
+                             std::vector<node *> &ready) {
+    if (!x || x->folded) return false;
+    ExpressionTree &tree = *request.tree;
+    // 条件已经没有异步调用: 计算并折叠(条件中的非纯函数只调用一次)
+    auto decide = [&](node *condition) {
+        double c = tree.calcValue(condition);
+        fold(tree, condition, c);
+        return c != 0;
+    };
+    if (x->type == Tag::Conditional) {
+        if (collect(request, x->args[0], ready)) return true;
+        return collect(request, x->args[decide(x->args[0]) ? 1 : 2], ready);
+    }
+    if (x->type == Tag::LogicalAnd || x->type == Tag::LogicalOr) {
+        // 缺少操作数的错误在计算时报告
+        if (!x->left || !x->right) return false;
+        if (collect(request, x->left, ready)) return true;
+        if (decide(x->left) == (x->type == Tag::LogicalOr)) return false;
+        return collect(request, x->right, ready);
+    }
+    if (x->type == Tag::Builtin) {
+        // 函数体(第一个参数)用到绑定变量，其中的异步调用在计算时同步等待
+        bool pending = false;
+        for (size_t i = 1; i < x->args.size(); i++)
+            pending = collect(request, x->args[i], ready) || pending;
+        return pending;
+    }
+    if (x->type == Tag::Function &&
+        tree.lexer_.functions().async_functions.count(x->funcname)) {
+        node *arg = x->left ? x->left : x->right;
+        if (!arg) throw UnaryFunctionException(x->funcname);
+        if (!collect(request, arg, ready)) ready.push_back(x);
+        return true;
+    }
+    bool pending = false;
+    for (node *arg : x->args) pending = collect(request, arg, ready) || pending;
+    pending = collect(request, x->left, ready) || pending;
+    pending = collect(request, x->right, ready) || pending;
+    return pending;
+}
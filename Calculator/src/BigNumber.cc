@@ -0,0 +1,696 @@
+#include "../include/BigNumber.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../include/Exception.h"
+using namespace calculator;
+
+using Limbs = std::vector<uint32_t>;
+
+// ---- 绝对值(limb 数组，低位在前)的运算 ----
+
+static void trim(Limbs &a) {
+    while (!a.empty() && a.back() == 0) a.pop_back();
+}
+
+static int compareMagnitude(const Limbs &a, const Limbs &b) {
+    if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0;)
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+static Limbs addMagnitude(const Limbs &a, const Limbs &b) {
+    const Limbs &x = a.size() >= b.size() ? a : b;
+    const Limbs &y = a.size() >= b.size() ? b : a;
+    Limbs out(x.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        carry += (uint64_t)x[i] + (i < y.size() ? y[i] : 0);
+        out[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    out[x.size()] = (uint32_t)carry;
+    trim(out);
+    return out;
+}
+
+// a - b, 要求 a >= b
+static Limbs subMagnitude(const Limbs &a, const Limbs &b) {
+    Limbs out(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t t = (int64_t)a[i] - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = t < 0;
+        out[i] = (uint32_t)(t + (borrow << 32));
+    }
+    trim(out);
+    return out;
+}
+
+// out[offset...] += b，out 足够长
+static void addShifted(Limbs &out, const Limbs &b, size_t offset) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < b.size(); i++) {
+        carry += (uint64_t)out[offset + i] + b[i];
+        out[offset + i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    for (; carry; i++) {
+        carry += out[offset + i];
+        out[offset + i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+static Limbs mulSchool(const uint32_t *a, size_t n, const uint32_t *b,
+                       size_t m) {
+    Limbs out(n + m);
+    for (size_t i = 0; i < n; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < m; j++) {
+            carry += (uint64_t)a[i] * b[j] + out[i + j];
+            out[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        out[i + m] = (uint32_t)carry;
+    }
+    trim(out);
+    return out;
+}
+
+static Limbs slice(const uint32_t *a, size_t n) {
+    Limbs out(a, a + n);
+    trim(out);
+    return out;
+}
+
+static Limbs mulMagnitude(const uint32_t *a, size_t n, const uint32_t *b,
+                          size_t m) {
+    if (n < m) return mulMagnitude(b, m, a, n);
+    if (m == 0) return {};
+    if (m < BigInt::kKaratsubaLimbs) return mulSchool(a, n, b, m);
+    Limbs out(n + m + 1);
+    if (2 * m <= n) {
+        // 长度相差较大时，把长的一边切成与短的一边等长的块
+        for (size_t i = 0; i < n; i += m)
+            addShifted(out, mulMagnitude(a + i, std::min(m, n - i), b, m), i);
+        trim(out);
+        return out;
+    }
+    // Karatsuba: (a1 B + a0)(b1 B + b0) = z2 B^2 + z1 B + z0,
+    // z1 = (a0 + a1)(b0 + b1) - z0 - z2，三次递归乘法
+    size_t k = (n + 1) / 2;
+    Limbs a0 = slice(a, k), a1 = slice(a + k, n - k);
+    Limbs b0 = slice(b, k), b1 = slice(b + k, m - k);
+    Limbs z0 = mulMagnitude(a0.data(), a0.size(), b0.data(), b0.size());
+    Limbs z2 = mulMagnitude(a1.data(), a1.size(), b1.data(), b1.size());
+    Limbs sa = addMagnitude(a0, a1), sb = addMagnitude(b0, b1);
+    Limbs z1 = mulMagnitude(sa.data(), sa.size(), sb.data(), sb.size());
+    z1 = subMagnitude(subMagnitude(z1, z0), z2);
+    addShifted(out, z0, 0);
+    addShifted(out, z1, k);
+    addShifted(out, z2, 2 * k);
+    trim(out);
+    return out;
+}
+
+// 除以一个 limb，返回余数
+static uint32_t divSmall(Limbs &a, uint32_t d) {
+    uint64_t rem = 0;
+    for (size_t i = a.size(); i-- > 0;) {
+        uint64_t cur = rem << 32 | a[i];
+        a[i] = (uint32_t)(cur / d);
+        rem = cur % d;
+    }
+    trim(a);
+    return (uint32_t)rem;
+}
+
+// Knuth 的 D 算法: u = q v + r, v 不为 0
+static void divMagnitude(const Limbs &u, const Limbs &v, Limbs &q, Limbs &r) {
+    if (compareMagnitude(u, v) < 0) {
+        q.clear();
+        r = u;
+        return;
+    }
+    if (v.size() == 1) {
+        q = u;
+        uint32_t rem = divSmall(q, v[0]);
+        r.clear();
+        if (rem) r.push_back(rem);
+        return;
+    }
+    const size_t n = v.size(), m = u.size() - n;
+    // 规格化: 除数的最高位为1，商的估计最多大2
+    int s = __builtin_clz(v.back());
+    Limbs vn(n), un(u.size() + 1);
+    for (size_t i = n - 1; i > 0; i--)
+        vn[i] = (v[i] << s) | (s ? v[i - 1] >> (32 - s) : 0);
+    vn[0] = v[0] << s;
+    un[u.size()] = s ? u.back() >> (32 - s) : 0;
+    for (size_t i = u.size() - 1; i > 0; i--)
+        un[i] = (u[i] << s) | (s ? u[i - 1] >> (32 - s) : 0);
+    un[0] = u[0] << s;
+
+    q.assign(m + 1, 0);
+    const uint64_t base = 1ull << 32;
+    for (size_t j = m + 1; j-- > 0;) {
+        uint64_t top = (uint64_t)un[j + n] << 32 | un[j + n - 1];
+        uint64_t qhat = top / vn[n - 1], rhat = top % vn[n - 1];
+        while (qhat >= base ||
+               qhat * vn[n - 2] > (rhat << 32 | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= base) break;
+        }
+        // un[j..j+n] -= qhat * vn
+        int64_t borrow = 0, t;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i + j] - borrow - (int64_t)(p & 0xFFFFFFFF);
+            un[i + j] = (uint32_t)t;
+            borrow = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j + n] - borrow;
+        un[j + n] = (uint32_t)t;
+        q[j] = (uint32_t)qhat;
+        // 估计大了1，加回一个除数
+        if (t < 0) {
+            q[j]--;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                carry += (uint64_t)un[i + j] + vn[i];
+                un[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            un[j + n] += (uint32_t)carry;
+        }
+    }
+    trim(q);
+    r.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+        r[i] = (un[i] >> s) | (s ? un[i + 1] << (32 - s) : 0);
+    trim(r);
+}
+
+static Limbs shiftLeftMagnitude(const Limbs &a, size_t bits) {
+    if (a.empty()) return {};
+    size_t words = bits / 32, s = bits % 32;
+    Limbs out(a.size() + words + 1);
+    for (size_t i = 0; i < a.size(); i++) {
+        out[i + words] |= a[i] << s;
+        if (s) out[i + words + 1] |= a[i] >> (32 - s);
+    }
+    trim(out);
+    return out;
+}
+
+// 右移，dropped 为移出的位中是否有1
+static Limbs shiftRightMagnitude(const Limbs &a, size_t bits, bool &dropped) {
+    size_t words = bits / 32, s = bits % 32;
+    dropped = false;
+    if (words >= a.size()) {
+        dropped = !a.empty();
+        return {};
+    }
+    for (size_t i = 0; i < words; i++) dropped = dropped || a[i];
+    if (s && (a[words] & ((1u << s) - 1))) dropped = true;
+    Limbs out(a.size() - words);
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = a[i + words] >> s;
+        if (s && i + words + 1 < a.size())
+            out[i] |= a[i + words + 1] << (32 - s);
+    }
+    trim(out);
+    return out;
+}
+
+// ---- BigInt ----
+
+BigInt BigInt::fromMagnitude(bool negative, Limbs magnitude) {
+    trim(magnitude);
+    if (magnitude.size() <= 2) {
+        uint64_t v = magnitude.empty() ? 0 : magnitude[0];
+        if (magnitude.size() == 2) v |= (uint64_t)magnitude[1] << 32;
+        if (!negative && v <= (uint64_t)INT64_MAX) return BigInt((int64_t)v);
+        if (negative && v <= (uint64_t)INT64_MAX + 1)
+            return BigInt((int64_t)(0 - v));
+    }
+    BigInt x;
+    x.negative_ = negative;
+    x.limbs_ = std::move(magnitude);
+    return x;
+}
+
+BigInt::Limbs BigInt::magnitude() const {
+    if (!isSmall()) return limbs_;
+    uint64_t v = small_ < 0 ? 0 - (uint64_t)small_ : (uint64_t)small_;
+    Limbs out = {(uint32_t)v, (uint32_t)(v >> 32)};
+    trim(out);
+    return out;
+}
+
+BigInt BigInt::parse(const std::string &text) {
+    size_t i = 0;
+    bool negative = false;
+    if (i < text.size() && (text[i] == '+' || text[i] == '-'))
+        negative = text[i++] == '-';
+    if (i == text.size()) throw SyntaxError("Error: invalid integer " + text);
+    // 每 9 位十进制数乘一次 10^9
+    Limbs mag;
+    size_t first = i + (text.size() - i) % 9;
+    if (first == i) first += 9;
+    for (size_t begin = i, end = first; begin < text.size();
+         begin = end, end += 9) {
+        uint32_t chunk = 0, scale = 1;
+        for (size_t k = begin; k < end; k++) {
+            if (text[k] < '0' || text[k] > '9')
+                throw SyntaxError("Error: invalid integer " + text);
+            chunk = chunk * 10 + (text[k] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (uint32_t &limb : mag) {
+            carry += (uint64_t)limb * scale;
+            limb = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry) mag.push_back((uint32_t)carry);
+    }
+    return fromMagnitude(negative, std::move(mag));
+}
+
+int BigInt::sign() const {
+    if (isSmall()) return (small_ > 0) - (small_ < 0);
+    return negative_ ? -1 : 1;
+}
+
+bool BigInt::isOdd() const {
+    return isSmall() ? (small_ & 1) != 0 : (limbs_[0] & 1) != 0;
+}
+
+size_t BigInt::bitLength() const {
+    if (isSmall()) {
+        uint64_t v = small_ < 0 ? 0 - (uint64_t)small_ : (uint64_t)small_;
+        return v ? 64 - __builtin_clzll(v) : 0;
+    }
+    return 32 * limbs_.size() - __builtin_clz(limbs_.back());
+}
+
+double BigInt::toDouble() const {
+    if (isSmall()) return (double)small_;
+    // 取最高的 64 位，其余的位合并为最低位(粘滞位)，保证舍入正确
+    size_t bits = bitLength();
+    bool dropped;
+    Limbs top = shiftRightMagnitude(limbs_, bits - 64, dropped);
+    uint64_t v = (uint64_t)top[1] << 32 | top[0];
+    if (dropped) v |= 1;
+    double x = std::ldexp((double)v, (int)std::min<size_t>(bits - 64, 2000));
+    return negative_ ? -x : x;
+}
+
+// 十进制转换: x < powers[level]，powers[k] = 10^(9*2^k)。按 powers[level-1]
+// 分为高低两半分别转换(分治)，较短时每次除以 10^9 得到 9 位。
+// width 不为 0 时在前面补零到 width 位
+static void appendDecimal(Limbs x, const std::vector<Limbs> &powers,
+                          size_t level, size_t width, std::string &out) {
+    if (level == 0 || x.size() <= 32) {
+        std::string digits;
+        char buffer[16];
+        while (!x.empty()) {
+            uint32_t chunk = divSmall(x, 1000000000);
+            std::snprintf(buffer, sizeof(buffer), x.empty() ? "%u" : "%09u",
+                          chunk);
+            digits.insert(0, buffer);
+        }
+        if (digits.size() < width) out.append(width - digits.size(), '0');
+        out += digits;
+        return;
+    }
+    const size_t half = (size_t)9 << (level - 1);
+    Limbs q, r;
+    divMagnitude(x, powers[level - 1], q, r);
+    // 最高位部分不补零，高半部分为 0 时低半部分也不补零
+    if (width == 0 && q.empty()) {
+        appendDecimal(std::move(r), powers, level - 1, 0, out);
+        return;
+    }
+    appendDecimal(std::move(q), powers, level - 1, width ? width - half : 0,
+                  out);
+    appendDecimal(std::move(r), powers, level - 1, half, out);
+}
+
+std::string BigInt::toString() const {
+    if (isSmall()) return std::to_string(small_);
+    std::vector<Limbs> powers = {{1000000000}};
+    while (compareMagnitude(powers.back(), limbs_) <= 0) {
+        const Limbs &p = powers.back();
+        powers.push_back(mulMagnitude(p.data(), p.size(), p.data(), p.size()));
+    }
+    std::string out = negative_ ? "-" : "";
+    appendDecimal(limbs_, powers, powers.size() - 1, 0, out);
+    return out;
+}
+
+BigInt BigInt::operator-() const {
+    if (isSmall() && small_ != INT64_MIN) return BigInt(-small_);
+    return fromMagnitude(!negative(), magnitude());
+}
+
+BigInt BigInt::add(const BigInt &a, const BigInt &b, bool subtract) {
+    Limbs x = a.magnitude(), y = b.magnitude();
+    bool negative_a = a.negative(), negative_b = b.negative() != subtract;
+    if (negative_a == negative_b)
+        return fromMagnitude(negative_a, addMagnitude(x, y));
+    // 符号不同时用绝对值大的减去小的
+    if (compareMagnitude(x, y) >= 0)
+        return fromMagnitude(negative_a, subMagnitude(x, y));
+    return fromMagnitude(negative_b, subMagnitude(y, x));
+}
+
+BigInt BigInt::multiply(const BigInt &a, const BigInt &b) {
+    Limbs x = a.magnitude(), y = b.magnitude();
+    return fromMagnitude(a.negative() != b.negative(),
+                         mulMagnitude(x.data(), x.size(), y.data(), y.size()));
+}
+
+void BigInt::divide(const BigInt &a, const BigInt &b, BigInt *quotient,
+                    BigInt *remainder) {
+    if (b.isZero()) throw DivZeroException(a.toDouble(), 0);
+    // INT64_MIN / -1 溢出，走大数的路径
+    if (a.isSmall() && b.isSmall() &&
+        !(a.small_ == INT64_MIN && b.small_ == -1)) {
+        if (quotient) *quotient = BigInt(a.small_ / b.small_);
+        if (remainder) *remainder = BigInt(a.small_ % b.small_);
+        return;
+    }
+    Limbs q, r;
+    divMagnitude(a.magnitude(), b.magnitude(), q, r);
+    if (quotient)
+        *quotient = fromMagnitude(a.negative() != b.negative(), std::move(q));
+    if (remainder) *remainder = fromMagnitude(a.negative(), std::move(r));
+}
+
+BigInt calculator::operator/(const BigInt &a, const BigInt &b) {
+    BigInt q;
+    BigInt::divide(a, b, &q, nullptr);
+    return q;
+}
+
+BigInt calculator::operator%(const BigInt &a, const BigInt &b) {
+    BigInt r;
+    BigInt::divide(a, b, nullptr, &r);
+    return r;
+}
+
+// 补码形式的位运算: 两边扩展为同样长度的补码(多一个 limb 作为符号位)，
+// 逐 limb 计算后再转换回符号和绝对值
+template <class Op>
+BigInt BigInt::bitwise(const BigInt &a, const BigInt &b, Op op) {
+    if (a.isSmall() && b.isSmall()) return BigInt(op(a.small_, b.small_));
+    Limbs x = a.magnitude(), y = b.magnitude();
+    size_t n = std::max(x.size(), y.size()) + 1;
+    // 非负数补零，负数取反加一
+    auto complement = [n](Limbs v, bool negative) {
+        v.resize(n, 0);
+        if (!negative) return v;
+        uint64_t carry = 1;
+        for (uint32_t &limb : v) {
+            carry += (uint32_t)~limb;
+            limb = (uint32_t)carry;
+            carry >>= 32;
+        }
+        return v;
+    };
+    Limbs cx = complement(std::move(x), a.negative());
+    Limbs cy = complement(std::move(y), b.negative());
+    Limbs out(n);
+    for (size_t i = 0; i < n; i++) out[i] = (uint32_t)op(cx[i], cy[i]);
+    bool negative = (out.back() >> 31) != 0;
+    return fromMagnitude(negative, complement(std::move(out), negative));
+}
+
+BigInt calculator::operator&(const BigInt &a, const BigInt &b) {
+    return BigInt::bitwise(a, b, [](auto x, auto y) { return x & y; });
+}
+
+BigInt calculator::operator|(const BigInt &a, const BigInt &b) {
+    return BigInt::bitwise(a, b, [](auto x, auto y) { return x | y; });
+}
+
+BigInt calculator::operator^(const BigInt &a, const BigInt &b) {
+    return BigInt::bitwise(a, b, [](auto x, auto y) { return x ^ y; });
+}
+
+BigInt BigInt::shiftLeft(size_t bits) const {
+    if (isSmall() && bits < 63) {
+        int64_t limit = INT64_MAX >> bits;
+        if (small_ <= limit && small_ >= -limit)
+            return BigInt(small_ * ((int64_t)1 << bits));
+    }
+    return fromMagnitude(negative(), shiftLeftMagnitude(magnitude(), bits));
+}
+
+BigInt BigInt::shiftRight(size_t bits) const {
+    if (isSmall()) return BigInt(small_ >> std::min<size_t>(bits, 63));
+    bool dropped;
+    BigInt x = fromMagnitude(negative_,
+                             shiftRightMagnitude(limbs_, bits, dropped));
+    // 负数向负无穷取整
+    if (negative_ && dropped) x = x - BigInt(1);
+    return x;
+}
+
+int BigInt::compareBig(const BigInt &a, const BigInt &b) {
+    if (a.negative() != b.negative()) return a.negative() ? -1 : 1;
+    // 同号时大数的绝对值一定大于小整数
+    int c = compareMagnitude(a.magnitude(), b.magnitude());
+    return a.negative() ? -c : c;
+}
+
+BigInt BigInt::gcd(BigInt a, BigInt b) {
+    if (a.negative()) a = -a;
+    if (b.negative()) b = -b;
+    while (!b.isZero()) {
+        if (a.isSmall() && b.isSmall()) {
+            uint64_t x = a.small_, y = b.small_;
+            while (y) {
+                uint64_t t = x % y;
+                x = y;
+                y = t;
+            }
+            return BigInt((int64_t)x);
+        }
+        BigInt r = a % b;
+        a = std::move(b);
+        b = std::move(r);
+    }
+    return a;
+}
+
+BigInt BigInt::pow(BigInt base, uint64_t exponent) {
+    BigInt result(1);
+    while (exponent) {
+        if (exponent & 1) result = result * base;
+        exponent >>= 1;
+        if (exponent) base = base * base;
+    }
+    return result;
+}
+
+BigInt BigInt::product(uint64_t lo, uint64_t hi) {
+    if (lo > hi) return BigInt(1);
+    // 项数较少时直接累乘，小整数的乘积不会分配内存
+    if (hi - lo < 16) {
+        BigInt result(1);
+        for (uint64_t i = lo; i <= hi; i++)
+            result = result * BigInt((int64_t)std::min<uint64_t>(i, INT64_MAX));
+        return result;
+    }
+    uint64_t mid = lo + (hi - lo) / 2;
+    return product(lo, mid) * product(mid + 1, hi);
+}
+
+// ---- Rational ----
+
+Rational::Rational(BigInt num, BigInt den) {
+    if (den.isZero()) throw DivZeroException(num.toDouble(), 0);
+    if (den.sign() < 0) {
+        num = -num;
+        den = -den;
+    }
+    BigInt g = BigInt::gcd(num, den);
+    if (!(g.isSmall() && g.small() == 1)) {
+        num = num / g;
+        den = den / g;
+    }
+    num_ = std::move(num);
+    den_ = std::move(den);
+}
+
+Rational Rational::fromDouble(double x) {
+    if (!std::isfinite(x))
+        throw NumericException("exact", "value is not finite");
+    int exponent;
+    double mantissa = std::frexp(x, &exponent);
+    // x = m * 2^(exponent-53)，m 为整数
+    BigInt m((int64_t)std::ldexp(mantissa, 53));
+    exponent -= 53;
+    if (exponent >= 0) return Rational(m.shiftLeft(exponent));
+    return Rational(m, BigInt(1).shiftLeft(-exponent));
+}
+
+Rational Rational::fromShortest(double x) {
+    if (!std::isfinite(x))
+        throw NumericException("exact", "value is not finite");
+    if (x == std::floor(x) && std::fabs(x) < 9.2e18) return Rational((int64_t)x);
+    char buffer[32];
+    for (int digits = 1; digits <= 17; digits++) {
+        std::snprintf(buffer, sizeof(buffer), "%.*e", digits - 1, x);
+        if (std::strtod(buffer, nullptr) == x) break;
+    }
+    return parse(buffer);
+}
+
+Rational Rational::parse(const std::string &text) {
+    // 符号、整数部分、小数部分、指数
+    size_t i = 0;
+    std::string digits;
+    if (i < text.size() && (text[i] == '+' || text[i] == '-'))
+        digits += text[i++];
+    long scale = 0;
+    bool any = false;
+    for (; i < text.size() && isdigit((unsigned char)text[i]); i++)
+        digits += text[i], any = true;
+    if (i < text.size() && text[i] == '.')
+        for (i++; i < text.size() && isdigit((unsigned char)text[i]); i++)
+            digits += text[i], scale--, any = true;
+    if (any && i < text.size() && (text[i] == 'e' || text[i] == 'E')) {
+        char *end;
+        long exponent = std::strtol(text.c_str() + i + 1, &end, 10);
+        if (end == text.c_str() + i + 1)
+            throw SyntaxError("Error: invalid number " + text);
+        scale += exponent;
+        i = end - text.c_str();
+    }
+    if (!any || i != text.size())
+        throw SyntaxError("Error: invalid number " + text);
+    BigInt value = BigInt::parse(digits);
+    BigInt power = BigInt::pow(BigInt(10), (uint64_t)std::labs(scale));
+    if (scale >= 0) return Rational(value * power);
+    return Rational(value, power);
+}
+
+double Rational::toDouble() const {
+    if (isInteger()) return num_.toDouble();
+    // 分子分母都能精确转换为 double 时，一次除法就是正确舍入的结果
+    const int64_t exact = (int64_t)1 << 53;
+    if (num_.isSmall() && den_.isSmall() && num_.small() < exact &&
+        num_.small() > -exact && den_.small() < exact)
+        return (double)num_.small() / (double)den_.small();
+    // 否则取 66 位左右的商，余数合并为粘滞位
+    long shift = 66 + (long)den_.bitLength() - (long)num_.bitLength();
+    BigInt n = num_.sign() < 0 ? -num_ : num_, q, r;
+    if (shift >= 0)
+        BigInt::divide(n.shiftLeft(shift), den_, &q, &r);
+    else
+        BigInt::divide(n, den_.shiftLeft(-shift), &q, &r);
+    if (!r.isZero()) q = q | BigInt(1);
+    double x = std::ldexp(q.toDouble(), (int)std::max(-shift, -4000L));
+    return num_.sign() < 0 ? -x : x;
+}
+
+std::string Rational::toString() const {
+    if (isInteger()) return num_.toString();
+    return num_.toString() + "/" + den_.toString();
+}
+
+Rational Rational::operator-() const {
+    Rational x = *this;
+    x.num_ = -x.num_;
+    return x;
+}
+
+Rational calculator::operator+(const Rational &a, const Rational &b) {
+    if (a.isInteger() && b.isInteger()) return Rational(a.num_ + b.num_);
+    if (a.den_ == b.den_) return Rational(a.num_ + b.num_, a.den_);
+    return Rational(a.num_ * b.den_ + b.num_ * a.den_, a.den_ * b.den_);
+}
+
+Rational calculator::operator-(const Rational &a, const Rational &b) {
+    return a + -b;
+}
+
+Rational calculator::operator*(const Rational &a, const Rational &b) {
+    if (a.isInteger() && b.isInteger()) return Rational(a.num_ * b.num_);
+    // 先交叉约分，乘积不需要再约分
+    BigInt g1 = BigInt::gcd(a.num_, b.den_), g2 = BigInt::gcd(b.num_, a.den_);
+    Rational x;
+    x.num_ = (a.num_ / g1) * (b.num_ / g2);
+    x.den_ = (a.den_ / g2) * (b.den_ / g1);
+    return x;
+}
+
+Rational calculator::operator/(const Rational &a, const Rational &b) {
+    if (b.isZero()) throw DivZeroException(a.toDouble(), 0);
+    if (a.isInteger() && b.isInteger()) return Rational(a.num_, b.num_);
+    Rational inverse;
+    inverse.num_ = b.sign() < 0 ? -b.den_ : b.den_;
+    inverse.den_ = b.sign() < 0 ? -b.num_ : b.num_;
+    return a * inverse;
+}
+
+int Rational::compare(const Rational &a, const Rational &b) {
+    if (a.isInteger() && b.isInteger()) return BigInt::compare(a.num_, b.num_);
+    return BigInt::compare(a.num_ * b.den_, b.num_ * a.den_);
+}
+
+Rational Rational::pow(const Rational &base, int64_t exponent) {
+    if (exponent < 0) {
+        if (base.isZero()) throw DivZeroException(0, 0);
+        Rational inverse = Rational(1) / base;
+        // -INT64_MIN 溢出，先乘一次
+        if (exponent == INT64_MIN) return pow(inverse, INT64_MAX) * inverse;
+        return pow(inverse, -exponent);
+    }
+    // 分子分母互质，它们的幂也互质
+    Rational x;
+    x.num_ = BigInt::pow(base.num_, (uint64_t)exponent);
+    x.den_ = BigInt::pow(base.den_, (uint64_t)exponent);
+    return x;
+}
+
+BigInt Rational::floor() const {
+    BigInt q, r;
+    BigInt::divide(num_, den_, &q, &r);
+    if (r.sign() < 0) q = q - BigInt(1);
+    return q;
+}
+
+BigInt Rational::ceil() const {
+    BigInt q, r;
+    BigInt::divide(num_, den_, &q, &r);
+    if (r.sign() > 0) q = q + BigInt(1);
+    return q;
+}
+
+BigInt Rational::round() const {
+    // |x| + 1/2 向下取整，再加上符号
+    BigInt n = num_.sign() < 0 ? -num_ : num_;
+    BigInt q = (n.shiftLeft(1) + den_) / den_.shiftLeft(1);
+    return num_.sign() < 0 ? -q : q;
+}
+
+// ---- ExactNumber ----
+
+std::string ExactNumber::toString() const {
+    if (exact_) return value_.toString();
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.17g", approx_);
+    return buffer;
+}
@@ -0,0 +1,111 @@
+#include "../include/CApi.h"
+
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "../include/ExpressionTree.h"
+using namespace calculator;
+
+struct calculator_session {
+    ExpressionTree tree;
+};
+
+struct calculator_function {
+    CompiledExpression program;
+};
+
+// 每个线程最后一次出错的原因
+static thread_local std::string last_error;
+
+// 异常不能穿过 C 接口，在这里转换为错误码
+template <class F>
+static int guard(F &&f) {
+    try {
+        f();
+        return CALCULATOR_OK;
+    } catch (std::exception &e) {
+        last_error = e.what();
+    } catch (...) {
+        last_error = "Error: unknown exception";
+    }
+    return CALCULATOR_ERROR;
+}
+
+static int invalid(const char *argument) {
+    last_error = std::string("Error: ") + argument + " is null";
+    return CALCULATOR_ERROR;
+}
+
+calculator_session *calculator_session_create(void) {
+    calculator_session *session = nullptr;
+    guard([&] { session = new calculator_session(); });
+    return session;
+}
+
+void calculator_session_destroy(calculator_session *session) { delete session; }
+
+int calculator_set_variable(calculator_session *session, const char *name,
+                            double value) {
+    if (!session || !name) return invalid(!session ? "session" : "name");
+    return guard([&] { session->tree.addVariable(name, value); });
+}
+
+int calculator_load_plugin(calculator_session *session, const char *path) {
+    if (!session || !path) return invalid(!session ? "session" : "path");
+    return guard([&] { session->tree.loadPlugin(path); });
+}
+
+int calculator_evaluate(calculator_session *session, const char *expression,
+                        double *result) {
+    if (!session || !expression || !result)
+        return invalid(!session ? "session" : !expression ? "expression" : "result");
+    return guard([&] { *result = session->tree.calcExpression(expression); });
+}
+
+calculator_function *calculator_compile(calculator_session *session,
+                                        const char *expression,
+                                        const char *const *parameters,
+                                        size_t count) {
+    if (!session || !expression || (count && !parameters)) {
+        invalid(!session ? "session" : !expression ? "expression" : "parameters");
+        return nullptr;
+    }
+    calculator_function *function = nullptr;
+    guard([&] {
+        std::vector<std::string> names(parameters, parameters + count);
+        function = new calculator_function{
+            session->tree.compile(expression, names)};
+    });
+    return function;
+}
+
+void calculator_function_destroy(calculator_function *function) {
+    delete function;
+}
+
+size_t calculator_function_arity(const calculator_function *function) {
+    return function ? function->program.arity() : 0;
+}
+
+int calculator_function_evaluate(const calculator_function *function,
+                                 const double *args, double *result) {
+    if (!function || !result) return invalid(!function ? "function" : "result");
+    if (!args && function->program.arity()) return invalid("args");
+    return guard([&] { *result = function->program.evaluate(args); });
+}
+
+int calculator_function_evaluate_batch(const calculator_function *function,
+                                       const double *args,
+                                       const double *const *columns,
+                                       double *out, size_t n) {
+    if (!function || !out) return invalid(!function ? "function" : "out");
+    // 没有 args 时每个参数都要有对应的列
+    if (!args)
+        for (size_t k = 0; k < function->program.arity(); k++)
+            if (!columns || !columns[k]) return invalid("args");
+    return guard(
+        [&] { function->program.evaluateBatch(args, columns, out, n); });
+}
+
+const char *calculator_last_error(void) { return last_error.c_str(); }
@@ -0,0 +1,973 @@
+#include "../include/CompiledExpression.h"
+
+#include <cmath>
+#include <deque>
+
+#include "../include/Governor.h"
+using namespace calculator;
+
+// 计算栈较浅时直接使用栈上的数组
+static constexpr size_t kInlineStack = 64;
+
+// 线程局部的临时缓冲区。内置函数的函数体在计算过程中又会进入计算(比如嵌套积分)，
+// 所以按嵌套的层次使用不同的缓冲区，而不是每个函数一个 thread_local 变量
+template <class T>
+class ScratchBuffer {
+   public:
+    ScratchBuffer() : level_(depth()++) {
+        if (pool().size() <= level_) pool().emplace_back();
+    }
+    ~ScratchBuffer() { depth()--; }
+    std::vector<T>& get() { return pool()[level_]; }
+
+   private:
+    static std::deque<std::vector<T>>& pool() {
+        thread_local std::deque<std::vector<T>> buffers;
+        return buffers;
+    }
+    static size_t& depth() {
+        thread_local size_t level = 0;
+        return level;
+    }
+    size_t level_;
+};
+
+// 没有提供导数的自定义函数使用中心差分
+static double numericDerivative(const UnaryFunctionType& f, double x) {
+    double h = 6.0554544523933395e-06 * std::max(1.0, std::fabs(x));
+    return (f(x + h) - f(x - h)) / (2 * h);
+}
+
+// 函数的 float/long double 版本，没有时为空
+template <class Map>
+static typename Map::mapped_type findPrecisionFunction(
+    const Map& functions, const std::string& name) {
+    auto it = functions.find(name);
+    return it == functions.end() ? nullptr : it->second;
+}
+
+int CompiledExpression::addUnary(const std::string& name,
+                                 const UnaryFunctionType& func,
+                                 const UnaryFunctionType& derivative,
+                                 BatchFunctionType batch,
+                                 const FunctionTable* table) {
+    for (size_t i = 0; i < unary_names_.size(); i++)
+        if (unary_names_[i] == name) return (int)i;
+    unary_names_.push_back(name);
+    unary_.push_back(func);
+    unary_derivatives_.push_back(derivative);
+    unary_batch_.push_back(batch);
+    auto addCalls = [&](auto& calls, const auto* functions) {
+        calls.unary.push_back(
+            functions ? findPrecisionFunction(functions->unary, name) : nullptr);
+        calls.batch.push_back(
+            functions ? findPrecisionFunction(functions->batch, name) : nullptr);
+    };
+    addCalls(float_calls_, table ? &table->float_functions : nullptr);
+    addCalls(long_double_calls_,
+             table ? &table->long_double_functions : nullptr);
+    return (int)unary_.size() - 1;
+}
+
+int CompiledExpression::addBinary(const std::string& name,
+                                  const BinaryFunctionType& func,
+                                  const BinaryFunctionType& dx,
+                                  const BinaryFunctionType& dy,
+                                  const FunctionTable* table) {
+    for (size_t i = 0; i < binary_names_.size(); i++)
+        if (binary_names_[i] == name) return (int)i;
+    binary_names_.push_back(name);
+    binary_.push_back(func);
+    binary_dx_.push_back(dx);
+    binary_dy_.push_back(dy);
+    float_calls_.binary.push_back(
+        table ? findPrecisionFunction(table->float_functions.binary, name)
+              : nullptr);
+    long_double_calls_.binary.push_back(
+        table
+            ? findPrecisionFunction(table->long_double_functions.binary, name)
+            : nullptr);
+    return (int)binary_.size() - 1;
+}
+
+int CompiledExpression::addBuiltin(
+    const std::string& name, std::shared_ptr<const CompiledExpression> body) {
+    static const std::unordered_map<std::string, std::pair<BuiltinKind, int>>
+        kinds = {{"integrate", {BuiltinKind::Integrate, 2}},
+                 {"solve", {BuiltinKind::Solve, 1}},
+                 {"minimize", {BuiltinKind::Minimize, 2}},
+                 {"sum", {BuiltinKind::Sum, 2}},
+                 {"prod", {BuiltinKind::Product, 2}}};
+    auto kind = kinds.find(name);
+    if (kind == kinds.end()) throw FunctionDeclareException(name);
+    if (!body->concurrent_) concurrent_ = false;
+    if (body->random_) random_ = true;
+    builtins_.push_back(
+        {kind->second.first, name, kind->second.second, std::move(body)});
+    return (int)builtins_.size() - 1;
+}
+
+int CompiledExpression::addConditional(
+    std::shared_ptr<const CompiledExpression> then_branch,
+    std::shared_ptr<const CompiledExpression> else_branch) {
+    bool per_lane = then_branch->expensive_ || else_branch->expensive_;
+    if (!then_branch->concurrent_ || !else_branch->concurrent_)
+        concurrent_ = false;
+    if (then_branch->random_ || else_branch->random_) random_ = true;
+    conditionals_.push_back(
+        {std::move(then_branch), std::move(else_branch), per_lane});
+    return (int)conditionals_.size() - 1;
+}
+
+bool CompiledExpression::usesParameter(size_t k) const {
+    for (const Instruction& ins : code_)
+        if (ins.op == OpCode::Argument && ins.index == (int)k) return true;
+    for (const Builtin& builtin : builtins_)
+        if (builtin.body->usesParameter(k)) return true;
+    for (const Conditional& conditional : conditionals_)
+        if (conditional.then_branch->usesParameter(k) ||
+            conditional.else_branch->usesParameter(k))
+            return true;
+    return false;
+}
+
+void CompiledExpression::finalize() {
+    // 模拟一遍计算栈，记录每条指令的操作数来自哪条指令
+    std::vector<int> stack;
+    operands_.assign(code_.size(), {-1, -1});
+    max_depth_ = 0;
+    for (int i = 0; i < (int)code_.size(); i++) {
+        switch (code_[i].op) {
+            case OpCode::Constant:
+            case OpCode::Argument:
+                break;
+            case OpCode::Not:
+            case OpCode::Negate:
+            case OpCode::Minus:
+            case OpCode::Call1:
+            case OpCode::Conditional:
+                operands_[i].first = stack.back();
+                stack.pop_back();
+                break;
+            case OpCode::Builtin:
+                if (builtins_[code_[i].index].operands == 2) {
+                    operands_[i].second = stack.back();
+                    stack.pop_back();
+                }
+                operands_[i].first = stack.back();
+                stack.pop_back();
+                break;
+            default:
+                operands_[i].second = stack.back();
+                stack.pop_back();
+                operands_[i].first = stack.back();
+                stack.pop_back();
+                break;
+        }
+        stack.push_back(i);
+        max_depth_ = std::max(max_depth_, stack.size());
+    }
+    // 计算代价较大或者有副作用的表达式，作为分支时不能两个分支都计算
+    expensive_ = !concurrent_ || random_ || !builtins_.empty();
+    for (auto& conditional : conditionals_)
+        if (conditional.per_lane) expensive_ = true;
+}
+
+template <class T>
+T CompiledExpression::callUnary(int index, T x) const {
+    if constexpr (!std::is_same_v<T, double>)
+        if (auto f = precisionCalls<T>().unary[index]) return f(x);
+    return (T)unary_[index]((double)x);
+}
+
+template <class T>
+T CompiledExpression::callBinary(int index, T x, T y) const {
+    if constexpr (!std::is_same_v<T, double>)
+        if (auto f = precisionCalls<T>().binary[index]) return f(x, y);
+    return (T)binary_[index]((double)x, (double)y);
+}
+
+template <class T>
+T CompiledExpression::apply(const Instruction& ins, T a, T b) const {
+    switch (ins.op) {
+        case OpCode::Add:
+            return a + b;
+        case OpCode::Sub:
+            return a - b;
+        case OpCode::Mul:
+            return a * b;
+        case OpCode::Div:
+            return a / b;
+        case OpCode::Mod:
+            return std::fmod(a, b);
+        case OpCode::And:
+            return (Integer)a & (Integer)b;
+        case OpCode::Or:
+            return (Integer)a | (Integer)b;
+        case OpCode::Xor:
+            return (Integer)a ^ (Integer)b;
+        case OpCode::ShiftLeft:
+            if (b < 0) throw ShiftNegativeException();
+            return (Integer)a << (Integer)b;
+        case OpCode::ShiftRight:
+            if (b < 0) throw ShiftNegativeException();
+            return (Integer)a >> (Integer)b;
+        case OpCode::Less:
+            return a < b;
+        case OpCode::LessEqual:
+            return a <= b;
+        case OpCode::Greater:
+            return a > b;
+        case OpCode::GreaterEqual:
+            return a >= b;
+        case OpCode::Equal:
+            return a == b;
+        case OpCode::NotEqual:
+            return a != b;
+        case OpCode::Not:
+            return (Integer) !((Integer)a);
+        case OpCode::Negate:
+            return ~((Integer)a);
+        case OpCode::Minus:
+            return -a;
+        case OpCode::Call1:
+            return callUnary(ins.index, a);
+        case OpCode::Call2:
+            return callBinary(ins.index, a, b);
+        default:
+            break;
+    }
+    return 0;
+}
+
+void CompiledExpression::partials(const Instruction& ins, double a, double b,
+                                  double r, double& da, double& db) const {
+    da = db = 0;
+    switch (ins.op) {
+        case OpCode::Add:
+            da = 1, db = 1;
+            break;
+        case OpCode::Sub:
+            da = 1, db = -1;
+            break;
+        case OpCode::Mul:
+            da = b, db = a;
+            break;
+        case OpCode::Div:
+            da = 1 / b, db = -r / b;
+            break;
+        case OpCode::Mod:
+            da = 1, db = -std::trunc(a / b);
+            break;
+        case OpCode::Minus:
+            da = -1;
+            break;
+        case OpCode::Call1:
+            if (auto& d = unary_derivatives_[ins.index])
+                da = d(a);
+            else
+                da = numericDerivative(unary_[ins.index], a);
+            break;
+        case OpCode::Call2: {
+            auto& f = binary_[ins.index];
+            if (auto& dx = binary_dx_[ins.index])
+                da = dx(a, b);
+            else
+                da = numericDerivative([&](double x) { return f(x, b); }, a);
+            if (auto& dy = binary_dy_[ins.index])
+                db = dy(a, b);
+            else
+                db = numericDerivative([&](double y) { return f(a, y); }, b);
+        } break;
+        default:
+            // 位运算、移位等整数运算的导数为0
+            break;
+    }
+}
+
+void CompiledExpression::setPrecision(Precision precision) {
+    precision_ = precision;
+    // 函数体和分支可能与复制出的编译表达式共享，复制后再修改
+    auto update = [&](std::shared_ptr<const CompiledExpression>& sub) {
+        if (sub->precision_ == precision) return;
+        auto copy = std::make_shared<CompiledExpression>(*sub);
+        copy->setPrecision(precision);
+        sub = std::move(copy);
+    };
+    for (Builtin& builtin : builtins_) update(builtin.body);
+    for (Conditional& conditional : conditionals_) {
+        update(conditional.then_branch);
+        update(conditional.else_branch);
+    }
+}
+
+double CompiledExpression::evaluate(const double* args) const {
+    switch (precision_) {
+        case Precision::Single:
+            return evaluateConverted<float>(args);
+        case Precision::Extended:
+            return evaluateConverted<long double>(args);
+        default:
+            return evaluateAs(args);
+    }
+}
+
+float CompiledExpression::evaluate(const float* args) const {
+    return evaluateAs(args);
+}
+
+long double CompiledExpression::evaluate(const long double* args) const {
+    return evaluateAs(args);
+}
+
+template <class T>
+double CompiledExpression::evaluateConverted(const double* args) const {
+    T inline_args[kInlineStack];
+    std::vector<T> heap_args;
+    T* values = inline_args;
+    if (arity() > kInlineStack) {
+        heap_args.resize(arity());
+        values = heap_args.data();
+    }
+    for (size_t k = 0; k < arity(); k++) values[k] = (T)args[k];
+    return (double)evaluateAs(values);
+}
+
+template <class T>
+T CompiledExpression::evaluateAs(const T* args) const {
+    if (code_.empty()) return 0;
+    T inline_stack[kInlineStack];
+    std::vector<T> heap_stack;
+    T* stack = inline_stack;
+    if (max_depth_ > kInlineStack) {
+        heap_stack.resize(max_depth_);
+        stack = heap_stack.data();
+    }
+
+    int top = -1;
+    for (const Instruction& ins : code_) {
+        switch (ins.op) {
+            case OpCode::Constant:
+                stack[++top] = ins.value;
+                break;
+            case OpCode::Argument:
+                stack[++top] = args[ins.index];
+                break;
+            case OpCode::Add:
+                top--;
+                stack[top] += stack[top + 1];
+                break;
+            case OpCode::Sub:
+                top--;
+                stack[top] -= stack[top + 1];
+                break;
+            case OpCode::Mul:
+                top--;
+                stack[top] *= stack[top + 1];
+                break;
+            case OpCode::Div:
+                top--;
+                stack[top] /= stack[top + 1];
+                break;
+            case OpCode::Minus:
+                stack[top] = -stack[top];
+                break;
+            case OpCode::Call1:
+                stack[top] = callUnary(ins.index, stack[top]);
+                break;
+            case OpCode::Not:
+            case OpCode::Negate:
+                stack[top] = apply(ins, stack[top], (T)0);
+                break;
+            case OpCode::Builtin: {
+                const Builtin& builtin = builtins_[ins.index];
+                top -= builtin.operands - 1;
+                stack[top] = callBuiltin(builtin, args, &stack[top]);
+            } break;
+            case OpCode::Conditional: {
+                // 只计算选中的分支
+                const Conditional& conditional = conditionals_[ins.index];
+                stack[top] = (stack[top] != 0 ? conditional.then_branch
+                                              : conditional.else_branch)
+                                 ->evaluateAs(args);
+            } break;
+            default:
+                top--;
+                stack[top] = apply(ins, stack[top], stack[top + 1]);
+                break;
+        }
+    }
+    return stack[0];
+}
+
+double CompiledExpression::operator()(const std::vector<double>& args) const {
+    if (args.size() != arity())
+        throw SyntaxError("compiled expression needs " +
+                          std::to_string(arity()) + " arguments");
+    return evaluate(args.data());
+}
+
+void CompiledExpression::evaluateBatch(const double* args,
+                                       const double* const* columns,
+                                       double* out, size_t n) const {
+    switch (precision_) {
+        case Precision::Single:
+            return evaluateBatchConverted<float>(args, columns, out, n);
+        case Precision::Extended:
+            return evaluateBatchConverted<long double>(args, columns, out, n);
+        default:
+            return evaluateBatchAs(args, columns, out, n);
+    }
+}
+
+void CompiledExpression::evaluateBatch(const float* args,
+                                       const float* const* columns,
+                                       float* out, size_t n) const {
+    evaluateBatchAs(args, columns, out, n);
+}
+
+void CompiledExpression::evaluateBatch(const long double* args,
+                                       const long double* const* columns,
+                                       long double* out, size_t n) const {
+    evaluateBatchAs(args, columns, out, n);
+}
+
+template <class T>
+void CompiledExpression::evaluateBatchAs(const T* args,
+                                         const T* const* columns, T* out,
+                                         size_t n) const {
+    for (size_t offset = 0; offset < n; offset += kBatchLanes)
+        evaluateLanes(args, columns, offset, out + offset,
+                      std::min(kBatchLanes, n - offset));
+}
+
+// 每一段的参数列转换为 T 后计算，转换的代价相对于按列计算很小
+template <class T>
+void CompiledExpression::evaluateBatchConverted(const double* args,
+                                                const double* const* columns,
+                                                double* out, size_t n) const {
+    const size_t m = arity();
+    std::vector<T> values(m);
+    for (size_t k = 0; k < m; k++) values[k] = args ? (T)args[k] : 0;
+    ScratchBuffer<T> scratch;
+    std::vector<T>& buffer = scratch.get();
+    // 前 m 列为转换后的参数列，最后一列为结果
+    buffer.resize((m + 1) * kBatchLanes);
+    T* result = buffer.data() + m * kBatchLanes;
+    std::vector<const T*> converted(m, nullptr);
+    for (size_t offset = 0; offset < n; offset += kBatchLanes) {
+        size_t count = std::min(kBatchLanes, n - offset);
+        for (size_t k = 0; k < m; k++) {
+            if (!columns || !columns[k]) continue;
+            T* column = buffer.data() + k * kBatchLanes;
+            for (size_t i = 0; i < count; i++)
+                column[i] = (T)columns[k][offset + i];
+            converted[k] = column;
+        }
+        evaluateLanes(values.data(), converted.data(), 0, result, count);
+        for (size_t i = 0; i < count; i++) out[offset + i] = (double)result[i];
+    }
+}
+
+// 计算栈中的每个位置是一列 kBatchLanes 个值，每条指令处理一整列
+template <class T>
+void CompiledExpression::evaluateLanes(const T* args, const T* const* columns,
+                                       size_t offset, T* out,
+                                       size_t n) const {
+    if (code_.empty()) return std::fill(out, out + n, (T)0);
+    ScratchBuffer<T> scratch;
+    std::vector<T>& buffer = scratch.get();
+    // 最后三列用作批量函数的输出和条件表达式的两个分支
+    buffer.resize((max_depth_ + 3) * kBatchLanes);
+    auto lane = [&](int k) { return buffer.data() + k * kBatchLanes; };
+    T* temp = lane((int)max_depth_);
+    // 参数的第i个点
+    auto point = [&](size_t i, std::vector<T>& values) {
+        values.assign(arity(), (T)0);
+        for (size_t k = 0; k < arity(); k++)
+            values[k] = columns && columns[k] ? columns[k][offset + i]
+                                              : args[k];
+    };
+
+    int top = -1;
+    for (const Instruction& ins : code_) {
+        switch (ins.op) {
+            case OpCode::Constant: {
+                T* x = lane(++top);
+                std::fill(x, x + n, ins.value);
+            } break;
+            case OpCode::Argument: {
+                T* x = lane(++top);
+                if (columns && columns[ins.index]) {
+                    const T* column = columns[ins.index] + offset;
+                    std::copy(column, column + n, x);
+                } else {
+                    std::fill(x, x + n, args[ins.index]);
+                }
+            } break;
+            case OpCode::Add: {
+                top--;
+                T* __restrict x = lane(top);
+                const T* __restrict y = lane(top + 1);
+                for (size_t i = 0; i < n; i++) x[i] += y[i];
+            } break;
+            case OpCode::Sub: {
+                top--;
+                T* __restrict x = lane(top);
+                const T* __restrict y = lane(top + 1);
+                for (size_t i = 0; i < n; i++) x[i] -= y[i];
+            } break;
+            case OpCode::Mul: {
+                top--;
+                T* __restrict x = lane(top);
+                const T* __restrict y = lane(top + 1);
+                for (size_t i = 0; i < n; i++) x[i] *= y[i];
+            } break;
+            case OpCode::Div: {
+                top--;
+                T* __restrict x = lane(top);
+                const T* __restrict y = lane(top + 1);
+                for (size_t i = 0; i < n; i++) x[i] /= y[i];
+            } break;
+            case OpCode::Minus: {
+                T* x = lane(top);
+                for (size_t i = 0; i < n; i++) x[i] = -x[i];
+            } break;
+            case OpCode::Call1: {
+                T* x = lane(top);
+                void (*batch)(const T*, T*, size_t);
+                if constexpr (std::is_same_v<T, double>)
+                    batch = unary_batch_[ins.index];
+                else
+                    batch = precisionCalls<T>().batch[ins.index];
+                if (batch) {
+                    batch(x, temp, n);
+                    std::copy(temp, temp + n, x);
+                } else {
+                    for (size_t i = 0; i < n; i++)
+                        x[i] = callUnary(ins.index, x[i]);
+                }
+            } break;
+            case OpCode::Not:
+            case OpCode::Negate: {
+                T* x = lane(top);
+                for (size_t i = 0; i < n; i++) x[i] = apply(ins, x[i], (T)0);
+            } break;
+            case OpCode::Less:
+            case OpCode::LessEqual:
+            case OpCode::Greater:
+            case OpCode::GreaterEqual:
+            case OpCode::Equal:
+            case OpCode::NotEqual: {
+                // 比较的结果为 1.0/0.0，没有分支的循环可以向量化
+                top--;
+                T* __restrict x = lane(top);
+                const T* __restrict y = lane(top + 1);
+                switch (ins.op) {
+                    case OpCode::Less:
+                        for (size_t i = 0; i < n; i++) x[i] = x[i] < y[i];
+                        break;
+                    case OpCode::LessEqual:
+                        for (size_t i = 0; i < n; i++) x[i] = x[i] <= y[i];
+                        break;
+                    case OpCode::Greater:
+                        for (size_t i = 0; i < n; i++) x[i] = x[i] > y[i];
+                        break;
+                    case OpCode::GreaterEqual:
+                        for (size_t i = 0; i < n; i++) x[i] = x[i] >= y[i];
+                        break;
+                    case OpCode::Equal:
+                        for (size_t i = 0; i < n; i++) x[i] = x[i] == y[i];
+                        break;
+                    default:
+                        for (size_t i = 0; i < n; i++) x[i] = x[i] != y[i];
+                        break;
+                }
+            } break;
+            case OpCode::Conditional: {
+                const Conditional& conditional = conditionals_[ins.index];
+                T* x = lane(top);
+                if (conditional.per_lane) {
+                    // 分支代价大或者有副作用，逐个点只计算选中的分支
+                    std::vector<T> values;
+                    for (size_t i = 0; i < n; i++) {
+                        point(i, values);
+                        x[i] = (x[i] != 0 ? conditional.then_branch
+                                          : conditional.else_branch)
+                                   ->evaluateAs(values.data());
+                    }
+                    break;
+                }
+                // 两个分支都批量计算，再按条件混合
+                T* __restrict a = lane((int)max_depth_ + 1);
+                T* __restrict b = lane((int)max_depth_ + 2);
+                conditional.then_branch->evaluateLanes(args, columns, offset,
+                                                       a, n);
+                conditional.else_branch->evaluateLanes(args, columns, offset,
+                                                       b, n);
+                for (size_t i = 0; i < n; i++) x[i] = x[i] != 0 ? a[i] : b[i];
+            } break;
+            case OpCode::Builtin: {
+                // 嵌套的内置函数逐个点计算
+                const Builtin& builtin = builtins_[ins.index];
+                top -= builtin.operands - 1;
+                T* x = lane(top);
+                const T* y = lane(top + 1);
+                std::vector<T> values;
+                for (size_t i = 0; i < n; i++) {
+                    point(i, values);
+                    T operands[2] = {x[i], y[i]};
+                    x[i] = callBuiltin(builtin, values.data(), operands);
+                }
+            } break;
+            default: {
+                top--;
+                T* x = lane(top);
+                const T* y = lane(top + 1);
+                for (size_t i = 0; i < n; i++) x[i] = apply(ins, x[i], y[i]);
+            } break;
+        }
+    }
+    std::copy(lane(0), lane(0) + n, out);
+}
+
+// 数值算法使用 double，参数和结果在调用前后转换
+template <class T>
+T CompiledExpression::callBuiltin(const Builtin& builtin, const T* args,
+                                  const T* operands) const {
+    std::vector<double> values(args, args + arity());
+    double converted[2] = {(double)operands[0],
+                           builtin.operands == 2 ? (double)operands[1] : 0.0};
+    return (T)callBuiltin(builtin, values.data(), converted);
+}
+
+double CompiledExpression::callBuiltin(const Builtin& builtin,
+                                       const double* args,
+                                       const double* operands) const {
+    // 函数体的参数为外层的参数加上绑定变量
+    const size_t n = arity();
+    const CompiledExpression& body = *builtin.body;
+    ScratchBuffer<double> scratch;
+    std::vector<double>& point = scratch.get();
+    point.assign(args, args + n);
+    point.push_back(0.0);
+    auto f = [&](double x) {
+        point[n] = x;
+        return body.evaluate(point.data());
+    };
+    // 在 calcExpression 等计算中调用时检查资源限制
+    Governor* governor = Governor::current();
+
+    switch (builtin.kind) {
+        case BuiltinKind::Integrate: {
+            // 采样点作为绑定变量的一列批量计算
+            std::vector<const double*> columns(n + 1, nullptr);
+            return numeric::integrate(
+                [&](const double* x, double* y, size_t m) {
+                    if (governor) governor->checkDeadline();
+                    columns[n] = x;
+                    body.evaluateBatch(point.data(), columns.data(), y, m);
+                },
+                operands[0], operands[1]);
+        }
+        case BuiltinKind::Solve: {
+            std::vector<double> grad(n + 1);
+            auto df = [&](double x) {
+                point[n] = x;
+                body.gradient(point.data(), grad.data());
+                return grad[n];
+            };
+            return numeric::solve(f, df, operands[0]);
+        }
+        case BuiltinKind::Minimize:
+            return numeric::minimize(f, operands[0], operands[1]);
+        case BuiltinKind::Sum:
+        case BuiltinKind::Product: {
+            if (governor && std::isfinite(operands[0]) &&
+                std::isfinite(operands[1]) && operands[1] >= operands[0])
+                governor->addIterations(
+                    (size_t)std::min(std::floor(operands[1] - operands[0]) + 1,
+                                     9007199254740992.0));
+            // 每一块在各自的线程中批量计算，point 只读。
+            // 函数体中嵌套的内置函数在工作线程中也计入同一个资源限制
+            auto terms = [&](const double* x, double* y, size_t m) {
+                Governor::Scope scope(governor);
+                if (governor) governor->checkDeadline();
+                std::vector<const double*> columns(n + 1, nullptr);
+                columns[n] = x;
+                body.evaluateBatch(point.data(), columns.data(), y, m);
+            };
+            bool parallel = body.concurrent_ && !body.random_;
+            if (builtin.kind == BuiltinKind::Sum)
+                return numeric::sum(terms, operands[0], operands[1], parallel);
+            return numeric::product(terms, operands[0], operands[1], parallel);
+        }
+    }
+    return 0;
+}
+
+void CompiledExpression::builtinPartials(const Builtin& builtin,
+                                         const double* args,
+                                         const double* operands,
+                                         double result, double* d_operands,
+                                         double* d_args) const {
+    const size_t n = arity();
+    const CompiledExpression& body = *builtin.body;
+    std::vector<double> point(args, args + n), grad(n + 1);
+    point.push_back(0.0);
+    auto f = [&](double x) {
+        point[n] = x;
+        return body.evaluate(point.data());
+    };
+    auto gradientAt = [&](double x, double* g) {
+        point[n] = x;
+        body.gradient(point.data(), g);
+    };
+    d_operands[0] = d_operands[1] = 0;
+    std::fill(d_args, d_args + n, 0.0);
+
+    switch (builtin.kind) {
+        case BuiltinKind::Integrate: {
+            // d/da = -f(a), d/db = f(b)，对外层参数的导数在积分号下求导
+            double a = operands[0], b = operands[1];
+            d_operands[0] = -f(a);
+            d_operands[1] = f(b);
+            for (size_t k = 0; k < n; k++) {
+                d_args[k] = numeric::integrate(
+                    [&](const double* x, double* y, size_t m) {
+                        for (size_t i = 0; i < m; i++) {
+                            gradientAt(x[i], grad.data());
+                            y[i] = grad[k];
+                        }
+                    },
+                    a, b);
+            }
+        } break;
+        case BuiltinKind::Solve: {
+            // 隐函数求导: f(r(p), p) = 0 => dr/dp = -f_p / f_x, 与初值无关
+            gradientAt(result, grad.data());
+            for (size_t k = 0; k < n; k++) d_args[k] = -grad[k] / grad[n];
+        } break;
+        case BuiltinKind::Minimize: {
+            // 极小值在端点上时随端点移动
+            if (result == operands[0]) {
+                d_operands[0] = 1;
+                break;
+            }
+            if (result == operands[1]) {
+                d_operands[1] = 1;
+                break;
+            }
+            // 内部极小值满足 f_x(x*, p) = 0 => dx*/dp = -f_xp / f_xx,
+            // 二阶导数用梯度的中心差分
+            double h = 6.0554544523933395e-06 * std::max(1.0, std::fabs(result));
+            std::vector<double> upper(n + 1);
+            gradientAt(result + h, upper.data());
+            gradientAt(result - h, grad.data());
+            double fxx = (upper[n] - grad[n]) / (2 * h);
+            for (size_t k = 0; k < n; k++)
+                d_args[k] = -(upper[k] - grad[k]) / (2 * h) / fxx;
+        } break;
+        case BuiltinKind::Sum:
+        case BuiltinKind::Product: {
+            // 项数是上下限的分段常数函数，对上下限的导数为0。
+            // 项数和块的划分与 numeric::sum 相同，每块计入资源限制
+            bool product = builtin.kind == BuiltinKind::Product;
+            size_t count = numeric::termCount(product ? "prod" : "sum",
+                                              operands[0], operands[1]);
+            Governor* governor = Governor::current();
+            double value = 1.0;
+            // 块内各项的值和对外层参数的偏导数(按参数分列)
+            std::vector<double> terms, partials;
+            for (size_t first = 0; first < count;
+                 first += numeric::kBlockTerms) {
+                size_t m = std::min(numeric::kBlockTerms, count - first);
+                if (governor) governor->addIterations(m);
+                terms.resize(m);
+                partials.resize(m * n);
+                for (size_t i = 0; i < m; i++) {
+                    point[n] = operands[0] + (double)(first + i);
+                    terms[i] = body.gradient(point.data(), grad.data());
+                    for (size_t k = 0; k < n; k++) partials[k * m + i] = grad[k];
+                }
+                if (!product) {
+                    for (size_t k = 0; k < n; k++)
+                        d_args[k] += numeric::sumArray(&partials[k * m], m);
+                    continue;
+                }
+                // (P*f)' = P'*f + P*f'
+                for (size_t i = 0; i < m; i++) {
+                    for (size_t k = 0; k < n; k++)
+                        d_args[k] = d_args[k] * terms[i] +
+                                    value * partials[k * m + i];
+                    value *= terms[i];
+                }
+            }
+        } break;
+    }
+}
+
+double CompiledExpression::gradient(const double* args, double* grad,
+                                    GradientMode mode) const {
+    std::fill(grad, grad + arity(), 0.0);
+    if (code_.empty()) return 0.0;
+    if (mode == GradientMode::Automatic)
+        mode = arity() <= kForwardModeMaxParams ? GradientMode::Forward
+                                                : GradientMode::Reverse;
+    if (mode == GradientMode::Forward) return gradientForward(args, grad);
+    return gradientReverse(args, grad);
+}
+
+std::vector<double> CompiledExpression::gradient(
+    const std::vector<double>& args, GradientMode mode) const {
+    if (args.size() != arity())
+        throw SyntaxError("compiled expression needs " +
+                          std::to_string(arity()) + " arguments");
+    std::vector<double> grad(arity());
+    gradient(args.data(), grad.data(), mode);
+    return grad;
+}
+
+// 前向模式: 栈中每个值同时携带对所有参数的导数(对偶数的向量形式)
+double CompiledExpression::gradientForward(const double* args,
+                                           double* grad) const {
+    const size_t n = arity();
+    ScratchBuffer<double> value_scratch, tangent_scratch;
+    std::vector<double>& values = value_scratch.get();
+    std::vector<double>& tangents = tangent_scratch.get();
+    values.resize(max_depth_);
+    tangents.resize(max_depth_ * n);
+
+    int top = -1;
+    for (const Instruction& ins : code_) {
+        switch (ins.op) {
+            case OpCode::Constant:
+            case OpCode::Argument: {
+                ++top;
+                double* t = &tangents[top * n];
+                std::fill(t, t + n, 0.0);
+                if (ins.op == OpCode::Constant) {
+                    values[top] = ins.value;
+                } else {
+                    values[top] = args[ins.index];
+                    t[ins.index] = 1.0;
+                }
+            } break;
+            case OpCode::Not:
+            case OpCode::Negate:
+            case OpCode::Minus:
+            case OpCode::Call1: {
+                double a = values[top], r = apply(ins, a, 0.0), da, db;
+                partials(ins, a, 0, r, da, db);
+                double* t = &tangents[top * n];
+                for (size_t k = 0; k < n; k++) t[k] *= da;
+                values[top] = r;
+            } break;
+            case OpCode::Conditional: {
+                // 选中的分支与当前表达式的参数相同，它的梯度就是结果的切向量
+                const Conditional& conditional = conditionals_[ins.index];
+                auto& branch = values[top] != 0 ? conditional.then_branch
+                                                : conditional.else_branch;
+                values[top] = branch->gradient(args, &tangents[top * n]);
+            } break;
+            case OpCode::Builtin: {
+                const Builtin& builtin = builtins_[ins.index];
+                top -= builtin.operands - 1;
+                double operands[2] = {values[top], 0}, d_operands[2];
+                if (builtin.operands == 2) operands[1] = values[top + 1];
+                double r = callBuiltin(builtin, args, operands);
+                std::vector<double> d_args(n);
+                builtinPartials(builtin, args, operands, r, d_operands,
+                                d_args.data());
+                double *ta = &tangents[top * n], *tb = ta + n;
+                for (size_t k = 0; k < n; k++) {
+                    ta[k] = d_operands[0] * ta[k] + d_args[k];
+                    if (builtin.operands == 2) ta[k] += d_operands[1] * tb[k];
+                }
+                values[top] = r;
+            } break;
+            default: {
+                top--;
+                double a = values[top], b = values[top + 1];
+                double r = apply(ins, a, b), da, db;
+                partials(ins, a, b, r, da, db);
+                double *ta = &tangents[top * n], *tb = ta + n;
+                for (size_t k = 0; k < n; k++) ta[k] = da * ta[k] + db * tb[k];
+                values[top] = r;
+            } break;
+        }
+    }
+    std::copy(tangents.begin(), tangents.begin() + n, grad);
+    return values[0];
+}
+
+// 反向模式: 先正向计算并记录每条指令的值，再从最后一条指令反向累加伴随值
+double CompiledExpression::gradientReverse(const double* args,
+                                           double* grad) const {
+    const int count = (int)code_.size();
+    ScratchBuffer<double> value_scratch, adjoint_scratch;
+    std::vector<double>& values = value_scratch.get();
+    std::vector<double>& adjoints = adjoint_scratch.get();
+    values.resize(count);
+    adjoints.assign(count, 0.0);
+
+    for (int i = 0; i < count; i++) {
+        const Instruction& ins = code_[i];
+        auto [l, r] = operands_[i];
+        if (ins.op == OpCode::Constant) {
+            values[i] = ins.value;
+        } else if (ins.op == OpCode::Argument) {
+            values[i] = args[ins.index];
+        } else if (ins.op == OpCode::Builtin) {
+            double operands[2] = {values[l], r < 0 ? 0 : values[r]};
+            values[i] = callBuiltin(builtins_[ins.index], args, operands);
+        } else if (ins.op == OpCode::Conditional) {
+            const Conditional& conditional = conditionals_[ins.index];
+            values[i] = (values[l] != 0 ? conditional.then_branch
+                                        : conditional.else_branch)
+                            ->evaluate(args);
+        } else {
+            values[i] = apply(ins, values[l], r < 0 ? 0.0 : values[r]);
+        }
+    }
+
+    adjoints[count - 1] = 1.0;
+    for (int i = count - 1; i >= 0; i--) {
+        const Instruction& ins = code_[i];
+        double adj = adjoints[i];
+        if (adj == 0) continue;
+        if (ins.op == OpCode::Argument) {
+            grad[ins.index] += adj;
+            continue;
+        }
+        if (ins.op == OpCode::Constant) continue;
+        auto [l, r] = operands_[i];
+        if (ins.op == OpCode::Conditional) {
+            // 条件的导数为0，梯度只来自选中的分支
+            const Conditional& conditional = conditionals_[ins.index];
+            std::vector<double> branch_grad(arity());
+            (values[l] != 0 ? conditional.then_branch
+                            : conditional.else_branch)
+                ->gradient(args, branch_grad.data());
+            for (size_t k = 0; k < arity(); k++)
+                grad[k] += adj * branch_grad[k];
+            continue;
+        }
+        if (ins.op == OpCode::Builtin) {
+            double operands[2] = {values[l], r < 0 ? 0 : values[r]};
+            double d_operands[2];
+            std::vector<double> d_args(arity());
+            builtinPartials(builtins_[ins.index], args, operands, values[i],
+                            d_operands, d_args.data());
+            for (size_t k = 0; k < arity(); k++) grad[k] += adj * d_args[k];
+            adjoints[l] += adj * d_operands[0];
+            if (r >= 0) adjoints[r] += adj * d_operands[1];
+            continue;
+        }
+        double da, db;
+        partials(ins, values[l], r < 0 ? 0 : values[r], values[i], da, db);
+        adjoints[l] += adj * da;
+        if (r >= 0) adjoints[r] += adj * db;
+    }
+    return values[count - 1];
+}
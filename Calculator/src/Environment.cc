@@ -0,0 +1,125 @@
+#include "../include/Environment.h"
+
+#include <algorithm>
+#include <vector>
+using namespace calculator;
+
+std::shared_ptr<const Bindings> Environment::builtinConstants() {
+    static const std::shared_ptr<const Bindings> constants =
+        std::make_shared<const Bindings>(Bindings{
+            {"pi", 3.141592653589793},
+            {"e", 2.718281828459045},
+            {"sqrt2", 1.4142135623730951}});
+    return constants;
+}
+
+std::shared_ptr<const Bindings> Environment::makeBase(
+    const Bindings &globals) {
+    auto base = std::make_shared<Bindings>(*builtinConstants());
+    for (auto &[name, value] : globals) (*base)[name] = value;
+    return base;
+}
+
+std::optional<double> Environment::find(const std::string &name,
+                                        const Bindings *globals) {
+    if (local_) {
+        if (auto it = local_->entries.find(name); it != local_->entries.end()) {
+            // 会话层被共享时不更新使用时刻(近似的LRU)，避免读取也要复制
+            if (local_.use_count() == 1) it->second.used = ++local_->clock;
+            // 数组遮住外层的同名常量
+            if (it->second.array) return std::nullopt;
+            return it->second.value;
+        }
+    }
+    if (globals)
+        if (auto it = globals->find(name); it != globals->end())
+            return it->second;
+    if (auto it = base_->find(name); it != base_->end()) return it->second;
+    return std::nullopt;
+}
+
+ArrayRef Environment::findArray(const std::string &name) {
+    if (!local_) return nullptr;
+    auto it = local_->entries.find(name);
+    if (it == local_->entries.end()) return nullptr;
+    if (local_.use_count() == 1) it->second.used = ++local_->clock;
+    return it->second.array;
+}
+
+bool Environment::contains(const std::string &name) const {
+    return (local_ && local_->entries.count(name)) || base_->count(name);
+}
+
+void Environment::assign(const std::string &name, double value) {
+    put(name, value, nullptr);
+}
+
+void Environment::assign(const std::string &name, ArrayRef array) {
+    put(name, 0.0, std::move(array));
+}
+
+void Environment::put(const std::string &name, double value, ArrayRef array) {
+    detach();
+    auto [it, inserted] = local_->entries.try_emplace(name);
+    Entry &entry = it->second;
+    // 标量覆盖标量时内存不变，数组的大小可能变化
+    if (!inserted) local_->memory -= entryCost(name, entry);
+    entry.value = value;
+    entry.array = std::move(array);
+    entry.used = ++local_->clock;
+    local_->memory += entryCost(name, entry);
+    if (limit_ && local_->memory > limit_) evict(&it->first);
+}
+
+bool Environment::erase(const std::string &name) {
+    if (!local_ || !local_->entries.count(name)) return false;
+    detach();
+    auto it = local_->entries.find(name);
+    local_->memory -= entryCost(name, it->second);
+    local_->entries.erase(it);
+    return true;
+}
+
+void Environment::setMemoryLimit(size_t bytes) {
+    limit_ = bytes;
+    if (limit_ && memoryUsage() > limit_) {
+        detach();
+        evict(nullptr);
+    }
+}
+
+void Environment::detach() {
+    if (!local_)
+        local_ = std::make_shared<Layer>();
+    else if (local_.use_count() > 1)
+        local_ = std::make_shared<Layer>(*local_);
+}
+
+void Environment::evict(const std::string *keep) {
+    using Iterator = std::unordered_map<std::string, Entry>::iterator;
+    std::vector<Iterator> order;
+    order.reserve(local_->entries.size());
+    for (auto it = local_->entries.begin(); it != local_->entries.end(); ++it)
+        if (!keep || &it->first != keep) order.push_back(it);
+    std::sort(order.begin(), order.end(), [](Iterator a, Iterator b) {
+        return a->second.used < b->second.used;
+    });
+    // 一次淘汰到上限的3/4，连续定义新变量时不用每次都排序
+    size_t target = limit_ / 4 * 3;
+    for (Iterator it : order) {
+        if (local_->memory <= target) break;
+        local_->memory -= entryCost(it->first, it->second);
+        local_->entries.erase(it);
+        evictions_++;
+    }
+}
+
+// 哈希表节点的估计大小: 变量名 + 值 + 节点指针和哈希值，数组另加元素和控制块
+size_t Environment::entryCost(const std::string &name, const Entry &entry) {
+    size_t cost =
+        sizeof(std::string) + name.size() + sizeof(Entry) + 2 * sizeof(void *);
+    if (entry.array)
+        cost += sizeof(std::vector<double>) + 2 * sizeof(void *) +
+                entry.array->size() * sizeof(double);
+    return cost;
+}
@@ -1,21 +1,261 @@
 #include "../include/ExpressionTree.h"
+
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <thread>
+#include <unordered_set>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 using namespace calculator;
 
+// 性能分析的时钟: x86 上为时间戳计数器(时钟周期)，其他平台为纳秒
+static uint64_t profileTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
 double ExpressionTree::calcExpression(const std::string &text) {
+    FunctionPin pin(lexer_);
+    Governor governor(limits_);
+    Governor::Scope scope(limits_.enabled() ? &governor : nullptr);
     double value = 0.0;
-    parseExpression(text);
+    slot_count_ = 0;
     node *root;
-    if ((root = buildTree())) value = calcValue(root);
+    if ((root = parseScript(text))) {
+        if (isArrayValued(root))
+            throw ArrayException(
+                "can not be the value of calcExpression, use calcArray or a "
+                "reduction such as sum()");
+        value = calcValue(root);
+    }
     return value;
 }
 
+std::vector<double> ExpressionTree::calcArray(const std::string &text) {
+    FunctionPin pin(lexer_);
+    Governor governor(limits_);
+    Governor::Scope scope(limits_.enabled() ? &governor : nullptr);
+    slot_count_ = 0;
+    node *root = parseScript(text);
+    if (!root) return {0.0};
+    ArrayRef value = calcArrayValue(root);
+    return *value;
+}
+
+ExactNumber ExpressionTree::calcExact(const std::string &text) {
+    FunctionPin pin(lexer_);
+    Governor governor(limits_);
+    Governor::Scope scope(limits_.enabled() ? &governor : nullptr);
+    slot_count_ = 0;
+    // 常量折叠按 double 计算，精确模式计算没有折叠的语法树
+    fold_ = false;
+    node *root;
+    try {
+        root = parseScript(text);
+    } catch (...) {
+        fold_ = true;
+        throw;
+    }
+    fold_ = true;
+    if (!root) return ExactNumber();
+    if (isArrayValued(root))
+        throw ArrayException(
+            "can not be used in exact mode, use a reduction such as sum()");
+    std::vector<ExactNumber> slots;
+    return calcExactValue(root, slots);
+}
+
+std::string ExpressionTree::explain(const std::string &text) {
+    FunctionPin pin(lexer_);
+    Governor governor(limits_);
+    Governor::Scope scope(limits_.enabled() ? &governor : nullptr);
+    slot_count_ = 0;
+    node *root = parseScript(text);
+    if (!root) return "(no expression)\n";
+    // 统计折叠之后的语法树
+    size_t nodes = 0, depth = 0, folded = 0;
+    std::vector<std::pair<node *, size_t>> pending = {{root, 1}};
+    while (!pending.empty()) {
+        auto [x, d] = pending.back();
+        pending.pop_back();
+        nodes++;
+        depth = std::max(depth, d);
+        if (x->folded) folded++;
+        for (node *arg : x->args)
+            if (arg) pending.push_back({arg, d + 1});
+        if (x->left) pending.push_back({x->left, d + 1});
+        if (x->right) pending.push_back({x->right, d + 1});
+    }
+    std::string out = "nodes " + std::to_string(nodes) + ", depth " +
+                      std::to_string(depth) + ", folded " +
+                      std::to_string(folded) + "\n";
+    describe(root, 0, out, nullptr);
+    return out;
+}
+
+std::string ExpressionTree::profile(const std::string &text,
+                                    size_t iterations) {
+    FunctionPin pin(lexer_);
+    Governor governor(limits_);
+    Governor::Scope scope(limits_.enabled() ? &governor : nullptr);
+    slot_count_ = 0;
+    // 常量折叠之后只剩下一个常数，分析的是没有折叠的语法树
+    fold_ = false;
+    node *root;
+    try {
+        root = parseScript(text);
+    } catch (...) {
+        fold_ = true;
+        throw;
+    }
+    fold_ = true;
+    if (!root) return "(no expression)\n";
+    if (isArrayValued(root))
+        throw ArrayException(
+            "can not be profiled, use a reduction such as sum()");
+
+    std::unordered_map<const node *, NodeProfile> profile;
+    profile_ = &profile;
+    uint64_t begin = profileTicks();
+    try {
+        for (size_t i = 0; i < iterations; i++) calcValue(root);
+    } catch (...) {
+        profile_ = nullptr;
+        throw;
+    }
+    uint64_t total = profileTicks() - begin;
+    profile_ = nullptr;
+
+#if defined(__x86_64__) || defined(__i386__)
+    const char *unit = "cycles";
+#else
+    const char *unit = "ns";
+#endif
+    char line[128];
+    std::snprintf(line, sizeof(line),
+                  "%zu iterations, %.1f %s per iteration\n", iterations,
+                  iterations ? (double)total / iterations : 0.0, unit);
+    std::string out = line;
+    std::snprintf(line, sizeof(line), "%10s %14s %14s %6s  %s\n", "calls",
+                  "total", "self", "%", "node");
+    out += line;
+    // 百分比相对于根节点的总耗时
+    describe(root, 0, out, &profile, profile[root].ticks);
+    return out;
+}
+
+void ExpressionTree::describe(
+    node *x, int depth, std::string &out,
+    const std::unordered_map<const node *, NodeProfile> *profile,
+    uint64_t total) {
+    if (!x) return;
+    std::vector<node *> children(x->args.begin(), x->args.end());
+    if (x->left) children.push_back(x->left);
+    if (x->right) children.push_back(x->right);
+
+    if (profile) {
+        // 自身的耗时 = 总耗时 - 子节点的总耗时
+        NodeProfile p;
+        if (auto it = profile->find(x); it != profile->end()) p = it->second;
+        uint64_t children_ticks = 0;
+        for (node *child : children)
+            if (auto it = profile->find(child); it != profile->end())
+                children_ticks += it->second.ticks;
+        char line[96];
+        std::snprintf(line, sizeof(line), "%10llu %14llu %14llu %6.1f  ",
+                      (unsigned long long)p.calls, (unsigned long long)p.ticks,
+                      (unsigned long long)(p.ticks > children_ticks
+                                               ? p.ticks - children_ticks
+                                               : 0),
+                      total ? 100.0 * p.ticks / total : 0.0);
+        out += line;
+    }
+    out += std::string(2 * depth, ' ');
+
+    auto number = [](double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.10g", value);
+        return std::string(buffer);
+    };
+    auto attributes = [&](const std::string &name) {
+        auto &table = lexer_.functions().function_attributes;
+        auto it = table.find(name);
+        if (it != table.end() && it->second.random) return std::string(" (random)");
+        if (it == table.end() || !it->second.pure) return std::string(" (impure)");
+        if (it->second.cache_size)
+            return " (pure, cache " + std::to_string(it->second.cache_size) +
+                   ")";
+        return std::string(" (pure)");
+    };
+    std::string label;
+    switch (x->type) {
+        case Tag::Number:
+            label = "integer " + number(x->value);
+            break;
+        case Tag::Float:
+            label = "number " + number(x->value);
+            break;
+        case Tag::Identifier:
+            label = "parameter #" + std::to_string(x->index);
+            break;
+        case Tag::Array:
+            label = x->array ? "array [" + std::to_string(x->array->size()) +
+                                   " elements]"
+                             : "array literal";
+            break;
+        case Tag::Function:
+            label = "unary " + x->funcname + attributes(x->funcname);
+            break;
+        case Tag::BinaryFunction:
+            label = "binary " + x->funcname + attributes(x->funcname);
+            break;
+        case Tag::Builtin:
+            label = "builtin " + x->funcname + " (variable " + x->variable +
+                    " = parameter #" + std::to_string(x->index) + ")";
+            break;
+        case Tag::Reduction:
+            label = "reduction " + x->funcname;
+            break;
+        case Tag::Conditional:
+            label = "if";
+            break;
+        default:
+            label = "operator " + Token(x->type).toString();
+            break;
+    }
+    if (x->negative && (x->type == Tag::Function ||
+                        x->type == Tag::BinaryFunction ||
+                        x->type == Tag::Builtin || x->type == Tag::Reduction ||
+                        x->type == Tag::Conditional))
+        label = "-" + label;
+    // 折叠的节点只保留值，原来的子树已经释放
+    if (x->folded) label = "constant " + number(x->value) + " <- " + label;
+    out += label + "\n";
+    for (node *child : children)
+        describe(child, depth + 1, out, profile, total);
+}
+
 void ExpressionTree::parseExpression(const std::string &text) {
     // 重新设置文本串
     lexer_.reader().set_buffer(text);
+    // 上一个表达式出错时可能留下未匹配的括号
+    lexer_.reset();
     // 清除token
     lexer_.tokenList().clear();
     // 词法分析阶段开始
-    while (!lexer_.reader().eof()) lexer_.scan();
+    Governor *governor = Governor::current();
+    while (!lexer_.reader().eof()) {
+        lexer_.scan();
+        if (governor)
+            governor->checkTokens(lexer_.tokenList().size(), lexer_.depth());
+    }
 
     // 然后判断表达式是否括号匹配
     if (!lexer_.bm().empty()) throw SyntaxError("expression unexpected )!");
@@ -23,23 +263,568 @@ void ExpressionTree::parseExpression(const std::string &text) {
 
 node *ExpressionTree::buildTree() {
     int i = 0;
+    // 释放上一个表达式的语法树
+    clear(root_);
     root_ = buildTreeInfix(i);
+    checkTree(root_);
+    if (fold_) foldConstants(root_);
     return root_;
 }
 
+/*
+ * 长脚本的并行分析: 词法分析时会话中已有的变量被替换为常量，脚本中赋值的变量在
+ * 构建语法树时才查找。所以在顶层的 ; 处切分后，每块可以在独立的线程中用同一个
+ * 变量环境的快照做词法分析和语法分析，脚本中定义的变量先保留为变量名，
+ * 然后在当前线程按顺序执行赋值语句，执行到一条语句时再查找它用到的变量。
+ * 结果和错误与整体分析相同; 不能保证相同的写法(比如重复赋值、表达式中的赋值)
+ * 回到整体分析
+ */
+node *ExpressionTree::parseScript(const std::string &text) {
+    size_t workers =
+        parse_workers_ ? parse_workers_ : std::thread::hardware_concurrency();
+    std::vector<size_t> bounds;
+    if (workers > 1 && text.size() >= kParallelScriptBytes)
+        bounds = splitScript(text, workers);
+    if (bounds.size() < 3) {
+        parseExpression(text);
+        return buildTree();
+    }
+
+    // 工作分析器共享当前的变量快照和固定的函数表版本，在启动线程前创建
+    size_t chunks = bounds.size() - 1;
+    std::vector<std::unique_ptr<ExpressionTree>> trees;
+    std::vector<std::vector<Statement>> parsed(chunks);
+    std::vector<std::exception_ptr> errors(chunks);
+    std::vector<char> supported(chunks, 1);
+    for (size_t k = 0; k < chunks; k++) {
+        trees.push_back(std::make_unique<ExpressionTree>(lexer_.registry));
+        trees[k]->lexer_.environment = lexer_.environment;
+        trees[k]->lexer_.shareFunctions(lexer_);
+        trees[k]->deferred_ = true;
+    }
+    Governor *governor = Governor::current();
+    auto work = [&](size_t k) {
+        // 工作线程只检查 token 数、嵌套深度和时间
+        Governor::Scope scope(governor);
+        try {
+            supported[k] = trees[k]->parseStatements(
+                text.substr(bounds[k], bounds[k + 1] - bounds[k]), parsed[k]);
+        } catch (...) {
+            errors[k] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t k = 1; k < chunks; k++) threads.emplace_back(work, k);
+    work(0);
+    for (auto &thread : threads) thread.join();
+
+    std::vector<Statement> statements;
+    for (auto &chunk : parsed)
+        for (auto &statement : chunk) statements.push_back(std::move(statement));
+    auto release = [&] {
+        for (auto &statement : statements) clear(statement.value);
+    };
+    // 词法分析的错误在执行任何语句之前抛出
+    for (auto &error : errors) {
+        if (!error) continue;
+        release();
+        std::rethrow_exception(error);
+    }
+    if (governor) {
+        size_t tokens = 0;
+        for (auto &tree : trees) tokens += tree->lexer_.tokenList().size();
+        try {
+            governor->checkTokens(tokens, 0);
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+    // 只检查会执行到的语句: 第一个表达式语句或者出错的语句之后的不会执行
+    std::unordered_set<std::string> assigned;
+    bool fallback =
+        std::find(supported.begin(), supported.end(), 0) != supported.end();
+    for (auto &statement : statements) {
+        if (statement.error || statement.variable.empty()) break;
+        if (!assigned.insert(statement.variable).second) fallback = true;
+    }
+    if (fallback) {
+        release();
+        parseExpression(text);
+        return buildTree();
+    }
+
+    lexer_.tokenList().clear();
+    clear(root_);
+    try {
+        root_ = runStatements(statements);
+    } catch (...) {
+        release();
+        throw;
+    }
+    release();
+    if (fold_) foldConstants(root_);
+    return root_;
+}
+
+std::vector<size_t> ExpressionTree::splitScript(const std::string &text,
+                                                size_t chunks) {
+    std::vector<size_t> bounds = {0};
+    size_t target = text.size() / chunks, depth = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '(' || c == '[') {
+            depth++;
+        } else if (c == ')' || c == ']') {
+            if (depth-- == 0) return {};
+        } else if (c == ';') {
+            if (depth != 0) return {};
+            if (i + 1 - bounds.back() >= target && bounds.size() < chunks)
+                bounds.push_back(i + 1);
+        }
+    }
+    if (depth != 0) return {};
+    if (bounds.back() != text.size()) bounds.push_back(text.size());
+    return bounds;
+}
+
+bool ExpressionTree::parseStatements(const std::string &text,
+                                     std::vector<Statement> &statements) {
+    parseExpression(text);
+    return buildStatements(statements);
+}
+
+bool ExpressionTree::buildStatements(std::vector<Statement> &statements) {
+    auto &tokens = lexer_.tokenList();
+    int size = (int)tokens.size();
+    for (int begin = 0, end; begin < size; begin = end + 1) {
+        for (end = begin; end < size && tokens[end]->type() != Tag::END_SEP;)
+            end++;
+        if (begin == end) continue;
+        Statement statement;
+        int value = begin;
+        if (end - begin >= 2 && tokens[begin]->type() == Tag::Identifier &&
+            tokens[begin + 1]->type() == Tag::Equal) {
+            statement.variable = ((Word *)tokens[begin].get())->lexeme();
+            value = begin + 2;
+            if (value == end) return false;
+        }
+        // 表达式中的赋值在构建时执行，只能逐条分析
+        for (int k = value; k < end; k++)
+            if (tokens[k]->type() == Tag::Equal) return false;
+
+        try {
+            if (statement.variable.empty() || end - value > 1) {
+                int i = value;
+                statement.value = buildTreeInfix(i);
+                // 赋值语句的值应该正好在 ; 结束
+                if (!statement.variable.empty() && i != end) {
+                    clear(statement.value);
+                    return false;
+                }
+            } else {
+                // 只有一个运算符之类的值(比如 c=*)整体分析时不赋值，
+                // 只能逐条分析
+                Tag type = tokens[value]->type();
+                if (type != Tag::Number && type != Tag::Float &&
+                    type != Tag::Array && type != Tag::Identifier)
+                    return false;
+                statement.token = tokens[value];
+            }
+        } catch (...) {
+            statement.error = std::current_exception();
+        }
+        bool last = statement.error || statement.variable.empty();
+        statements.push_back(std::move(statement));
+        // 之后的语句不会执行
+        if (last) break;
+    }
+    return true;
+}
+
+node *ExpressionTree::runStatements(std::vector<Statement> &statements) {
+    for (auto &statement : statements) {
+        if (statement.error) std::rethrow_exception(statement.error);
+        // 表达式语句: 脚本的值，之后的语句不执行
+        checkTree(statement.value);
+        if (statement.variable.empty()) {
+            resolveVariables(statement.value);
+            node *root = statement.value;
+            statement.value = nullptr;
+            return root;
+        }
+        const std::string &key = statement.variable;
+        if (node *x = statement.value) {
+            resolveVariables(x);
+            if (isArrayValued(x))
+                lexer_.environment.assign(key, calcArrayValue(x));
+            else
+                lexer_.environment.assign(key, calcValue(x));
+            continue;
+        }
+        // 值只有一个 token，与 buildTreeInfix 中的处理相同
+        Token *token = statement.token.get();
+        if (token->type() == Tag::Number) {
+            lexer_.environment.assign(key, ((Number *)token)->value());
+        } else if (token->type() == Tag::Float) {
+            lexer_.environment.assign(key, ((Float *)token)->value());
+        } else if (token->type() == Tag::Array) {
+            lexer_.environment.assign(key, ((ArrayConstant *)token)->value());
+        } else if (token->type() == Tag::Identifier) {
+            if (auto x = lexer_.lookupConstant(token->toString()))
+                lexer_.environment.assign(key, *x);
+            else if (auto array =
+                         lexer_.environment.findArray(token->toString()))
+                lexer_.environment.assign(key, array);
+            else
+                throw VariableNotDefined(token->toString());
+        }
+    }
+    // 脚本中只有赋值语句
+    return nullptr;
+}
+
+void ExpressionTree::resolveVariables(node *x) {
+    if (!x) return;
+    if (x->type == Tag::Identifier && x->index < 0) {
+        if (auto value = lexer_.lookupConstant(x->variable)) {
+            x->type = Tag::Float;
+            x->value = *value;
+        } else if (auto array = lexer_.environment.findArray(x->variable)) {
+            x->type = Tag::Array;
+            x->array = array;
+        } else {
+            throw AssignVariableException(x->variable);
+        }
+        return;
+    }
+    for (node *arg : x->args) resolveVariables(arg);
+    resolveVariables(x->left);
+    resolveVariables(x->right);
+}
+
+CompiledExpression ExpressionTree::compile(
+    const std::string &text, const std::vector<std::string> &params,
+    Precision precision) {
+    FunctionPin pin(lexer_);
+    Governor governor(limits_);
+    Governor::Scope scope(limits_.enabled() ? &governor : nullptr);
+    CompiledExpression program;
+    program.parameters_ = params;
+    lexer_.parameters.clear();
+    for (int i = 0; i < (int)params.size(); i++) {
+        if (!lexer_.parameters.emplace(params[i], i).second)
+            throw SyntaxError("duplicate parameter " + params[i]);
+    }
+    slot_count_ = (int)params.size();
+    try {
+        parseExpression(text);
+        emitProgram(buildTree(), program);
+    } catch (...) {
+        lexer_.parameters.clear();
+        throw;
+    }
+    lexer_.parameters.clear();
+    program.finalize();
+    program.setPrecision(precision);
+    return program;
+}
+
+// 后序遍历表达式树生成指令，类型检查与 calcValue 中的一致
+void ExpressionTree::emitProgram(node *x, CompiledExpression &program) {
+    if (!x) return;
+    auto emit = [&](OpCode op, int index = 0, double value = 0) {
+        program.code_.push_back({op, index, value});
+    };
+    if (x->folded || x->type == Tag::Number || x->type == Tag::Float)
+        return emit(OpCode::Constant, 0, x->value);
+    if (x->type == Tag::Identifier) return emit(OpCode::Argument, x->index);
+    // 数组只能在 calcExpression/calcArray 中逐元素计算，见 calcArrayValue
+    if (x->type == Tag::Array) {
+        if (x->index < 0)
+            throw ArrayException(
+                "can not be used in builtin functions or compiled expressions");
+        return emit(OpCode::Argument, x->index);
+    }
+    if (x->type == Tag::Reduction)
+        throw ArrayException("reduction [" + x->funcname +
+                             "] can not be used in compiled expressions");
+
+    node *valid_child = x->left ? x->left : x->right;
+    switch (x->type) {
+        case Tag::Function: {
+            if (!valid_child) throw UnaryFunctionException(x->funcname);
+            auto it = lexer_.functions().unary_functions.find(x->funcname);
+            if (it == lexer_.functions().unary_functions.end())
+                throw FunctionDeclareException(x->funcname);
+            UnaryFunctionType derivative;
+            if (auto d = lexer_.functions().unary_derivatives.find(x->funcname);
+                d != lexer_.functions().unary_derivatives.end())
+                derivative = d->second;
+            BatchFunctionType batch = nullptr;
+            if (auto b = lexer_.functions().unary_batch_functions.find(x->funcname);
+                b != lexer_.functions().unary_batch_functions.end())
+                batch = b->second;
+            if (!isConcurrent(x->funcname)) program.concurrent_ = false;
+            if (isRandom(x->funcname)) program.random_ = true;
+            emitProgram(valid_child, program);
+            emit(OpCode::Call1,
+                 program.addUnary(x->funcname, it->second, derivative, batch,
+                                  &lexer_.functions()));
+            if (x->negative) emit(OpCode::Minus);
+            return;
+        }
+        case Tag::BinaryFunction:
+        case Tag::Pow: {
+            // ** 与 pow 相同
+            std::string name = x->type == Tag::Pow ? "pow" : x->funcname;
+            if (!x->left || !x->right) throw BinaryFunctionException(name);
+            auto it = lexer_.functions().binary_functions.find(name);
+            if (it == lexer_.functions().binary_functions.end())
+                throw FunctionDeclareException(name);
+            std::pair<BinaryFunctionType, BinaryFunctionType> derivative;
+            if (auto d = lexer_.functions().binary_derivatives.find(name);
+                d != lexer_.functions().binary_derivatives.end())
+                derivative = d->second;
+            if (!isConcurrent(name)) program.concurrent_ = false;
+            if (isRandom(name)) program.random_ = true;
+            emitProgram(x->left, program);
+            emitProgram(x->right, program);
+            emit(OpCode::Call2,
+                 program.addBinary(name, it->second, derivative.first,
+                                   derivative.second, &lexer_.functions()));
+            if (x->type == Tag::BinaryFunction && x->negative)
+                emit(OpCode::Minus);
+            return;
+        }
+        case Tag::Builtin: {
+            // 函数体编译为子表达式，参数为当前的参数加上绑定变量
+            for (size_t k = 1; k < x->args.size(); k++)
+                emitProgram(x->args[k], program);
+            auto body = std::make_shared<CompiledExpression>();
+            body->parameters_ = program.parameters_;
+            body->parameters_.resize(x->index);
+            body->parameters_.push_back(x->variable);
+            emitProgram(x->args[0], *body);
+            body->finalize();
+            emit(OpCode::Builtin, program.addBuiltin(x->funcname, body));
+            if (x->negative) emit(OpCode::Minus);
+            return;
+        }
+        case Tag::Conditional:
+        case Tag::LogicalAnd:
+        case Tag::LogicalOr: {
+            // 分支编译为参数相同的子表达式，计算时只计算选中的分支
+            auto branch = [&](node *y, bool truth) {
+                auto sub = std::make_shared<CompiledExpression>();
+                sub->parameters_ = program.parameters_;
+                emitProgram(y, *sub);
+                // && 和 || 的结果为 1/0
+                if (truth) {
+                    sub->code_.push_back({OpCode::Constant, 0, 0.0});
+                    sub->code_.push_back({OpCode::NotEqual, 0, 0.0});
+                }
+                sub->finalize();
+                return sub;
+            };
+            node truth(Tag::Number, 1.0), falsity(Tag::Number, 0.0);
+            node *condition = x->left, *then_branch, *else_branch;
+            if (x->type == Tag::Conditional) {
+                condition = x->args[0];
+                then_branch = x->args[1], else_branch = x->args[2];
+            } else if (x->type == Tag::LogicalAnd) {
+                then_branch = x->right, else_branch = &falsity;
+            } else {
+                then_branch = &truth, else_branch = x->right;
+            }
+            if (!condition || !then_branch || !else_branch)
+                throw SyntaxError("need two operator numbers");
+            bool logical = x->type != Tag::Conditional;
+            emitProgram(condition, program);
+            emit(OpCode::Conditional,
+                 program.addConditional(
+                     branch(then_branch, logical && then_branch == x->right),
+                     branch(else_branch, logical && else_branch == x->right)));
+            if (x->type == Tag::Conditional && x->negative) emit(OpCode::Minus);
+            return;
+        }
+        case Tag::Not:
+            if (!valid_child) throw SyntaxError("need one operator numbers");
+            emitProgram(valid_child, program);
+            return emit(OpCode::Not);
+        case Tag::Negate:
+            // 能到这里说明操作数不是整数常量
+            if (!valid_child) throw SyntaxError("need one operator numbers");
+            throw NegateTypeException(valid_child->value);
+        default:
+            break;
+    }
+
+    static const std::unordered_map<Tag, OpCode> binary_ops = {
+        {Tag::Add, OpCode::Add},
+        {Tag::Sub, OpCode::Sub},
+        {Tag::Mul, OpCode::Mul},
+        {Tag::Div, OpCode::Div},
+        {Tag::Mod, OpCode::Mod},
+        {Tag::And, OpCode::And},
+        {Tag::Or, OpCode::Or},
+        {Tag::Xor, OpCode::Xor},
+        {Tag::ShiftLeft, OpCode::ShiftLeft},
+        {Tag::ShiftRight, OpCode::ShiftRight},
+        {Tag::Less, OpCode::Less},
+        {Tag::LessEqual, OpCode::LessEqual},
+        {Tag::Greater, OpCode::Greater},
+        {Tag::GreaterEqual, OpCode::GreaterEqual},
+        {Tag::EqualEqual, OpCode::Equal},
+        {Tag::NotEqual, OpCode::NotEqual}};
+    auto op = binary_ops.find(x->type);
+    if (op == binary_ops.end()) throw SyntaxError("unexpected operator");
+    node *l = x->left, *r = x->right;
+    if (!l || !r) throw SyntaxError("need two operator numbers");
+    if (x->type == Tag::Div && r->type == Tag::Number && r->value == 0)
+        throw DivZeroException(l->value, r->value);
+    // 参数和变量一样都是浮点数，不能移位
+    if (x->type == Tag::ShiftLeft || x->type == Tag::ShiftRight) {
+        for (node *y : {l, r})
+            if (y->type == Tag::Float || y->type == Tag::Identifier)
+                throw ShiftLeftRightException();
+    }
+    emitProgram(l, program);
+    emitProgram(r, program);
+    emit(op->second);
+}
+
+static void putUnaryFunction(FunctionTable &table, const std::string &name,
+                             const UnaryFunctionType &func,
+                             FunctionAttribute attr) {
+    table.function_attributes[name] = attr;
+    table.async_functions.erase(name);
+    table.unary_caches.erase(name);
+    table.unary_derivatives.erase(name);
+    table.nullary_functions.erase(name);
+    table.unary_batch_functions.erase(name);
+    table.erasePrecisionFunctions(name);
+    if (!attr.pure || attr.cache_size == 0) {
+        table.unary_functions[name] = func;
+        return;
+    }
+    // 纯函数的调用结果可以按参数缓存起来
+    auto cache = std::make_shared<MemoCache<1>>(attr.cache_size);
+    table.unary_caches[name] = cache;
+    table.unary_functions[name] = [cache, func](double x) {
+        return cache->get({x}, [&] { return func(x); });
+    };
+}
+
+void ExpressionTree::addUnaryFunction(const std::string &function_name,
+                                      const UnaryFunctionType &func,
+                                      FunctionAttribute attr) {
+    lexer_.registry->update([&](FunctionTable &table) {
+        putUnaryFunction(table, function_name, func, attr);
+    });
+}
+
+void ExpressionTree::addAsyncFunction(const std::string &function_name,
+                                      const AsyncFunctionType &func) {
+    // 同步调用时等待结果
+    UnaryFunctionType wait = [func](double x) {
+        auto result = std::make_shared<std::promise<double>>();
+        std::future<double> future = result->get_future();
+        func(x, [result](double value, std::exception_ptr error) {
+            if (error)
+                result->set_exception(error);
+            else
+                result->set_value(value);
+        });
+        return future.get();
+    };
+    lexer_.registry->update([&](FunctionTable &table) {
+        putUnaryFunction(table, function_name, wait, FunctionAttribute());
+        table.async_functions[function_name] = func;
+    });
+}
+
+void ExpressionTree::loadPlugin(const std::string &path) {
+    addPlugin(PluginLibrary::load(path));
+}
+
+void ExpressionTree::addPlugin(const std::shared_ptr<PluginLibrary> &library) {
+    // 插件中的函数作为一个新版本一起发布
+    lexer_.registry->update([&](FunctionTable &table) {
+        for (auto &f : library->functions()) {
+            // 注册的函数持有插件的引用，插件在不再被使用时才卸载
+            UnaryFunctionType scalar;
+            if (f.scalar)
+                scalar = [library, func = f.scalar](double x) {
+                    return func(x);
+                };
+            else
+                scalar = [library, batch = f.batch](double x) {
+                    double y;
+                    batch(&x, &y, 1);
+                    return y;
+                };
+            putUnaryFunction(table, f.name, scalar, {f.pure != 0});
+            table.unary_batch_functions[f.name] = f.batch;
+            if (f.derivative)
+                table.unary_derivatives[f.name] =
+                    [library, func = f.derivative](double x) {
+                        return func(x);
+                    };
+        }
+    });
+}
+
+void ExpressionTree::addBinaryFunction(const std::string &function_name,
+                                       const BinaryFunctionType &func,
+                                       FunctionAttribute attr) {
+    lexer_.registry->update([&](FunctionTable &table) {
+        table.function_attributes[function_name] = attr;
+        table.binary_caches.erase(function_name);
+        table.binary_derivatives.erase(function_name);
+        table.erasePrecisionFunctions(function_name);
+        if (!attr.pure || attr.cache_size == 0) {
+            table.binary_functions[function_name] = func;
+            return;
+        }
+        auto cache = std::make_shared<MemoCache<2>>(attr.cache_size);
+        table.binary_caches[function_name] = cache;
+        table.binary_functions[function_name] = [cache, func](double x,
+                                                              double y) {
+            return cache->get({x, y}, [&] { return func(x, y); });
+        };
+    });
+}
+
 // token序列,中缀表达式构建语法分析树
 node *ExpressionTree::buildTreeInfix(int &token_index) {
     // 操作符栈
     std::stack<std::pair<std::string, Tag>> ops;
     // 操作数栈
     std::stack<node *> nodes;
+    // 出错时释放操作数栈中的子树
+    struct Operands {
+        ExpressionTree &tree;
+        std::stack<node *> &nodes;
+        ~Operands() {
+            for (; !nodes.empty(); nodes.pop()) tree.clear(nodes.top());
+        }
+    } operands{*this, nodes};
+    // 取出栈顶的操作数，缺少操作数(比如 * 或 1;*)时抛出异常
+    auto pop = [&nodes] {
+        if (nodes.empty()) throw SyntaxError("need two operator numbers");
+        node *x = nodes.top();
+        nodes.pop();
+        return x;
+    };
     int i;
     for (i = token_index; i < lexer_.tokenList().size(); i++) {
         Token *token = lexer_.tokenList()[i].get();
         // 函数的右闭括号 或者 二元函数的自变量分割符, 或者
         // 变量定义的结束分隔符;
         // 对 f(x) 和 f(x,y) 和 表达式赋值 a=1+2+cos(100);
-        if (token->type() == Tag::END_FUNC || token->toString() == ",") {
+        if (token->type() == Tag::END_FUNC || token->type() == Tag::END_ARRAY ||
+            token->toString() == ",") {
             // 转到函数后面的token
             break;
         }
@@ -60,8 +845,7 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                 // 一元操作符
                 if (ops.top().second == Tag::Negate ||
                     ops.top().second == Tag::Not) {
-                    node *l = nodes.top();
-                    nodes.pop();
+                    node *l = pop();
                     node *root = new node(ops.top().second);
                     root->left = l;
 
@@ -70,10 +854,8 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
 
                 } else {
                     // 二元操作符
-                    node *r = nodes.top();
-                    nodes.pop();
-                    node *l = nodes.top();
-                    nodes.pop();
+                    node *r = pop();
+                    node *l = pop();
                     root->left = l, root->right = r;
 
                     nodes.push(root);
@@ -96,16 +878,34 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                 x = new node(Tag::Number, ((Number *)token)->value());
             nodes.push(x);
 
+        } else if (token->type() == Tag::Array) {
+            // 数组变量
+            node *x = new node(Tag::Array);
+            x->array = ((ArrayConstant *)token)->value();
+            nodes.push(x);
+        } else if (token->type() == Tag::BEGIN_ARRAY) {
+            nodes.push(buildArray(i));
+        } else if (token->type() == Tag::Reduction) {
+            nodes.push(buildReduction(i));
         } else if (token->type() == Tag::Identifier) {
             // 变量名/函数名
             std::string key = ((Word *)token)->lexeme();
-            // 定义变量
-            if (lexer_.constant.find(key) == lexer_.constant.end()) {
+            // 编译表达式的参数
+            if (auto p = lexer_.parameters.find(key);
+                p != lexer_.parameters.end()) {
+                node *x = new node(Tag::Identifier);
+                x->index = p->second;
+                nodes.push(x);
+                // 定义变量
+            } else if (auto value = lexer_.lookupConstant(key); !value) {
                 // 如果不是赋值，说明不是声明变量
                 if (i + 1 < lexer_.tokenList().size() &&
                     lexer_.tokenList()[i + 1]->type() == Tag::Equal) {
                     // 跳到变量定义的部分，获取其值
                     i += 2;
+                    // 缺少变量的值(a=)
+                    if (i >= lexer_.tokenList().size())
+                        throw DeclareVariableException(key);
                     // 如果当前的变量声明不是以;结束，则抛出异常
                     // 如果表达式中只有变量定义语句，即a=100此时;分隔符不是必须的
                     // a=100+200*cos(10);
@@ -114,7 +914,16 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                         lexer_.tokenList()[i + 1]->type() != Tag::END_SEP) {
                         // 构建子表达式树,然后在计算这颗树的数值,保存到常量表中
                         auto node = buildTreeInfix(i);
-                        lexer_.constant[key] = calcValue(node);
+                        try {
+                            checkTree(node);
+                        } catch (...) {
+                            clear(node);
+                            throw;
+                        }
+                        if (isArrayValued(node))
+                            lexer_.environment.assign(key, calcArrayValue(node));
+                        else
+                            lexer_.environment.assign(key, calcValue(node));
                         // 释放子树内存，因为我们只需要这个子表达式的值
                         clear(node);
                         // 继续处理下一个token
@@ -126,28 +935,46 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                     // 2.已经定义的常量(在词法分析阶段已经被替换为对应的数值)/变量名所表示的数值
                     token = lexer_.tokenList()[i].get();
                     if (token->type() == Tag::Number) {
-                        lexer_.constant[key] = ((Number *)token)->value();
+                        lexer_.environment.assign(key,
+                                                  ((Number *)token)->value());
                     } else if (token->type() == Tag::Float) {
-                        lexer_.constant[key] = ((Float *)token)->value();
+                        lexer_.environment.assign(key,
+                                                  ((Float *)token)->value());
+                    } else if (token->type() == Tag::Array) {
+                        // 数组变量只复制引用
+                        lexer_.environment.assign(
+                            key, ((ArrayConstant *)token)->value());
                     } else if (token->type() == Tag::Identifier) {
                         // 然后再判断这个变量是否已经声明
-                        if (auto x = lexer_.constant.find(token->toString());
-                            x != lexer_.constant.end()) {
+                        if (auto x = lexer_.lookupConstant(token->toString())) {
                             // 这里将变量b设置为a变量对应的值
-                            lexer_.constant[key] = x->second;
-
+                            lexer_.environment.assign(key, *x);
+                        } else if (auto array = lexer_.environment.findArray(
+                                       token->toString())) {
+                            lexer_.environment.assign(key, array);
                         } else {
                             throw VariableNotDefined(token->toString());
                         }
                     }
                     // 跳过变量定义的分隔符 ; token
                     i++;
+                } else if (auto array = lexer_.environment.findArray(key)) {
+                    // 在同一个表达式中前面定义的数组变量
+                    node *x = new node(Tag::Array);
+                    x->array = array;
+                    nodes.push(x);
+                } else if (deferred_) {
+                    // 可能是脚本中其他块的语句定义的变量，执行到这条语句时再查找
+                    node *x = new node(Tag::Identifier);
+                    x->variable = key;
+                    nodes.push(x);
+                    if (deferred_names_) deferred_names_->push_back(key);
                 } else {
                     throw AssignVariableException(key);
                 }
             } else {
                 // 如果变量已经有值了,再次赋值时不会变化
-                nodes.push(new node(Tag::Float, lexer_.constant[key]));
+                nodes.push(new node(Tag::Float, *value));
             }
 
             // 一元函数 f(x)
@@ -166,20 +993,26 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                     throw FunctionClosureException(token->toString());
                 }
                 Token *nxToken = lexer_.tokenList()[i].get();
+                // rand() 这样不需要参数的函数以 0 作为参数
+                bool nullary =
+                    nxToken->type() == Tag::END_FUNC &&
+                    lexer_.functions().nullary_functions.count(
+                        ((Function *)token)->lexeme());
                 // cos(1,) 或 cos() 或 cos(,) 的情况是不允许的
-                if (i + 1 >= lexer_.tokenList().size())
+                if (!nullary && i + 1 >= lexer_.tokenList().size())
                     throw FunctionClosureException(token->toString());
 
                 // cos() 和 cos(,)
-                if (nxToken->type() == Tag::END_FUNC ||
-                    (nxToken->toString() == "," &&
-                     lexer_.tokenList()[i + 1]->type() == Tag::END_FUNC))
+                if (!nullary &&
+                    (nxToken->type() == Tag::END_FUNC ||
+                     (nxToken->toString() == "," &&
+                      lexer_.tokenList()[i + 1]->type() == Tag::END_FUNC)))
                     throw UnaryFunctionException(token->toString());
 
                 node *root = new node(Tag::Function);
                 root->funcname = ((Function *)token)->lexeme();
                 root->negative = ((Function *)token)->negative();
-                root->left = buildTreeInfix(i);
+                root->left = nullary ? new node(Tag::Number, 0) : buildTreeInfix(i);
                 // 缺少 )
                 if (i < lexer_.tokenList().size() &&
                     lexer_.tokenList()[i]->type() != Tag::END_FUNC) {
@@ -187,6 +1020,12 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                 }
                 nodes.push(root);
             }
+            // 内置的多参数函数 integrate(f,x,a,b)
+        } else if (token->type() == Tag::Builtin) {
+            if (lexer_.functions().builtin_forms.at(((Word *)token)->lexeme()).variable < 0)
+                nodes.push(buildConditional(i));
+            else
+                nodes.push(buildBuiltin(i));
             // 二元函数 f(x,y)
         } else if (token->type() == Tag::BinaryFunction) {
             if (i + 1 >= lexer_.tokenList().size())
@@ -235,6 +1074,14 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                 case Tag::ShiftLeft:   // <<
                 case Tag::ShiftRight:  // >>
                 case Tag::Pow:         // **
+                case Tag::Less:          // <
+                case Tag::LessEqual:     // <=
+                case Tag::Greater:       // >
+                case Tag::GreaterEqual:  // >=
+                case Tag::EqualEqual:    // ==
+                case Tag::NotEqual:      // !=
+                case Tag::LogicalAnd:    // &&
+                case Tag::LogicalOr:     // ||
                 {
                     // 操作符栈顶的运算符优先级小于等于当前的操作符，取出操作数栈顶两个数字构建一个子表达式树，然后再重新添加到操作数栈
                     // 这里需要while循环来不断的取操作符，直到当前的操作符的优先级大于操作符栈顶的操作符
@@ -245,8 +1092,7 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                         // 一元运算符
                         if (ops.top().second == Tag::Negate ||
                             ops.top().second == Tag::Not) {
-                            node *l = nodes.top();
-                            nodes.pop();
+                            node *l = pop();
                             node *root = new node(ops.top().second);
 
                             // 左节点
@@ -256,12 +1102,10 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
                         }
                         // 二元运算符
                         else {
-                            node *r = nodes.top();
-                            nodes.pop();
+                            node *r = pop();
                             node *l = nullptr;
                             if (!nodes.empty()) {
-                                l = nodes.top();
-                                nodes.pop();
+                                l = pop();
                             }
                             node *root = new node(ops.top().second);
                             root->left = l, root->right = r;
@@ -286,14 +1130,12 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
         node *l = nullptr, *r = nullptr;
         ops.pop();
 
-        r = nodes.top();
-        nodes.pop();
+        r = pop();
         // 对于一元运算符，只能取一个节点 ，这里将一元函数也看作是一元运算符
         if (x.second != Tag::Not && x.second != Tag::Negate &&
             x.second != Tag::Function) {
             if (!nodes.empty()) {
-                l = nodes.top();
-                nodes.pop();
+                l = pop();
             }
         }
 
@@ -308,24 +1150,307 @@ node *ExpressionTree::buildTreeInfix(int &token_index) {
     // 表达式中没有计算式,只有变量定义
     if (nodes.empty()) return nullptr;
 
-    auto x = nodes.top();
-    nodes.pop();
+    return pop();
+}
+
+// 内置函数的每个参数的第一个token的位置，最后一个元素是函数的右括号的下一个位置
+std::vector<int> ExpressionTree::splitArguments(int token_index) {
+    auto &tokens = lexer_.tokenList();
+    std::string name = ((Word *)tokens[token_index].get())->lexeme();
+    const BuiltinForm &form = lexer_.functions().builtin_forms.at(name);
+    if (token_index + 1 >= (int)tokens.size() ||
+        tokens[token_index + 1]->type() != Tag::BEGIN_FUNC)
+        throw FunctionDeclareException(name);
+
+    std::vector<int> starts = {token_index + 2};
+    int depth = 0, end = -1;
+    for (int k = token_index + 2; k < (int)tokens.size() && end < 0; k++) {
+        Tag tag = tokens[k]->type();
+        if (tag == Tag::BEGIN_FUNC || tag == Tag::BEGIN_BRACKET ||
+            tag == Tag::BEGIN_ARRAY)
+            depth++;
+        else if (tag == Tag::END_BRACKET || tag == Tag::END_ARRAY)
+            depth--;
+        else if (tag == Tag::END_FUNC && depth-- == 0)
+            end = k;
+        else if (depth == 0 && tokens[k]->toString() == ",")
+            starts.push_back(k + 1);
+    }
+    if (end < 0) throw FunctionClosureException(name);
+    if ((int)starts.size() != form.arity)
+        throw BuiltinArgumentException(
+            name, "needs " + std::to_string(form.arity) + " arguments");
+    starts.push_back(end + 1);
+    for (int k = 0; k < form.arity; k++)
+        if (starts[k] + 1 >= starts[k + 1])
+            throw BuiltinArgumentException(name, "has an empty argument");
+    return starts;
+}
+
+// 解析内置函数的第k个参数，结束时应该正好停在 , 或 ) 上
+node *ExpressionTree::buildArgument(const std::string &name,
+                                    const std::vector<int> &starts, int k) {
+    int j = starts[k];
+    node *x = buildTreeInfix(j);
+    if (j != starts[k + 1] - 1) {
+        clear(x);
+        throw BuiltinArgumentException(
+            name, "argument " + std::to_string(k + 1) + " is invalid");
+    }
     return x;
 }
 
+// if(c,a,b): 三个参数分别保存在 args 中，计算时只计算选中的分支
+node *ExpressionTree::buildConditional(int &token_index) {
+    Word *token = (Word *)lexer_.tokenList()[token_index].get();
+    std::vector<int> starts = splitArguments(token_index);
+    node *root = new node(Tag::Conditional);
+    root->funcname = token->lexeme();
+    root->negative = token->negative();
+    try {
+        for (int k = 0; k < 3; k++)
+            root->args.push_back(buildArgument(root->funcname, starts, k));
+    } catch (...) {
+        clear(root);
+        throw;
+    }
+    token_index = starts.back() - 1;
+    return root;
+}
+
+// 数组字面量的元素依次解析，结束时停在 ] 上
+node *ExpressionTree::buildArray(int &token_index) {
+    auto &tokens = lexer_.tokenList();
+    node *root = new node(Tag::Array);
+    int i = token_index + 1;
+    try {
+        if (i < (int)tokens.size() && tokens[i]->type() == Tag::END_ARRAY)
+            throw ArrayException("literal can not be empty");
+        for (;;) {
+            node *element = buildTreeInfix(i);
+            if (!element) throw ArrayException("literal has an empty element");
+            root->args.push_back(element);
+            if (i >= (int)tokens.size() ||
+                (tokens[i]->type() != Tag::END_ARRAY &&
+                 tokens[i]->toString() != ","))
+                throw ArrayException("literal needs ]");
+            if (tokens[i]->type() == Tag::END_ARRAY) break;
+            i++;
+        }
+    } catch (...) {
+        clear(root);
+        throw;
+    }
+    token_index = i;
+    return root;
+}
+
+// 归约的参数个数在词法分析时已经检查，结束时停在函数的 ) 上
+node *ExpressionTree::buildReduction(int &token_index) {
+    auto &tokens = lexer_.tokenList();
+    Word *token = (Word *)tokens[token_index].get();
+    node *root = new node(Tag::Reduction);
+    root->funcname = token->lexeme();
+    root->negative = token->negative();
+    // 跳过函数的左括号
+    int i = token_index + 2;
+    try {
+        for (;;) {
+            node *arg = buildTreeInfix(i);
+            if (!arg) throw FunctionClosureException(root->funcname);
+            root->args.push_back(arg);
+            if (i >= (int)tokens.size() ||
+                (tokens[i]->type() != Tag::END_FUNC &&
+                 tokens[i]->toString() != ","))
+                throw FunctionClosureException(root->funcname);
+            if (tokens[i]->type() == Tag::END_FUNC) break;
+            i++;
+        }
+    } catch (...) {
+        clear(root);
+        throw;
+    }
+    token_index = i;
+    return root;
+}
+
+// 函数体中的绑定变量作为参数，和编译表达式的参数一样不会被替换为常量
+node *ExpressionTree::buildBuiltin(int &token_index) {
+    auto &tokens = lexer_.tokenList();
+    Word *token = (Word *)tokens[token_index].get();
+    std::string name = token->lexeme();
+    const BuiltinForm &form = lexer_.functions().builtin_forms.at(name);
+    std::vector<int> starts = splitArguments(token_index);
+    int end = starts.back() - 1;
+
+    // 绑定变量只能是一个变量名
+    Token *bound = tokens[starts[form.variable]].get();
+    if (starts[form.variable] + 2 != starts[form.variable + 1] ||
+        bound->type() != Tag::Identifier)
+        throw BuiltinArgumentException(
+            name, "argument " + std::to_string(form.variable + 1) +
+                      " must be a variable name");
+    std::string variable = ((Word *)bound)->lexeme();
+
+    // 函数体中绑定变量会遮住外层同名的参数
+    auto saved = lexer_.parameters;
+    int slot = slot_count_++;
+    lexer_.parameters[variable] = slot;
+    node *body = nullptr;
+    try {
+        body = buildArgument(name, starts, form.body);
+    } catch (...) {
+        lexer_.parameters = saved;
+        slot_count_--;
+        throw;
+    }
+    lexer_.parameters = saved;
+    slot_count_--;
+
+    node *root = new node(Tag::Builtin);
+    root->funcname = name;
+    root->negative = token->negative();
+    root->index = slot;
+    root->variable = variable;
+    root->args.push_back(body);
+    try {
+        for (int k = 0; k < form.arity; k++)
+            if (k != form.variable && k != form.body)
+                root->args.push_back(buildArgument(name, starts, k));
+    } catch (...) {
+        clear(root);
+        throw;
+    }
+    token_index = end;
+    return root;
+}
+
+// 用栈代替递归，很深的语法树(比如超过深度限制的树)也可以释放
 void ExpressionTree::clear(node *&x) {
     if (!x) return;
+    std::vector<node *> pending = {x};
+    while (!pending.empty()) {
+        node *y = pending.back();
+        pending.pop_back();
+        for (node *arg : y->args)
+            if (arg) pending.push_back(arg);
+        if (y->left) pending.push_back(y->left);
+        if (y->right) pending.push_back(y->right);
+        delete y;
+    }
+    x = nullptr;
+}
+
+void ExpressionTree::checkTree(node *x) {
+    Governor *governor = Governor::current();
+    if (!governor || !x) return;
+    size_t nodes = 0, depth = 0;
+    std::vector<std::pair<node *, size_t>> pending = {{x, 1}};
+    while (!pending.empty()) {
+        auto [y, d] = pending.back();
+        pending.pop_back();
+        nodes++;
+        depth = std::max(depth, d);
+        for (node *arg : y->args)
+            if (arg) pending.push_back({arg, d + 1});
+        if (y->left) pending.push_back({y->left, d + 1});
+        if (y->right) pending.push_back({y->right, d + 1});
+    }
+    governor->addTree(nodes, depth);
+}
+
+// 常量折叠: 子树中只有数字、运算符和纯函数时，在构建时就计算出它的值，
+// 只有非纯函数(比如读取外部状态的用户函数)需要在每次计算时调用
+bool ExpressionTree::foldConstants(node *x) {
+    if (!x) return true;
+    if (x->folded || x->type == Tag::Number || x->type == Tag::Float)
+        return true;
+    if (x->type == Tag::Identifier) return false;
+    if (x->type == Tag::Array || x->type == Tag::Reduction) {
+        // 数组不是常量，只折叠数组字面量的元素和归约的参数中的常量子树
+        for (node *arg : x->args) foldConstants(arg);
+        return false;
+    }
+    if (x->type == Tag::Conditional || x->type == Tag::LogicalAnd ||
+        x->type == Tag::LogicalOr) {
+        // 条件是常量时只折叠选中的分支，未选中的分支可能在计算时出错(比如除0)
+        bool conditional = x->type == Tag::Conditional;
+        node *&condition = conditional ? x->args[0] : x->left;
+        // 缺少左操作数(&&1)，留给计算时报错
+        if (!condition) return false;
+        if (!foldConstants(condition)) {
+            for (node *branch : conditional
+                                    ? std::vector<node *>{x->args[1], x->args[2]}
+                                    : std::vector<node *>{x->right})
+                foldBranch(branch);
+            return false;
+        }
+        node *taken = conditional ? x->args[condition->value != 0 ? 1 : 2]
+                                  : x->right;
+        bool decided = !conditional && (condition->value != 0) ==
+                                           (x->type == Tag::LogicalOr);
+        if (!decided && !foldBranch(taken)) return false;
+        x->value = calcValue(x);
+        x->folded = true;
+        for (node *&arg : x->args) clear(arg);
+        x->args.clear();
+        clear(x->left);
+        clear(x->right);
+        return true;
+    }
+    if (x->type == Tag::Builtin) {
+        // 函数体中有绑定变量，只折叠其中的常量子树
+        bool constant = true;
+        for (node *arg : x->args)
+            if (arg != x->args[0]) constant = foldConstants(arg) && constant;
+        foldConstants(x->args[0]);
+        // 函数体只用到绑定变量时，整个函数的值也是常量
+        if (!constant || !isClosed(x->args[0], x->index)) return false;
+        x->value = calcValue(x);
+        x->folded = true;
+        for (node *&arg : x->args) clear(arg);
+        x->args.clear();
+        return true;
+    }
+    bool l = foldConstants(x->left);
+    bool r = foldConstants(x->right);
+    if (!l || !r) return false;
+    if ((x->type == Tag::Function || x->type == Tag::BinaryFunction) &&
+        !lexer_.isPureFunction(x->funcname))
+        return false;
+    // 节点保留原来的类型，移位/取反等运算仍然根据类型检查
+    x->value = calcValue(x);
+    x->folded = true;
     clear(x->left);
     clear(x->right);
-    delete x;
-    x = nullptr;
+    return true;
+}
+
+// 分支中的常量子树在折叠时出错(比如 1/0)不是错误，只有计算到这个分支时才报错
+bool ExpressionTree::foldBranch(node *x) {
+    try {
+        return foldConstants(x);
+    } catch (SyntaxError &) {
+        return false;
+    }
+}
+
+bool ExpressionTree::isClosed(node *x, int slot) {
+    if (!x || x->folded) return true;
+    if (x->type == Tag::Identifier) return x->index >= slot;
+    if ((x->type == Tag::Function || x->type == Tag::BinaryFunction) &&
+        !lexer_.isPureFunction(x->funcname))
+        return false;
+    for (node *arg : x->args)
+        if (!isClosed(arg, slot)) return false;
+    return isClosed(x->left, slot) && isClosed(x->right, slot);
 }
 
 // 一元函数的计算
 double ExpressionTree::calcFunctionValue(node *x, std::string function) {
     if (x == nullptr) throw UnaryFunctionException(function);
-    if (auto it = lexer_.unary_functions.find(function);
-        it != lexer_.unary_functions.end()) {
+    if (auto it = lexer_.functions().unary_functions.find(function);
+        it != lexer_.functions().unary_functions.end()) {
         return it->second(x->value);
     }
     throw FunctionDeclareException(function);
@@ -334,8 +1459,8 @@ double ExpressionTree::calcFunctionValue(node *x, std::string function) {
 double ExpressionTree::calcBinaryFunctionValuie(node *x, node *y,
                                                 std::string function) {
     if (y == nullptr || x == nullptr) throw BinaryFunctionException(function);
-    if (auto it = lexer_.binary_functions.find(function);
-        it != lexer_.binary_functions.end()) {
+    if (auto it = lexer_.functions().binary_functions.find(function);
+        it != lexer_.functions().binary_functions.end()) {
         return it->second(x->value, y->value);
     }
     throw FunctionDeclareException(function);
@@ -394,7 +1519,20 @@ double ExpressionTree::calcValue(node *x, node *y, Tag tag) {
             if (y->value < 0) throw ShiftNegativeException();
             return (Integer)x->value >> (Integer)y->value;
         case Tag::Pow:
-            return lexer_.binary_functions["pow"](x->value, y->value);
+            return lexer_.functions().binary_functions.at("pow")(x->value,
+                                                             y->value);
+        case Tag::Less:
+            return x->value < y->value;
+        case Tag::LessEqual:
+            return x->value <= y->value;
+        case Tag::Greater:
+            return x->value > y->value;
+        case Tag::GreaterEqual:
+            return x->value >= y->value;
+        case Tag::EqualEqual:
+            return x->value == y->value;
+        case Tag::NotEqual:
+            return x->value != y->value;
         default:
             break;
     }
@@ -404,6 +1542,51 @@ double ExpressionTree::calcValue(node *x, node *y, Tag tag) {
 // 递归计算表达式树的值
 double ExpressionTree::calcValue(node *x) {
     if (!x) return 0.0;
+    if (Governor *governor = Governor::current()) governor->step();
+    if (!profile_) return calcNode(x);
+    uint64_t begin = profileTicks();
+    double value = calcNode(x);
+    NodeProfile &p = (*profile_)[x];
+    p.ticks += profileTicks() - begin;
+    p.calls++;
+    return value;
+}
+
+double ExpressionTree::calcNode(node *x) {
+    if (x->folded) return x->value;
+    // 参数只能在编译表达式中使用
+    if (x->type == Tag::Identifier)
+        throw SyntaxError("parameter can only be used in compiled expression");
+    if (x->type == Tag::Array)
+        throw ArrayException("can not be used as a number, use a reduction "
+                             "such as sum()");
+    if (x->type == Tag::Reduction) {
+        double val = calcReduction(x);
+        return x->negative ? -val : val;
+    }
+    // 条件表达式和逻辑运算只计算需要的分支
+    if (x->type == Tag::Conditional) {
+        double c = calcValue(x->args[0]);
+        double val = calcValue(c != 0 ? x->args[1] : x->args[2]);
+        return x->negative ? -val : val;
+    }
+    if (x->type == Tag::LogicalAnd || x->type == Tag::LogicalOr) {
+        if (!x->left || !x->right)
+            throw SyntaxError("need two operator numbers");
+        bool l = calcValue(x->left) != 0;
+        if (l == (x->type == Tag::LogicalOr)) return l;
+        return calcValue(x->right) != 0;
+    }
+    if (x->type == Tag::Builtin) {
+        // 函数体只编译一次，然后在数值方法中反复计算。
+        // 能在这里计算的内置函数不会用到外层的参数，外层参数的值可以任意
+        CompiledExpression program;
+        program.parameters_.resize(x->index);
+        emitProgram(x, program);
+        program.finalize();
+        std::vector<double> args(x->index, 0.0);
+        return program.evaluate(args.data());
+    }
 
     // 更新操作符节点中的值
     double l = calcValue(x->left);
@@ -433,13 +1616,126 @@ double ExpressionTree::calcValue(node *x) {
     return calcValue(x->left, x->right, x->type);
 }
 
+bool ExpressionTree::isArrayValued(node *x) {
+    if (!x || x->folded) return false;
+    if (x->type == Tag::Array) return true;
+    // 归约的值是数值; 内置函数的参数不能是数组(计算时报错)
+    if (x->type == Tag::Reduction || x->type == Tag::Builtin) return false;
+    for (node *arg : x->args)
+        if (isArrayValued(arg)) return true;
+    return isArrayValued(x->left) || isArrayValued(x->right);
+}
+
+// 数值子树对每个元素都相同，先计算出来(非纯函数也只调用一次)。
+// 数组字面量在这里生成，每个数组按出现的顺序作为一个参数
+void ExpressionTree::prepareArray(node *x, std::vector<node *> &leaves) {
+    if (!x || x->folded || x->type == Tag::Number || x->type == Tag::Float)
+        return;
+    if (!isArrayValued(x)) {
+        x->value = calcValue(x);
+        x->folded = true;
+        for (node *&arg : x->args) clear(arg);
+        x->args.clear();
+        clear(x->left);
+        clear(x->right);
+        return;
+    }
+    if (x->type == Tag::Array) {
+        if (!x->array) {
+            auto values = std::make_shared<std::vector<double>>();
+            values->reserve(x->args.size());
+            for (node *element : x->args) {
+                if (isArrayValued(element))
+                    throw ArrayException("literal elements must be numbers");
+                values->push_back(calcValue(element));
+            }
+            x->array = std::move(values);
+        }
+        x->index = (int)leaves.size();
+        leaves.push_back(x);
+        return;
+    }
+    for (node *arg : x->args) prepareArray(arg, leaves);
+    prepareArray(x->left, leaves);
+    prepareArray(x->right, leaves);
+}
+
+/*
+ * 数组表达式整体编译为一个以数组为参数的编译表达式，再批量计算:
+ * 每 kBatchLanes 个元素一段，逐条指令处理一整段(循环可以向量化)，
+ * 中间结果只占缓存中的几段，而不是每个运算生成一个完整的临时数组
+ */
+ArrayRef ExpressionTree::calcArrayValue(node *x) {
+    if (!isArrayValued(x))
+        return std::make_shared<const std::vector<double>>(1, calcValue(x));
+    std::vector<node *> leaves;
+    prepareArray(x, leaves);
+    // 数组本身不需要计算
+    if (x->type == Tag::Array) return x->array;
+
+    size_t n = leaves[0]->array->size();
+    std::vector<const double *> columns;
+    for (node *leaf : leaves) {
+        if (leaf->array->size() != n)
+            throw ArrayException("lengths do not match: " + std::to_string(n) +
+                                 " and " +
+                                 std::to_string(leaf->array->size()));
+        columns.push_back(leaf->array->data());
+    }
+    CompiledExpression program;
+    program.parameters_.resize(leaves.size());
+    emitProgram(x, program);
+    program.finalize();
+    if (Governor *governor = Governor::current()) governor->step(n);
+    auto value = std::make_shared<std::vector<double>>(n);
+    std::vector<double> args(leaves.size(), 0.0);
+    program.evaluateBatch(args.data(), columns.data(), value->data(), n);
+    return value;
+}
+
+double ExpressionTree::calcReduction(node *x) {
+    ArrayRef a = calcArrayValue(x->args[0]);
+    const std::string &name = x->funcname;
+    if (name == "dot") {
+        ArrayRef b = calcArrayValue(x->args[1]);
+        if (a->size() != b->size())
+            throw ArrayException("lengths do not match: " +
+                                 std::to_string(a->size()) + " and " +
+                                 std::to_string(b->size()));
+        return numeric::dot(a->data(), b->data(), a->size());
+    }
+    if (name == "sum") return numeric::sumArray(a->data(), a->size());
+    if (name == "mean")
+        return numeric::sumArray(a->data(), a->size()) / (double)a->size();
+    if (name == "min") return *std::min_element(a->begin(), a->end());
+    if (name == "max") return *std::max_element(a->begin(), a->end());
+    throw FunctionDeclareException(name);
+}
+
 // 操作符优先级
 int ExpressionTree::getPriority(char c, Tag tag) {
     // 函数的优先级最高,对于 ** 求指数幂，也可以看作函数
     if (tag == Tag::Function || tag == Tag::BinaryFunction || tag == Tag::Pow)
         return 200;
-    // 左移和右移运算优先级最低
-    if (tag == Tag::ShiftLeft || tag == Tag::ShiftRight) return 0;
+    // 左移和右移运算低于加减，但必须高于左括号(0)，否则会把括号当作运算符弹出
+    if (tag == Tag::ShiftLeft || tag == Tag::ShiftRight) return 80;
+    // 比较和逻辑运算的优先级最低，与C语言的顺序相同
+    switch (tag) {
+        case Tag::Less:
+        case Tag::LessEqual:
+        case Tag::Greater:
+        case Tag::GreaterEqual:
+            return 70;
+        case Tag::EqualEqual:
+        case Tag::NotEqual:
+            return 60;
+        case Tag::LogicalAnd:
+            return 50;
+        case Tag::LogicalOr:
+            return 40;
+        default:
+            break;
+    }
 
     int priority = 0;
     switch (c) {
@@ -464,3 +1760,281 @@ int ExpressionTree::getPriority(char c, Tag tag) {
     }
     return priority;
 }
+
+// 精确模式中的辅助函数
+static ExactNumber negate(const ExactNumber &x) {
+    if (x.exact()) return -x.rational();
+    return ExactNumber::approximate(-x.toDouble());
+}
+
+static bool isZero(const ExactNumber &x) {
+    return x.exact() ? x.rational().isZero() : x.toDouble() == 0;
+}
+
+static ExactNumber boolean(bool x) { return Rational(x ? 1 : 0); }
+
+// 结果的位数超过上限时抛出异常
+static void checkExactBits(const char *function, double bits) {
+    if (bits > (double)ExpressionTree::kMaxExactBits)
+        throw NumericException(function,
+                               "result is too large for exact mode");
+}
+
+// 二分递归地合并，大数运算的两边长度接近(和 BigInt::product 相同)
+template <class Op>
+static Rational reduceTree(const std::vector<Rational> &terms, size_t lo,
+                           size_t hi, Op op) {
+    if (hi - lo == 1) return terms[lo];
+    size_t mid = lo + (hi - lo) / 2;
+    return op(reduceTree(terms, lo, mid, op), reduceTree(terms, mid, hi, op));
+}
+
+// 整数次幂，指数太大时抛出异常。底数为 0、±1 时结果不会变大
+static Rational exactPow(const char *function, const Rational &base,
+                         const Rational &exponent) {
+    const BigInt &e = exponent.numerator();
+    size_t bits = std::max(base.numerator().bitLength(),
+                           base.denominator().bitLength());
+    if (bits > 1 || base.denominator().bitLength() > 1) {
+        if (!e.isSmall()) checkExactBits(function, INFINITY);
+        checkExactBits(function,
+                       (double)bits * std::fabs((double)e.small()));
+    } else if (!e.isSmall()) {
+        // 0、1、-1 的幂只取决于指数的奇偶
+        if (base.isZero()) {
+            if (e.sign() < 0) throw DivZeroException(0, 0);
+            return Rational(0);
+        }
+        return e.isOdd() ? base : Rational(1);
+    }
+    return Rational::pow(base, e.small());
+}
+
+ExactNumber ExpressionTree::calcExactValue(node *x,
+                                           std::vector<ExactNumber> &slots) {
+    if (!x) return ExactNumber();
+    if (Governor *governor = Governor::current()) governor->step();
+    auto sign = [x](const ExactNumber &v) { return x->negative ? negate(v) : v; };
+    if (x->folded || x->type == Tag::Number || x->type == Tag::Float) {
+        if (!std::isfinite(x->value)) return ExactNumber::approximate(x->value);
+        return Rational::fromShortest(x->value);
+    }
+    switch (x->type) {
+        case Tag::Identifier:
+            if (x->index >= 0 && x->index < (int)slots.size())
+                return slots[x->index];
+            throw SyntaxError(
+                "parameter can only be used in compiled expression");
+        case Tag::Array:
+        case Tag::Reduction:
+            // 数组的值是 double，按原来的方式计算
+            return ExactNumber::approximate(calcValue(x));
+        case Tag::Conditional: {
+            ExactNumber c = calcExactValue(x->args[0], slots);
+            return sign(calcExactValue(!isZero(c) ? x->args[1] : x->args[2],
+                                       slots));
+        }
+        case Tag::LogicalAnd:
+        case Tag::LogicalOr: {
+            if (!x->left || !x->right)
+                throw SyntaxError("need two operator numbers");
+            bool l = !isZero(calcExactValue(x->left, slots));
+            if (l == (x->type == Tag::LogicalOr)) return boolean(l);
+            return boolean(!isZero(calcExactValue(x->right, slots)));
+        }
+        case Tag::Builtin:
+            return calcExactBuiltin(x, slots);
+        default:
+            break;
+    }
+
+    node *valid_child = x->left ? x->left : x->right;
+    if (x->type == Tag::Function) {
+        if (valid_child == nullptr) throw UnaryFunctionException(x->funcname);
+        ExactNumber a = calcExactValue(valid_child, slots);
+        const std::string &name = x->funcname;
+        if (a.exact() && (name == "floor" || name == "ceil" ||
+                          name == "round" || name == "factorial")) {
+            const Rational &v = a.rational();
+            if (name == "floor") return sign(Rational(v.floor()));
+            if (name == "ceil") return sign(Rational(v.ceil()));
+            if (name == "round") return sign(Rational(v.round()));
+            // 与 double 版本相同: x < 1 时为 1，否则为 floor(x)!
+            BigInt n = v.floor();
+            if (n.sign() <= 0) return sign(Rational(1));
+            if (!n.isSmall()) checkExactBits("factorial", INFINITY);
+            checkExactBits("factorial",
+                           std::lgamma((double)n.small() + 1) / std::log(2.0));
+            return sign(Rational(BigInt::factorial((uint64_t)n.small())));
+        }
+        valid_child->value = a.toDouble();
+        return sign(
+            ExactNumber::approximate(calcFunctionValue(valid_child, name)));
+    }
+
+    ExactNumber l = calcExactValue(x->left, slots);
+    ExactNumber r = calcExactValue(x->right, slots);
+    if (x->type == Tag::BinaryFunction) {
+        if (!x->left || !x->right) throw BinaryFunctionException(x->funcname);
+        const std::string &name = x->funcname;
+        if (l.exact() && r.exact()) {
+            const Rational &a = l.rational(), &b = r.rational();
+            if (name == "max") return sign(b < a ? a : b);
+            if (name == "min") return sign(a < b ? a : b);
+            if (name == "pow" && b.isInteger())
+                return sign(exactPow("pow", a, b));
+        }
+        x->left->value = l.toDouble();
+        x->right->value = r.toDouble();
+        return sign(ExactNumber::approximate(
+            calcBinaryFunctionValuie(x->left, x->right, name)));
+    }
+    if (x->type == Tag::Not || x->type == Tag::Negate) {
+        if (valid_child == nullptr)
+            throw SyntaxError("need one operator numbers");
+        ExactNumber a = valid_child == x->left ? l : r;
+        if (!a.exact()) {
+            valid_child->value = a.toDouble();
+            return ExactNumber::approximate(
+                (double)calcValue(valid_child, x->type));
+        }
+        // 与 double 版本一样先向零取整
+        if (x->type == Tag::Not) return boolean(a.rational().trunc().isZero());
+        if (valid_child->type != Tag::Number)
+            throw NegateTypeException(valid_child->value);
+        return Rational(~a.rational().trunc());
+    }
+
+    if (!x->left || !x->right) throw SyntaxError("need two operator numbers");
+    // 左移或右移的操作数不能是浮点数，右操作数不能是负数
+    if (x->type == Tag::ShiftLeft || x->type == Tag::ShiftRight) {
+        if (x->left->type == Tag::Float || x->right->type == Tag::Float)
+            throw ShiftLeftRightException();
+        if (r.toDouble() < 0) throw ShiftNegativeException();
+    }
+    if (!l.exact() || !r.exact()) {
+        x->left->value = l.toDouble();
+        x->right->value = r.toDouble();
+        return ExactNumber::approximate(calcValue(x->left, x->right, x->type));
+    }
+    const Rational &a = l.rational(), &b = r.rational();
+    switch (x->type) {
+        case Tag::Add:
+            return a + b;
+        case Tag::Sub:
+            return a - b;
+        case Tag::Mul:
+            return a * b;
+        case Tag::Div:
+            return a / b;
+        case Tag::Mod:
+            // 与 fmod 相同，结果与被除数同号
+            if (b.isZero()) throw DivZeroException(a.toDouble(), 0);
+            return a - Rational((a / b).trunc()) * b;
+        case Tag::And:
+            return Rational(a.trunc() & b.trunc());
+        case Tag::Or:
+            return Rational(a.trunc() | b.trunc());
+        case Tag::Xor:
+            return Rational(a.trunc() ^ b.trunc());
+        case Tag::ShiftLeft:
+        case Tag::ShiftRight: {
+            BigInt count = b.trunc();
+            if (x->type == Tag::ShiftLeft) {
+                if (!count.isSmall()) checkExactBits("<<", INFINITY);
+                checkExactBits("<<", (double)a.trunc().bitLength() +
+                                         (double)count.small());
+                return Rational(a.trunc().shiftLeft((size_t)count.small()));
+            }
+            // 右移的位数超过位数时结果为 0 或 -1
+            size_t bits = count.isSmall() ? (size_t)count.small() : SIZE_MAX;
+            return Rational(a.trunc().shiftRight(bits));
+        }
+        case Tag::Pow:
+            if (b.isInteger()) return exactPow("**", a, b);
+            x->left->value = a.toDouble();
+            x->right->value = b.toDouble();
+            return ExactNumber::approximate(
+                calcValue(x->left, x->right, x->type));
+        case Tag::Less:
+            return boolean(Rational::compare(a, b) < 0);
+        case Tag::LessEqual:
+            return boolean(Rational::compare(a, b) <= 0);
+        case Tag::Greater:
+            return boolean(Rational::compare(a, b) > 0);
+        case Tag::GreaterEqual:
+            return boolean(Rational::compare(a, b) >= 0);
+        case Tag::EqualEqual:
+            return boolean(a == b);
+        case Tag::NotEqual:
+            return boolean(a != b);
+        default:
+            break;
+    }
+    return Rational(0);
+}
+
+ExactNumber ExpressionTree::calcExactBuiltin(node *x,
+                                             std::vector<ExactNumber> &slots) {
+    // sum/prod 逐项精确计算；其他内置函数(数值积分、求根、求极小值)和
+    // 范围不是精确值的 sum/prod 编译后按 double 计算，外层绑定变量取近似值
+    const bool sum = x->funcname == "sum";
+    if (sum || x->funcname == "prod") {
+        ExactNumber lo = calcExactValue(x->args[1], slots);
+        ExactNumber hi = calcExactValue(x->args[2], slots);
+        if (lo.exact() && hi.exact()) {
+            const Rational &first = lo.rational();
+            BigInt span = (hi.rational() - first).floor();
+            if (!span.isSmall() || span.small() >= (int64_t)1 << 32)
+                throw NumericException(x->funcname, "range is too large");
+            size_t count = span.sign() < 0 ? 0 : (size_t)span.small() + 1;
+            if (Governor *governor = Governor::current())
+                governor->addIterations(count);
+            if (slots.size() <= (size_t)x->index) slots.resize(x->index + 1);
+            std::vector<Rational> terms;
+            terms.reserve(count);
+            // 有一项是近似值后，改为按 double 累加/累乘
+            bool exact = true;
+            double approx = sum ? 0.0 : 1.0;
+            auto accumulate = [&](double term) {
+                approx = sum ? approx + term : approx * term;
+            };
+            for (size_t k = 0; k < count; k++) {
+                slots[x->index] = first + Rational((int64_t)k);
+                ExactNumber term = calcExactValue(x->args[0], slots);
+                if (exact && !term.exact()) {
+                    exact = false;
+                    for (const Rational &t : terms) accumulate(t.toDouble());
+                }
+                if (exact)
+                    terms.push_back(term.rational());
+                else
+                    accumulate(term.toDouble());
+            }
+            ExactNumber value;
+            if (!exact)
+                value = ExactNumber::approximate(approx);
+            else if (terms.empty())
+                value = Rational(sum ? 0 : 1);
+            else if (sum)
+                value = reduceTree(terms, 0, terms.size(),
+                                   [](const Rational &a, const Rational &b) {
+                                       return a + b;
+                                   });
+            else
+                value = reduceTree(
+                    terms, 0, terms.size(),
+                    [](const Rational &a, const Rational &b) { return a * b; });
+            return x->negative ? negate(value) : value;
+        }
+    }
+    CompiledExpression program;
+    program.parameters_.resize(x->index);
+    emitProgram(x, program);
+    program.finalize();
+    std::vector<double> args(x->index, 0.0);
+    for (size_t k = 0; k < args.size() && k < slots.size(); k++)
+        args[k] = slots[k].toDouble();
+    // 编译的指令中已经包含了前导负号
+    return ExactNumber::approximate(program.evaluate(args.data()));
+}
@@ -0,0 +1,390 @@
+#include "../include/IncrementalScript.h"
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+
+#include "../include/ExpressionTree.h"
+using namespace calculator;
+
+IncrementalScript::IncrementalScript(const ExpressionTree &session,
+                                     const std::string &text)
+    : tree_(std::make_unique<ExpressionTree>(session.registry())),
+      base_(session.snapshot()) {
+    tree_->restore(base_);
+    tree_->setLimits(session.limits());
+    // 与并行分析的工作线程相同: 脚本中赋值的变量留到执行时查找
+    tree_->deferred_ = true;
+    registry_version_ = session.registry()->version();
+    setText(text);
+}
+
+IncrementalScript::~IncrementalScript() {
+    for (auto &segment : segments_) tree_->clear(segment->value);
+}
+
+void IncrementalScript::edit(size_t offset, size_t removed,
+                             const std::string &inserted) {
+    if (offset > text_.size() || removed > text_.size() - offset)
+        throw SyntaxError("Error: edit range is out of the script");
+    text_.replace(offset, removed, inserted);
+
+    // 编辑范围所在的语句 [first, last) 和它们在编辑前的开始位置
+    size_t first = 0, start = 0;
+    while (first < segments_.size() &&
+           start + segments_[first]->text.size() <= offset)
+        start += segments_[first++]->text.size();
+    // 只有最后一条语句可以没有 ;，在它后面插入时与它合并
+    if (first > 0 && segments_[first - 1]->text.back() != ';')
+        start -= segments_[--first]->text.size();
+    size_t last = first, end = start;
+    do {
+        if (last == segments_.size()) break;
+        end += segments_[last++]->text.size();
+    } while (end < offset + removed);
+    std::string region =
+        text_.substr(start, end - start - removed + inserted.size());
+    // 删除了结尾的 ; 时与下一条语句合并
+    while (!region.empty() && region.back() != ';' &&
+           last < segments_.size())
+        region += segments_[last++]->text;
+
+    // 重新切分，与原来相同的语句(比如插入 ; 分开的两半之外的部分)不需要重新分析
+    // 不能切分时整段作为一条语句，计算时整体计算
+    std::vector<size_t> bounds =
+        ExpressionTree::splitScript(region, region.size() + 1);
+    bool raw = !region.empty() && bounds.empty();
+    if (raw) bounds = {0, region.size()};
+    std::vector<std::string> pieces;
+    for (size_t k = 0; k + 1 < bounds.size(); k++)
+        pieces.push_back(region.substr(bounds[k], bounds[k + 1] - bounds[k]));
+    size_t head = 0, tail = 0;
+    while (!raw && head < pieces.size() && first + head < last &&
+           segments_[first + head]->text == pieces[head])
+        head++;
+    while (!raw && tail < pieces.size() - head &&
+           last - tail > first + head &&
+           segments_[last - tail - 1]->text ==
+               pieces[pieces.size() - tail - 1])
+        tail++;
+
+    for (size_t k = first + head; k < last - tail; k++) {
+        release(*segments_[k]);
+        if (segments_[k]->raw) raw_--;
+    }
+    std::vector<std::unique_ptr<Segment>> created;
+    for (size_t k = head; k < pieces.size() - tail; k++) {
+        auto segment = std::make_unique<Segment>();
+        segment->text = std::move(pieces[k]);
+        segment->raw = raw;
+        if (raw) raw_++;
+        created.push_back(std::move(segment));
+    }
+    segments_.erase(segments_.begin() + (first + head),
+                    segments_.begin() + (last - tail));
+    segments_.insert(segments_.begin() + (first + head),
+                     std::make_move_iterator(created.begin()),
+                     std::make_move_iterator(created.end()));
+}
+
+void IncrementalScript::lex(Segment &segment) {
+    segment.lexed = true;
+    segment.pending = true;
+    if (segment.raw) return;
+    ExpressionTree &tree = *tree_;
+    try {
+        tree.parseExpression(segment.text);
+    } catch (...) {
+        segment.lex_error = std::current_exception();
+        lex_errors_++;
+        tree.lexer_.tokenList().clear();
+        return;
+    }
+    segment.tokens.swap(tree.lexer_.tokenList());
+    segment.token_count = segment.tokens.size();
+    tokens_ += segment.token_count;
+    segment.empty = std::all_of(
+        segment.tokens.begin(), segment.tokens.end(),
+        [](auto &token) { return token->type() == Tag::END_SEP; });
+}
+
+void IncrementalScript::build(Segment &segment) {
+    segment.built = true;
+    ExpressionTree &tree = *tree_;
+    std::vector<ExpressionTree::Statement> statements;
+    tree.lexer_.tokenList().swap(segment.tokens);
+    tree.slot_count_ = 0;
+    // 整体计算时在构建语法树的过程中报告第一个没有定义的变量(包括语法树中
+    // 丢弃的操作数)，记录构建时经过的变量名
+    std::vector<std::string> names;
+    tree.deferred_names_ = &names;
+    segment.supported = tree.buildStatements(statements);
+    tree.deferred_names_ = nullptr;
+    auto release = [&] {
+        for (auto &statement : statements) tree.clear(statement.value);
+        tree.lexer_.tokenList().clear();
+    };
+    if (!segment.supported || statements.empty()) {
+        release();
+        return;
+    }
+
+    // 值只有一个 token 时转换为节点，与 runStatements 中的处理相同
+    ExpressionTree::Statement &statement = statements[0];
+    segment.variable = statement.variable;
+    segment.error = statement.error;
+    std::swap(segment.value, statement.value);
+    if (Token *token = statement.token.get()) {
+        if (token->type() == Tag::Number) {
+            segment.value = new node(Tag::Number, ((Number *)token)->value());
+        } else if (token->type() == Tag::Float) {
+            segment.value = new node(Tag::Float, ((Float *)token)->value());
+        } else if (token->type() == Tag::Array) {
+            segment.value = new node(Tag::Array);
+            segment.value->array = ((ArrayConstant *)token)->value();
+        } else if (token->type() == Tag::Identifier) {
+            segment.value = new node(Tag::Identifier);
+            segment.value->variable = token->toString();
+            segment.single = true;
+            if (!tree.lexer_.lookupConstant(token->toString()) &&
+                !tree.lexer_.environment.findArray(token->toString()))
+                names.push_back(token->toString());
+        }
+    }
+    release();
+    for (auto &name : names)
+        if (std::find(segment.names.begin(), segment.names.end(), name) ==
+            segment.names.end())
+            segment.names.push_back(name);
+    for (auto &name : segment.names) readers_[name].push_back(&segment);
+    if (segment.error) return;
+
+    // 留到执行时查找的变量节点和非纯函数
+    std::vector<node *> pending = {segment.value};
+    while (!pending.empty()) {
+        node *x = pending.back();
+        pending.pop_back();
+        if (!x) continue;
+        if (x->type == Tag::Identifier && x->index < 0) {
+            segment.references.push_back(x);
+        } else if ((x->type == Tag::Function ||
+                    x->type == Tag::BinaryFunction) &&
+                   !tree.lexer_.isPureFunction(x->funcname)) {
+            segment.impure = true;
+        }
+        pending.push_back(x->right);
+        pending.push_back(x->left);
+        pending.insert(pending.end(), x->args.rbegin(), x->args.rend());
+    }
+    if (!segment.variable.empty()) {
+        auto &writers = writers_[segment.variable];
+        writers.push_back(&segment);
+        if (writers.size() == 2) duplicated_.insert(segment.variable);
+        segment.writer = true;
+        invalidate(segment.variable);
+    }
+}
+
+void IncrementalScript::release(Segment &segment) {
+    auto unlink = [&](std::unordered_map<std::string,
+                                         std::vector<Segment *>> &table,
+                      const std::string &name) {
+        auto it = table.find(name);
+        auto &list = it->second;
+        list.erase(std::find(list.begin(), list.end(), &segment));
+        if (list.empty()) table.erase(it);
+    };
+    if (segment.writer) {
+        unlink(writers_, segment.variable);
+        auto it = writers_.find(segment.variable);
+        if (it == writers_.end() || it->second.size() < 2)
+            duplicated_.erase(segment.variable);
+        invalidate(segment.variable);
+    }
+    for (auto &name : segment.names) unlink(readers_, name);
+    tree_->clear(segment.value);
+    if (segment.lex_error) lex_errors_--;
+    tokens_ -= segment.token_count;
+
+    Segment reset;
+    reset.text = std::move(segment.text);
+    reset.raw = segment.raw;
+    segment = std::move(reset);
+}
+
+void IncrementalScript::invalidate(const std::string &variable) {
+    auto it = readers_.find(variable);
+    if (it == readers_.end()) return;
+    for (Segment *reader : it->second) reader->pending = true;
+}
+
+// 值按位比较，数组比较元素
+static bool sameValue(double a, const ArrayRef &array_a, double b,
+                      const ArrayRef &array_b) {
+    if (!array_a || !array_b)
+        return !array_a && !array_b && std::memcmp(&a, &b, sizeof(a)) == 0;
+    return array_a == array_b ||
+           (array_a->size() == array_b->size() &&
+            std::memcmp(array_a->data(), array_b->data(),
+                        array_a->size() * sizeof(double)) == 0);
+}
+
+const std::string *IncrementalScript::undefinedName(
+    const Segment &segment) const {
+    for (auto &name : segment.names) {
+        auto it = writers_.find(name);
+        if (it == writers_.end() ||
+            std::none_of(it->second.begin(), it->second.end(),
+                         [&](const Segment *writer) {
+                             return writer->index < segment.index;
+                         }))
+            return &name;
+    }
+    return nullptr;
+}
+
+bool IncrementalScript::compute(Segment &segment) {
+    // 整体计算时在构建语法树时发现没有定义的变量，先于语法错误
+    if (const std::string *name = undefinedName(segment)) {
+        if (segment.single) throw VariableNotDefined(*name);
+        throw AssignVariableException(*name);
+    }
+    if (segment.error) std::rethrow_exception(segment.error);
+    ExpressionTree &tree = *tree_;
+    // 脚本中在这条语句之前赋值的变量，重复赋值时已经整体计算
+    for (node *x : segment.references) {
+        Segment *writer = nullptr;
+        for (Segment *candidate : writers_[x->variable])
+            if (candidate->index < segment.index && candidate->computed)
+                writer = candidate;
+        if (!writer) throw AssignVariableException(x->variable);
+        x->type = writer->array ? Tag::Array : Tag::Float;
+        x->value = writer->result;
+        x->array = writer->array;
+    }
+    tree.checkTree(segment.value);
+    double result = 0.0;
+    ArrayRef array;
+    if (tree.isArrayValued(segment.value)) {
+        if (segment.variable.empty())
+            throw ArrayException(
+                "can not be the value of calcExpression, use calcArray or a "
+                "reduction such as sum()");
+        array = tree.calcArrayValue(segment.value);
+    } else {
+        result = tree.calcValue(segment.value);
+    }
+    bool changed = !segment.computed ||
+                   !sameValue(result, array, segment.result, segment.array);
+    segment.result = result;
+    segment.array = std::move(array);
+    segment.computed = true;
+    segment.pending = false;
+    return changed;
+}
+
+double IncrementalScript::evaluate() {
+    FunctionPin pin(tree_->lexer_);
+    const ResourceLimits &limits = tree_->limits();
+    Governor governor(limits);
+    Governor::Scope scope(limits.enabled() ? &governor : nullptr);
+    stats_ = IncrementalStats();
+    if (tree_->registry()->version() != registry_version_) {
+        registry_version_ = tree_->registry()->version();
+        for (auto &segment : segments_) release(*segment);
+    }
+
+    // 更新位置，对新的语句做词法分析
+    for (size_t i = 0; i < segments_.size(); i++) {
+        Segment &segment = *segments_[i];
+        segment.index = i;
+        if (!segment.lexed) {
+            lex(segment);
+            stats_.relexed++;
+        }
+        if (!segment.empty) stats_.statements++;
+    }
+    // 按顺序构建语法树，直到第一条表达式语句或者出错的语句(之后的语句不执行)
+    const size_t none = segments_.size();
+    size_t stop = none;
+    for (size_t i = 0; i < segments_.size() && stop == none; i++) {
+        Segment &segment = *segments_[i];
+        if (segment.empty) continue;
+        if (!segment.raw && !segment.lex_error && !segment.built) {
+            build(segment);
+            stats_.rebuilt++;
+        }
+        if (segment.raw || segment.lex_error || !segment.supported ||
+            segment.error || segment.variable.empty() ||
+            undefinedName(segment))
+            stop = i;
+    }
+    if (raw_ || (stop != none && !segments_[stop]->supported))
+        return evaluateFull();
+    if (Governor *current = Governor::current())
+        current->checkTokens(tokens_, 0);
+    if (lex_errors_)
+        for (auto &segment : segments_)
+            if (segment->lex_error) std::rethrow_exception(segment->lex_error);
+    // 执行到的语句中有重复赋值(包括停止的语句: 整体分析时它不是赋值)
+    for (auto &variable : duplicated_) {
+        size_t executed = 0;
+        for (Segment *writer : writers_[variable])
+            if (writer->index <= stop) executed++;
+        if (executed > 1) return evaluateFull();
+    }
+
+    // 按位置的顺序计算需要重新计算的语句，值变化时标记后面用到它的语句
+    auto later = [](const Segment *a, const Segment *b) {
+        return a->index > b->index;
+    };
+    std::priority_queue<Segment *, std::vector<Segment *>, decltype(later)>
+        queue(later);
+    size_t active = 0;
+    for (size_t i = 0; i < segments_.size() && i <= stop; i++) {
+        Segment &segment = *segments_[i];
+        if (segment.empty) continue;
+        active++;
+        if (segment.impure) segment.pending = true;
+        if (segment.pending) queue.push(&segment);
+    }
+    while (!queue.empty()) {
+        Segment &segment = *queue.top();
+        queue.pop();
+        stats_.evaluated++;
+        // 出错时整体计算: 整体计算先折叠常量，报告的错误可能不同(比如数组的值)
+        bool changed;
+        try {
+            changed = compute(segment);
+        } catch (...) {
+            return evaluateFull();
+        }
+        if (!changed || !segment.writer) continue;
+        // 不执行的语句也要标记，之后可能会执行
+        for (Segment *reader : readers_[segment.variable]) {
+            if (reader->index <= segment.index || reader->pending) continue;
+            reader->pending = true;
+            if (reader->index <= stop) queue.push(reader);
+        }
+    }
+    stats_.reused = active - stats_.evaluated;
+    // 脚本中只有赋值语句
+    if (stop == none) return 0.0;
+    return segments_[stop]->result;
+}
+
+double IncrementalScript::evaluateFull() {
+    stats_.full = true;
+    tree_->deferred_ = false;
+    tree_->restore(base_);
+    try {
+        double value = tree_->calcExpression(text_);
+        tree_->restore(base_);
+        tree_->deferred_ = true;
+        return value;
+    } catch (...) {
+        tree_->restore(base_);
+        tree_->deferred_ = true;
+        throw;
+    }
+}
@@ -1,14 +1,61 @@
 #include "../include/Lexer.h"
 using namespace calculator;
 
-Lexer::Lexer() : line_(0), lookforward_(0), is_function_(false) {
-    constant.clear();
-    variable.clear();
+Lexer::Lexer() : Lexer(std::make_shared<Registry>()) {}
+
+Lexer::Lexer(std::shared_ptr<Registry> shared)
+    : registry(std::move(shared)),
+      line_(0),
+      lookforward_(0),
+      is_function_(false) {
     tokenlist_.clear();
+}
+
+std::string Lexer::lookupArgument(int index) const {
+    // 当前位置的下一个字符是函数的左括号
+    int depth = 0, arg = 0;
+    std::string name;
+    for (int i = reader_.pos() + 1; i < reader_.len(); i++) {
+        char c = reader_.at(i);
+        if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            if (--depth == 0) break;
+        } else if (c == ',' && depth == 1) {
+            arg++;
+        } else if (depth == 1 && arg == index &&
+                   (isletter(c) || isdigit(c))) {
+            name.append(1, c);
+        }
+    }
+    return name;
+}
 
-    putConstant("pi", 3.141592653589793);
-    putConstant("e", 2.718281828459045);
-    putConstant("sqrt2", 1.4142135623730951);
+int Lexer::countArguments() const {
+    // 当前位置是函数的左括号
+    int depth = 0, count = 0;
+    bool empty = true;
+    for (int i = reader_.pos(); i < reader_.len(); i++) {
+        char c = reader_.at(i);
+        if (c == '(' || c == '[') {
+            if (depth++ == 0) continue;
+        } else if (c == ')' || c == ']') {
+            if (--depth == 0) break;
+        } else if (c == ',' && depth == 1) {
+            count++;
+            continue;
+        }
+        if (depth >= 1 && !isspace(c)) empty = false;
+    }
+    return empty ? 0 : count + 1;
+}
+
+bool Lexer::isReduction(const std::string& func) const {
+    auto it = functions_->reductions.find(func);
+    if (it == functions_->reductions.end()) return false;
+    if (it->second == 1 && isUnaryFunction(func)) return false;
+    if (it->second == 2 && isBinaryFunction(func)) return false;
+    return countArguments() == it->second;
 }
 
 void Lexer::scan() {
@@ -39,7 +86,7 @@ void Lexer::scan() {
     }
 
     // )+   )- 向前看字符如果是 ) 说明当前的 +/- 一定是一个 减法或加法
-    if (lookforward_ != ')' && !isexponent(lookforward_) &&
+    if (lookforward_ != ')' && lookforward_ != ']' && !isexponent(lookforward_) &&
         (c == '-' || c == '+')) {
         // +100 / -100  0.+100
         // 对于表达式 1 + -100 和 1. - 100 可以识别出来
@@ -55,12 +102,24 @@ void Lexer::scan() {
 
     switch (c) {
         case '&':
+            // && 逻辑与
+            if (auto [ok, c] = reader_.geteq('&'); ok)
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Token(Tag::LogicalAnd)));
             return tokenlist_.push_back(
                 std::shared_ptr<Token>(new Token(Tag::And)));
         case '|':
+            // || 逻辑或
+            if (auto [ok, c] = reader_.geteq('|'); ok)
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Token(Tag::LogicalOr)));
             return tokenlist_.push_back(
                 std::shared_ptr<Token>(new Token(Tag::Or)));
         case '!':
+            // != 不等于
+            if (auto [ok, c] = reader_.geteq('='); ok)
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Token(Tag::NotEqual)));
             return tokenlist_.push_back(
                 std::shared_ptr<Token>(new Token(Tag::Not)));
         case '^':
@@ -91,6 +150,10 @@ void Lexer::scan() {
             return tokenlist_.push_back(
                 std::shared_ptr<Token>(new Token(Tag::Div)));
         case '=':
+            // == 等于
+            if (auto [ok, c] = reader_.geteq('='); ok)
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Token(Tag::EqualEqual)));
             return tokenlist_.push_back(
                 std::shared_ptr<Token>(new Token(Tag::Equal)));
         case '%':
@@ -101,16 +164,24 @@ void Lexer::scan() {
             if (auto [ok, c] = reader_.geteq('<'); ok)
                 return tokenlist_.push_back(
                     std::shared_ptr<Token>(new Token(Tag::ShiftLeft)));
-            else
-                throw SyntaxError("unexpected <?");
-        } break;
+            // <= 和 <
+            if (auto [ok, c] = reader_.geteq('='); ok)
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Token(Tag::LessEqual)));
+            return tokenlist_.push_back(
+                std::shared_ptr<Token>(new Token(Tag::Less)));
+        }
         case '>': {
             // >>右移
             if (auto [ok, c] = reader_.geteq('>'); ok)
                 return tokenlist_.push_back(
                     std::shared_ptr<Token>(new Token(Tag::ShiftRight)));
-            else
-                throw SyntaxError("unexpected >?");
+            // >= 和 >
+            if (auto [ok, c] = reader_.geteq('='); ok)
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Token(Tag::GreaterEqual)));
+            return tokenlist_.push_back(
+                std::shared_ptr<Token>(new Token(Tag::Greater)));
         }
         default:
             break;
@@ -252,7 +323,12 @@ __integer_float_number_state:
         }
         // 如果变量名表示的是一个函数名(查表)
         if (c == '(') {
-            if (isUnaryFunction(b)) {
+            if (isReduction(b)) {
+                reader_.back();
+                is_function_ = true;
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new ReductionFunction(b, minus)));
+            } else if (isUnaryFunction(b)) {
                 reader_.back();
                 is_function_ = true;
                 return tokenlist_.push_back(
@@ -262,35 +338,51 @@ __integer_float_number_state:
                 is_function_ = true;
                 return tokenlist_.push_back(
                     std::shared_ptr<Token>(new BinaryFunction(b, minus)));
+            } else if (auto form = functions().builtin_forms.find(b);
+                       form != functions().builtin_forms.end()) {
+                reader_.back();
+                is_function_ = true;
+                // 提前找出绑定变量名，函数的参数中这个变量名不能被替换为常量
+                if (form->second.variable >= 0)
+                    bound_names_.push_back(
+                        {bracket_match_.size() + 1,
+                         lookupArgument(form->second.variable)});
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new BuiltinFunction(b, minus)));
             } else
                 throw FunctionNotDefined(b);
         } else {
             // 回退一个位置，因为还需要将 (
             // 作为token保存下来(目的是后续判断当前变量名是否是一个函数名)
             reader_.back();
-            // 变量名不存在，则保存到变量表中。注意，函数名不需要保存到表中！！！
-            if (auto it = variable.find(b); it == variable.end()) {
-                auto word = std::shared_ptr<Token>(new Word(b, minus));
-                variable[b] = word;
-                return tokenlist_.push_back(word);
-            } else {
-                // 变量/常量附带一个负号标志
-                // 比如 a=100;b=-a / -pi
-                // 这里处理方法是将 -a 看作 -1 * a
+            // 编译表达式的参数，在计算时才传入值，不能替换为常量
+            if (isParameter(b)) {
                 if (minus) {
                     tokenlist_.push_back(
                         std::shared_ptr<Token>(new Number(-1)));
                     tokenlist_.push_back(
                         std::shared_ptr<Token>(new Token(Tag::Mul)));
                 }
-                // 如果变量存在常量表中，那么就直接将这个变量替换为对应的常量值
-                if (auto x = constant.find(it->first); x != constant.end()) {
-                    return tokenlist_.push_back(
-                        std::shared_ptr<Token>(new Float(x->second)));
-                }
-                // 否则直接返回表中变量名
-                return tokenlist_.push_back(it->second);
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Word(b)));
             }
+            // 变量/常量附带一个负号标志
+            // 比如 a=100;b=-a / -pi
+            // 这里处理方法是将 -a 看作 -1 * a
+            if (minus) {
+                tokenlist_.push_back(std::shared_ptr<Token>(new Number(-1)));
+                tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Token(Tag::Mul)));
+            }
+            // 如果变量已经定义，那么就直接将这个变量替换为对应的常量值
+            if (auto array = environment.findArray(b))
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new ArrayConstant(array)));
+            if (auto x = lookupConstant(b))
+                return tokenlist_.push_back(
+                    std::shared_ptr<Token>(new Float(*x)));
+            // 否则是正在定义的变量名(或者未定义的变量)，不保存到任何表中
+            return tokenlist_.push_back(std::shared_ptr<Token>(new Word(b)));
         }
         // 变量声明的分隔符;
     } else if (c == ';') {
@@ -300,6 +392,20 @@ __integer_float_number_state:
         return tokenlist_.push_back(
             std::shared_ptr<Token>(new Token(Tag::END_SEP)));
 
+    } else if (c == '[') {
+        // -[1,2] 看作 -1 * [1,2]
+        if (minus) {
+            tokenlist_.push_back(std::shared_ptr<Token>(new Number(-1)));
+            tokenlist_.push_back(std::shared_ptr<Token>(new Token(Tag::Mul)));
+        }
+        array_depth_++;
+        return tokenlist_.push_back(
+            std::shared_ptr<Token>(new Token(Tag::BEGIN_ARRAY)));
+    } else if (c == ']') {
+        if (array_depth_ == 0) throw SyntaxError("expression unexpected ]!");
+        array_depth_--;
+        return tokenlist_.push_back(
+            std::shared_ptr<Token>(new Token(Tag::END_ARRAY)));
     } else if (c == '(') {
         // 函数的开始标志符 (
         if (is_function_) {
@@ -321,6 +427,10 @@ __integer_float_number_state:
 
         // 函数的结尾标识符 )
         bool isEndOfFunction = bracket_match_.top();
+        // 内置函数结束，解除绑定变量
+        if (!bound_names_.empty() &&
+            bound_names_.back().first == bracket_match_.size())
+            bound_names_.pop_back();
         bracket_match_.pop();
         if (isEndOfFunction) {
             is_function_ = false;
@@ -0,0 +1,36 @@
+#include "../include/MonteCarlo.h"
+
+#include <string>
+
+#include "../include/Exception.h"
+#include "../include/Random.h"
+using namespace calculator;
+
+SampleStats calculator::monteCarlo(const CompiledExpression &program,
+                                   const double *args, size_t samples,
+                                   const MonteCarloOptions &options) {
+    // 采样会改变调用线程的随机数流，结束后恢复
+    struct Restore {
+        RandomStream saved = RandomStream::current();
+        ~Restore() { RandomStream::current() = saved; }
+    } restore;
+    return numeric::sample(
+        [&](size_t first, double *y, size_t n) {
+            RandomStream &stream = RandomStream::current();
+            for (size_t i = 0; i < n; i++) {
+                stream.reset(options.seed, first + i);
+                y[i] = program.evaluate(args);
+            }
+        },
+        samples, options.confidence, program.concurrent());
+}
+
+SampleStats calculator::monteCarlo(const CompiledExpression &program,
+                                   const std::vector<double> &args,
+                                   size_t samples,
+                                   const MonteCarloOptions &options) {
+    if (args.size() != program.arity())
+        throw SyntaxError("compiled expression needs " +
+                          std::to_string(program.arity()) + " arguments");
+    return monteCarlo(program, args.data(), samples, options);
+}
@@ -0,0 +1,531 @@
+#include "../include/Numeric.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "../include/Exception.h"
+using namespace calculator;
+
+static constexpr double kEpsilon = std::numeric_limits<double>::epsilon();
+
+// Kronrod 15 点的节点(正半轴)和权重，奇数下标的节点同时是 Gauss 7 点的节点
+static const double kKronrodNodes[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.000000000000000000000000000000000};
+static const double kKronrodWeights[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714};
+static const double kGaussWeights[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327};
+
+namespace {
+struct Interval {
+    double a, b;
+    double value, error;
+    bool operator<(const Interval &other) const { return error < other.error; }
+};
+}  // namespace
+
+// [a,b] 上的 15 个采样点, 对称分布: x[j] 与 x[14-j] 关于中点对称
+static void kronrodPoints(double a, double b, double *x) {
+    double center = 0.5 * (a + b), half = 0.5 * (b - a);
+    for (int j = 0; j < 7; j++) {
+        x[j] = center - half * kKronrodNodes[j];
+        x[14 - j] = center + half * kKronrodNodes[j];
+    }
+    x[7] = center;
+}
+
+static Interval kronrodRule(double a, double b, const double *y) {
+    double half = 0.5 * (b - a);
+    double kronrod = kKronrodWeights[7] * y[7];
+    double gauss = kGaussWeights[3] * y[7];
+    for (int j = 0; j < 7; j++) {
+        double pair = y[j] + y[14 - j];
+        kronrod += kKronrodWeights[j] * pair;
+        if (j & 1) gauss += kGaussWeights[j / 2] * pair;
+    }
+    return {a, b, kronrod * half, std::fabs((kronrod - gauss) * half)};
+}
+
+double numeric::integrate(const BatchEvaluator &f, double a, double b) {
+    if (!std::isfinite(a) || !std::isfinite(b))
+        throw NumericException("integrate", "limits must be finite");
+    if (a == b) return 0.0;
+    if (a > b) return -integrate(f, b, a);
+
+    double x[30], y[30];
+    kronrodPoints(a, b, x);
+    f(x, y, 15);
+    std::priority_queue<Interval> intervals;
+    intervals.push(kronrodRule(a, b, y));
+    double value = intervals.top().value, error = intervals.top().error;
+
+    while (intervals.size() < kMaxIntervals && std::isfinite(value) &&
+           error > std::max(kAbsTolerance, kRelTolerance * std::fabs(value))) {
+        Interval worst = intervals.top();
+        double mid = 0.5 * (worst.a + worst.b);
+        // 区间已经不能再分
+        if (mid <= worst.a || mid >= worst.b) break;
+        intervals.pop();
+        // 两个子区间的采样点一起计算
+        kronrodPoints(worst.a, mid, x);
+        kronrodPoints(mid, worst.b, x + 15);
+        f(x, y, 30);
+        Interval left = kronrodRule(worst.a, mid, y);
+        Interval right = kronrodRule(mid, worst.b, y + 15);
+        value += left.value + right.value - worst.value;
+        error += left.error + right.error - worst.error;
+        intervals.push(left);
+        intervals.push(right);
+    }
+    // 重新累加，避免增量更新累积的舍入误差
+    value = 0.0;
+    for (; !intervals.empty(); intervals.pop()) value += intervals.top().value;
+    return value;
+}
+
+// Brent 方法求 [a,b] 内的根, 要求 f(a) 与 f(b) 异号
+static double brentRoot(const ScalarEvaluator &f, double a, double b,
+                        double fa, double fb) {
+    double c = b, fc = fb, d = b - a, e = d;
+    for (int iter = 0; iter < 200; iter++) {
+        if ((fb > 0 && fc > 0) || (fb < 0 && fc < 0)) {
+            c = a, fc = fa;
+            d = e = b - a;
+        }
+        if (std::fabs(fc) < std::fabs(fb)) {
+            a = b, b = c, c = a;
+            fa = fb, fb = fc, fc = fa;
+        }
+        double tol = 2 * kEpsilon * std::fabs(b) + 1e-300;
+        double m = 0.5 * (c - b);
+        if (std::fabs(m) <= tol || fb == 0) return b;
+        if (std::fabs(e) >= tol && std::fabs(fa) > std::fabs(fb)) {
+            // 割线法或反二次插值
+            double p, q, r, s = fb / fa;
+            if (a == c) {
+                p = 2 * m * s;
+                q = 1 - s;
+            } else {
+                q = fa / fc, r = fb / fc;
+                p = s * (2 * m * q * (q - r) - (b - a) * (r - 1));
+                q = (q - 1) * (r - 1) * (s - 1);
+            }
+            if (p > 0) q = -q;
+            p = std::fabs(p);
+            if (2 * p < std::min(3 * m * q - std::fabs(tol * q),
+                                 std::fabs(e * q))) {
+                e = d;
+                d = p / q;
+            } else {
+                d = e = m;
+            }
+        } else {
+            // 二分
+            d = e = m;
+        }
+        a = b, fa = fb;
+        b += std::fabs(d) > tol ? d : std::copysign(tol, m);
+        fb = f(b);
+    }
+    return b;
+}
+
+double numeric::solve(const ScalarEvaluator &f, const ScalarEvaluator &df,
+                      double x0) {
+    if (!std::isfinite(x0))
+        throw NumericException("solve", "initial value must be finite");
+    // 牛顿法
+    double x = x0;
+    for (int iter = 0; iter < 100; iter++) {
+        double fx = f(x);
+        if (fx == 0) return x;
+        double d = df(x);
+        if (!std::isfinite(fx) || !std::isfinite(d) || d == 0) break;
+        double step = fx / d;
+        x -= step;
+        if (!std::isfinite(x)) break;
+        if (std::fabs(step) <= 4 * kEpsilon * std::max(1.0, std::fabs(x)))
+            return x;
+    }
+
+    // 牛顿法不收敛，从 x0 向两侧寻找变号的区间
+    double f0 = f(x0);
+    if (f0 == 0) return x0;
+    if (std::isfinite(f0)) {
+        double h = 1e-3 * std::max(1.0, std::fabs(x0));
+        for (int k = 0; k < 100 && std::isfinite(x0 + h * 2); k++, h *= 2) {
+            for (double side : {x0 + h, x0 - h}) {
+                double fs = f(side);
+                if (fs == 0) return side;
+                if (std::isfinite(fs) && (fs > 0) != (f0 > 0))
+                    return brentRoot(f, x0, side, f0, fs);
+            }
+        }
+    }
+    throw NumericException("solve", "no root found near " + std::to_string(x0));
+}
+
+double numeric::minimize(const ScalarEvaluator &f, double a, double b) {
+    if (!std::isfinite(a) || !std::isfinite(b))
+        throw NumericException("minimize", "interval must be finite");
+    if (a > b) std::swap(a, b);
+    if (a == b) return a;
+
+    const double lo = a, hi = b;
+    // (3-sqrt(5))/2, 黄金分割的步长
+    const double golden = 0.3819660112501051;
+    double x, w, v, fx, fw, fv, d = 0, e = 0;
+    x = w = v = a + golden * (b - a);
+    fx = fw = fv = f(x);
+    for (int iter = 0; iter < 200; iter++) {
+        double mid = 0.5 * (a + b);
+        double tol = 1.4901161193847656e-08 * std::fabs(x) + 1e-12;
+        if (std::fabs(x - mid) <= 2 * tol - 0.5 * (b - a)) break;
+        bool golden_step = true;
+        if (std::fabs(e) > tol) {
+            // 通过 x, w, v 三点的抛物线的极小值点
+            double r = (x - w) * (fx - fv);
+            double q = (x - v) * (fx - fw);
+            double p = (x - v) * q - (x - w) * r;
+            q = 2 * (q - r);
+            if (q > 0) p = -p;
+            q = std::fabs(q);
+            double last = e;
+            e = d;
+            if (std::fabs(p) < std::fabs(0.5 * q * last) && p > q * (a - x) &&
+                p < q * (b - x)) {
+                d = p / q;
+                double u = x + d;
+                if (u - a < 2 * tol || b - u < 2 * tol)
+                    d = std::copysign(tol, mid - x);
+                golden_step = false;
+            }
+        }
+        if (golden_step) {
+            e = x >= mid ? a - x : b - x;
+            d = golden * e;
+        }
+        double u = std::fabs(d) >= tol ? x + d : x + std::copysign(tol, d);
+        double fu = f(u);
+        if (fu <= fx) {
+            (u >= x ? a : b) = x;
+            v = w, fv = fw;
+            w = x, fw = fx;
+            x = u, fx = fu;
+        } else {
+            (u < x ? a : b) = u;
+            if (fu <= fw || w == x) {
+                v = w, fv = fw;
+                w = u, fw = fu;
+            } else if (fu <= fv || v == x || v == w) {
+                v = u, fv = fu;
+            }
+        }
+    }
+    // Brent 方法不会计算端点，单调函数的极小值在端点上
+    double flo = f(lo), fhi = f(hi);
+    if (flo < fx && flo <= fhi) return lo;
+    if (fhi < fx) return hi;
+    return x;
+}
+
+static std::atomic<size_t> max_threads{0};
+
+void numeric::setMaxThreads(size_t threads) { max_threads = threads; }
+
+size_t numeric::maxThreads() {
+    size_t threads = max_threads;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    return std::max<size_t>(threads, 1);
+}
+
+// 按块并行计算，块的结果只取决于块内的数据
+template <class Block>
+static void forEachBlock(size_t blocks, bool parallel, Block &&block) {
+    size_t threads = parallel ? std::min(numeric::maxThreads(), blocks) : 1;
+    if (threads <= 1) {
+        for (size_t b = 0; b < blocks; b++) block(b);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+    std::mutex mutex;
+    auto worker = [&] {
+        try {
+            for (size_t b; (b = next++) < blocks;) block(b);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+            next = blocks;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for (auto &thread : pool) thread.join();
+    if (error) std::rethrow_exception(error);
+}
+
+size_t numeric::termCount(const char *function, double lo, double hi) {
+    if (!std::isfinite(lo) || !std::isfinite(hi))
+        throw NumericException(function, "range must be finite");
+    if (hi < lo) return 0;
+    double count = std::floor(hi - lo) + 1;
+    if (count > 9007199254740992.0)
+        throw NumericException(function, "range is too large");
+    return (size_t)count;
+}
+
+namespace {
+// 每个位置一个累加器，同一块内的项按位置分别累加，循环可以向量化
+constexpr size_t kAccumulatorLanes = 256;
+
+// Kahan 补偿求和
+struct SumAccumulator {
+    double sum[kAccumulatorLanes] = {0}, comp[kAccumulatorLanes] = {0};
+
+    void add(const double *y, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            double t = y[i] - comp[i];
+            double s = sum[i] + t;
+            comp[i] = (s - sum[i]) - t;
+            sum[i] = s;
+        }
+    }
+};
+
+// double-double 表示的数 hi + lo
+struct DoubleDouble {
+    double hi = 0, lo = 0;
+};
+
+// 2Sum: a + b = s + e (精确)
+inline DoubleDouble twoSum(double a, double b) {
+    double s = a + b, v = s - a;
+    return {s, (a - (s - v)) + (b - v)};
+}
+
+// Dekker 的 TwoProduct: a * b = p + e (精确), 不需要 fma
+inline DoubleDouble twoProduct(double a, double b) {
+    const double split = 134217729.0;  // 2^27 + 1
+    double p = a * b;
+    double ca = split * a, cb = split * b;
+    double ah = ca - (ca - a), al = a - ah;
+    double bh = cb - (cb - b), bl = b - bh;
+    return {p, ((ah * bh - p) + ah * bl + al * bh) + al * bl};
+}
+
+// double-double 累乘
+struct ProductAccumulator {
+    double hi[kAccumulatorLanes], lo[kAccumulatorLanes];
+
+    ProductAccumulator() {
+        std::fill(hi, hi + kAccumulatorLanes, 1.0);
+        std::fill(lo, lo + kAccumulatorLanes, 0.0);
+    }
+    void add(const double *y, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            DoubleDouble p = twoProduct(hi[i], y[i]);
+            double e = p.lo + lo[i] * y[i];
+            hi[i] = p.hi + e;
+            lo[i] = e - (hi[i] - p.hi);
+        }
+    }
+};
+
+// 两个 double-double 相乘
+inline DoubleDouble multiply(DoubleDouble a, DoubleDouble b) {
+    DoubleDouble p = twoProduct(a.hi, b.hi);
+    double e = p.lo + (a.hi * b.lo + a.lo * b.hi);
+    double hi = p.hi + e;
+    return {hi, e - (hi - p.hi)};
+}
+
+// Neumaier 补偿累加
+struct NeumaierSum {
+    double sum = 0, comp = 0;
+    void add(double x) {
+        DoubleDouble s = twoSum(sum, x);
+        sum = s.hi;
+        comp += s.lo;
+    }
+    double value() const { return sum + comp; }
+};
+}  // namespace
+
+// 各个位置的累加器合并为一个值
+static double merge(const SumAccumulator &accumulator) {
+    NeumaierSum total;
+    for (size_t i = 0; i < kAccumulatorLanes; i++) {
+        total.add(accumulator.sum[i]);
+        total.add(-accumulator.comp[i]);
+    }
+    return total.value();
+}
+
+// 第 block 块的各项: 绑定变量依次取 lo + first, lo + first + 1, ...
+template <class Accumulator, class Reduce>
+static void reduceBlocks(const BatchEvaluator &f, double lo, size_t count,
+                         bool parallel, Reduce &&reduce) {
+    size_t blocks = (count + numeric::kBlockTerms - 1) / numeric::kBlockTerms;
+    parallel = parallel && count >= numeric::kParallelMinTerms;
+    forEachBlock(blocks, parallel, [&](size_t block) {
+        // 每块使用自己的缓冲区: 函数体中嵌套的 sum/prod 会在同一个线程中
+        // 再次进入这里，不能共用 thread_local 的缓冲区
+        size_t first = block * numeric::kBlockTerms;
+        size_t n = std::min(numeric::kBlockTerms, count - first);
+        std::vector<double> x(n), y(n);
+        for (size_t i = 0; i < n; i++) x[i] = lo + (double)(first + i);
+        f(x.data(), y.data(), n);
+        Accumulator accumulator;
+        for (size_t i = 0; i < n; i += kAccumulatorLanes)
+            accumulator.add(&y[i], std::min(kAccumulatorLanes, n - i));
+        reduce(block, accumulator);
+    });
+}
+
+double numeric::sum(const BatchEvaluator &f, double lo, double hi,
+                    bool parallel) {
+    size_t count = termCount("sum", lo, hi);
+    size_t blocks = (count + kBlockTerms - 1) / kBlockTerms;
+    std::vector<double> partials(blocks);
+    reduceBlocks<SumAccumulator>(
+        f, lo, count, parallel,
+        [&](size_t block, const SumAccumulator &accumulator) {
+            partials[block] = merge(accumulator);
+        });
+    NeumaierSum total;
+    for (double partial : partials) total.add(partial);
+    return total.value();
+}
+
+double numeric::sumArray(const double *x, size_t n) {
+    SumAccumulator accumulator;
+    for (size_t i = 0; i < n; i += kAccumulatorLanes)
+        accumulator.add(&x[i], std::min(kAccumulatorLanes, n - i));
+    return merge(accumulator);
+}
+
+double numeric::dot(const double *x, const double *y, size_t n) {
+    // 乘积拆成 p + e 两部分分别累加
+    SumAccumulator accumulator;
+    double p[kAccumulatorLanes], e[kAccumulatorLanes];
+    for (size_t i = 0; i < n; i += kAccumulatorLanes) {
+        size_t m = std::min(kAccumulatorLanes, n - i);
+        for (size_t k = 0; k < m; k++) {
+            DoubleDouble product = twoProduct(x[i + k], y[i + k]);
+            p[k] = product.hi, e[k] = product.lo;
+        }
+        accumulator.add(p, m);
+        accumulator.add(e, m);
+    }
+    return merge(accumulator);
+}
+
+double numeric::product(const BatchEvaluator &f, double lo, double hi,
+                        bool parallel) {
+    size_t count = termCount("prod", lo, hi);
+    size_t blocks = (count + kBlockTerms - 1) / kBlockTerms;
+    std::vector<DoubleDouble> partials(blocks);
+    reduceBlocks<ProductAccumulator>(
+        f, lo, count, parallel,
+        [&](size_t block, const ProductAccumulator &accumulator) {
+            DoubleDouble total = {1.0, 0.0};
+            for (size_t i = 0; i < kAccumulatorLanes; i++)
+                total = multiply(total, {accumulator.hi[i], accumulator.lo[i]});
+            partials[block] = total;
+        });
+    DoubleDouble total = {1.0, 0.0};
+    for (auto &partial : partials) total = multiply(total, partial);
+    return total.hi + total.lo;
+}
+
+double numeric::normalQuantile(double p) {
+    // Acklam 的有理逼近(相对误差约 1e-9)，再用一步 Halley 迭代修正
+    static const double a[6] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                                -2.759285104469687e+02, 1.383577518672690e+02,
+                                -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[5] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                                -1.556989798598866e+02, 6.680131188771972e+01,
+                                -1.328068155288572e+01};
+    static const double c[6] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                                -2.400758277161838e+00, -2.549732539343734e+00,
+                                4.374664141464968e+00,  2.938163982698783e+00};
+    static const double d[4] = {7.784695709041462e-03, 3.224671290700398e-01,
+                                2.445134137142996e+00, 3.754408661907416e+00};
+    if (!(p > 0 && p < 1))
+        throw NumericException("normalQuantile", "p must be in (0, 1)");
+    auto tail = [&](double q) {
+        return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q +
+                c[5]) /
+               ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    };
+    double x;
+    if (p < 0.02425) {
+        x = tail(std::sqrt(-2 * std::log(p)));
+    } else if (p > 1 - 0.02425) {
+        x = -tail(std::sqrt(-2 * std::log1p(-p)));
+    } else {
+        double q = p - 0.5, r = q * q;
+        x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r +
+             a[5]) *
+            q /
+            (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+    }
+    double e = 0.5 * std::erfc(-x / std::sqrt(2.0)) - p;
+    double u = e * std::sqrt(2 * M_PI) * std::exp(x * x / 2);
+    return x - u / (1 + x * u / 2);
+}
+
+SampleStats numeric::sample(const SampleEvaluator &f, size_t count,
+                            double confidence, bool parallel) {
+    if (!(confidence > 0 && confidence < 1))
+        throw NumericException("sample", "confidence must be in (0, 1)");
+    // 每块的样本数、均值和离差平方和
+    struct Moments {
+        double n, mean, m2;
+    };
+    size_t blocks = (count + kBlockSamples - 1) / kBlockSamples;
+    std::vector<Moments> partials(blocks);
+    forEachBlock(blocks, parallel, [&](size_t block) {
+        // 同 reduceBlocks，样本的计算中可能再次进入这里
+        size_t first = block * kBlockSamples;
+        size_t n = std::min(kBlockSamples, count - first);
+        std::vector<double> y(n);
+        f(first, y.data(), n);
+        double mean = sumArray(y.data(), n) / n;
+        for (double &v : y) v = (v - mean) * (v - mean);
+        partials[block] = {(double)n, mean, sumArray(y.data(), n)};
+    });
+    Moments total = {0, 0, 0};
+    for (auto &part : partials) {
+        double n = total.n + part.n, delta = part.mean - total.mean;
+        total.mean += delta * part.n / n;
+        total.m2 += part.m2 + delta * delta * total.n * part.n / n;
+        total.n = n;
+    }
+    SampleStats stats;
+    stats.count = count;
+    stats.mean = count ? total.mean : NAN;
+    stats.variance = count > 1 ? total.m2 / (count - 1) : NAN;
+    stats.std_error = std::sqrt(stats.variance / count);
+    stats.confidence = confidence;
+    double z = normalQuantile(0.5 + confidence / 2);
+    stats.lower = stats.mean - z * stats.std_error;
+    stats.upper = stats.mean + z * stats.std_error;
+    return stats;
+}
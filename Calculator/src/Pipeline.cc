@@ -0,0 +1,295 @@
+#include "../include/Pipeline.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+using namespace calculator;
+
+// 字段从 p 开始，返回字段的结束位置，p 移到下一个字段的开始。
+// 引号中的逗号不分隔字段，"" 表示引号本身
+static const char *nextField(const char *&p, const char *stop) {
+    const char *q = p;
+    if (q < stop && *q == '"') {
+        for (q++; q < stop; q++) {
+            if (*q != '"') continue;
+            if (q + 1 < stop && q[1] == '"')
+                q++;
+            else {
+                q++;
+                break;
+            }
+        }
+    }
+    auto comma = (const char *)std::memchr(q, ',', stop - q);
+    const char *end = comma ? comma : stop;
+    p = comma ? comma + 1 : stop;
+    return end;
+}
+
+// 去掉字段两端的空白和引号
+static void trimField(const char *&begin, const char *&end) {
+    while (begin < end && (*begin == ' ' || *begin == '\t' || *begin == '"'))
+        begin++;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '"'))
+        end--;
+}
+
+// 数值字段，空字段或者不是数值时为 nan
+static double parseField(const char *begin, const char *end) {
+    trimField(begin, end);
+    // from_chars 不接受前导的 +
+    if (begin < end && *begin == '+') begin++;
+    double value;
+    auto [ptr, ec] = std::from_chars(begin, end, value);
+    if (ec != std::errc() || ptr != end) return NAN;
+    return value;
+}
+
+CsvPipeline::CsvPipeline(ExpressionTree &tree, const PipelineOptions &options)
+    : options_(options) {
+    int fd = ::open(options_.input.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) throw CsvException(options_.input, std::strerror(errno));
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+        int error = errno;
+        ::close(fd);
+        throw CsvException(options_.input, std::strerror(error));
+    }
+    size_ = (size_t)st.st_size;
+    if (size_ == 0) {
+        ::close(fd);
+        throw CsvException(options_.input, "is empty");
+    }
+    void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    // 映射后文件描述符可以立即关闭
+    ::close(fd);
+    if (data == MAP_FAILED) throw CsvException(options_.input, std::strerror(error));
+    data_ = (const char *)data;
+    ::madvise(data, size_, MADV_SEQUENTIAL);
+
+    // 第一行是列名
+    auto newline = (const char *)std::memchr(data_, '\n', size_);
+    const char *stop = newline ? newline : data_ + size_;
+    body_ = newline ? newline - data_ + 1 : size_;
+    if (stop > data_ && stop[-1] == '\r') stop--;
+    header_.assign(data_, stop);
+    for (const char *p = data_; p < stop;) {
+        const char *begin = p, *end = nextField(p, stop);
+        trimField(begin, end);
+        columns_.emplace_back(begin, end);
+    }
+    if (columns_.empty()) throw CsvException(options_.input, "has no header");
+
+    formulas_ = std::make_unique<Workspace>(tree, columns_);
+    for (auto &[name, expression] : options_.formulas)
+        formulas_->add(name, expression);
+    used_.assign(columns_.size(), false);
+    for (size_t k = 0; k < columns_.size(); k++)
+        used_[k] = formulas_->usesInput(k);
+    workers_ = options_.workers ? options_.workers
+                                : std::thread::hardware_concurrency();
+    if (workers_ == 0 || !formulas_->concurrent()) workers_ = 1;
+}
+
+CsvPipeline::~CsvPipeline() {
+    if (data_) ::munmap((void *)data_, size_);
+}
+
+size_t CsvPipeline::process(const char *begin, const char *end,
+                            Worker &worker) const {
+    worker.lines.clear();
+    worker.missing.clear();
+    worker.columns.resize(columns_.size());
+    for (auto &column : worker.columns) column.clear();
+    for (const char *line = begin; line < end;) {
+        auto newline = (const char *)std::memchr(line, '\n', end - line);
+        const char *next = newline ? newline + 1 : end;
+        const char *stop = newline ? newline : end;
+        if (stop > line && stop[-1] == '\r') stop--;
+        // 跳过空行
+        if (stop == line) {
+            line = next;
+            continue;
+        }
+        worker.lines.push_back({line, stop});
+        // 缺少的字段为空字段
+        const char *p = line;
+        size_t fields = 0;
+        bool more = true;
+        for (size_t k = 0; k < columns_.size(); k++) {
+            const char *field = p, *field_end = nextField(p, stop);
+            if (more) fields++;
+            // 字段后面没有逗号时之后的字段都缺少
+            more = more && field_end != stop;
+            if (used_[k])
+                worker.columns[k].push_back(parseField(field, field_end));
+        }
+        worker.missing.push_back(columns_.size() - fields);
+        line = next;
+    }
+
+    // 所有公式对整块一起批量计算，没有用到的列不需要传入
+    const size_t n = worker.lines.size();
+    const size_t m = options_.formulas.size();
+    std::vector<const double *> columns(columns_.size(), nullptr);
+    for (size_t k = 0; k < columns_.size(); k++)
+        if (used_[k]) columns[k] = worker.columns[k].data();
+    std::vector<double> args(columns_.size(), 0.0);
+    worker.results.resize(m);
+    std::vector<double *> results(m);
+    for (size_t j = 0; j < m; j++) {
+        worker.results[j].resize(n);
+        results[j] = worker.results[j].data();
+    }
+    formulas_->evaluateBatch(args.data(), columns.data(), results.data(), n);
+
+    // 原来的行加上结果(最短的可以精确还原的十进制表示)，字段少于列名时
+    // 先补上空字段，结果与列名对齐
+    worker.output.clear();
+    char buffer[32];
+    for (size_t i = 0; i < n; i++) {
+        worker.output.append(worker.lines[i].first, worker.lines[i].second);
+        worker.output.append(worker.missing[i], ',');
+        for (size_t j = 0; j < m; j++) {
+            worker.output.push_back(',');
+            auto result =
+                std::to_chars(buffer, buffer + sizeof(buffer), worker.results[j][i]);
+            worker.output.append(buffer, result.ptr);
+        }
+        worker.output.push_back('\n');
+    }
+    return n;
+}
+
+void CsvPipeline::writeAll(int fd, const std::string &data) const {
+    for (size_t written = 0; written < data.size();) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw CsvException(
+                options_.output.empty() ? "stdout" : options_.output,
+                std::strerror(errno));
+        }
+        written += n;
+    }
+}
+
+PipelineStats CsvPipeline::run() {
+    auto begin = std::chrono::steady_clock::now();
+    // 按大小切分，每块在行尾结束
+    std::vector<std::pair<size_t, size_t>> chunks;
+    for (size_t pos = body_; pos < size_;) {
+        size_t end = std::min(pos + std::max<size_t>(options_.chunk_bytes, 1),
+                              size_);
+        if (end < size_) {
+            auto newline =
+                (const char *)std::memchr(data_ + end, '\n', size_ - end);
+            end = newline ? newline - data_ + 1 : size_;
+        }
+        chunks.push_back({pos, end});
+        pos = end;
+    }
+
+    int fd = STDOUT_FILENO;
+    if (!options_.output.empty()) {
+        fd = ::open(options_.output.c_str(),
+                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) throw CsvException(options_.output, std::strerror(errno));
+    }
+    struct Slot {
+        std::string output;
+        size_t rows = 0;
+        bool ready = false;
+    };
+    // 正在处理和等待写出的块最多 window 个
+    const size_t window = 2 * workers_;
+    std::vector<Slot> slots(window);
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t next = 0, written = 0;
+    std::exception_ptr error;
+
+    auto work = [&] {
+        Worker worker;
+        for (;;) {
+            size_t k;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] {
+                    return error || next >= chunks.size() ||
+                           next < written + window;
+                });
+                if (error || next >= chunks.size()) return;
+                k = next++;
+            }
+            size_t rows = 0;
+            try {
+                rows = process(data_ + chunks[k].first,
+                               data_ + chunks[k].second, worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+                changed.notify_all();
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            // 交换缓冲区，写出后的缓冲区留给下一块复用
+            Slot &slot = slots[k % window];
+            slot.output.swap(worker.output);
+            slot.rows = rows;
+            slot.ready = true;
+            changed.notify_all();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers_; i++) threads.emplace_back(work);
+
+    PipelineStats stats;
+    std::string output = header_;
+    for (auto &formula : options_.formulas) output += "," + formula.first;
+    output += "\n";
+    try {
+        writeAll(fd, output);
+        for (size_t k = 0; k < chunks.size(); k++) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                Slot &slot = slots[k % window];
+                changed.wait(lock, [&] { return error || slot.ready; });
+                if (error) break;
+                output.swap(slot.output);
+                stats.rows += slot.rows;
+                slot.ready = false;
+            }
+            writeAll(fd, output);
+            std::lock_guard<std::mutex> lock(mutex);
+            written++;
+            changed.notify_all();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error) error = std::current_exception();
+        changed.notify_all();
+    }
+    for (auto &thread : threads) thread.join();
+    if (fd != STDOUT_FILENO) ::close(fd);
+    if (error) std::rethrow_exception(error);
+
+    stats.bytes = size_;
+    stats.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count();
+    return stats;
+}
@@ -0,0 +1,78 @@
+#include "../include/Plugin.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include "../include/Exception.h"
+using namespace calculator;
+
+// 把动态库复制到临时文件，返回临时文件的路径
+static std::string copyToTemporary(const std::string &path) {
+    int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) throw PluginException(path, std::strerror(errno));
+    const char *dir = std::getenv("TMPDIR");
+    std::string copy = std::string(dir && *dir ? dir : "/tmp") +
+                       "/calculator-plugin-XXXXXX";
+    int out = ::mkstemp(&copy[0]);
+    if (out < 0) {
+        int error = errno;
+        ::close(in);
+        throw PluginException(path, std::strerror(error));
+    }
+    char buffer[65536];
+    ssize_t n;
+    while ((n = ::read(in, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t written = 0; written < n;) {
+            ssize_t w = ::write(out, buffer + written, n - written);
+            if (w < 0) {
+                n = -1;
+                break;
+            }
+            written += w;
+        }
+        if (n < 0) break;
+    }
+    int error = errno;
+    ::close(in);
+    ::close(out);
+    if (n < 0) {
+        ::unlink(copy.c_str());
+        throw PluginException(path, std::strerror(error));
+    }
+    return copy;
+}
+
+std::shared_ptr<PluginLibrary> PluginLibrary::load(const std::string &path) {
+    std::string copy = copyToTemporary(path);
+    void *handle = ::dlopen(copy.c_str(), RTLD_NOW | RTLD_LOCAL);
+    // 加载后映射一直有效，临时文件可以立即删除
+    ::unlink(copy.c_str());
+    if (!handle) throw PluginException(path, ::dlerror());
+    std::shared_ptr<PluginLibrary> library(new PluginLibrary(path, handle));
+
+    auto abi = (CalculatorPluginAbi)::dlsym(handle, "calculator_plugin_abi");
+    auto entry = (CalculatorPluginEntry)::dlsym(
+        handle, "calculator_plugin_functions");
+    if (!abi || !entry)
+        throw PluginException(path, "is not a calculator plugin");
+    if (abi() != CALCULATOR_PLUGIN_ABI)
+        throw PluginException(path, "has ABI version " +
+                                        std::to_string(abi()) + ", expected " +
+                                        std::to_string(CALCULATOR_PLUGIN_ABI));
+    size_t count = 0;
+    const CalculatorPluginFunction *functions = entry(&count);
+    for (size_t i = 0; i < count; i++) {
+        if (!functions[i].name || !*functions[i].name || !functions[i].batch)
+            throw PluginException(path, "function " + std::to_string(i) +
+                                            " has no name or batch version");
+        library->functions_.push_back(functions[i]);
+    }
+    return library;
+}
+
+PluginLibrary::~PluginLibrary() { ::dlclose(handle_); }
@@ -0,0 +1,71 @@
+#include "../include/Random.h"
+
+#include <atomic>
+#include <cmath>
+#include <random>
+using namespace calculator;
+
+Philox4x32::Counter Philox4x32::generate(Counter counter, Key key) {
+    constexpr uint64_t kMultiplier0 = 0xD2511F53, kMultiplier1 = 0xCD9E8D57;
+    constexpr uint32_t kWeyl0 = 0x9E3779B9, kWeyl1 = 0xBB67AE85;
+    for (int round = 0; round < 10; round++) {
+        if (round > 0) key[0] += kWeyl0, key[1] += kWeyl1;
+        uint64_t p0 = kMultiplier0 * counter[0];
+        uint64_t p1 = kMultiplier1 * counter[2];
+        counter = {(uint32_t)(p1 >> 32) ^ counter[1] ^ key[0], (uint32_t)p1,
+                   (uint32_t)(p0 >> 32) ^ counter[3] ^ key[1], (uint32_t)p0};
+    }
+    return counter;
+}
+
+void RandomStream::refill() {
+    Philox4x32::Counter x = Philox4x32::generate(
+        {(uint32_t)block_, (uint32_t)(block_ >> 32), (uint32_t)stream_,
+         (uint32_t)(stream_ >> 32)},
+        {(uint32_t)seed_, (uint32_t)(seed_ >> 32)});
+    block_++;
+    // 每 64 位取高 53 位
+    for (int i = 0; i < 2; i++) {
+        uint64_t bits = (uint64_t)x[2 * i] << 32 | x[2 * i + 1];
+        buffer_[i] = (double)(bits >> 11) * 0x1p-53;
+    }
+    available_ = 2;
+}
+
+double RandomStream::normal() {
+    // 1-u 在 (0,1] 上，log 不会得到 -inf
+    double u = 1 - uniform(), v = uniform();
+    return std::sqrt(-2 * std::log(u)) * std::cos(6.283185307179586 * v);
+}
+
+// 线程的流号从最高位为1开始，样本的流号为样本序号
+static constexpr uint64_t kThreadStreams = 1ull << 63;
+
+static std::atomic<uint64_t> &globalSeed() {
+    static std::atomic<uint64_t> seed{[] {
+        std::random_device device;
+        return (uint64_t)device() << 32 | device();
+    }()};
+    return seed;
+}
+// 每次 seedRandom 加一，线程发现变化时重新初始化自己的流
+static std::atomic<uint64_t> generation{1};
+static std::atomic<uint64_t> next_thread{0};
+
+void calculator::seedRandom(uint64_t seed) {
+    globalSeed().store(seed, std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+}
+
+RandomStream &RandomStream::current() {
+    thread_local RandomStream stream;
+    thread_local uint64_t seen = 0;
+    thread_local uint64_t thread = next_thread++;
+    uint64_t now = generation.load(std::memory_order_acquire);
+    if (seen != now) {
+        seen = now;
+        stream.reset(globalSeed().load(std::memory_order_relaxed),
+                     kThreadStreams | thread);
+    }
+    return stream;
+}
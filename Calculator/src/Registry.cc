@@ -0,0 +1,220 @@
+#include "../include/Registry.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "../include/Random.h"
+using namespace calculator;
+
+FunctionTable::FunctionTable() {
+    for (auto& [name, func] : unary_functions)
+        function_attributes[name].pure = true;
+    for (auto& [name, func] : binary_functions)
+        function_attributes[name].pure = true;
+    for (auto& [name, form] : builtin_forms)
+        function_attributes[name].pure = true;
+    // 随机数函数使用当前线程的随机数流，不能常量折叠
+    unary_functions["rand"] = [](double) {
+        return RandomStream::current().uniform();
+    };
+    binary_functions["uniform"] = [](double a, double b) {
+        return a + (b - a) * RandomStream::current().uniform();
+    };
+    binary_functions["normal"] = [](double mu, double sigma) {
+        return mu + sigma * RandomStream::current().normal();
+    };
+    nullary_functions.insert("rand");
+    for (const char* name : {"rand", "uniform", "normal"})
+        function_attributes[name].random = true;
+    fillPrecisionFunctions(float_functions);
+    fillPrecisionFunctions(long_double_functions);
+    setMathMode(MathMode::Precise);
+}
+
+template <class T>
+void FunctionTable::fillPrecisionFunctions(PrecisionFunctions<T>& functions) {
+    // std:: 的重载按参数类型选择 sinf/sin/sinl 等
+#define CALCULATOR_PRECISION_UNARY(name)                               \
+    functions.unary[#name] = [](T x) { return (T)std::name(x); };     \
+    functions.batch[#name] = [](const T* in, T* out, size_t n) {      \
+        for (size_t i = 0; i < n; i++) out[i] = (T)std::name(in[i]); \
+    };
+    CALCULATOR_PRECISION_UNARY(sqrt)
+    CALCULATOR_PRECISION_UNARY(ceil)
+    CALCULATOR_PRECISION_UNARY(cos)
+    CALCULATOR_PRECISION_UNARY(sin)
+    CALCULATOR_PRECISION_UNARY(tan)
+    CALCULATOR_PRECISION_UNARY(log)
+    CALCULATOR_PRECISION_UNARY(floor)
+    CALCULATOR_PRECISION_UNARY(acos)
+    CALCULATOR_PRECISION_UNARY(asin)
+    CALCULATOR_PRECISION_UNARY(atan)
+    CALCULATOR_PRECISION_UNARY(exp)
+    CALCULATOR_PRECISION_UNARY(log2)
+    CALCULATOR_PRECISION_UNARY(log10)
+    CALCULATOR_PRECISION_UNARY(erf)
+    CALCULATOR_PRECISION_UNARY(round)
+#undef CALCULATOR_PRECISION_UNARY
+    functions.binary["pow"] = [](T x, T y) { return (T)std::pow(x, y); };
+    functions.binary["max"] = [](T x, T y) { return x > y ? x : y; };
+    functions.binary["min"] = [](T x, T y) { return x < y ? x : y; };
+}
+
+void FunctionTable::erasePrecisionFunctions(const std::string& name) {
+    float_functions.unary.erase(name);
+    float_functions.binary.erase(name);
+    float_functions.batch.erase(name);
+    long_double_functions.unary.erase(name);
+    long_double_functions.binary.erase(name);
+    long_double_functions.batch.erase(name);
+}
+
+// 精确模式下的批量实现，省去逐个调用 std::function 的开销
+#define CALCULATOR_PRECISE_BATCH(func)                              \
+    [](const double* in, double* out, size_t n) {                  \
+        for (size_t i = 0; i < n; i++) out[i] = (double)func(in[i]); \
+    }
+
+template <MathMode M>
+void FunctionTable::useFastMath() {
+    unary_functions["sin"] = static_cast<double (*)(double)>(fastSin<M>);
+    unary_functions["cos"] = static_cast<double (*)(double)>(fastCos<M>);
+    unary_functions["tan"] = static_cast<double (*)(double)>(fastTan<M>);
+    unary_functions["exp"] = static_cast<double (*)(double)>(fastExp<M>);
+    unary_batch_functions["sin"] = fastSin<M>;
+    unary_batch_functions["cos"] = fastCos<M>;
+    unary_batch_functions["tan"] = fastTan<M>;
+    unary_batch_functions["exp"] = fastExp<M>;
+}
+
+void FunctionTable::setMathMode(MathMode mode) {
+    switch (mode) {
+        case MathMode::Fast:
+            useFastMath<MathMode::Fast>();
+            break;
+        case MathMode::Approximate:
+            useFastMath<MathMode::Approximate>();
+            break;
+        default:
+            unary_functions["sin"] = __xsin;
+            unary_functions["cos"] = __xcos;
+            unary_functions["tan"] = __xtan;
+            unary_functions["exp"] = __xexp;
+            unary_batch_functions["sin"] = CALCULATOR_PRECISE_BATCH(__xsin);
+            unary_batch_functions["cos"] = CALCULATOR_PRECISE_BATCH(__xcos);
+            unary_batch_functions["tan"] = CALCULATOR_PRECISE_BATCH(__xtan);
+            unary_batch_functions["exp"] = CALCULATOR_PRECISE_BATCH(__xexp);
+    }
+    // fastLog/fastPow 不比 glibc 的 log/pow 快(见 FastMath.h)，各模式都用 libm
+    unary_functions["log"] = __xlog;
+    binary_functions["pow"] = __xpow;
+    unary_batch_functions["log"] = CALCULATOR_PRECISE_BATCH(__xlog);
+    unary_batch_functions["sqrt"] = CALCULATOR_PRECISE_BATCH(__xsqrt);
+    math_mode = mode;
+}
+
+namespace {
+
+// 每个读者线程的记录: 正在读时为开始读时的纪元，不在读时为0
+struct ReaderRecord {
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> in_use{true};
+    // 嵌套的读的层数，只由所属的线程访问
+    size_t depth = 0;
+    ReaderRecord *next = nullptr;
+};
+
+// 所有注册表共用的纪元和读者记录。记录不会释放，线程退出后留给新的线程复用
+std::atomic<uint64_t> global_epoch{1};
+std::atomic<ReaderRecord *> readers{nullptr};
+std::mutex readers_mutex;
+
+ReaderRecord *acquireRecord() {
+    std::lock_guard<std::mutex> lock(readers_mutex);
+    for (ReaderRecord *r = readers.load(); r; r = r->next) {
+        if (!r->in_use.load(std::memory_order_relaxed)) {
+            r->in_use.store(true, std::memory_order_relaxed);
+            return r;
+        }
+    }
+    auto *r = new ReaderRecord;
+    r->next = readers.load(std::memory_order_relaxed);
+    readers.store(r, std::memory_order_release);
+    return r;
+}
+
+struct ThreadRecord {
+    ReaderRecord *record = acquireRecord();
+    ~ThreadRecord() {
+        std::lock_guard<std::mutex> lock(readers_mutex);
+        record->epoch.store(0, std::memory_order_relaxed);
+        record->in_use.store(false, std::memory_order_relaxed);
+    }
+};
+
+ReaderRecord &threadRecord() {
+    thread_local ThreadRecord self;
+    return *self.record;
+}
+
+}  // namespace
+
+Registry::ReadGuard::ReadGuard(const Registry &registry) {
+    ReaderRecord &self = threadRecord();
+    if (self.depth++ == 0) {
+        // 先公开开始读的纪元，再读取当前版本。屏障保证写者在发布新版本后
+        // 要么看到这个纪元(不释放旧版本)，要么这里读到的是新版本；
+        // 读到某次发布之后的纪元时也一定能读到那次发布的版本(acquire)
+        self.epoch.store(global_epoch.load(std::memory_order_acquire),
+                         std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    table_ = registry.current_.load(std::memory_order_acquire);
+}
+
+Registry::ReadGuard::~ReadGuard() {
+    ReaderRecord &self = threadRecord();
+    if (--self.depth == 0) self.epoch.store(0, std::memory_order_release);
+}
+
+void Registry::update(const std::function<void(FunctionTable &)> &modify) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    std::unique_ptr<FunctionTable> next(
+        new FunctionTable(*current_.load(std::memory_order_relaxed)));
+    modify(*next);
+    const FunctionTable *old = current_.exchange(next.release());
+    // 在这之后开始读的读者都会读到新版本
+    uint64_t epoch = global_epoch.fetch_add(1) + 1;
+    retired_.push_back({old, epoch});
+    version_.fetch_add(1, std::memory_order_relaxed);
+    reclaim();
+}
+
+void Registry::reclaim() {
+    // 正在读的读者中最早开始的纪元
+    uint64_t oldest = UINT64_MAX;
+    for (ReaderRecord *r = readers.load(std::memory_order_acquire); r;
+         r = r->next) {
+        uint64_t epoch = r->epoch.load();
+        if (epoch != 0 && epoch < oldest) oldest = epoch;
+    }
+    // 旧版本只可能被纪元小于替换时纪元的读者使用
+    auto it = std::remove_if(retired_.begin(), retired_.end(),
+                             [oldest](const auto &item) {
+                                 if (item.second > oldest) return false;
+                                 delete item.first;
+                                 return true;
+                             });
+    retired_.erase(it, retired_.end());
+}
+
+size_t Registry::retired() const {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    return retired_.size();
+}
+
+Registry::~Registry() {
+    for (auto &item : retired_) delete item.first;
+    delete current_.load();
+}
@@ -0,0 +1,476 @@
+#include "../include/Server.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <system_error>
+
+#include "../include/ExpressionTree.h"
+using namespace calculator;
+
+using Clock = std::chrono::steady_clock;
+
+// epoll 事件中的 id: 0 和 1 是监听套接字和 eventfd，连接从 2 开始编号
+static constexpr uint64_t kListenId = 0;
+static constexpr uint64_t kEventId = 1;
+// 一行请求的最大长度，超过时关闭连接
+static constexpr size_t kMaxLineLength = 1 << 20;
+// 背压: 等待发送的结果超过高水位或积压的请求达到上限时不再读取这个连接，
+// 结果降到低水位以下并且积压的请求减半后恢复。每次最多读取一个缓冲区，
+// 所以积压的请求最多超过上限一个缓冲区中的行数
+static constexpr size_t kOutputHighWater = 1 << 20;
+static constexpr size_t kOutputLowWater = 1 << 18;
+static constexpr size_t kMaxPending = 4096;
+// 关注可读事件时的 epoll 事件
+static constexpr uint32_t kReadEvents = EPOLLIN | EPOLLRDHUP;
+
+struct Server::Connection {
+    struct Request {
+        std::string line;
+        Clock::time_point received;
+    };
+
+    Connection(uint64_t i, int f, const Server &server)
+        : id(i), fd(f), server(server) {
+        reset();
+    }
+    // 新的会话，所有会话共享函数注册表和内置常量
+    void reset() {
+        session.reset(new ExpressionTree(server.registry_));
+        session->environment().setMemoryLimit(server.session_memory_);
+        session->setLimits(server.limits_);
+    }
+
+    const uint64_t id;
+    const int fd;
+    const Server &server;
+    // 只在计算线程中访问，同一时间只有一个线程(scheduled)
+    std::unique_ptr<ExpressionTree> session;
+
+    // 以下只在事件循环线程中访问
+    std::string input;
+    bool peer_closed = false;
+    // 背压: 暂停读取
+    bool paused = false;
+    // 当前在 epoll 中关注的事件，0 表示已经从 epoll 中移除
+    uint32_t events = kReadEvents;
+
+    // 以下由 mutex 保护
+    std::mutex mutex;
+    std::vector<Request> pending;
+    std::string output;
+    // 已经在线程池的队列中或正在计算
+    bool scheduled = false;
+    // 收到 :quit，不再计算新的请求
+    bool quit = false;
+};
+
+static std::system_error systemError(const std::string &what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+Server::Server(const ServerOptions &options)
+    : unix_path_(options.unix_path),
+      session_memory_(options.session_memory),
+      limits_(options.limits),
+      registry_(std::make_shared<Registry>()) {
+    ExpressionTree setup(registry_);
+    for (auto &path : options.plugins) setup.loadPlugin(path);
+    try {
+        if (!unix_path_.empty()) {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            if (unix_path_.size() >= sizeof(addr.sun_path)) {
+                errno = ENAMETOOLONG;
+                throw systemError("unix socket " + unix_path_);
+            }
+            std::strcpy(addr.sun_path, unix_path_.c_str());
+            listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listen_fd_ < 0) throw systemError("socket");
+            // 删除上次运行遗留的套接字文件
+            ::unlink(unix_path_.c_str());
+            if (::bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0)
+                throw systemError("bind " + unix_path_);
+            address_ = "unix:" + unix_path_;
+        } else {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons((uint16_t)options.tcp_port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listen_fd_ < 0) throw systemError("socket");
+            int on = 1;
+            ::setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (::bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0)
+                throw systemError("bind 127.0.0.1:" + std::to_string(options.tcp_port));
+            socklen_t len = sizeof(addr);
+            ::getsockname(listen_fd_, (sockaddr *)&addr, &len);
+            address_ = "tcp:127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+        }
+        if (::listen(listen_fd_, SOMAXCONN) < 0) throw systemError("listen");
+
+        epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ < 0) throw systemError("epoll_create1");
+        event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (event_fd_ < 0) throw systemError("eventfd");
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = kListenId;
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+        ev.data.u64 = kEventId;
+        ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev);
+        spare_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    } catch (...) {
+        if (listen_fd_ >= 0) ::close(listen_fd_);
+        if (epoll_fd_ >= 0) ::close(epoll_fd_);
+        if (event_fd_ >= 0) ::close(event_fd_);
+        throw;
+    }
+
+    size_t workers = options.workers;
+    if (workers == 0) workers = std::thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+    for (size_t i = 0; i < workers; i++)
+        workers_.emplace_back(&Server::work, this);
+}
+
+Server::~Server() {
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex_);
+        shutdown_ = true;
+    }
+    tasks_cv_.notify_all();
+    for (auto &worker : workers_) worker.join();
+    for (auto &item : connections_) ::close(item.second->fd);
+    ::close(listen_fd_);
+    ::close(epoll_fd_);
+    ::close(event_fd_);
+    if (spare_fd_ >= 0) ::close(spare_fd_);
+    if (!unix_path_.empty()) ::unlink(unix_path_.c_str());
+}
+
+void Server::stop() {
+    stopping_ = true;
+    uint64_t one = 1;
+    // 只用到异步信号安全的调用
+    ssize_t n = ::write(event_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+void Server::run() {
+    epoll_event events[64];
+    while (!stopping_) {
+        int n = ::epoll_wait(epoll_fd_, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throw systemError("epoll_wait");
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t id = events[i].data.u64;
+            if (id == kListenId) {
+                accept();
+                continue;
+            }
+            if (id == kEventId) {
+                uint64_t count;
+                while (::read(event_fd_, &count, sizeof(count)) > 0)
+                    ;
+                std::vector<uint64_t> completed;
+                {
+                    std::lock_guard<std::mutex> lock(completed_mutex_);
+                    completed.swap(completed_);
+                }
+                for (uint64_t cid : completed) {
+                    auto it = connections_.find(cid);
+                    // 计算期间连接可能已经关闭
+                    if (it != connections_.end()) flush(it->second);
+                }
+                continue;
+            }
+            // 同一批事件中前面的事件可能已经关闭了连接
+            auto it = connections_.find(id);
+            if (it == connections_.end()) continue;
+            auto conn = it->second;
+            if (events[i].events & EPOLLERR) {
+                close(conn);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))
+                receive(conn);
+            if ((events[i].events & EPOLLOUT) && connections_.count(id))
+                flush(conn);
+        }
+    }
+}
+
+void Server::accept() {
+    for (;;) {
+        int fd = ::accept4(listen_fd_, nullptr, nullptr,
+                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            // 文件描述符用完: 监听套接字是水平触发的，不取走等待的连接会一直
+            // 收到可读事件。用预留的描述符接受这个连接后立即关闭
+            if ((errno == EMFILE || errno == ENFILE) && spare_fd_ >= 0) {
+                ::close(spare_fd_);
+                fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd >= 0) ::close(fd);
+                spare_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+                // 没有等待的连接时 accept 同样报告描述符用完
+                if (fd >= 0) continue;
+            }
+            // EAGAIN: 没有等待的连接; 其他错误下次再试
+            return;
+        }
+        // 流水线的请求和结果都很短，不等待合并
+        int on = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        auto conn = std::make_shared<Connection>(next_id_++, fd, *this);
+        epoll_event ev{};
+        ev.events = kReadEvents;
+        ev.data.u64 = conn->id;
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            ::close(fd);
+            continue;
+        }
+        connections_[conn->id] = conn;
+        accepted_++;
+        active_++;
+    }
+}
+
+void Server::receive(const std::shared_ptr<Connection> &conn) {
+    // 只读取一个缓冲区，剩余的数据在下一次可读事件(水平触发)中读取，
+    // 中间可以检查积压的请求
+    char buffer[65536];
+    for (;;) {
+        ssize_t n = ::read(conn->fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            conn->input.append(buffer, n);
+            break;
+        }
+        if (n == 0) {
+            conn->peer_closed = true;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        close(conn);
+        return;
+    }
+
+    // 按行切分，对端关闭时最后没有换行的部分也作为一个请求
+    std::vector<Connection::Request> batch;
+    auto now = Clock::now();
+    size_t start = 0, end;
+    while ((end = conn->input.find('\n', start)) != std::string::npos) {
+        size_t length = end - start;
+        if (length > 0 && conn->input[end - 1] == '\r') length--;
+        if (length > 0) batch.push_back({conn->input.substr(start, length), now});
+        start = end + 1;
+    }
+    conn->input.erase(0, start);
+    if (conn->peer_closed && !conn->input.empty()) {
+        batch.push_back({std::move(conn->input), now});
+        conn->input.clear();
+    }
+    if (conn->input.size() > kMaxLineLength) {
+        close(conn);
+        return;
+    }
+
+    if (!batch.empty()) {
+        bool schedule_now = false;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            if (!conn->quit) {
+                for (auto &request : batch)
+                    conn->pending.push_back(std::move(request));
+                schedule_now = !conn->scheduled;
+                conn->scheduled = true;
+            }
+        }
+        if (schedule_now) schedule(conn);
+    }
+    // 对端关闭写端后还需要发送剩余的结果；积压过多时暂停读取
+    flush(conn);
+}
+
+void Server::flush(const std::shared_ptr<Connection> &conn) {
+    bool sent_all, finished;
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        size_t sent = 0;
+        while (sent < conn->output.size()) {
+            ssize_t n = ::send(conn->fd, conn->output.data() + sent,
+                               conn->output.size() - sent, MSG_NOSIGNAL);
+            if (n >= 0) {
+                sent += n;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else {
+                // 对端已经关闭，剩余的结果无法发送
+                conn->output.clear();
+                conn->quit = true;
+                sent = 0;
+                break;
+            }
+        }
+        conn->output.erase(0, sent);
+        sent_all = conn->output.empty();
+        finished = !conn->scheduled && conn->pending.empty() &&
+                   (conn->quit || conn->peer_closed);
+        if (conn->output.size() > kOutputHighWater ||
+            conn->pending.size() >= kMaxPending)
+            conn->paused = true;
+        else if (conn->output.size() <= kOutputLowWater &&
+                 conn->pending.size() <= kMaxPending / 2)
+            conn->paused = false;
+    }
+    if (sent_all && finished) {
+        close(conn);
+        return;
+    }
+    // 有没发送完的结果时等待可写事件，对端关闭写端或暂停读取时不关注可读事件
+    uint32_t events = (conn->peer_closed || conn->paused ? 0 : kReadEvents) |
+                      (sent_all ? 0 : (uint32_t)EPOLLOUT);
+    // 不关注任何事件时从 epoll 中移除: 对端关闭后 EPOLLHUP 总会报告，
+    // 只清空事件掩码时事件循环会在计算完成前一直被唤醒
+    if (events == conn->events) return;
+    int op = conn->events == 0 ? EPOLL_CTL_ADD
+             : events == 0     ? EPOLL_CTL_DEL
+                               : EPOLL_CTL_MOD;
+    conn->events = events;
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = conn->id;
+    ::epoll_ctl(epoll_fd_, op, conn->fd, &ev);
+}
+
+void Server::close(std::shared_ptr<Connection> conn) {
+    if (conn->events) ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, nullptr);
+    ::close(conn->fd);
+    connections_.erase(conn->id);
+    active_--;
+}
+
+void Server::schedule(const std::shared_ptr<Connection> &conn) {
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex_);
+        tasks_.push_back(conn);
+    }
+    tasks_cv_.notify_one();
+}
+
+void Server::work() {
+    for (;;) {
+        std::shared_ptr<Connection> conn;
+        {
+            std::unique_lock<std::mutex> lock(tasks_mutex_);
+            tasks_cv_.wait(lock, [this] { return shutdown_ || !tasks_.empty(); });
+            if (shutdown_) return;
+            conn = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        process(*conn);
+        complete(conn->id);
+    }
+}
+
+void Server::process(Connection &conn) {
+    std::vector<Connection::Request> batch;
+    std::string output;
+    bool quit = false;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(conn.mutex);
+            conn.output += output;
+            if (quit) conn.quit = true;
+            // 计算期间又收到的请求继续由当前线程计算，保证顺序
+            if (conn.quit || conn.pending.empty()) {
+                conn.pending.clear();
+                conn.scheduled = false;
+                return;
+            }
+            batch.swap(conn.pending);
+        }
+        output.clear();
+        for (auto &request : batch) {
+            if (request.line == ":quit") {
+                quit = true;
+                break;
+            }
+            output += execute(conn, request.line);
+            output += '\n';
+            requests_++;
+            auto elapsed = Clock::now() - request.received;
+            latency_.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                    .count());
+        }
+        batch.clear();
+    }
+}
+
+std::string Server::execute(Connection &conn, const std::string &line) {
+    if (line == ":stats") return stats();
+    if (line == ":reset") {
+        conn.reset();
+        return "ok";
+    }
+    try {
+        // 值为数组时在一行中输出全部元素 => [1.0000000000, 2.0000000000]
+        std::vector<double> value = conn.session->calcArray(line);
+        std::string result = "=> ";
+        char buffer[64];
+        for (size_t i = 0; i < value.size(); i++) {
+            std::snprintf(buffer, sizeof(buffer), "%.10f", value[i]);
+            if (value.size() > 1) result += i ? ", " : "[";
+            result += buffer;
+        }
+        if (value.size() > 1) result += "]";
+        return result;
+    } catch (SyntaxError &e) {
+        errors_++;
+        return e.what();
+    } catch (std::exception &e) {
+        errors_++;
+        return std::string("Error: ") + e.what();
+    }
+}
+
+void Server::complete(uint64_t id) {
+    {
+        std::lock_guard<std::mutex> lock(completed_mutex_);
+        completed_.push_back(id);
+    }
+    uint64_t one = 1;
+    ssize_t n = ::write(event_fd_, &one, sizeof(one));
+    (void)n;
+}
+
+std::string Server::stats() const {
+    auto us = [this](double p) { return latency_.percentile(p) / 1000.0; };
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer),
+                  "requests=%llu errors=%llu connections=%zu accepted=%llu "
+                  "p50_us=%.1f p90_us=%.1f p99_us=%.1f max_us=%.1f",
+                  (unsigned long long)requests_.load(),
+                  (unsigned long long)errors_.load(), active_.load(),
+                  (unsigned long long)accepted_.load(), us(0.5), us(0.9),
+                  us(0.99), latency_.max() / 1000.0);
+    return buffer;
+}
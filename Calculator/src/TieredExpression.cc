@@ -0,0 +1,384 @@
+#include "../include/TieredExpression.h"
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <unordered_set>
+
+#include "../include/ExpressionTree.h"
+using namespace calculator;
+
+static constexpr uint64_t kNever = std::numeric_limits<uint64_t>::max();
+
+const char *calculator::tierName(Tier tier) {
+    switch (tier) {
+        case Tier::Baseline:
+            return "baseline";
+        case Tier::Optimized:
+            return "optimized";
+        default:
+            return "native";
+    }
+}
+
+struct TieredExpression::NativeCode {
+    void *handle = nullptr;
+    NativeFunction function = nullptr;
+    NativeBatch batch = nullptr;
+    ~NativeCode() {
+        if (handle) ::dlclose(handle);
+    }
+};
+
+TieredExpression::TieredExpression(ExpressionTree &et, const std::string &text,
+                                   const std::vector<std::string> &params,
+                                   const TieringOptions &options)
+    : text_(text),
+      parameters_(params),
+      options_(options),
+      registry_(et.registry()),
+      environment_(et.snapshot()) {
+    // 不折叠时 ~ 等要求常量操作数的运算编译不了，这时直接编译 Optimized 层
+    et.fold_ = false;
+    try {
+        baseline_ = std::make_unique<CompiledExpression>(et.compile(text, params));
+    } catch (SyntaxError &) {
+    }
+    et.fold_ = true;
+    if (baseline_) {
+        program_.store(baseline_.get());
+        threshold_.store(options_.optimize_after);
+        return;
+    }
+    precise_ = et.mathMode() == MathMode::Precise;
+    optimized_ = std::make_unique<CompiledExpression>(et.compile(text, params));
+    program_.store(optimized_.get());
+    tier_.store(Tier::Optimized);
+    threshold_.store(options_.native_after ? options_.native_after : kNever);
+}
+
+TieredExpression::~TieredExpression() {
+    if (worker_.joinable()) worker_.join();
+}
+
+double TieredExpression::evaluate(const double *args) const {
+    count(1);
+    if (NativeFunction f = native_function_.load(std::memory_order_acquire))
+        return f(args);
+    return program_.load(std::memory_order_acquire)->evaluate(args);
+}
+
+double TieredExpression::operator()(const std::vector<double> &args) const {
+    if (args.size() != arity())
+        throw SyntaxError("compiled expression needs " +
+                          std::to_string(arity()) + " arguments");
+    return evaluate(args.data());
+}
+
+void TieredExpression::evaluateBatch(const double *args,
+                                     const double *const *columns, double *out,
+                                     size_t n) const {
+    count(n);
+    if (NativeBatch f = native_batch_.load(std::memory_order_acquire))
+        return f(args, columns, out, n);
+    program_.load(std::memory_order_acquire)
+        ->evaluateBatch(args, columns, out, n);
+}
+
+void TieredExpression::promote() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (compiling_ || calls_.load(std::memory_order_relaxed) <
+                          threshold_.load(std::memory_order_relaxed))
+        return;
+    threshold_.store(kNever, std::memory_order_relaxed);
+    compiling_ = true;
+    // 上一次编译的线程已经结束(compiling_ 为 false)，只需要回收
+    if (worker_.joinable()) worker_.join();
+    // 计算是 const 的，升级只替换内部的各层，对调用者不可见
+    worker_ = std::thread([self = const_cast<TieredExpression *>(this),
+                           calls = calls_.load(std::memory_order_relaxed)] {
+        self->compileNext(calls);
+    });
+}
+
+void TieredExpression::compileNext(uint64_t calls) {
+    Tier from = tier();
+    auto begin = std::chrono::steady_clock::now();
+    std::string blocked;
+    uint64_t next = kNever;
+    if (from == Tier::Baseline) {
+        try {
+            ExpressionTree et(registry_);
+            et.restore(environment_);
+            precise_ = et.mathMode() == MathMode::Precise;
+            optimized_ =
+                std::make_unique<CompiledExpression>(et.compile(text_, parameters_));
+            program_.store(optimized_.get(), std::memory_order_release);
+            tier_.store(Tier::Optimized, std::memory_order_release);
+            if (options_.native_after) next = options_.native_after;
+        } catch (std::exception &e) {
+            blocked = e.what();
+        }
+    } else {
+        try {
+            if (!precise_) throw SyntaxError("math mode is not precise");
+            native_ = compileNative(*optimized_);
+            native_batch_.store(native_->batch, std::memory_order_release);
+            native_function_.store(native_->function, std::memory_order_release);
+            tier_.store(Tier::Native, std::memory_order_release);
+        } catch (std::exception &e) {
+            blocked = e.what();
+        }
+    }
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - begin)
+                    .count();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tier() != from) transitions_.push_back({from, tier(), calls, ms});
+    blocked_ = blocked;
+    compiling_ = false;
+    threshold_.store(next, std::memory_order_relaxed);
+}
+
+TierStats TieredExpression::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {tier(), calls_.load(std::memory_order_relaxed), transitions_,
+            compiling_, blocked_};
+}
+
+void TieredExpression::wait() {
+    std::thread worker;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        worker.swap(worker_);
+    }
+    if (worker.joinable()) worker.join();
+}
+
+// 内置函数中与 C 标准库同名、同样以 double 计算的一元函数
+static const std::unordered_set<std::string> kNativeUnary = {
+    "sqrt", "ceil", "cos",  "sin",  "tan",   "log", "floor", "acos",
+    "asin", "atan", "exp",  "log2", "log10", "erf", "round"};
+
+// 常数的 C 字面量，十六进制浮点数没有舍入误差
+static std::string literal(double value) {
+    if (std::isnan(value)) return "__builtin_nan(\"\")";
+    if (std::isinf(value))
+        return value > 0 ? "__builtin_inf()" : "(-__builtin_inf())";
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "%a", value);
+    return buffer;
+}
+
+int TieredExpression::generate(const CompiledExpression &program,
+                               std::string &source, int &functions,
+                               std::string &reason) {
+    if (!program.builtins_.empty()) {
+        reason = "builtin function " + program.builtins_[0].name +
+                 " can not be compiled to native code";
+        return -1;
+    }
+    // 自定义函数、插件和被替换的内置函数没有 float 版本
+    for (size_t i = 0; i < program.unary_names_.size(); i++) {
+        if (!kNativeUnary.count(program.unary_names_[i]) ||
+            !program.float_calls_.unary[i]) {
+            reason = "function " + program.unary_names_[i] +
+                     " can not be compiled to native code";
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < program.binary_names_.size(); i++) {
+        const std::string &name = program.binary_names_[i];
+        if ((name != "pow" && name != "max" && name != "min") ||
+            !program.float_calls_.binary[i]) {
+            reason = "function " + name + " can not be compiled to native code";
+            return -1;
+        }
+    }
+    // 分支生成为单独的函数，定义在使用之前
+    std::vector<std::pair<int, int>> branches;
+    for (auto &conditional : program.conditionals_) {
+        int then_branch =
+            generate(*conditional.then_branch, source, functions, reason);
+        if (then_branch < 0) return -1;
+        int else_branch =
+            generate(*conditional.else_branch, source, functions, reason);
+        if (else_branch < 0) return -1;
+        branches.push_back({then_branch, else_branch});
+    }
+
+    int id = functions++;
+    std::string body =
+        "static double e" + std::to_string(id) + "(const double *args) {\n";
+    if (program.code_.empty()) body += "    return 0;\n";
+    // 每条指令的结果是一个局部变量 v<下标>，操作数来自 operands_ 记录的指令
+    for (size_t i = 0; i < program.code_.size(); i++) {
+        const Instruction &ins = program.code_[i];
+        std::string a = "v" + std::to_string(program.operands_[i].first);
+        std::string b = "v" + std::to_string(program.operands_[i].second);
+        auto integer = [&](const char *op) {
+            return "(double)((long long)" + a + " " + op + " (long long)" + b +
+                   ")";
+        };
+        auto compare = [&](const char *op) {
+            return "(double)(" + a + " " + op + " " + b + ")";
+        };
+        std::string value;
+        switch (ins.op) {
+            case OpCode::Constant:
+                value = literal(ins.value);
+                break;
+            case OpCode::Argument:
+                value = "args[" + std::to_string(ins.index) + "]";
+                break;
+            case OpCode::Add:
+                value = a + " + " + b;
+                break;
+            case OpCode::Sub:
+                value = a + " - " + b;
+                break;
+            case OpCode::Mul:
+                value = a + " * " + b;
+                break;
+            case OpCode::Div:
+                value = a + " / " + b;
+                break;
+            case OpCode::Mod:
+                value = "fmod(" + a + ", " + b + ")";
+                break;
+            case OpCode::And:
+                value = integer("&");
+                break;
+            case OpCode::Or:
+                value = integer("|");
+                break;
+            case OpCode::Xor:
+                value = integer("^");
+                break;
+            case OpCode::Less:
+                value = compare("<");
+                break;
+            case OpCode::LessEqual:
+                value = compare("<=");
+                break;
+            case OpCode::Greater:
+                value = compare(">");
+                break;
+            case OpCode::GreaterEqual:
+                value = compare(">=");
+                break;
+            case OpCode::Equal:
+                value = compare("==");
+                break;
+            case OpCode::NotEqual:
+                value = compare("!=");
+                break;
+            case OpCode::Not:
+                value = "(double)!(long long)" + a;
+                break;
+            case OpCode::Negate:
+                value = "(double)~(long long)" + a;
+                break;
+            case OpCode::Minus:
+                value = "-" + a;
+                break;
+            case OpCode::Call1:
+                value = program.unary_names_[ins.index] + "(" + a + ")";
+                break;
+            case OpCode::Call2: {
+                const std::string &name = program.binary_names_[ins.index];
+                if (name == "pow")
+                    value = "pow(" + a + ", " + b + ")";
+                else
+                    value = "(" + a + (name == "max" ? " > " : " < ") + b +
+                            " ? " + a + " : " + b + ")";
+            } break;
+            case OpCode::Conditional: {
+                auto [then_branch, else_branch] = branches[ins.index];
+                value = "(" + a + " != 0 ? e" + std::to_string(then_branch) +
+                        "(args) : e" + std::to_string(else_branch) + "(args))";
+            } break;
+            default:
+                // 移位的操作数为负数时抛出异常，C 代码中不能抛出
+                reason = "shift operators can not be compiled to native code";
+                return -1;
+        }
+        body += "    const double v" + std::to_string(i) + " = " + value + ";\n";
+    }
+    if (!program.code_.empty())
+        body += "    return v" + std::to_string(program.code_.size() - 1) + ";\n";
+    source += body + "}\n\n";
+    return id;
+}
+
+std::unique_ptr<TieredExpression::NativeCode> TieredExpression::compileNative(
+    const CompiledExpression &program) {
+    std::string source = "#include <math.h>\n#include <stddef.h>\n\n";
+    int functions = 0;
+    std::string reason;
+    int root = generate(program, source, functions, reason);
+    if (root < 0) throw SyntaxError(reason);
+    std::string e = "e" + std::to_string(root);
+    std::string arity = std::to_string(std::max<size_t>(program.arity(), 1));
+    source += "double calculator_native_evaluate(const double *args) {\n"
+              "    return " + e + "(args);\n}\n\n"
+              "void calculator_native_batch(const double *args,\n"
+              "                             const double *const *columns,\n"
+              "                             double *out, size_t n) {\n"
+              "    double values[" + arity + "];\n"
+              "    for (size_t k = 0; k < " + std::to_string(program.arity()) +
+              "; k++) values[k] = args ? args[k] : 0;\n"
+              "    for (size_t i = 0; i < n; i++) {\n"
+              "        for (size_t k = 0; k < " + std::to_string(program.arity()) +
+              "; k++)\n"
+              "            if (columns && columns[k]) values[k] = columns[k][i];\n"
+              "        out[i] = " + e + "(values);\n"
+              "    }\n}\n";
+
+    const char *dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") +
+                       "/calculator-native-XXXXXX.c";
+    int fd = ::mkstemps(&path[0], 2);
+    if (fd < 0) throw SyntaxError("can not create " + path);
+    bool written =
+        ::write(fd, source.data(), source.size()) == (ssize_t)source.size();
+    ::close(fd);
+    std::string library = path.substr(0, path.size() - 2) + ".so";
+    // 不允许浮点收缩(FMA)，结果与编译表达式逐位相同
+    std::string command = options_.compiler +
+                          " -O2 -fPIC -shared -ffp-contract=off -o '" +
+                          library + "' '" + path + "' -lm 2>&1";
+    std::string output;
+    int status = -1;
+    if (written) {
+        if (FILE *pipe = ::popen(command.c_str(), "r")) {
+            char buffer[256];
+            while (std::fgets(buffer, sizeof(buffer), pipe)) output += buffer;
+            status = ::pclose(pipe);
+        }
+    }
+    ::unlink(path.c_str());
+    auto native = std::make_unique<NativeCode>();
+    if (status == 0)
+        native->handle = ::dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+    // 加载后映射一直有效，动态库可以立即删除
+    ::unlink(library.c_str());
+    if (status != 0) {
+        output = output.substr(0, output.find('\n'));
+        throw SyntaxError("native compiler failed: " +
+                          (output.empty() ? command : output));
+    }
+    if (!native->handle) throw SyntaxError(::dlerror());
+    native->function =
+        (NativeFunction)::dlsym(native->handle, "calculator_native_evaluate");
+    native->batch = (NativeBatch)::dlsym(native->handle, "calculator_native_batch");
+    if (!native->function || !native->batch)
+        throw SyntaxError("native code has no entry point");
+    return native;
+}
@@ -0,0 +1,412 @@
+#include "../include/Workspace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "../include/ExpressionTree.h"
+using namespace calculator;
+
+// 常数按位比较，0 和 -0 不合并
+static std::string bits(double value) {
+    uint64_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    return std::to_string(x);
+}
+
+Workspace::Workspace(ExpressionTree &tree, const std::vector<std::string> &inputs)
+    : inputs_(inputs), tree_(tree) {}
+
+size_t Workspace::add(const std::string &name, const std::string &text) {
+    auto program =
+        std::make_unique<CompiledExpression>(tree_.compile(text, inputs_));
+    const int formula = (int)names_.size();
+    auto attributes = Registry::ReadGuard(*tree_.registry());
+    auto pure = [&](const std::string &function) {
+        auto it = attributes->function_attributes.find(function);
+        return it != attributes->function_attributes.end() && it->second.pure;
+    };
+
+    // 按后缀指令的顺序把每条指令换成图中的节点
+    std::vector<int> ids(program->code_.size());
+    for (size_t i = 0; i < program->code_.size(); i++) {
+        const Instruction &ins = program->code_[i];
+        Node x;
+        x.op = ins.op;
+        x.index = ins.index;
+        x.value = ins.value;
+        x.program = program.get();
+        auto [a, b] = program->operands_[i];
+        x.a = a >= 0 ? ids[a] : -1;
+        x.b = b >= 0 ? ids[b] : -1;
+
+        std::string key = std::to_string((int)ins.op) + ":";
+        bool shared = true;
+        switch (ins.op) {
+            case OpCode::Constant:
+                key += bits(ins.value);
+                break;
+            case OpCode::Argument:
+                key += std::to_string(ins.index);
+                break;
+            case OpCode::Call1:
+                key += program->unary_names_[ins.index];
+                shared = pure(program->unary_names_[ins.index]);
+                break;
+            case OpCode::Call2:
+                key += program->binary_names_[ins.index];
+                shared = pure(program->binary_names_[ins.index]);
+                break;
+            case OpCode::Builtin: {
+                auto &body = *program->builtins_[ins.index].body;
+                key += program->builtins_[ins.index].name;
+                signature(body, key);
+                shared = body.concurrent() && !body.random();
+            } break;
+            case OpCode::Conditional: {
+                auto &conditional = program->conditionals_[ins.index];
+                signature(*conditional.then_branch, key);
+                key += "|";
+                signature(*conditional.else_branch, key);
+                shared = conditional.then_branch->concurrent() &&
+                         conditional.else_branch->concurrent() &&
+                         !conditional.then_branch->random() &&
+                         !conditional.else_branch->random();
+            } break;
+            case OpCode::Add:
+            case OpCode::Mul:
+            case OpCode::Equal:
+            case OpCode::NotEqual:
+            case OpCode::And:
+            case OpCode::Or:
+            case OpCode::Xor:
+                // 交换律: 操作数按节点的顺序排列
+                if (x.a > x.b) std::swap(x.a, x.b);
+                break;
+            default:
+                break;
+        }
+        key += "(" + std::to_string(x.a) + "," + std::to_string(x.b) + ")";
+
+        int id = -1;
+        if (shared) {
+            auto it = index_.find(key);
+            if (it != index_.end()) id = it->second;
+        }
+        if (id < 0) {
+            id = (int)nodes_.size();
+            nodes_.push_back(x);
+            if (shared) index_.emplace(std::move(key), id);
+        }
+        if (nodes_[id].last_formula != formula) {
+            nodes_[id].last_formula = formula;
+            nodes_[id].formulas++;
+        }
+        ids[i] = id;
+    }
+    names_.push_back(name);
+    outputs_.push_back(ids.back());
+    instructions_ += program->code_.size();
+    if (!program->concurrent()) concurrent_ = false;
+    programs_.push_back(std::move(program));
+    prepared_.store(false, std::memory_order_release);
+    return names_.size() - 1;
+}
+
+bool Workspace::usesInput(size_t k) const {
+    for (auto &program : programs_)
+        if (program->usesParameter(k)) return true;
+    return false;
+}
+
+void Workspace::prepare() const {
+    if (prepared_.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (prepared_.load(std::memory_order_relaxed)) return;
+    const std::vector<Node> &nodes = nodes_;
+    // 每个节点最后一次被用到的位置，公式的结果在计算出来时写出
+    std::vector<int> last(nodes.size());
+    for (int i = 0; i < (int)nodes.size(); i++) {
+        last[i] = i;
+        if (nodes[i].a >= 0) last[nodes[i].a] = i;
+        if (nodes[i].b >= 0) last[nodes[i].b] = i;
+    }
+    writes_.clear();
+    for (int j = 0; j < (int)outputs_.size(); j++)
+        writes_.push_back({outputs_[j], j});
+    std::sort(writes_.begin(), writes_.end());
+
+    // 按顺序分配存储位置，值不再被用到时回收(结果可以与操作数使用同一个位置)
+    std::vector<int> free;
+    slot_.assign(nodes.size(), -1);
+    slots_ = 0;
+    for (int i = 0; i < (int)nodes.size(); i++) {
+        const Node &x = nodes[i];
+        if (x.a >= 0 && last[x.a] == i) free.push_back(slot_[x.a]);
+        if (x.b >= 0 && x.b != x.a && last[x.b] == i) free.push_back(slot_[x.b]);
+        if (free.empty()) {
+            slot_[i] = (int)slots_++;
+        } else {
+            slot_[i] = free.back();
+            free.pop_back();
+        }
+        if (last[i] == i) free.push_back(slot_[i]);
+    }
+    prepared_.store(true, std::memory_order_release);
+}
+
+void Workspace::evaluate(const double *args, double *out) const {
+    prepare();
+    thread_local std::vector<double> values;
+    values.resize(slots_);
+    auto write = writes_.begin();
+    for (int i = 0; i < (int)nodes_.size(); i++) {
+        const Node &x = nodes_[i];
+        double a = x.a >= 0 ? values[slot_[x.a]] : 0;
+        double b = x.b >= 0 ? values[slot_[x.b]] : 0;
+        double r;
+        switch (x.op) {
+            case OpCode::Constant:
+                r = x.value;
+                break;
+            case OpCode::Argument:
+                r = args[x.index];
+                break;
+            case OpCode::Builtin: {
+                double operands[2] = {a, b};
+                r = x.program->callBuiltin(x.program->builtins_[x.index], args,
+                                           operands);
+            } break;
+            case OpCode::Conditional: {
+                auto &conditional = x.program->conditionals_[x.index];
+                r = (a != 0 ? conditional.then_branch
+                            : conditional.else_branch)
+                        ->evaluate(args);
+            } break;
+            default:
+                r = apply(x, a, b);
+                break;
+        }
+        values[slot_[i]] = r;
+        for (; write != writes_.end() && write->first == i; ++write)
+            out[write->second] = r;
+    }
+}
+
+std::vector<double> Workspace::evaluate(const std::vector<double> &args) const {
+    if (args.size() != inputs_.size())
+        throw SyntaxError("workspace needs " + std::to_string(inputs_.size()) +
+                          " arguments");
+    std::vector<double> out(names_.size());
+    evaluate(args.data(), out.data());
+    return out;
+}
+
+void Workspace::evaluateBatch(const double *args, const double *const *columns,
+                              double *const *out, size_t n) const {
+    prepare();
+    constexpr size_t lanes = CompiledExpression::kBatchLanes;
+    for (size_t offset = 0; offset < n; offset += lanes)
+        evaluateLanes(args, columns, offset, out, std::min(lanes, n - offset));
+}
+
+// 每个存储位置是一列 kBatchLanes 个值，每个节点处理一整列
+void Workspace::evaluateLanes(const double *args, const double *const *columns,
+                              size_t offset, double *const *out,
+                              size_t n) const {
+    constexpr size_t lanes = CompiledExpression::kBatchLanes;
+    thread_local std::vector<double> buffer;
+    // 最后三列用作批量函数的输出和条件表达式的两个分支
+    buffer.resize((slots_ + 3) * lanes);
+    auto lane = [&](int k) { return buffer.data() + k * lanes; };
+    double *temp = lane((int)slots_);
+    const size_t arity = inputs_.size();
+    std::vector<double> values;
+    // 参数的第i个点
+    auto point = [&](size_t i) {
+        values.assign(arity, 0.0);
+        for (size_t k = 0; k < arity; k++)
+            values[k] = columns && columns[k] ? columns[k][offset + i] : args[k];
+    };
+
+    auto write = writes_.begin();
+    for (int j = 0; j < (int)nodes_.size(); j++) {
+        const Node &node = nodes_[j];
+        double *x = lane(slot_[j]);
+        const double *a = node.a >= 0 ? lane(slot_[node.a]) : nullptr;
+        const double *b = node.b >= 0 ? lane(slot_[node.b]) : nullptr;
+        switch (node.op) {
+            case OpCode::Constant:
+                std::fill(x, x + n, node.value);
+                break;
+            case OpCode::Argument:
+                if (columns && columns[node.index]) {
+                    const double *column = columns[node.index] + offset;
+                    std::copy(column, column + n, x);
+                } else {
+                    std::fill(x, x + n, args[node.index]);
+                }
+                break;
+            case OpCode::Add:
+                for (size_t i = 0; i < n; i++) x[i] = a[i] + b[i];
+                break;
+            case OpCode::Sub:
+                for (size_t i = 0; i < n; i++) x[i] = a[i] - b[i];
+                break;
+            case OpCode::Mul:
+                for (size_t i = 0; i < n; i++) x[i] = a[i] * b[i];
+                break;
+            case OpCode::Div:
+                for (size_t i = 0; i < n; i++) x[i] = a[i] / b[i];
+                break;
+            case OpCode::Minus:
+                for (size_t i = 0; i < n; i++) x[i] = -a[i];
+                break;
+            case OpCode::Call1:
+                if (auto batch = node.program->unary_batch_[node.index]) {
+                    batch(a, temp, n);
+                    std::copy(temp, temp + n, x);
+                } else {
+                    auto &f = node.program->unary_[node.index];
+                    for (size_t i = 0; i < n; i++) x[i] = f(a[i]);
+                }
+                break;
+            case OpCode::Conditional: {
+                auto &conditional = node.program->conditionals_[node.index];
+                if (conditional.per_lane) {
+                    // 分支代价大或者有副作用，逐个点只计算选中的分支
+                    for (size_t i = 0; i < n; i++) {
+                        point(i);
+                        x[i] = (a[i] != 0 ? conditional.then_branch
+                                          : conditional.else_branch)
+                                   ->evaluate(values.data());
+                    }
+                    break;
+                }
+                // 两个分支都批量计算，再按条件混合
+                double *t = lane((int)slots_ + 1), *e = lane((int)slots_ + 2);
+                std::vector<const double *> shifted(arity, nullptr);
+                for (size_t k = 0; k < arity; k++)
+                    if (columns && columns[k]) shifted[k] = columns[k] + offset;
+                conditional.then_branch->evaluateBatch(args, shifted.data(), t, n);
+                conditional.else_branch->evaluateBatch(args, shifted.data(), e, n);
+                for (size_t i = 0; i < n; i++) x[i] = a[i] != 0 ? t[i] : e[i];
+            } break;
+            case OpCode::Builtin: {
+                // 内置函数逐个点计算
+                auto &builtin = node.program->builtins_[node.index];
+                for (size_t i = 0; i < n; i++) {
+                    point(i);
+                    double operands[2] = {a[i], b ? b[i] : 0};
+                    x[i] = node.program->callBuiltin(builtin, values.data(),
+                                                     operands);
+                }
+            } break;
+            default:
+                for (size_t i = 0; i < n; i++)
+                    x[i] = apply(node, a[i], b ? b[i] : 0);
+                break;
+        }
+        for (; write != writes_.end() && write->first == j; ++write)
+            std::copy(x, x + n, out[write->second] + offset);
+    }
+}
+
+WorkspaceStats Workspace::stats() const {
+    prepare();
+    WorkspaceStats stats;
+    stats.formulas = names_.size();
+    stats.instructions = instructions_;
+    stats.nodes = nodes_.size();
+    for (const Node &x : nodes_)
+        if (x.formulas > 1) stats.shared_nodes++;
+    stats.slots = slots_;
+    return stats;
+}
+
+double Workspace::apply(const Node &x, double a, double b) {
+    switch (x.op) {
+        case OpCode::Add:
+            return a + b;
+        case OpCode::Sub:
+            return a - b;
+        case OpCode::Mul:
+            return a * b;
+        case OpCode::Div:
+            return a / b;
+        case OpCode::Mod:
+            return std::fmod(a, b);
+        case OpCode::And:
+            return (Integer)a & (Integer)b;
+        case OpCode::Or:
+            return (Integer)a | (Integer)b;
+        case OpCode::Xor:
+            return (Integer)a ^ (Integer)b;
+        case OpCode::ShiftLeft:
+            if (b < 0) throw ShiftNegativeException();
+            return (Integer)a << (Integer)b;
+        case OpCode::ShiftRight:
+            if (b < 0) throw ShiftNegativeException();
+            return (Integer)a >> (Integer)b;
+        case OpCode::Less:
+            return a < b;
+        case OpCode::LessEqual:
+            return a <= b;
+        case OpCode::Greater:
+            return a > b;
+        case OpCode::GreaterEqual:
+            return a >= b;
+        case OpCode::Equal:
+            return a == b;
+        case OpCode::NotEqual:
+            return a != b;
+        case OpCode::Not:
+            return (Integer) !((Integer)a);
+        case OpCode::Negate:
+            return ~((Integer)a);
+        case OpCode::Minus:
+            return -a;
+        case OpCode::Call1:
+            return x.program->unary_[x.index](a);
+        case OpCode::Call2:
+            return x.program->binary_[x.index](a, b);
+        default:
+            break;
+    }
+    return 0;
+}
+
+void Workspace::signature(const CompiledExpression &program,
+                          std::string &out) {
+    out += "{" + std::to_string(program.arity()) + ";";
+    for (const Instruction &ins : program.code_) {
+        out += std::to_string((int)ins.op);
+        switch (ins.op) {
+            case OpCode::Constant:
+                out += "=" + bits(ins.value);
+                break;
+            case OpCode::Argument:
+                out += "#" + std::to_string(ins.index);
+                break;
+            case OpCode::Call1:
+                out += "@" + program.unary_names_[ins.index];
+                break;
+            case OpCode::Call2:
+                out += "@" + program.binary_names_[ins.index];
+                break;
+            case OpCode::Builtin:
+                out += "@" + program.builtins_[ins.index].name;
+                signature(*program.builtins_[ins.index].body, out);
+                break;
+            case OpCode::Conditional:
+                signature(*program.conditionals_[ins.index].then_branch, out);
+                signature(*program.conditionals_[ins.index].else_branch, out);
+                break;
+            default:
+                break;
+        }
+        out += " ";
+    }
+    out += "}";
+}
@@ -0,0 +1,29 @@
+#include <cstddef>
+
+#include "Calculator/include/Plugin.h"
+
+/*
+ * 示例插件(见 Plugin.h)，calculator --test 加载它测试插件的接口:
+ *   square  批量版本、标量版本和导数，纯函数
+ *   twice   只有批量版本，标量计算时用批量版本计算一个值
+ * 定义 CALCULATOR_EXAMPLE_PLUGIN_BROKEN 时不导出函数表，用于测试缺少符号的错误
+ */
+#ifdef CALCULATOR_EXAMPLE_PLUGIN_BROKEN
+extern "C" int calculator_plugin_abi() { return CALCULATOR_PLUGIN_ABI; }
+#else
+static void square(const double *in, double *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = in[i] * in[i];
+}
+static double squareScalar(double x) { return x * x; }
+static double squareDerivative(double x) { return 2 * x; }
+
+static void twice(const double *in, double *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = 2 * in[i];
+}
+
+static const CalculatorPluginFunction functions[] = {
+    {"square", square, squareScalar, squareDerivative, 1},
+    {"twice", twice, nullptr, nullptr, 0},
+};
+CALCULATOR_DECLARE_PLUGIN(functions)
+#endif
@@ -0,0 +1,328 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Calculator/include/ExpressionTree.h"
+#include "Calculator/include/Histogram.h"
+#include "Calculator/include/Test.h"
+using namespace calculator;
+using namespace std;
+
+/*
+ * calculator_loadgen: 重放表达式日志或者随机生成的表达式，测量计算的吞吐量和延迟
+ *   [--log path | --synthetic n [--seed s]]      语料，默认为 Test.h 中的表达式
+ *   [--unix path | --tcp port]                   发送到 calculator --serve，默认在进程内计算
+ *   [--threads n] [--rate r]                     线程数；每秒 r 个请求(所有线程合计)，
+ *                                                不指定时每个线程收到结果后立即发送下一个
+ *   [--duration s | --requests n]                运行的秒数(默认 5)或请求总数
+ * 结果以 JSON 输出到标准输出。固定速率时延迟从计划发送的时间算起，
+ * 服务端变慢时排队的时间也计入延迟。
+ * 语料按顺序分给各个线程，每个线程是一个会话，赋值语句定义的变量在会话中保留；
+ * 进程内的会话定义了 Test.h 中用到的 var、func 和 h
+ */
+
+struct LoadOptions {
+    string log;
+    size_t synthetic = 0;
+    uint64_t seed = 1;
+    string unix_path;
+    int tcp_port = 0;
+    size_t threads = 1;
+    double rate = 0;
+    double duration = 5;
+    uint64_t requests = 0;
+};
+
+// 一个线程的会话，request 返回请求是否成功
+class Client {
+   public:
+    virtual ~Client() = default;
+    virtual bool request(const string &text) = 0;
+};
+
+class LocalClient : public Client {
+   public:
+    LocalClient() { setupTestSession(et_); }
+    bool request(const string &text) override {
+        try {
+            et_.calcArray(text);
+            return true;
+        } catch (exception &) {
+            return false;
+        }
+    }
+
+   private:
+    ExpressionTree et_;
+};
+
+// 按行的协议，见 Server.h
+class RemoteClient : public Client {
+   public:
+    explicit RemoteClient(const LoadOptions &options) {
+        if (!options.unix_path.empty()) {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, options.unix_path.c_str(),
+                    sizeof(addr.sun_path) - 1);
+            fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd_ < 0 || ::connect(fd_, (sockaddr *)&addr, sizeof(addr)) < 0)
+                throw runtime_error("can not connect to unix:" +
+                                    options.unix_path);
+        } else {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(options.tcp_port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (fd_ < 0 || ::connect(fd_, (sockaddr *)&addr, sizeof(addr)) < 0)
+                throw runtime_error("can not connect to tcp:127.0.0.1:" +
+                                    to_string(options.tcp_port));
+        }
+    }
+    ~RemoteClient() override {
+        if (fd_ >= 0) ::close(fd_);
+    }
+
+    bool request(const string &text) override {
+        string line = text + "\n";
+        for (size_t sent = 0; sent < line.size();) {
+            ssize_t n = ::write(fd_, line.data() + sent, line.size() - sent);
+            if (n <= 0) throw runtime_error("connection closed");
+            sent += n;
+        }
+        size_t end;
+        while ((end = buffer_.find('\n')) == string::npos) {
+            char chunk[4096];
+            ssize_t n = ::read(fd_, chunk, sizeof(chunk));
+            if (n <= 0) throw runtime_error("connection closed");
+            buffer_.append(chunk, n);
+        }
+        bool ok = buffer_.compare(0, 5, "Error") != 0;
+        buffer_.erase(0, end + 1);
+        return ok;
+    }
+
+   private:
+    int fd_ = -1;
+    string buffer_;
+};
+
+// 每行一个表达式，忽略空行和 # 开头的行
+static vector<string> readLog(const string &path) {
+    ifstream in(path);
+    if (!in) throw runtime_error("can not open " + path);
+    vector<string> corpus;
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        corpus.push_back(line);
+    }
+    return corpus;
+}
+
+static string randomNumber(mt19937_64 &rng) {
+    string number = to_string(rng() % 999 + 1);
+    if (rng() % 2) number += "." + to_string(rng() % 1000);
+    return number;
+}
+
+// 深度不超过 depth 的随机表达式，可以使用 v1~v<variables>
+static string randomTerm(mt19937_64 &rng, int depth, int variables) {
+    static const char *unary[] = {"sin", "cos", "exp", "log", "sqrt", "atan"};
+    static const char *binary[] = {"pow", "max", "min"};
+    static const char ops[] = "+-*/";
+    if (depth == 0 || rng() % 4 == 0) {
+        if (variables > 0 && rng() % 2)
+            return "v" + to_string(rng() % variables + 1);
+        return randomNumber(rng);
+    }
+    switch (rng() % 3) {
+        case 0:
+            return string(unary[rng() % 6]) + "(" +
+                   randomTerm(rng, depth - 1, variables) + ")";
+        case 1:
+            return string(binary[rng() % 3]) + "(" +
+                   randomTerm(rng, depth - 1, variables) + "," +
+                   randomTerm(rng, depth - 1, variables) + ")";
+        default:
+            return "(" + randomTerm(rng, depth - 1, variables) + ops[rng() % 4] +
+                   randomTerm(rng, depth - 1, variables) + ")";
+    }
+}
+
+// 字面量、变量、嵌套函数和赋值语句的混合: 0~3 条赋值语句后接一个表达式
+static vector<string> synthesize(size_t n, uint64_t seed) {
+    mt19937_64 rng(seed);
+    vector<string> corpus;
+    for (size_t i = 0; i < n; i++) {
+        int variables = rng() % 4;
+        string text;
+        for (int k = 1; k <= variables; k++)
+            text += "v" + to_string(k) + "=" + randomTerm(rng, 2, k - 1) + ";";
+        corpus.push_back(text + randomTerm(rng, rng() % 5 + 1, variables));
+    }
+    return corpus;
+}
+
+// 测试中不带参数的表达式
+static vector<string> testCorpus() {
+    vector<string> corpus;
+    for (const TestCase &c : testCases())
+        if (c.params.empty()) corpus.push_back(c.expression);
+    return corpus;
+}
+
+static string quote(const string &s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static int run(const LoadOptions &options) {
+    vector<string> corpus;
+    string source = "test";
+    if (!options.log.empty()) {
+        corpus = readLog(options.log);
+        source = "log:" + options.log;
+    } else if (options.synthetic) {
+        corpus = synthesize(options.synthetic, options.seed);
+        source = "synthetic";
+    } else {
+        corpus = testCorpus();
+    }
+    if (corpus.empty()) throw runtime_error("no expressions in " + source);
+
+    bool remote = !options.unix_path.empty() || options.tcp_port;
+    string target = !options.unix_path.empty() ? "unix:" + options.unix_path
+                    : remote ? "tcp:127.0.0.1:" + to_string(options.tcp_port)
+                             : "in-process";
+    size_t threads = options.threads ? options.threads : 1;
+    // 先建立所有连接，连接失败时不开始测试
+    vector<unique_ptr<Client>> clients;
+    for (size_t t = 0; t < threads; t++) {
+        if (remote)
+            clients.emplace_back(new RemoteClient(options));
+        else
+            clients.emplace_back(new LocalClient());
+    }
+
+    LatencyHistogram latency;
+    atomic<uint64_t> next{0}, errors{0};
+    atomic<bool> failed{false};
+    string failure;
+    using clock = chrono::steady_clock;
+    auto start = clock::now();
+    auto deadline = start + chrono::duration_cast<clock::duration>(
+                                chrono::duration<double>(options.duration));
+    // 固定速率时每个线程发送请求的间隔
+    auto interval = chrono::duration_cast<clock::duration>(
+        chrono::duration<double>(options.rate > 0 ? threads / options.rate : 0));
+
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            Client &client = *clients[t];
+            // 各线程的计划发送时间错开
+            auto scheduled = start + interval * t / threads;
+            while (!failed.load(memory_order_relaxed)) {
+                if (options.rate > 0) {
+                    this_thread::sleep_until(scheduled);
+                } else {
+                    scheduled = clock::now();
+                }
+                if (options.requests == 0 && scheduled >= deadline) break;
+                uint64_t k = next.fetch_add(1, memory_order_relaxed);
+                if (options.requests && k >= options.requests) break;
+                try {
+                    if (!client.request(corpus[k % corpus.size()])) errors++;
+                } catch (exception &e) {
+                    if (!failed.exchange(true)) failure = e.what();
+                    break;
+                }
+                latency.record(chrono::duration_cast<chrono::nanoseconds>(
+                                   clock::now() - scheduled)
+                                   .count());
+                scheduled += interval;
+            }
+        });
+    }
+    for (auto &worker : workers) worker.join();
+    double seconds = chrono::duration<double>(clock::now() - start).count();
+    if (failed) throw runtime_error(failure);
+
+    auto us = [&](double p) { return latency.percentile(p) / 1000.0; };
+    uint64_t count = latency.count();
+    printf("{\n");
+    printf("  \"target\": %s,\n", quote(target).c_str());
+    printf("  \"corpus\": %s,\n", quote(source).c_str());
+    printf("  \"expressions\": %zu,\n", corpus.size());
+    printf("  \"threads\": %zu,\n", threads);
+    printf("  \"mode\": \"%s\",\n", options.rate > 0 ? "fixed-rate" : "closed-loop");
+    printf("  \"rate\": %.1f,\n", options.rate);
+    printf("  \"requests\": %llu,\n", (unsigned long long)count);
+    printf("  \"errors\": %llu,\n", (unsigned long long)errors.load());
+    printf("  \"seconds\": %.3f,\n", seconds);
+    printf("  \"throughput\": %.1f,\n", seconds > 0 ? count / seconds : 0);
+    printf("  \"latency_us\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+           "\"p999\": %.3f, \"max\": %.3f}\n",
+           us(0.5), us(0.9), us(0.99), us(0.999), latency.max() / 1000.0);
+    printf("}\n");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    LoadOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--log") && i + 1 < argc) {
+            options.log = argv[++i];
+        } else if (!strcmp(argv[i], "--synthetic") && i + 1 < argc) {
+            options.synthetic = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--unix") && i + 1 < argc) {
+            options.unix_path = argv[++i];
+        } else if (!strcmp(argv[i], "--tcp") && i + 1 < argc) {
+            options.tcp_port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            options.threads = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+            options.rate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--duration") && i + 1 < argc) {
+            options.duration = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--requests") && i + 1 < argc) {
+            options.requests = strtoull(argv[++i], nullptr, 10);
+        } else {
+            cerr << "usage: " << argv[0]
+                 << " [--log path | --synthetic n [--seed s]]"
+                 << " [--unix path | --tcp port]\n"
+                 << "       [--threads n] [--rate requests_per_second]"
+                 << " [--duration seconds | --requests n]" << endl;
+            return 1;
+        }
+    }
+    try {
+        return run(options);
+    } catch (exception &e) {
+        cerr << "calculator_loadgen: " << e.what() << endl;
+        return 1;
+    }
+}
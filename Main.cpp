@@ -1,22 +1,212 @@
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 #include "Calculator/include/ExpressionTree.h"
+#include "Calculator/include/MonteCarlo.h"
+#include "Calculator/include/Pipeline.h"
+#include "Calculator/include/Random.h"
+#include "Calculator/include/Server.h"
 #include "Calculator/include/Test.h"
 using namespace calculator;
 using namespace std;
 
-int main() {
-    expression_test();
+static Server *running_server = nullptr;
+
+static void stopServer(int) {
+    if (running_server) running_server->stop();
+}
+
+// calculator --serve [--unix path | --tcp port] [--workers n]
+//                    [--session-memory bytes] [--plugin path]...
+// 资源限制 --max-tokens/--max-nodes/--max-depth/--max-steps/--max-iterations/
+// --time-limit 对交互模式和服务模式的每个表达式生效。
+// --seed 设置交互模式的随机数种子，没有设置时 rand() 每次运行不同，:sample 的种子为0
+static int serve(const ServerOptions &options) {
+    try {
+        Server server(options);
+        running_server = &server;
+        signal(SIGINT, stopServer);
+        signal(SIGTERM, stopServer);
+        cout << "listening on " << server.address() << endl;
+        server.run();
+        running_server = nullptr;
+    } catch (exception &e) {
+        cerr << "calculator: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// calculator --csv path [--formula name=expr]... [--output path] [--workers n]
+//                        [--plugin path]...
+static int pipeline(const PipelineOptions &options,
+                    const vector<string> &plugins) {
+    try {
+        ExpressionTree et;
+        for (auto &path : plugins) et.loadPlugin(path);
+        CsvPipeline csv(et, options);
+        PipelineStats stats = csv.run();
+        double mb = stats.bytes / 1e6;
+        cerr << stats.rows << " rows, " << mb << " MB in " << stats.seconds
+             << " s (" << (stats.seconds > 0 ? mb / stats.seconds : 0)
+             << " MB/s)" << endl;
+    } catch (exception &e) {
+        cerr << "calculator: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// name=expr 中第一个不是 == 的 = 之前是列名，没有列名时用公式作为列名
+static pair<string, string> parseFormula(const string &text) {
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '=') continue;
+        if (i + 1 < text.size() && text[i + 1] == '=') {
+            i++;
+            continue;
+        }
+        // <= >= != 中的 = 也不是分隔符
+        if (i > 0 && strchr("<>!", text[i - 1])) continue;
+        return {text.substr(0, i), text.substr(i + 1)};
+    }
+    return {text, text};
+}
+
+// 蒙特卡罗估计，样本 i 只取决于种子和 i(见 monteCarlo)
+static void sample(ExpressionTree &et, const string &text, uint64_t seed) {
+    char *end = nullptr;
+    unsigned long long n = strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str() || n == 0)
+        throw SyntaxError("Error: usage :sample n expression");
+    CompiledExpression program = et.compile(end, {});
+    MonteCarloOptions options;
+    options.seed = seed;
+    SampleStats stats = monteCarlo(program, nullptr, n, options);
+    cout.precision(10);
+    cout << fixed << "=> " << stats.mean << " (variance " << stats.variance
+         << ", 95% CI [" << stats.lower << ", " << stats.upper << "], "
+         << stats.count << " samples)" << endl;
+}
+
+// 精确计算(见 calcExact)，分数同时输出小数，近似值前加 ~
+static void exact(ExpressionTree &et, const string &text) {
+    ExactNumber x = et.calcExact(text);
+    cout << "=> " << (x.exact() ? "" : "~") << x.toString();
+    if (x.exact() && !x.rational().isInteger()) {
+        cout.precision(10);
+        cout << fixed << " (" << x.toDouble() << ")";
+    }
+    cout << endl;
+}
+
+int main(int argc, char *argv[]) {
+    bool server_mode = false;
+    ServerOptions options;
+    PipelineOptions csv;
+    // 随机数的种子: rand/uniform/normal 和 :sample 使用
+    uint64_t seed = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--serve")) {
+            server_mode = true;
+        } else if (!strcmp(argv[i], "--unix") && i + 1 < argc) {
+            options.unix_path = argv[++i];
+        } else if (!strcmp(argv[i], "--tcp") && i + 1 < argc) {
+            options.tcp_port = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+            options.workers = strtoul(argv[++i], nullptr, 10);
+            csv.workers = options.workers;
+        } else if (!strcmp(argv[i], "--session-memory") && i + 1 < argc) {
+            options.session_memory = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--plugin") && i + 1 < argc) {
+            options.plugins.push_back(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-tokens") && i + 1 < argc) {
+            options.limits.max_tokens = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--max-nodes") && i + 1 < argc) {
+            options.limits.max_nodes = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--max-depth") && i + 1 < argc) {
+            options.limits.max_depth = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--max-steps") && i + 1 < argc) {
+            options.limits.max_steps = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--max-iterations") && i + 1 < argc) {
+            options.limits.max_iterations = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--time-limit") && i + 1 < argc) {
+            options.limits.time_limit_ms = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+            seedRandom(seed);
+        } else if (!strcmp(argv[i], "--test")) {
+            // 运行 Test.h 中的表达式测试
+            return expression_test();
+        } else if (!strcmp(argv[i], "--csv") && i + 1 < argc) {
+            csv.input = argv[++i];
+        } else if (!strcmp(argv[i], "--formula") && i + 1 < argc) {
+            csv.formulas.push_back(parseFormula(argv[++i]));
+        } else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+            csv.output = argv[++i];
+        } else {
+            cerr << "usage: " << argv[0]
+                 << " [--serve [--unix path | --tcp port] [--workers n]"
+                 << " [--session-memory bytes]] [--plugin path]...\n"
+                 << "       [--max-tokens n] [--max-nodes n] [--max-depth n]"
+                 << " [--max-steps n] [--max-iterations n] [--time-limit ms]\n"
+                 << "       [--seed n]\n"
+                 << "       " << argv[0]
+                 << " --csv path [--formula name=expr]... [--output path]"
+                 << " [--workers n] [--plugin path]...\n"
+                 << "       " << argv[0] << " --test" << endl;
+            return 1;
+        }
+    }
+    if (server_mode) return serve(options);
+    if (!csv.input.empty()) return pipeline(csv, options.plugins);
+
     ExpressionTree et;
+    et.setLimits(options.limits);
+    try {
+        for (auto &path : options.plugins) et.loadPlugin(path);
+    } catch (SyntaxError &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
     string line;
     while (cin.good()) {
         cout << ">>> ";
         getline(cin, line);
         if (line.empty()) continue;
         try {
-            double x = et.calcExpression(line);
+            // :explain 表达式   输出常量折叠后的语法树
+            // :profile 表达式   计算 10000 次，输出每个节点的耗时
+            // :sample n 表达式  计算 n 个样本，输出均值、方差和 95% 置信区间
+            // :exact 表达式     按任意精度的整数和有理数计算
+            if (line.rfind(":explain ", 0) == 0) {
+                cout << et.explain(line.substr(9));
+                continue;
+            }
+            if (line.rfind(":profile ", 0) == 0) {
+                cout << et.profile(line.substr(9));
+                continue;
+            }
+            if (line.rfind(":sample ", 0) == 0) {
+                sample(et, line.substr(8), seed);
+                continue;
+            }
+            if (line.rfind(":exact ", 0) == 0) {
+                exact(et, line.substr(7));
+                continue;
+            }
+            // 值为数组时输出全部元素
+            vector<double> x = et.calcArray(line);
             cout.precision(10);
-            cout << fixed << "=> " << x << endl;
+            cout << fixed << "=> ";
+            if (x.size() == 1) {
+                cout << x[0] << endl;
+                continue;
+            }
+            for (size_t i = 0; i < x.size(); i++)
+                cout << (i ? ", " : "[") << x[i];
+            cout << "]" << endl;
         } catch (SyntaxError &e) {
             cout << e.what() << endl;
             cin.ignore();